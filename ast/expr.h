@@ -4,6 +4,10 @@
 #include <vector>
 #include <memory>
 
+#include "core/small-vector.h"
+#include "core/budget.h"
+#include "ast/walk.h"
+
 namespace soren {
 
 struct Expr
@@ -61,7 +65,8 @@ struct Expr
 	// Named/String/FnName
 	std::string named;
 
-	std::vector<std::unique_ptr<Expr>> children;
+	// operators have at most two children, only calls with more arguments allocate
+	SmallVector<std::unique_ptr<Expr>, 2> children;
 
 	static inline
 	std::unique_ptr<Expr> make_unique_intlit(std::int32_t value)
@@ -120,19 +125,94 @@ struct Expr
 	}
 
 	static inline
-	std::unique_ptr<Expr> make_unique_copy(const Expr& expr)
+	std::unique_ptr<Expr> make_unique_copy(const Expr& expr, WorkBudget* budget = nullptr)
 	{
-		std::unique_ptr<Expr> result = std::make_unique<Expr>();
+		// copies are made on the way down, each attached to the copy of its parent
+		// (repeated copies of copies grow exponentially, hence the budget)
 
-		result->kind = expr.kind;
-		result->literal = expr.literal;
-		result->named = expr.named;
+		struct Copier
+		{
+			void enter(const Expr& node)
+			{
+				charge_nodes(budget);
+				charge_bytes(budget, sizeof(Expr));
 
-		for (auto& child : expr.children)
-			result->children.push_back(make_unique_copy(*child));
+				auto copy = std::make_unique<Expr>();
 
-		return result;
+				copy->kind = node.kind;
+				copy->literal = node.literal;
+				copy->named = node.named;
+
+				copy->children.reserve(node.children.size());
+
+				Expr* raw = copy.get();
+
+				if (parents.empty())
+					result = std::move(copy);
+				else
+					parents.back()->children.push_back(std::move(copy));
+
+				parents.emplace_back(raw);
+			}
+
+			void between(const Expr&, std::size_t) {}
+
+			void leave(const Expr&)
+			{
+				parents.pop_back();
+			}
+
+			WorkBudget* budget;
+
+			std::unique_ptr<Expr> result;
+			SmallVector<Expr*, 32> parents;
+		};
+
+		Copier copier { budget, {}, {} };
+		walk_expr(expr, copier);
+
+		return std::move(copier.result);
 	}
+
+	Expr() = default;
+
+	~Expr()
+	{
+		// destroying children recursively could exhaust the stack on deep trees
+		// past some depth, descendants are detached and destroyed one by one instead
+
+		static thread_local unsigned depth = 0;
+
+		if (depth < DESTROY_RECURSION_LIMIT)
+		{
+			depth++;
+			children.clear();
+			depth--;
+
+			return;
+		}
+
+		SmallVector<std::unique_ptr<Expr>, 32> pending;
+
+		for (auto& child : children)
+			pending.push_back(std::move(child));
+
+		while (!pending.empty())
+		{
+			auto node = std::move(pending.back());
+			pending.pop_back();
+
+			if (!node)
+				continue;
+
+			for (auto& child : node->children)
+				pending.push_back(std::move(child));
+
+			// node is destroyed here, without children left
+		}
+	}
+
+	enum { DESTROY_RECURSION_LIMIT = 1024 };
 };
 
 } // namespace soren
@@ -30,7 +30,8 @@ struct Stmt
 
 	std::string label; //< TODO: better
 
-	std::vector<std::unique_ptr<Expr>> children;
+	// at most two (see Kind)
+	SmallVector<std::unique_ptr<Expr>, 2> children;
 	std::unique_ptr<Ast> childAst;
 
 	static inline
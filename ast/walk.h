@@ -0,0 +1,106 @@
+#ifndef SOREN_AST_WALK_INCLUDED
+#define SOREN_AST_WALK_INCLUDED
+
+#include <cstddef>
+
+#include "core/small-vector.h"
+
+namespace soren {
+
+// Depth first traversal of expression trees (or of any node type with a `children` container of pointers).
+// Deep trees don't exhaust the native stack: the first levels are walked recursively (which is the fastest),
+// deeper ones with an explicit stack.
+//
+// the visitor is called with:
+// - enter(node) before the children of node
+// - between(node, index) before children[index], for index > 0
+// - leave(node) after the children of node
+//
+// NodeType may be const, the visitor gets it as is
+
+enum { WALK_RECURSION_LIMIT = 64 };
+
+template<typename NodeType, typename Visitor>
+void walk_expr_iterative(NodeType& root, Visitor& visitor)
+{
+	struct Frame
+	{
+		NodeType* node;
+		std::size_t next;
+	};
+
+	SmallVector<Frame, 32> stack;
+
+	visitor.enter(root);
+	stack.push_back({ &root, 0u });
+
+	while (!stack.empty())
+	{
+		auto& frame = stack.back();
+		auto* node = frame.node;
+
+		if (frame.next == node->children.size())
+		{
+			stack.pop_back();
+			visitor.leave(*node);
+
+			continue;
+		}
+
+		const std::size_t index = frame.next++;
+
+		if (index != 0)
+			visitor.between(*node, index);
+
+		// frame may be invalidated from here
+
+		auto& child = *node->children[index];
+
+		visitor.enter(child);
+
+		// leaves don't need a frame
+		if (child.children.size() == 0)
+			visitor.leave(child);
+		else
+			stack.push_back({ &child, 0u });
+	}
+}
+
+template<typename NodeType, typename Visitor>
+void walk_expr_recursive(NodeType& node, Visitor& visitor, unsigned depth)
+{
+	visitor.enter(node);
+
+	for (std::size_t i = 0; i < node.children.size(); ++i)
+	{
+		if (i != 0)
+			visitor.between(node, i);
+
+		auto& child = *node.children[i];
+
+		if (depth < WALK_RECURSION_LIMIT)
+			walk_expr_recursive(child, visitor, depth + 1);
+		else
+			walk_expr_iterative(child, visitor);
+	}
+
+	visitor.leave(node);
+}
+
+template<typename NodeType, typename Visitor>
+void walk_expr(NodeType& root, Visitor&& visitor)
+{
+	walk_expr_recursive(root, visitor, 0);
+}
+
+// walks each expression of a statement (in order)
+template<typename StmtType, typename Visitor>
+void walk_stmt(StmtType& stmt, Visitor&& visitor)
+{
+	for (auto& child : stmt.children)
+		walk_expr(*child, visitor);
+}
+
+} // namespace soren
+
+#endif // SOREN_AST_WALK_INCLUDED
@@ -0,0 +1,870 @@
+
+// soren-bench: benchmarks of the dump pipeline, and comparison of benchmark results
+//
+//     soren-bench run [--repetitions <n>] [--warmup <n>] [--min-time <seconds>] [--out <results.json>] <path/to/script.cmb>...
+//     soren-bench compare [--threshold <fraction>] [--alpha <p>] <old.json> <new.json>
+//     soren-bench scale [--threads <n,n,...>] [--files <n>] [--seed <n>] [--repetitions <n>] [path/to/script.cmb...]
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "core/perf-counters.h"
+#include "core/soren-cmb.h"
+#include "core/work-stealing.h"
+
+#include "decode/decode.h"
+#include "decompile/decompile.h"
+#include "encode/encode.h"
+#include "encode/synthetic.h"
+
+#include "bench/json.h"
+#include "bench/stats.h"
+
+namespace soren {
+
+namespace {
+
+// discards what is written, so that printing is measured without the cost of a terminal or file
+struct NullBuffer : public std::streambuf
+{
+	int overflow(int c) override { return traits_type::not_eof(c); }
+	std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+struct Benchmark
+{
+	std::string name;
+
+	std::vector<double> samples; //< seconds per pass, one per repetition
+	std::vector<std::vector<std::uint64_t>> counters; //< per counter, one per repetition
+};
+
+struct RunOptions
+{
+	unsigned repetitions { 10u };
+	unsigned warmup { 1u };
+	double minSampleSeconds { 0.02 }; //< each sample repeats passes over its file for at least this long
+	std::string outPath; //< empty for stdout
+};
+
+// benchmarks of each stage are named <phase>/<path>, the one of all stages total/<path>
+const char* const gPhaseNames[DecompileStats::PHASE_COUNT] = { "decode", "slice", "statements", "print" };
+
+} // namespace
+
+static
+std::string read_text_file(const std::string& path, bool binary)
+{
+	std::ifstream in(path, binary ? std::ios::binary : std::ios::in);
+
+	if (!in.is_open())
+		throw std::runtime_error("couldn't open " + path); // TODO: better error
+
+	std::ostringstream result;
+	result << in.rdbuf();
+
+	return result.str();
+}
+
+// counters may be nullptr for benchmarks that don't count anything (then each benchmark has no counters)
+static
+void write_results(std::ostream& os, const PerfCounters* counters, const std::vector<Benchmark>& benchmarks)
+{
+	os << std::setprecision(std::numeric_limits<double>::max_digits10);
+
+	os << "{" << std::endl;
+	os << "  \"counters\": ";
+	write_json_string(os, counters != nullptr ? counters->source() : "none");
+	os << "," << std::endl;
+	os << "  \"benchmarks\": [" << std::endl;
+
+	for (unsigned i = 0; i < benchmarks.size(); ++i)
+	{
+		auto& benchmark = benchmarks[i];
+
+		os << "    { \"name\": ";
+		write_json_string(os, benchmark.name);
+
+		os << ", \"unit\": \"s\", \"samples\": [";
+
+		for (unsigned r = 0; r < benchmark.samples.size(); ++r)
+			os << (r != 0 ? ", " : "") << benchmark.samples[r];
+
+		// medians of counters, for information (timings are what is compared)
+
+		os << "], \"counters\": {";
+
+		bool first = true;
+
+		for (unsigned c = 0; counters != nullptr && c < PERF_COUNTER_COUNT; ++c)
+		{
+			if (!counters->available(c))
+				continue;
+
+			std::vector<double> values(benchmark.counters[c].begin(), benchmark.counters[c].end());
+
+			os << (first ? " " : ", ");
+			write_json_string(os, perf_counter_name(c));
+			os << ": " << median(values);
+
+			first = false;
+		}
+
+		os << " } }" << (i + 1 < benchmarks.size() ? "," : "") << std::endl;
+	}
+
+	os << "  ]" << std::endl;
+	os << "}" << std::endl;
+}
+
+static
+int write_results_file(const std::string& path, const PerfCounters* counters, const std::vector<Benchmark>& benchmarks)
+{
+	std::ofstream out(path);
+	write_results(out, counters, benchmarks);
+
+	if (!out)
+	{
+		std::cerr << "couldn't write " << path << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
+
+// runs all stages of dumping a file (one pass) until at least minSeconds passed, adding the counts of each
+// stage to phases, returns the amount of passes
+static
+unsigned run_passes(const PerfCounters& counters, std::ostream& nullStream, Span<const byte_type> data, double minSeconds,
+	PerfSample (&phases)[DecompileStats::PHASE_COUNT])
+{
+	const auto begin = std::chrono::steady_clock::now();
+	unsigned passes = 0;
+
+	do
+	{
+		DecompileStats stats(&counters);
+
+		const auto cmb = [&] ()
+		{
+			PerfScope scope(&counters, stats.phases[DecompileStats::PHASE_DECODE]);
+			return decode_cmb(data, GameKind::FE10);
+		} ();
+
+		for (auto& scene : cmb.scenes)
+		{
+			try
+			{
+				print_scene(nullStream, cmb, scene, nullptr, &stats);
+			}
+			catch (...)
+			{
+				// failing scenes are part of what is measured
+			}
+		}
+
+		for (unsigned p = 0; p < DecompileStats::PHASE_COUNT; ++p)
+			accumulate_perf(phases[p], PerfSample {}, stats.phases[p]);
+
+		passes++;
+	}
+	while (std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() < minSeconds);
+
+	return passes;
+}
+
+static
+int run_benchmarks(const RunOptions& options, const std::vector<std::string>& paths)
+{
+	// one benchmark per stage and file (as --stats counts them), and one for all stages of a file
+	// a sample is the mean of passes over a file for at least --min-time, so that it isn't mostly timer noise,
+	// and repetitions go round the files (rather than each file being done at once) so that the machine
+	// getting slower or faster over the run spreads over all samples instead of being a difference between files
+
+	PerfCounters counters;
+	NullBuffer nullBuffer;
+	std::ostream nullStream(&nullBuffer);
+
+	std::vector<std::string> texts;
+	std::vector<Benchmark> benchmarks;
+
+	for (auto& path : paths)
+	{
+		texts.push_back(read_text_file(path, true));
+
+		for (unsigned p = 0; p <= DecompileStats::PHASE_COUNT; ++p)
+		{
+			benchmarks.emplace_back();
+
+			benchmarks.back().name = std::string(p < DecompileStats::PHASE_COUNT ? gPhaseNames[p] : "total") + "/" + path;
+			benchmarks.back().counters.resize(PERF_COUNTER_COUNT);
+		}
+	}
+
+	for (unsigned r = 0; r < options.warmup + options.repetitions; ++r)
+	{
+		for (unsigned f = 0; f < paths.size(); ++f)
+		{
+			const Span<const byte_type> data(reinterpret_cast<const byte_type*>(texts[f].data()), texts[f].size());
+			const auto first = f * (DecompileStats::PHASE_COUNT + 1);
+
+			PerfSample phases[DecompileStats::PHASE_COUNT];
+			const unsigned passes = run_passes(counters, nullStream, data, options.minSampleSeconds, phases);
+
+			if (r < options.warmup)
+				continue;
+
+			PerfSample total;
+
+			for (unsigned p = 0; p <= DecompileStats::PHASE_COUNT; ++p)
+			{
+				const auto& sample = p < DecompileStats::PHASE_COUNT ? phases[p] : total;
+				auto& benchmark = benchmarks[first + p];
+
+				benchmark.samples.push_back(sample.seconds / passes);
+
+				for (unsigned c = 0; c < PERF_COUNTER_COUNT; ++c)
+					benchmark.counters[c].push_back(sample.values[c] / passes);
+
+				if (p < DecompileStats::PHASE_COUNT)
+					accumulate_perf(total, PerfSample {}, sample);
+			}
+		}
+	}
+
+	for (unsigned f = 0; f < paths.size(); ++f)
+		std::cerr << paths[f] << ": total median " << median(benchmarks[f * (DecompileStats::PHASE_COUNT + 1) + DecompileStats::PHASE_COUNT].samples) * 1e3 << "ms" << std::endl;
+
+	if (options.outPath.empty())
+	{
+		write_results(std::cout, &counters, benchmarks);
+		return 0;
+	}
+
+	return write_results_file(options.outPath, &counters, benchmarks);
+}
+
+namespace {
+
+struct ScaleOptions
+{
+	std::vector<unsigned> threadCounts; //< empty for powers of two up to the hardware threads
+	unsigned files { 64u }; //< of the generated corpus
+	unsigned largeEvery { 8u }; //< every n-th generated file is a large one
+	std::uint32_t seed { 1u };
+};
+
+struct CorpusFile
+{
+	std::string name;
+	std::vector<byte_type> data;
+};
+
+enum ScaleMode
+{
+	SCALE_MODE_FILES, //< one task per file (as in batch dumps of many files)
+	SCALE_MODE_SCENES, //< files one after the other, one task per scene (as for one big file)
+	SCALE_MODE_COUNT,
+};
+
+struct ScaleSample
+{
+	double seconds { 0.0 }; //< wall clock
+	std::vector<double> busy; //< seconds spent in tasks, per worker
+
+	std::size_t scenes { 0u };
+	std::size_t failed { 0u }; //< scenes, included in the above
+	std::size_t outputBytes { 0u };
+};
+
+} // namespace
+
+static
+double seconds_since(std::chrono::steady_clock::time_point begin)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static
+std::vector<CorpusFile> make_corpus(const ScaleOptions& options, const std::vector<std::string>& paths)
+{
+	std::vector<CorpusFile> result;
+
+	if (!paths.empty())
+	{
+		for (auto& path : paths)
+		{
+			const auto text = read_text_file(path, true);
+			result.push_back({ path, std::vector<byte_type>(text.begin(), text.end()) });
+		}
+
+		return result;
+	}
+
+	// mostly small files (a couple dozen scenes), with a few large ones (hundreds of bigger scenes)
+	// generated files are independent of the thread counts, so every run of the sweep does the same work
+
+	SyntheticShape small, large;
+
+	small.maxScenes = 24;
+	small.maxStatements = 8;
+
+	large.maxScenes = 320;
+	large.maxStatements = 24;
+	large.depth = 4;
+
+	for (unsigned i = 0; i < options.files; ++i)
+	{
+		const bool isLarge = options.largeEvery != 0 && i % options.largeEvery == options.largeEvery - 1;
+		const auto cmb = make_synthetic_cmb(options.seed + i, GameKind::FE10, isLarge ? large : small);
+
+		result.push_back({ (isLarge ? "large-" : "small-") + std::to_string(i), encode_cmb(cmb, GameKind::FE10) });
+	}
+
+	return result;
+}
+
+// decompiles scenes like print_scene does for the dump (to memory rather than stdout), returns the output size
+static
+std::size_t dump_scene(const CmbInfo& cmb, const SceneInfo& scene, std::size_t& failed)
+{
+	std::ostringstream os;
+
+	try
+	{
+		print_scene(os, cmb, scene);
+	}
+	catch (...)
+	{
+		failed++;
+	}
+
+	return os.tellp() < 0 ? 0 : static_cast<std::size_t>(os.tellp());
+}
+
+static
+ScaleSample run_scale_sample(ScaleMode mode, const std::vector<CorpusFile>& corpus, unsigned threadCount)
+{
+	using Clock = std::chrono::steady_clock;
+
+	ScaleSample sample;
+	sample.busy.resize(threadCount);
+
+	// per task results, summed once the workers are done (so that workers don't share counters)
+
+	std::vector<std::size_t> scenes, failed, outputBytes;
+
+	const auto decode = [&] (std::size_t index)
+	{
+		auto& file = corpus[index];
+		return decode_cmb(Span<const byte_type>(file.data.data(), file.data.size()), GameKind::FE10);
+	};
+
+	const auto begin = Clock::now();
+
+	switch (mode)
+	{
+
+	case SCALE_MODE_FILES:
+		scenes.resize(corpus.size());
+		failed.resize(corpus.size());
+		outputBytes.resize(corpus.size());
+
+		parallel_for(corpus.size(), threadCount, [&] (unsigned worker, std::size_t index)
+		{
+			const auto taskBegin = Clock::now();
+
+			const auto cmb = decode(index);
+
+			for (auto& scene : cmb.scenes)
+				outputBytes[index] += dump_scene(cmb, scene, failed[index]);
+
+			scenes[index] = cmb.scenes.size();
+			sample.busy[worker] += seconds_since(taskBegin);
+		});
+
+		break;
+
+	case SCALE_MODE_SCENES:
+		for (std::size_t f = 0; f < corpus.size(); ++f)
+		{
+			// decoding isn't split, it happens on the calling thread (which is worker 0)
+
+			const auto decodeBegin = Clock::now();
+			const auto cmb = decode(f);
+			sample.busy[0] += seconds_since(decodeBegin);
+
+			const auto first = failed.size();
+
+			sample.scenes += cmb.scenes.size();
+			failed.resize(first + cmb.scenes.size());
+			outputBytes.resize(first + cmb.scenes.size());
+
+			parallel_for(cmb.scenes.size(), threadCount, [&] (unsigned worker, std::size_t index)
+			{
+				const auto taskBegin = Clock::now();
+				outputBytes[first + index] = dump_scene(cmb, cmb.scenes[index], failed[first + index]);
+				sample.busy[worker] += seconds_since(taskBegin);
+			});
+		}
+
+		break;
+
+	default:
+		break;
+
+	} // switch (mode)
+
+	sample.seconds = seconds_since(begin);
+
+	for (auto count : scenes)
+		sample.scenes += count;
+
+	for (std::size_t i = 0; i < failed.size(); ++i)
+	{
+		sample.failed += failed[i];
+		sample.outputBytes += outputBytes[i];
+	}
+
+	return sample;
+}
+
+static
+int run_scaling(const RunOptions& runOptions, const ScaleOptions& options, const std::vector<std::string>& paths)
+{
+	static const char* const modeNames[SCALE_MODE_COUNT] = { "files", "scenes" };
+
+	auto threadCounts = options.threadCounts;
+
+	if (threadCounts.empty())
+	{
+		const auto hardwareThreads = resolve_thread_count(0);
+
+		for (unsigned t = 1; t < hardwareThreads; t *= 2)
+			threadCounts.push_back(t);
+
+		threadCounts.push_back(hardwareThreads);
+	}
+
+	// speedups are relative to one thread, so it is always measured
+
+	if (std::find(threadCounts.begin(), threadCounts.end(), 1u) == threadCounts.end())
+		threadCounts.push_back(1u);
+
+	std::sort(threadCounts.begin(), threadCounts.end());
+	threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+	const auto corpus = make_corpus(options, paths);
+
+	std::size_t inputBytes = 0;
+
+	for (auto& file : corpus)
+		inputBytes += file.data.size();
+
+	std::cerr << corpus.size() << " files, " << inputBytes / 1024 << " KiB of cmb, "
+		<< resolve_thread_count(0) << " hardware threads" << std::endl;
+
+	std::vector<Benchmark> benchmarks;
+
+	std::cout << std::left << std::setw(8) << "mode" << std::right
+		<< std::setw(8) << "threads" << std::setw(12) << "wall (ms)" << std::setw(12) << "scenes/s" << std::setw(10) << "MiB/s"
+		<< std::setw(10) << "speedup" << std::setw(12) << "efficiency" << std::setw(12) << "idle mean" << std::setw(12) << "idle max" << std::endl;
+
+	std::cout << std::fixed;
+
+	for (unsigned mode = 0; mode < SCALE_MODE_COUNT; ++mode)
+	{
+		double baseline = 0.0;
+
+		for (auto threadCount : threadCounts)
+		{
+			benchmarks.emplace_back();
+			benchmarks.back().name = std::string("scale-") + modeNames[mode] + "/" + std::to_string(threadCount);
+
+			std::vector<double> meanIdle, maxIdle;
+			ScaleSample sample;
+
+			for (unsigned r = 0; r < runOptions.warmup + runOptions.repetitions; ++r)
+			{
+				sample = run_scale_sample(static_cast<ScaleMode>(mode), corpus, threadCount);
+
+				if (r < runOptions.warmup)
+					continue;
+
+				benchmarks.back().samples.push_back(sample.seconds);
+
+				// idle is the part of the wall clock a worker spent out of tasks (waiting, stealing, or not started at all)
+
+				double idleSum = 0.0, idleMax = 0.0;
+
+				for (auto busy : sample.busy)
+				{
+					const auto idle = std::max(0.0, 1.0 - busy / sample.seconds);
+
+					idleSum += idle;
+					idleMax = std::max(idleMax, idle);
+				}
+
+				meanIdle.push_back(idleSum / sample.busy.size());
+				maxIdle.push_back(idleMax);
+			}
+
+			const auto seconds = median(benchmarks.back().samples);
+
+			if (threadCount == 1)
+				baseline = seconds;
+
+			const auto speedup = seconds > 0.0 ? baseline / seconds : 0.0;
+
+			std::cout << std::left << std::setw(8) << modeNames[mode] << std::right
+				<< std::setw(8) << threadCount
+				<< std::setw(12) << std::setprecision(2) << seconds * 1e3
+				<< std::setw(12) << std::setprecision(0) << sample.scenes / seconds
+				<< std::setw(10) << std::setprecision(2) << inputBytes / seconds / (1024 * 1024)
+				<< std::setw(10) << speedup
+				<< std::setw(11) << std::setprecision(1) << speedup / threadCount * 100 << "%"
+				<< std::setw(11) << median(meanIdle) * 100 << "%"
+				<< std::setw(11) << median(maxIdle) * 100 << "%" << std::endl;
+
+			if (sample.failed != 0)
+				std::cerr << "  (" << sample.failed << " of " << sample.scenes << " scenes failed)" << std::endl;
+		}
+	}
+
+	if (runOptions.outPath.empty())
+		return 0;
+
+	return write_results_file(runOptions.outPath, nullptr, benchmarks);
+}
+
+namespace {
+
+struct CompareOptions
+{
+	double threshold { 0.05 }; //< relative slowdown that counts as a regression
+	double alpha { 0.01 }; //< significance level
+	double confidence { 0.95 }; //< of the reported intervals
+};
+
+struct BenchmarkResult
+{
+	std::vector<double> samples;
+	double instructions { -1.0 }; //< median, -1 if not counted
+};
+
+} // namespace
+
+static
+std::map<std::string, BenchmarkResult> load_results(const std::string& path)
+{
+	const auto json = parse_json(read_text_file(path, false));
+	const auto benchmarks = json.find("benchmarks");
+
+	if (benchmarks == nullptr || benchmarks->kind != JsonValue::Kind::Array)
+		throw std::runtime_error(path + ": no benchmarks"); // TODO: better error
+
+	std::map<std::string, BenchmarkResult> result;
+
+	for (auto& benchmark : benchmarks->array)
+	{
+		const auto name = benchmark.find("name");
+		const auto samples = benchmark.find("samples");
+
+		if (name == nullptr || samples == nullptr || name->kind != JsonValue::Kind::String || samples->kind != JsonValue::Kind::Array)
+			throw std::runtime_error(path + ": bad benchmark entry"); // TODO: better error
+
+		auto& entry = result[name->string];
+
+		for (auto& sample : samples->array)
+			entry.samples.push_back(sample.number);
+
+		if (const auto counters = benchmark.find("counters"))
+			if (const auto instructions = counters->find("instructions"))
+				entry.instructions = instructions->number;
+	}
+
+	return result;
+}
+
+// whether the benchmark is one stage of a file, which is also part of its total
+static
+bool is_phase_benchmark(const std::string& name)
+{
+	for (auto phase : gPhaseNames)
+	{
+		const std::string prefix = std::string(phase) + "/";
+
+		if (name.compare(0, prefix.size(), prefix) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+// Holm's step-down adjustment of p-values for testing all of them at once:
+// the k-th smallest is multiplied by (m - k), and kept from going below the ones before it
+static
+std::vector<double> holm_adjust(const std::vector<double>& p)
+{
+	const auto m = p.size();
+
+	std::vector<std::size_t> order(m);
+
+	for (std::size_t i = 0; i < m; ++i)
+		order[i] = i;
+
+	std::sort(order.begin(), order.end(), [&] (auto x, auto y) { return p[x] < p[y]; });
+
+	std::vector<double> result(m);
+	double running = 0.0;
+
+	for (std::size_t k = 0; k < m; ++k)
+	{
+		running = std::max(running, std::min(1.0, (m - k) * p[order[k]]));
+		result[order[k]] = running;
+	}
+
+	return result;
+}
+
+static
+int compare_results(const CompareOptions& options, const std::string& oldPath, const std::string& newPath)
+{
+	const auto oldResults = load_results(oldPath);
+	const auto newResults = load_results(newPath);
+
+	// with many benchmarks, some are bound to look significant by chance: p-values are adjusted for all of them (Holm),
+	// and only totals (not the stages they are made of, whose timings are too short to be stable) can be regressions
+
+	struct Row
+	{
+		const std::string* name;
+		const BenchmarkResult* a;
+		const BenchmarkResult* b;
+	};
+
+	std::vector<Row> rows;
+	std::vector<double> pValues;
+
+	for (auto& entry : newResults)
+	{
+		const auto oldIt = oldResults.find(entry.first);
+
+		if (oldIt == oldResults.end())
+			continue;
+
+		rows.push_back({ &entry.first, &oldIt->second, &entry.second });
+		pValues.push_back(mann_whitney_p(oldIt->second.samples, entry.second.samples));
+	}
+
+	const auto adjusted = holm_adjust(pValues);
+
+	unsigned regressions = 0;
+
+	std::cout << std::left << std::setw(40) << "benchmark" << std::right
+		<< std::setw(12) << "old (ms)" << std::setw(12) << "new (ms)" << std::setw(10) << "change"
+		<< std::setw(22) << "CI" << std::setw(10) << "p (Holm)" << std::setw(10) << "instr" << "  verdict" << std::endl;
+
+	std::cout << std::fixed;
+
+	const auto percent = [] (double change)
+	{
+		std::ostringstream os;
+		os << std::showpos << std::fixed << std::setprecision(1) << change * 100 << "%";
+		return os.str();
+	};
+
+	for (auto& entry : newResults)
+		if (oldResults.find(entry.first) == oldResults.end())
+			std::cout << std::left << std::setw(40) << entry.first << std::right << "  (new)" << std::endl;
+
+	for (std::size_t i = 0; i < rows.size(); ++i)
+	{
+		auto& a = *rows[i].a;
+		auto& b = *rows[i].b;
+		const auto p = adjusted[i];
+
+		const auto oldMedian = median(a.samples), newMedian = median(b.samples);
+		const auto change = oldMedian > 0.0 ? newMedian / oldMedian - 1.0 : 0.0;
+		const auto interval = bootstrap_relative_change(a.samples, b.samples, options.confidence);
+
+		// a regression is both significant and beyond the threshold
+		const char* verdict = "same";
+
+		if (p < options.alpha)
+		{
+			if (change > options.threshold)
+			{
+				if (is_phase_benchmark(*rows[i].name))
+					verdict = "slower (stage)";
+				else
+					verdict = "REGRESSION", regressions++;
+			}
+			else if (change < -options.threshold)
+				verdict = "improved";
+			else
+				verdict = change > 0 ? "slower (within threshold)" : "faster (within threshold)";
+		}
+
+		std::string instructions = "-";
+
+		if (a.instructions > 0.0 && b.instructions >= 0.0)
+			instructions = percent(b.instructions / a.instructions - 1.0);
+
+		std::cout << std::left << std::setw(40) << *rows[i].name << std::right
+			<< std::setw(12) << std::setprecision(3) << oldMedian * 1e3
+			<< std::setw(12) << newMedian * 1e3
+			<< std::setw(10) << percent(change)
+			<< std::setw(22) << ("[" + percent(interval.low) + ", " + percent(interval.high) + "]")
+			<< std::setw(10) << std::setprecision(4) << p
+			<< std::setw(10) << instructions
+			<< "  " << verdict << std::endl;
+	}
+
+	for (auto& entry : oldResults)
+		if (newResults.find(entry.first) == newResults.end())
+			std::cout << std::left << std::setw(40) << entry.first << std::right << "  (removed)" << std::endl;
+
+	std::cout << regressions << " regression(s) beyond " << percent(options.threshold)
+		<< " at p < " << std::setprecision(3) << options.alpha << " (Holm-adjusted, totals only)" << std::endl;
+
+	return regressions > 0 ? 1 : 0;
+}
+
+} // namespace soren
+
+static
+void print_usage(const char* name)
+{
+	std::cerr << "usage: " << name << " run [options] <path/to/script.cmb>..." << std::endl
+		<< "       " << name << " compare [options] <old.json> <new.json>" << std::endl
+		<< "       " << name << " scale [options] [path/to/script.cmb...]" << std::endl
+		<< "run options (also for scale):" << std::endl
+		<< "  --repetitions <n>      measured runs of each file (default 10)" << std::endl
+		<< "  --warmup <n>           unmeasured runs of each file first (default 1)" << std::endl
+		<< "  --min-time <seconds>   each run of a file repeats it for at least that long (default 0.02)" << std::endl
+		<< "  --out <file>           write results there instead of stdout" << std::endl
+		<< "compare options:" << std::endl
+		<< "  --threshold <fraction> slowdown of the median that counts as a regression (default 0.05)" << std::endl
+		<< "  --alpha <p>            significance level of the Mann-Whitney U tests, Holm-adjusted (default 0.01)" << std::endl
+		<< "  --confidence <c>       of the reported bootstrap intervals (default 0.95)" << std::endl
+		<< "scale options (decompiles a generated corpus, or the given files, with each thread count):" << std::endl
+		<< "  --threads <n,n,...>    thread counts to measure (default powers of two up to the hardware threads)" << std::endl
+		<< "  --files <n>            files in the generated corpus (default 64)" << std::endl
+		<< "  --large-every <n>      every n-th generated file is a large one, 0 for none (default 8)" << std::endl
+		<< "  --seed <n>             of the generated corpus (default 1)" << std::endl
+		<< "exits with 1 if compare finds a regression (of a total, the stages only being reported)" << std::endl;
+}
+
+// whole arguments only, throwing std::invalid_argument (a std::logic_error, like std::stoul) on anything after the number
+static
+unsigned long parse_unsigned(const std::string& text)
+{
+	std::size_t end;
+	const auto value = std::stoul(text, &end);
+
+	if (end != text.size() || text[0] == '-')
+		throw std::invalid_argument(text);
+
+	return value;
+}
+
+static
+double parse_double(const std::string& text)
+{
+	std::size_t end;
+	const auto value = std::stod(text, &end);
+
+	if (end != text.size())
+		throw std::invalid_argument(text);
+
+	return value;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+		return print_usage(argv[0]), 2;
+
+	const std::string command = argv[1];
+
+	soren::RunOptions runOptions;
+	soren::CompareOptions compareOptions;
+	soren::ScaleOptions scaleOptions;
+	std::vector<std::string> paths;
+
+	for (int i = 2; i < argc; ++i)
+	{
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+
+		try
+		{
+			if (arg == "--repetitions" && hasValue)
+				runOptions.repetitions = std::max(1ul, parse_unsigned(argv[++i]));
+			else if (arg == "--warmup" && hasValue)
+				runOptions.warmup = parse_unsigned(argv[++i]);
+			else if (arg == "--min-time" && hasValue)
+				runOptions.minSampleSeconds = parse_double(argv[++i]);
+			else if (arg == "--out" && hasValue)
+				runOptions.outPath = argv[++i];
+			else if (arg == "--threshold" && hasValue)
+				compareOptions.threshold = parse_double(argv[++i]);
+			else if (arg == "--alpha" && hasValue)
+				compareOptions.alpha = parse_double(argv[++i]);
+			else if (arg == "--confidence" && hasValue)
+				compareOptions.confidence = parse_double(argv[++i]);
+			else if (arg == "--threads" && hasValue)
+			{
+				std::istringstream list(argv[++i]);
+				std::string count;
+
+				while (std::getline(list, count, ','))
+					scaleOptions.threadCounts.push_back(std::max(1ul, parse_unsigned(count)));
+			}
+			else if (arg == "--files" && hasValue)
+				scaleOptions.files = parse_unsigned(argv[++i]);
+			else if (arg == "--large-every" && hasValue)
+				scaleOptions.largeEvery = parse_unsigned(argv[++i]);
+			else if (arg == "--seed" && hasValue)
+				scaleOptions.seed = parse_unsigned(argv[++i]);
+			else if (arg.size() > 1 && arg[0] == '-')
+				return print_usage(argv[0]), 2;
+			else
+				paths.push_back(arg);
+		}
+		catch (const std::logic_error&) // from parse_unsigned and parse_double
+		{
+			std::cerr << "bad value for " << arg << ": " << argv[i] << std::endl;
+			return 2;
+		}
+	}
+
+	try
+	{
+		if (command == "run" && !paths.empty())
+			return soren::run_benchmarks(runOptions, paths);
+
+		if (command == "scale")
+			return soren::run_scaling(runOptions, scaleOptions, paths);
+
+		if (command == "compare" && paths.size() == 2)
+			return soren::compare_results(compareOptions, paths[0], paths[1]);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 2;
+	}
+
+	return print_usage(argv[0]), 2;
+}
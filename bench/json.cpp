@@ -0,0 +1,268 @@
+
+#include "bench/json.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace soren {
+
+const JsonValue* JsonValue::find(const std::string& key) const
+{
+	for (auto& member : object)
+		if (member.first == key)
+			return &member.second;
+
+	return nullptr;
+}
+
+namespace {
+
+struct JsonParser
+{
+	explicit JsonParser(const std::string& text)
+		: text(text) {}
+
+	JsonValue parse_value()
+	{
+		skip_space();
+
+		if (at_end())
+			throw std::runtime_error("JSON: unexpected end of input"); // TODO: better error
+
+		JsonValue result;
+
+		switch (text[pos])
+		{
+
+		case '{':
+			result.kind = JsonValue::Kind::Object;
+			pos++;
+
+			if (try_consume('}'))
+				break;
+
+			do
+			{
+				skip_space();
+				auto key = parse_string();
+
+				expect(':');
+				result.object.emplace_back(std::move(key), parse_value());
+			}
+			while (try_consume(','));
+
+			expect('}');
+			break;
+
+		case '[':
+			result.kind = JsonValue::Kind::Array;
+			pos++;
+
+			if (try_consume(']'))
+				break;
+
+			do
+				result.array.push_back(parse_value());
+			while (try_consume(','));
+
+			expect(']');
+			break;
+
+		case '"':
+			result.kind = JsonValue::Kind::String;
+			result.string = parse_string();
+			break;
+
+		case 't':
+		case 'f':
+			result.kind = JsonValue::Kind::Bool;
+			result.boolean = text[pos] == 't';
+			consume_word(result.boolean ? "true" : "false");
+			break;
+
+		case 'n':
+			consume_word("null");
+			break;
+
+		default:
+		{
+			const char* begin = text.c_str() + pos;
+			char* end = nullptr;
+
+			result.kind = JsonValue::Kind::Number;
+			result.number = std::strtod(begin, &end);
+
+			if (end == begin)
+				throw std::runtime_error("JSON: unexpected character"); // TODO: better error
+
+			pos += end - begin;
+			break;
+		}
+
+		} // switch (text[pos])
+
+		return result;
+	}
+
+	std::string parse_string()
+	{
+		expect('"');
+
+		std::string result;
+
+		while (!at_end() && text[pos] != '"')
+		{
+			char c = text[pos++];
+
+			if (c == '\\')
+			{
+				if (at_end())
+					break;
+
+				switch (c = text[pos++])
+				{
+
+				case 'n': c = '\n'; break;
+				case 't': c = '\t'; break;
+				case 'r': c = '\r'; break;
+				case 'b': c = '\b'; break;
+				case 'f': c = '\f'; break;
+
+				case 'u':
+				{
+					// as UTF-8, except for surrogate pairs (which what we write never has)
+
+					const auto digits = text.substr(pos, 4);
+
+					if (digits.size() != 4 || !std::all_of(digits.begin(), digits.end(), [] (char d) { return std::isxdigit(static_cast<unsigned char>(d)) != 0; }))
+						throw std::runtime_error("JSON: bad unicode escape"); // TODO: better error
+
+					const auto code = std::strtoul(digits.c_str(), nullptr, 16);
+
+					if (code >= 0xD800 && code <= 0xDFFF)
+						throw std::runtime_error("JSON: surrogate pairs aren't supported"); // TODO: better error
+
+					pos += 4;
+
+					if (code >= 0x80)
+					{
+						if (code >= 0x800)
+						{
+							result.push_back(static_cast<char>(0xE0 | (code >> 12)));
+							result.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+						}
+						else
+						{
+							result.push_back(static_cast<char>(0xC0 | (code >> 6)));
+						}
+
+						c = static_cast<char>(0x80 | (code & 0x3F));
+					}
+					else
+					{
+						c = static_cast<char>(code);
+					}
+
+					break;
+				}
+
+				} // switch (c)
+			}
+
+			result.push_back(c);
+		}
+
+		expect('"');
+
+		return result;
+	}
+
+	void skip_space()
+	{
+		while (!at_end() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+			pos++;
+	}
+
+	bool try_consume(char c)
+	{
+		skip_space();
+
+		if (at_end() || text[pos] != c)
+			return false;
+
+		pos++;
+		return true;
+	}
+
+	void expect(char c)
+	{
+		if (!try_consume(c))
+			throw std::runtime_error(std::string("JSON: expected '") + c + "'"); // TODO: better error
+	}
+
+	void consume_word(const char* word)
+	{
+		for (; *word != 0; ++word, ++pos)
+			if (at_end() || text[pos] != *word)
+				throw std::runtime_error("JSON: unexpected character"); // TODO: better error
+	}
+
+	bool at_end() const { return pos >= text.size(); }
+
+	const std::string& text;
+	std::size_t pos { 0u };
+};
+
+} // namespace
+
+JsonValue parse_json(const std::string& text)
+{
+	JsonParser parser(text);
+
+	auto result = parser.parse_value();
+	parser.skip_space();
+
+	if (!parser.at_end())
+		throw std::runtime_error("JSON: trailing characters"); // TODO: better error
+
+	return result;
+}
+
+void write_json_string(std::ostream& os, const std::string& str)
+{
+	os << '"';
+
+	for (char c : str)
+	{
+		switch (c)
+		{
+
+		case '"':  os << "\\\""; break;
+		case '\\': os << "\\\\"; break;
+		case '\n': os << "\\n"; break;
+		case '\t': os << "\\t"; break;
+		case '\r': os << "\\r"; break;
+
+		default:
+			// other control characters aren't allowed raw in strings
+			if (static_cast<unsigned char>(c) < 0x20)
+			{
+				const char* const digits = "0123456789abcdef";
+				os << "\\u00" << digits[(c >> 4) & 0xF] << digits[c & 0xF];
+			}
+			else
+			{
+				os << c;
+			}
+
+			break;
+
+		} // switch (c)
+	}
+
+	os << '"';
+}
+
+} // namespace soren
@@ -0,0 +1,45 @@
+#ifndef SOREN_BENCH_JSON_INCLUDED
+#define SOREN_BENCH_JSON_INCLUDED
+
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace soren {
+
+// just enough JSON for benchmark results: no unicode escapes, numbers are doubles
+
+struct JsonValue
+{
+	enum class Kind
+	{
+		Null,
+		Bool,
+		Number,
+		String,
+		Array,
+		Object,
+	};
+
+	// member of an object, nullptr if there is none (or this isn't an object)
+	const JsonValue* find(const std::string& key) const;
+
+	Kind kind { Kind::Null };
+
+	bool boolean { false };
+	double number { 0.0 };
+	std::string string;
+
+	std::vector<JsonValue> array;
+	std::vector<std::pair<std::string, JsonValue>> object; //< in file order
+};
+
+JsonValue parse_json(const std::string& text);
+
+// writes str as a JSON string (with quotes)
+void write_json_string(std::ostream& os, const std::string& str);
+
+} // namespace soren
+
+#endif // SOREN_BENCH_JSON_INCLUDED
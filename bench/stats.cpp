@@ -0,0 +1,128 @@
+
+#include "bench/stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <utility>
+
+namespace soren {
+
+double median(std::vector<double> samples)
+{
+	if (samples.empty())
+		return 0.0;
+
+	const auto mid = samples.size() / 2;
+	std::nth_element(samples.begin(), samples.begin() + mid, samples.end());
+
+	if (samples.size() % 2 != 0)
+		return samples[mid];
+
+	const auto below = *std::max_element(samples.begin(), samples.begin() + mid);
+	return (below + samples[mid]) / 2;
+}
+
+double mann_whitney_p(const std::vector<double>& a, const std::vector<double>& b)
+{
+	const double n1 = a.size(), n2 = b.size();
+	const double n = n1 + n2;
+
+	if (a.empty() || b.empty())
+		return 1.0;
+
+	// rank everything together, ties getting the average of their ranks
+
+	std::vector<std::pair<double, bool>> all; //< (value, from a)
+	all.reserve(a.size() + b.size());
+
+	for (auto v : a)
+		all.emplace_back(v, true);
+
+	for (auto v : b)
+		all.emplace_back(v, false);
+
+	std::sort(all.begin(), all.end(), [] (auto& x, auto& y) { return x.first < y.first; });
+
+	double rankSumA = 0.0, tieTerm = 0.0;
+
+	for (std::size_t i = 0; i < all.size();)
+	{
+		std::size_t j = i;
+
+		while (j < all.size() && all[j].first == all[i].first)
+			j++;
+
+		// ranks i+1 .. j
+		const double rank = (i + 1 + j) / 2.0;
+		const double ties = j - i;
+
+		for (auto k = i; k < j; ++k)
+			if (all[k].second)
+				rankSumA += rank;
+
+		tieTerm += ties * ties * ties - ties;
+		i = j;
+	}
+
+	const double u = rankSumA - n1 * (n1 + 1) / 2;
+	const double mean = n1 * n2 / 2;
+	const double variance = n1 * n2 / 12 * ((n + 1) - tieTerm / (n * (n - 1)));
+
+	if (variance <= 0.0)
+		return 1.0;
+
+	const double z = std::max(0.0, std::abs(u - mean) - 0.5) / std::sqrt(variance);
+
+	return std::erfc(z / std::sqrt(2.0));
+}
+
+ConfidenceInterval bootstrap_relative_change(const std::vector<double>& a, const std::vector<double>& b,
+	double confidence, unsigned resamples, std::uint32_t seed)
+{
+	if (a.empty() || b.empty() || resamples == 0)
+		return { 0.0, 0.0 };
+
+	std::mt19937 rng(seed);
+
+	std::vector<double> changes;
+	changes.reserve(resamples);
+
+	std::vector<double> resampleA(a.size()), resampleB(b.size());
+
+	const auto resample = [&] (const std::vector<double>& from, std::vector<double>& to)
+	{
+		std::uniform_int_distribution<std::size_t> pick(0, from.size() - 1);
+
+		for (auto& v : to)
+			v = from[pick(rng)];
+	};
+
+	for (unsigned i = 0; i < resamples; ++i)
+	{
+		resample(a, resampleA);
+		resample(b, resampleB);
+
+		const auto medianA = median(resampleA);
+
+		if (medianA > 0.0)
+			changes.push_back(median(resampleB) / medianA - 1.0);
+	}
+
+	if (changes.empty())
+		return { 0.0, 0.0 };
+
+	std::sort(changes.begin(), changes.end());
+
+	const auto at = [&] (double quantile)
+	{
+		const auto index = static_cast<std::size_t>(quantile * (changes.size() - 1) + 0.5);
+		return changes[std::min(index, changes.size() - 1)];
+	};
+
+	const double tail = (1.0 - confidence) / 2;
+
+	return { at(tail), at(1.0 - tail) };
+}
+
+} // namespace soren
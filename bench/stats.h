@@ -0,0 +1,28 @@
+#ifndef SOREN_BENCH_STATS_INCLUDED
+#define SOREN_BENCH_STATS_INCLUDED
+
+#include <cstdint>
+#include <vector>
+
+namespace soren {
+
+double median(std::vector<double> samples);
+
+// two-sided p-value of the Mann-Whitney U test (normal approximation with tie and continuity corrections)
+// that is, how likely samples this different are if a and b come from the same distribution
+// doesn't assume anything about the distributions, which is what timings need (they are skewed, with outliers)
+double mann_whitney_p(const std::vector<double>& a, const std::vector<double>& b);
+
+struct ConfidenceInterval
+{
+	double low, high;
+};
+
+// percentile bootstrap interval for median(b) / median(a) - 1 (relative change from a to b)
+// deterministic for a given seed
+ConfidenceInterval bootstrap_relative_change(const std::vector<double>& a, const std::vector<double>& b,
+	double confidence = 0.95, unsigned resamples = 2000, std::uint32_t seed = 1);
+
+} // namespace soren
+
+#endif // SOREN_BENCH_STATS_INCLUDED
@@ -0,0 +1,173 @@
+#ifndef SOREN_BUDGET_INCLUDED
+#define SOREN_BUDGET_INCLUDED
+
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+namespace soren {
+
+struct WorkLimits
+{
+	// 0 for no limit
+
+	std::uint64_t instructions { 0u }; //< instructions decoded or moved around (by rewrites)
+	std::uint64_t nodes { 0u }; //< expression nodes built
+	std::uint64_t bytes { 0u }; //< heap charged by what allocates while decoding and building statements (see --max-memory)
+	double seconds { 0.0 };
+};
+
+// thrown when a budget runs out
+struct BudgetExceeded : public std::runtime_error
+{
+	BudgetExceeded(const std::string& what, bool wholeFile)
+		: std::runtime_error(what), wholeFile(wholeFile) {}
+
+	bool wholeFile; //< if false, only the current scene is to be given up on
+};
+
+struct WorkBudget
+{
+	// work done for a file and for the scene being processed, against limits for both
+	// pathological (hostile or corrupted) inputs are what this is for, so the checks are cheap rather than exact:
+	// time is only looked at every so often
+
+	enum { TIME_CHECK_INTERVAL = 256 };
+
+	WorkBudget() = default;
+
+	WorkBudget(const WorkLimits& sceneLimits, const WorkLimits& fileLimits)
+		: sceneLimits(sceneLimits), fileLimits(fileLimits) {}
+
+	void begin_file()
+	{
+		file = {};
+		fileStart = std::chrono::steady_clock::now();
+
+		begin_scene();
+	}
+
+	void begin_scene()
+	{
+		scene = {};
+		sceneStart = std::chrono::steady_clock::now();
+	}
+
+	void charge_instructions(std::uint64_t amount = 1u)
+	{
+		scene.instructions += amount;
+		file.instructions += amount;
+
+		check(scene.instructions, sceneLimits.instructions, "instruction", false);
+		check(file.instructions, fileLimits.instructions, "instruction", true);
+
+		tick();
+	}
+
+	void charge_nodes(std::uint64_t amount = 1u)
+	{
+		scene.nodes += amount;
+		file.nodes += amount;
+
+		check(scene.nodes, sceneLimits.nodes, "node", false);
+		check(file.nodes, fileLimits.nodes, "node", true);
+
+		tick();
+	}
+
+	void charge_bytes(std::uint64_t amount)
+	{
+		scene.bytes += amount;
+		file.bytes += amount;
+
+		check(scene.bytes, sceneLimits.bytes, "byte", false);
+		check(file.bytes, fileLimits.bytes, "byte", true);
+	}
+
+	// charged since begin_scene
+	std::uint64_t scene_instructions() const { return scene.instructions; }
+	std::uint64_t scene_nodes() const { return scene.nodes; }
+
+	WorkLimits sceneLimits;
+	WorkLimits fileLimits;
+
+private:
+	struct Counters
+	{
+		std::uint64_t instructions { 0u };
+		std::uint64_t nodes { 0u };
+		std::uint64_t bytes { 0u };
+	};
+
+	static void check(std::uint64_t used, std::uint64_t limit, const char* what, bool wholeFile)
+	{
+		if (limit != 0 && used > limit)
+		{
+			throw BudgetExceeded([&] ()
+			{
+				std::string r(wholeFile ? "file " : "scene ");
+				r.append(what);
+				r.append(" budget exceeded (");
+				r.append(std::to_string(limit));
+				r.append(")");
+				return r;
+			} (), wholeFile); // TODO: better string formatting
+		}
+	}
+
+	void tick()
+	{
+		if (++sinceTimeCheck < TIME_CHECK_INTERVAL)
+			return;
+
+		sinceTimeCheck = 0;
+
+		if (sceneLimits.seconds <= 0.0 && fileLimits.seconds <= 0.0)
+			return;
+
+		const auto now = std::chrono::steady_clock::now();
+
+		const auto elapsed = [&] (std::chrono::steady_clock::time_point start)
+		{
+			return std::chrono::duration<double>(now - start).count();
+		};
+
+		if (sceneLimits.seconds > 0.0 && elapsed(sceneStart) > sceneLimits.seconds)
+			throw BudgetExceeded("scene time budget exceeded", false);
+
+		if (fileLimits.seconds > 0.0 && elapsed(fileStart) > fileLimits.seconds)
+			throw BudgetExceeded("file time budget exceeded", true);
+	}
+
+	Counters scene, file;
+	std::chrono::steady_clock::time_point sceneStart, fileStart;
+	unsigned sinceTimeCheck { 0u };
+};
+
+// for code that may or may not run under a budget
+
+static inline
+void charge_instructions(WorkBudget* budget, std::uint64_t amount = 1u)
+{
+	if (budget != nullptr)
+		budget->charge_instructions(amount);
+}
+
+static inline
+void charge_nodes(WorkBudget* budget, std::uint64_t amount = 1u)
+{
+	if (budget != nullptr)
+		budget->charge_nodes(amount);
+}
+
+static inline
+void charge_bytes(WorkBudget* budget, std::uint64_t amount)
+{
+	if (budget != nullptr)
+		budget->charge_bytes(amount);
+}
+
+} // namespace soren
+
+#endif // SOREN_BUDGET_INCLUDED
@@ -0,0 +1,267 @@
+
+#include "core/perf-counters.h"
+
+#include <iomanip>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define SOREN_HAS_PERF_EVENT 1
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define SOREN_HAS_RUSAGE 1
+#endif
+
+namespace soren {
+
+const char* perf_counter_name(unsigned counter)
+{
+	static const char* const names[PERF_COUNTER_COUNT] =
+	{
+		"cycles",
+		"instructions",
+		"branch-misses",
+		"cache-misses",
+		"task-clock",
+		"page-faults",
+		"context-switches",
+	};
+
+	return counter < PERF_COUNTER_COUNT ? names[counter] : "?";
+}
+
+#if SOREN_HAS_PERF_EVENT
+
+static
+int open_perf_event(unsigned counter, int groupFd)
+{
+	perf_event_attr attr {};
+
+	attr.size = sizeof(attr);
+	attr.exclude_hv = 1;
+
+	if (groupFd == -1)
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	switch (counter)
+	{
+
+	case PERF_COUNTER_CYCLES:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CPU_CYCLES;
+		break;
+
+	case PERF_COUNTER_INSTRUCTIONS:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+		break;
+
+	case PERF_COUNTER_BRANCH_MISSES:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+		break;
+
+	case PERF_COUNTER_CACHE_MISSES:
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		break;
+
+	case PERF_COUNTER_TASK_CLOCK:
+		attr.type = PERF_TYPE_SOFTWARE;
+		attr.config = PERF_COUNT_SW_TASK_CLOCK;
+		break;
+
+	case PERF_COUNTER_PAGE_FAULTS:
+		attr.type = PERF_TYPE_SOFTWARE;
+		attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+		break;
+
+	case PERF_COUNTER_CONTEXT_SWITCHES:
+		attr.type = PERF_TYPE_SOFTWARE;
+		attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+		break;
+
+	default:
+		return -1;
+
+	} // switch (counter)
+
+	// counting the kernel too if allowed, as page faults and context switches happen there
+	// (perf_event_paranoid >= 2 only allows user space)
+
+	const int fd = syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+
+	if (fd != -1)
+		return fd;
+
+	attr.exclude_kernel = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+#endif // SOREN_HAS_PERF_EVENT
+
+PerfCounters::PerfCounters()
+{
+	for (unsigned i = 0; i < PERF_COUNTER_COUNT; ++i)
+		fds[i] = indexInGroup[i] = -1;
+
+#if SOREN_HAS_PERF_EVENT
+	// each group is read at once, and is scheduled (and multiplexed if need be) as a whole
+
+	for (unsigned counter = 0; counter < PERF_COUNTER_COUNT; ++counter)
+	{
+		auto& group = groups[counter < PERF_COUNTER_TASK_CLOCK ? GROUP_HARDWARE : GROUP_SOFTWARE];
+
+		const int fd = open_perf_event(counter, group.fd);
+
+		if (fd == -1)
+			continue;
+
+		if (group.fd == -1)
+			group.fd = fd;
+
+		fds[counter] = fd;
+		indexInGroup[counter] = group.size++;
+		availableMask |= 1u << counter;
+	}
+
+	if (availableMask != 0)
+		sourceName = "perf_event";
+#endif
+
+#if SOREN_HAS_RUSAGE
+	const unsigned software = (1u << PERF_COUNTER_TASK_CLOCK) | (1u << PERF_COUNTER_PAGE_FAULTS) | (1u << PERF_COUNTER_CONTEXT_SWITCHES);
+
+	if ((availableMask & software) != software)
+	{
+		sourceName = availableMask != 0 ? "perf_event+getrusage" : "getrusage";
+		availableMask |= software;
+	}
+#endif
+
+	start = std::chrono::steady_clock::now();
+}
+
+PerfCounters::~PerfCounters()
+{
+#if SOREN_HAS_PERF_EVENT
+	for (auto fd : fds)
+		if (fd != -1)
+			close(fd);
+#endif
+}
+
+PerfSample PerfCounters::read() const
+{
+	PerfSample result;
+
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+#if SOREN_HAS_PERF_EVENT
+	for (unsigned g = 0; g < GROUP_COUNT; ++g)
+	{
+		if (groups[g].fd == -1)
+			continue;
+
+		// nr, time enabled, time running, then values in group order
+
+		std::uint64_t buffer[3 + PERF_COUNTER_COUNT] {};
+
+		if (::read(groups[g].fd, buffer, sizeof(buffer)) <= 0)
+			continue;
+
+		const auto enabled = buffer[1], running = buffer[2];
+
+		for (unsigned i = 0; i < PERF_COUNTER_COUNT; ++i)
+		{
+			if (fds[i] == -1 || (i < PERF_COUNTER_TASK_CLOCK) != (g == GROUP_HARDWARE))
+				continue;
+
+			auto value = buffer[3 + indexInGroup[i]];
+
+			// the group was multiplexed with others: estimate from the time it ran
+			if (running != 0 && running < enabled)
+				value = static_cast<std::uint64_t>(static_cast<double>(value) * enabled / running);
+
+			result.values[i] = value;
+		}
+	}
+#endif
+
+#if SOREN_HAS_RUSAGE
+	if (fds[PERF_COUNTER_TASK_CLOCK] == -1 || fds[PERF_COUNTER_PAGE_FAULTS] == -1 || fds[PERF_COUNTER_CONTEXT_SWITCHES] == -1)
+	{
+		rusage usage {};
+
+#if defined(RUSAGE_THREAD)
+		getrusage(RUSAGE_THREAD, &usage);
+#else
+		getrusage(RUSAGE_SELF, &usage);
+#endif
+
+		const auto nanoseconds = [] (const timeval& tv) { return std::uint64_t(tv.tv_sec) * 1000000000u + std::uint64_t(tv.tv_usec) * 1000u; };
+
+		if (fds[PERF_COUNTER_TASK_CLOCK] == -1)
+			result.values[PERF_COUNTER_TASK_CLOCK] = nanoseconds(usage.ru_utime) + nanoseconds(usage.ru_stime);
+
+		if (fds[PERF_COUNTER_PAGE_FAULTS] == -1)
+			result.values[PERF_COUNTER_PAGE_FAULTS] = usage.ru_minflt + usage.ru_majflt;
+
+		if (fds[PERF_COUNTER_CONTEXT_SWITCHES] == -1)
+			result.values[PERF_COUNTER_CONTEXT_SWITCHES] = usage.ru_nvcsw + usage.ru_nivcsw;
+	}
+#endif
+
+	return result;
+}
+
+void write_perf_table(std::ostream& os, const PerfCounters& counters,
+	const char* const* phaseNames, const PerfSample* phases, unsigned phaseCount)
+{
+	const auto flags = os.flags();
+	const auto precision = os.precision();
+
+	os << std::left << std::setw(12) << "phase" << std::right << std::setw(12) << "wall (ms)";
+
+	for (unsigned c = 0; c < PERF_COUNTER_COUNT; ++c)
+		if (counters.available(c))
+			os << std::setw(18) << perf_counter_name(c);
+
+	const bool ipc = counters.available(PERF_COUNTER_CYCLES) && counters.available(PERF_COUNTER_INSTRUCTIONS);
+
+	if (ipc)
+		os << std::setw(8) << "IPC";
+
+	os << std::endl;
+
+	for (unsigned p = 0; p < phaseCount; ++p)
+	{
+		auto& phase = phases[p];
+
+		os << std::left << std::setw(12) << phaseNames[p] << std::right
+			<< std::setw(12) << std::fixed << std::setprecision(3) << phase.seconds * 1e3;
+
+		for (unsigned c = 0; c < PERF_COUNTER_COUNT; ++c)
+			if (counters.available(c))
+				os << std::setw(18) << phase.values[c];
+
+		if (ipc)
+		{
+			const auto cycles = phase.values[PERF_COUNTER_CYCLES];
+			os << std::setw(8) << std::setprecision(2) << (cycles != 0 ? double(phase.values[PERF_COUNTER_INSTRUCTIONS]) / cycles : 0.0);
+		}
+
+		os << std::endl;
+	}
+
+	os << "(counters from " << counters.source() << ")" << std::endl;
+
+	os.flags(flags);
+	os.precision(precision);
+}
+
+} // namespace soren
@@ -0,0 +1,117 @@
+#ifndef SOREN_PERF_COUNTERS_INCLUDED
+#define SOREN_PERF_COUNTERS_INCLUDED
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace soren {
+
+enum
+{
+	// hardware (perf_event_open only)
+	PERF_COUNTER_CYCLES,
+	PERF_COUNTER_INSTRUCTIONS,
+	PERF_COUNTER_BRANCH_MISSES,
+	PERF_COUNTER_CACHE_MISSES,
+
+	// software (perf_event_open, or getrusage where there is no perf_event_open)
+	PERF_COUNTER_TASK_CLOCK, //< nanoseconds
+	PERF_COUNTER_PAGE_FAULTS,
+	PERF_COUNTER_CONTEXT_SWITCHES,
+
+	PERF_COUNTER_COUNT,
+};
+
+const char* perf_counter_name(unsigned counter);
+
+struct PerfSample
+{
+	std::uint64_t values[PERF_COUNTER_COUNT] {};
+	double seconds { 0.0 }; //< wall clock
+};
+
+struct PerfCounters
+{
+	// counters for the calling thread, counting from when this is made
+	// whatever can't be counted (no perf_event_open, no permission, no PMU as in most VMs) is left out, so that
+	// hardware counters missing still leave software ones, and no perf_event_open at all still leaves getrusage
+
+	PerfCounters();
+	~PerfCounters();
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator = (const PerfCounters&) = delete;
+
+	bool available(unsigned counter) const { return (availableMask >> counter) & 1; }
+
+	// "perf_event", "getrusage", "perf_event+getrusage" or "none"
+	const char* source() const { return sourceName; }
+
+	// counts so far (one read for all perf_event counters)
+	PerfSample read() const;
+
+private:
+	// software and hardware counters are separate groups, so that hardware ones not getting scheduled
+	// (too many for the PMU) doesn't take the software ones with them
+
+	enum { GROUP_SOFTWARE, GROUP_HARDWARE, GROUP_COUNT };
+
+	struct Group
+	{
+		int fd { -1 }; //< of the leader
+		unsigned size { 0u };
+	};
+
+	Group groups[GROUP_COUNT];
+
+	int fds[PERF_COUNTER_COUNT]; //< -1 for counters not opened
+	int indexInGroup[PERF_COUNTER_COUNT];
+
+	unsigned availableMask { 0u };
+	const char* sourceName { "none" };
+
+	std::chrono::steady_clock::time_point start;
+};
+
+// counts between two samples, added to total
+static inline
+void accumulate_perf(PerfSample& total, const PerfSample& begin, const PerfSample& end)
+{
+	for (unsigned i = 0; i < PERF_COUNTER_COUNT; ++i)
+		total.values[i] += end.values[i] - begin.values[i];
+
+	total.seconds += end.seconds - begin.seconds;
+}
+
+// adds the counts during its lifetime to total, if there are counters
+struct PerfScope
+{
+	PerfScope(const PerfCounters* counters, PerfSample& total)
+		: counters(counters), total(total)
+	{
+		if (counters != nullptr)
+			begin = counters->read();
+	}
+
+	~PerfScope()
+	{
+		if (counters != nullptr)
+			accumulate_perf(total, begin, counters->read());
+	}
+
+	PerfScope(const PerfScope&) = delete;
+	PerfScope& operator = (const PerfScope&) = delete;
+
+	const PerfCounters* counters;
+	PerfSample& total;
+	PerfSample begin;
+};
+
+// one line per phase: wall time, then each available counter (with IPC if there are cycles and instructions)
+void write_perf_table(std::ostream& os, const PerfCounters& counters,
+	const char* const* phaseNames, const PerfSample* phases, unsigned phaseCount);
+
+} // namespace soren
+
+#endif // SOREN_PERF_COUNTERS_INCLUDED
@@ -0,0 +1,62 @@
+
+#include "core/slowest-scenes.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <utility>
+
+namespace soren {
+
+static inline
+bool slower(const SceneCost& a, const SceneCost& b)
+{
+	return a.seconds > b.seconds;
+}
+
+void SlowestScenes::add(SceneCost cost)
+{
+	if (!wants(cost.seconds))
+		return;
+
+	// with slower() as "less", the heap functions keep the fastest scene at the front
+
+	if (heap.size() == capacity)
+	{
+		std::pop_heap(heap.begin(), heap.end(), slower);
+		heap.pop_back();
+	}
+
+	heap.push_back(std::move(cost));
+	std::push_heap(heap.begin(), heap.end(), slower);
+}
+
+std::vector<SceneCost> SlowestScenes::sorted() const
+{
+	auto result = heap;
+	std::sort(result.begin(), result.end(), slower);
+
+	return result;
+}
+
+void SlowestScenes::write(std::ostream& os) const
+{
+	const auto flags = os.flags();
+	const auto precision = os.precision();
+
+	os << std::right << std::setw(12) << "time (ms)" << std::setw(14) << "instructions" << std::setw(12) << "nodes"
+		<< std::setw(12) << "bytes" << "  scene" << std::endl;
+
+	for (auto& cost : sorted())
+	{
+		os << std::setw(12) << std::fixed << std::setprecision(3) << cost.seconds * 1e3
+			<< std::setw(14) << cost.instructions
+			<< std::setw(12) << cost.nodes
+			<< std::setw(12) << cost.outputBytes
+			<< "  " << cost.file << ": " << cost.scene << (cost.failed ? " (FAILED)" : "") << std::endl;
+	}
+
+	os.flags(flags);
+	os.precision(precision);
+}
+
+} // namespace soren
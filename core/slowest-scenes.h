@@ -0,0 +1,57 @@
+#ifndef SOREN_SLOWEST_SCENES_INCLUDED
+#define SOREN_SLOWEST_SCENES_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace soren {
+
+struct SceneCost
+{
+	std::string file;
+	std::string scene;
+
+	double seconds { 0.0 };
+	std::uint64_t instructions { 0u }; //< of the script, plus those moved around by rewrites (see core/budget.h)
+	std::uint64_t nodes { 0u };
+	std::uint64_t outputBytes { 0u };
+
+	bool failed { false };
+};
+
+struct SlowestScenes
+{
+	// keeps the `capacity` slowest scenes of a run, in a min-heap on time: its root is the fastest one kept,
+	// which is the one to drop for a slower one, so each scene costs a compare and at most a log(capacity) update
+
+	explicit SlowestScenes(std::size_t capacity)
+		: capacity(capacity)
+	{
+		heap.reserve(capacity);
+	}
+
+	// whether a scene that took this long would be kept (so that names are only copied for those that are)
+	bool wants(double seconds) const
+	{
+		return heap.size() < capacity || (capacity != 0 && seconds > heap.front().seconds);
+	}
+
+	void add(SceneCost cost);
+
+	// slowest first
+	std::vector<SceneCost> sorted() const;
+
+	// as a table, slowest first
+	void write(std::ostream& os) const;
+
+private:
+	std::size_t capacity;
+	std::vector<SceneCost> heap;
+};
+
+} // namespace soren
+
+#endif // SOREN_SLOWEST_SCENES_INCLUDED
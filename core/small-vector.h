@@ -0,0 +1,161 @@
+#ifndef SOREN_SMALL_VECTOR_INCLUDED
+#define SOREN_SMALL_VECTOR_INCLUDED
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace soren {
+
+template<typename Type, std::size_t InlineCount>
+struct SmallVector
+{
+	// a vector that keeps up to InlineCount elements in itself, and only allocates past that
+	// move-only (which is all we need it for: expression and statement children)
+
+	using value_type = Type;
+	using iterator = Type*;
+	using const_iterator = const Type*;
+
+	SmallVector() noexcept = default;
+
+	SmallVector(SmallVector&& other) noexcept
+	{
+		take(other);
+	}
+
+	SmallVector& operator = (SmallVector&& other) noexcept
+	{
+		if (this != &other)
+		{
+			clear();
+			release();
+			take(other);
+		}
+
+		return *this;
+	}
+
+	SmallVector(const SmallVector&) = delete;
+	SmallVector& operator = (const SmallVector&) = delete;
+
+	~SmallVector()
+	{
+		clear();
+		release();
+	}
+
+	std::size_t size() const noexcept { return mSize; }
+	std::size_t capacity() const noexcept { return mCapacity; }
+	bool empty() const noexcept { return mSize == 0; }
+
+	Type* data() noexcept { return mData; }
+	const Type* data() const noexcept { return mData; }
+
+	iterator begin() noexcept { return mData; }
+	iterator end() noexcept { return mData + mSize; }
+	const_iterator begin() const noexcept { return mData; }
+	const_iterator end() const noexcept { return mData + mSize; }
+
+	Type& operator [] (std::size_t index) noexcept { return mData[index]; }
+	const Type& operator [] (std::size_t index) const noexcept { return mData[index]; }
+
+	Type& back() noexcept { return mData[mSize - 1]; }
+	const Type& back() const noexcept { return mData[mSize - 1]; }
+
+	void reserve(std::size_t count)
+	{
+		if (count <= mCapacity)
+			return;
+
+		Type* data = static_cast<Type*>(::operator new(count * sizeof(Type)));
+
+		for (std::size_t i = 0; i < mSize; ++i)
+		{
+			new (data + i) Type(std::move(mData[i]));
+			mData[i].~Type();
+		}
+
+		release();
+
+		mData = data;
+		mCapacity = count;
+	}
+
+	template<typename... Args>
+	Type& emplace_back(Args&&... args)
+	{
+		if (mSize == mCapacity)
+			reserve(mCapacity * 2);
+
+		new (mData + mSize) Type(std::forward<Args>(args)...);
+		return mData[mSize++];
+	}
+
+	void push_back(Type&& value)
+	{
+		emplace_back(std::move(value));
+	}
+
+	void pop_back() noexcept
+	{
+		mData[--mSize].~Type();
+	}
+
+	void clear() noexcept
+	{
+		while (mSize != 0)
+			pop_back();
+	}
+
+private:
+	Type* inline_data() noexcept { return reinterpret_cast<Type*>(&mInline); }
+
+	bool is_inline() const noexcept { return mData == reinterpret_cast<const Type*>(&mInline); }
+
+	void release() noexcept
+	{
+		// expects no elements
+
+		if (!is_inline())
+			::operator delete(mData);
+
+		mData = inline_data();
+		mCapacity = InlineCount;
+	}
+
+	void take(SmallVector& other) noexcept
+	{
+		// expects no elements and no allocation
+
+		if (other.is_inline())
+		{
+			for (std::size_t i = 0; i < other.mSize; ++i)
+				new (mData + i) Type(std::move(other.mData[i]));
+
+			mSize = other.mSize;
+			other.clear();
+
+			return;
+		}
+
+		mData = other.mData;
+		mSize = other.mSize;
+		mCapacity = other.mCapacity;
+
+		other.mData = other.inline_data();
+		other.mSize = 0;
+		other.mCapacity = InlineCount;
+	}
+
+	typename std::aligned_storage<sizeof(Type) * InlineCount, alignof(Type)>::type mInline;
+
+	Type* mData { inline_data() };
+	std::size_t mSize { 0u };
+	std::size_t mCapacity { InlineCount };
+};
+
+} // namespace soren
+
+#endif // SOREN_SMALL_VECTOR_INCLUDED
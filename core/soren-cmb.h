@@ -1,6 +1,7 @@
 #ifndef SOREN_CORE_CMB_INCLUDED
 #define SOREN_CORE_CMB_INCLUDED
 
+#include <algorithm>
 #include <stdexcept>
 
 #include <vector>
@@ -10,6 +11,13 @@
 
 namespace soren {
 
+enum
+{
+	GLOBAL_AMT_SUSPICION_LIMIT = 1000,
+	LOCALS_AMT_SUSPICION_LIMIT = 1000,
+	PARAMS_AMT_SUSPICION_LIMIT = 20,
+};
+
 enum
 {
 	CMB_SCENE_KIND_FUNCTION = 0,
@@ -33,6 +41,10 @@ struct SceneInfo
 	std::vector<BcIns> rawScript;
 
 	bool isGlobal { false };
+
+	// scene information bytes we don't understand yet, kept so that the scene can be encoded back
+	std::uint32_t unknown08 { 0u }; // TODO: figure out what this is
+	std::uint8_t unknown0F { 0u }; // TODO: figure out what this is
 };
 
 struct CmbInfo
@@ -42,6 +54,10 @@ struct CmbInfo
 		if (offset >= stringPool.size())
 			throw std::runtime_error("Bad string pool offset");
 
+		// the string has to end in the pool (the pool may be cut short by the event offset array)
+		if (std::find(stringPool.begin() + offset, stringPool.end(), '\0') == stringPool.end())
+			throw std::runtime_error("Unterminated string in string pool");
+
 		return stringPool.data() + offset;
 	}
 
@@ -49,6 +65,9 @@ struct CmbInfo
 	std::vector<char> stringPool;
 
 	std::vector<std::string> globalNames; // TODO: this may not be what it is, investigate
+
+	// the file header, of which we only understand the global amount and the offsets (that are recomputed when encoding)
+	std::vector<byte_type> header;
 };
 
 } // namespace soren
@@ -0,0 +1,44 @@
+#ifndef SOREN_TRACE_INCLUDED
+#define SOREN_TRACE_INCLUDED
+
+// static tracepoints
+// where <sys/sdt.h> is there (systemtap-sdt-dev on Debian, systemtap-sdt-devel on Fedora), SOREN_TRACEn(name, ...) is
+// a USDT probe "soren:name": a single nop in the code plus an ELF note saying where it is and where its arguments are,
+// so it costs nothing until a tracer attaches to it, e.g.
+//
+//     bpftrace -e 'usdt:./soren:soren:scene__end { printf("%s %d\n", str(arg1), arg2); }' -c './soren file.cmb'
+//     perf buildid-cache --add ./soren && perf record -e sdt_soren:scene__start ./soren file.cmb
+//
+// elsewhere, or built with SOREN_DISABLE_TRACEPOINTS, they expand to nothing (and arguments aren't evaluated)
+//
+// probes (strings are const char*):
+//     file__start(path)
+//     file__end(path, status) - status is 0, or 1 if the file failed
+//     decode__error(path, message)
+//     scene__start(path, scene name, scene index)
+//     scene__end(path, scene name, failed)
+
+#if !defined(SOREN_DISABLE_TRACEPOINTS) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SOREN_HAS_TRACEPOINTS 1
+#endif
+#endif
+
+#if SOREN_HAS_TRACEPOINTS
+
+#define SOREN_TRACE0(name) STAP_PROBE(soren, name)
+#define SOREN_TRACE1(name, a) STAP_PROBE1(soren, name, a)
+#define SOREN_TRACE2(name, a, b) STAP_PROBE2(soren, name, a, b)
+#define SOREN_TRACE3(name, a, b, c) STAP_PROBE3(soren, name, a, b, c)
+
+#else
+
+#define SOREN_TRACE0(name) ((void) 0)
+#define SOREN_TRACE1(name, a) ((void) 0)
+#define SOREN_TRACE2(name, a, b) ((void) 0)
+#define SOREN_TRACE3(name, a, b, c) ((void) 0)
+
+#endif // SOREN_HAS_TRACEPOINTS
+
+#endif // SOREN_TRACE_INCLUDED
@@ -0,0 +1,145 @@
+#ifndef SOREN_WORK_STEALING_INCLUDED
+#define SOREN_WORK_STEALING_INCLUDED
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace soren {
+
+static inline
+unsigned resolve_thread_count(unsigned requested)
+{
+	if (requested != 0)
+		return requested;
+
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+template<typename Func>
+void parallel_for(std::size_t count, unsigned threadCount, Func&& func)
+{
+	// calls func(worker, index) for every index in [0, count)
+	// each worker starts with an equal contiguous share of the indices, and takes from the front of it
+	// a worker that runs out steals the back half of the share of another worker
+	// if any call throws, the first exception is rethrown once all workers are done
+
+	threadCount = std::max(1u, std::min<unsigned>(resolve_thread_count(threadCount), count));
+
+	if (threadCount == 1)
+	{
+		for (std::size_t i = 0; i < count; ++i)
+			func(0u, i);
+
+		return;
+	}
+
+	struct Share
+	{
+		std::mutex mutex;
+
+		std::size_t begin;
+		std::size_t end;
+
+		char padding[64]; // keep shares of different workers off the same cache line
+	};
+
+	std::unique_ptr<Share[]> shares(new Share[threadCount]);
+
+	for (unsigned i = 0; i < threadCount; ++i)
+	{
+		shares[i].begin = count * i / threadCount;
+		shares[i].end = count * (i+1) / threadCount;
+	}
+
+	std::mutex errorMutex;
+	std::exception_ptr error;
+
+	const auto take = [&] (unsigned worker, std::size_t& index)
+	{
+		std::lock_guard<std::mutex> lock(shares[worker].mutex);
+
+		if (shares[worker].begin == shares[worker].end)
+			return false;
+
+		index = shares[worker].begin++;
+		return true;
+	};
+
+	const auto steal = [&] (unsigned worker)
+	{
+		for (unsigned i = 1; i < threadCount; ++i)
+		{
+			auto& victim = shares[(worker + i) % threadCount];
+
+			std::size_t begin, end;
+
+			{
+				std::lock_guard<std::mutex> lock(victim.mutex);
+
+				if (victim.begin == victim.end)
+					continue;
+
+				begin = victim.begin + (victim.end - victim.begin) / 2;
+				end = victim.end;
+
+				victim.end = begin;
+			}
+
+			// never hold two locks at once: stolen work is "in transit" here, but only we can lose track of it
+
+			std::lock_guard<std::mutex> lock(shares[worker].mutex);
+
+			shares[worker].begin = begin;
+			shares[worker].end = end;
+
+			return true;
+		}
+
+		return false;
+	};
+
+	const auto work = [&] (unsigned worker)
+	{
+		try
+		{
+			std::size_t index;
+
+			do
+			{
+				while (take(worker, index))
+					func(worker, index);
+			}
+			while (steal(worker));
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(errorMutex);
+
+			if (!error)
+				error = std::current_exception();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount - 1);
+
+	for (unsigned i = 1; i < threadCount; ++i)
+		threads.emplace_back(work, i);
+
+	work(0);
+
+	for (auto& thread : threads)
+		thread.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+} // namespace soren
+
+#endif // SOREN_WORK_STEALING_INCLUDED
@@ -2,15 +2,22 @@
 #define SOREN_DECODE_INCLUDED
 
 #include <cstdint>
+#include <vector>
 
 #include "core/types.h"
 #include "core/soren-cmb.h"
+#include "core/budget.h"
 
 namespace soren {
 
 using byte_type = std::uint8_t;
 
-CmbInfo decode_cmb(Span<const byte_type> data, GameKind game);
+// if a budget is given, decoded instructions are charged to it (each scene being one budget scene)
+// a scene going over its budget still fails the whole file, as scenes refer to each other
+CmbInfo decode_cmb(Span<const byte_type> data, GameKind game, WorkBudget* budget = nullptr);
+
+// decodes one script, from the start of data up to its end instruction
+std::vector<BcIns> decode_script(Span<const byte_type> data, GameKind game, WorkBudget* budget = nullptr);
 
 } // namespace soren
 
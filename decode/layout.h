@@ -0,0 +1,44 @@
+#ifndef SOREN_DECODE_LAYOUT_INCLUDED
+#define SOREN_DECODE_LAYOUT_INCLUDED
+
+#include <cstdint>
+#include <vector>
+
+#include "core/types.h"
+
+namespace soren {
+
+// Where the parts of an encoded cmb are (see decode_cmb for the layout), for what works on the file as it is
+// (patching, editing, deltas) instead of decoding all of it.
+
+static inline
+std::uint32_t read_int_le(Span<const byte_type> data, std::size_t offset, unsigned size)
+{
+	std::uint32_t result = 0;
+
+	for (unsigned i = 0; i < size; ++i)
+		result |= std::uint32_t(data[offset + i]) << (8*i);
+
+	return result;
+}
+
+struct CmbSceneLayout
+{
+	std::uint32_t info, infoSize; //< the size including parameters
+	std::uint32_t script, scriptEnd; //< the end being where the next thing in the file starts
+};
+
+struct CmbLayout
+{
+	std::vector<CmbSceneLayout> scenes;
+
+	std::uint32_t strings { 0u }, stringsEnd { 0u };
+	std::uint32_t events { 0u };
+};
+
+// throws (as decode_cmb does) if the header, event offset array or scene informations go past the end of data
+CmbLayout read_cmb_layout(Span<const byte_type> data);
+
+} // namespace soren
+
+#endif // SOREN_DECODE_LAYOUT_INCLUDED
@@ -3,13 +3,6 @@
 
 namespace soren {
 
-enum
-{
-	GLOBAL_AMT_SUSPICION_LIMIT = 1000,
-	LOCALS_AMT_SUSPICION_LIMIT = 1000,
-	PARAMS_AMT_SUSPICION_LIMIT = 20,
-};
-
 template<typename IteratorType, typename ResultType = std::uint32_t>
 static inline
 ResultType decode_int_le(IteratorType begin, IteratorType end)
@@ -61,10 +54,13 @@ IntType sign_extend(IntType value, unsigned bits)
 
 	const auto rbits = (sizeof(IntType)*8 - bits);
 
-	return (value << rbits) >> rbits;
+	// shifting left in unsigned, as shifting negative values left is undefined
+	using UnsignedType = typename std::make_unsigned<IntType>::type;
+
+	return static_cast<IntType>(static_cast<UnsignedType>(value) << rbits) >> rbits;
 }
 
-std::vector<BcIns> decode_script(Span<const byte_type> data, GameKind game)
+std::vector<BcIns> decode_script(Span<const byte_type> data, GameKind game, WorkBudget* budget)
 {
 	std::vector<BcIns> result;
 
@@ -73,6 +69,10 @@ std::vector<BcIns> decode_script(Span<const byte_type> data, GameKind game)
 
 	while (!ended && i < data.size())
 	{
+		// corrupted scripts can go on until the end of the file
+		charge_instructions(budget);
+		charge_bytes(budget, sizeof(BcIns));
+
 		BcIns ins { i, 0, 0 };
 		ins.opcode = data[i++];
 
@@ -140,7 +140,7 @@ std::vector<BcIns> decode_script(Span<const byte_type> data, GameKind game)
 	return result;
 }
 
-CmbInfo decode_cmb(Span<const byte_type> data, GameKind game)
+CmbInfo decode_cmb(Span<const byte_type> data, GameKind game, WorkBudget* budget)
 {
 	CmbInfo result;
 
@@ -162,6 +162,8 @@ CmbInfo decode_cmb(Span<const byte_type> data, GameKind game)
 	if (globalAmt > GLOBAL_AMT_SUSPICION_LIMIT)
 		throw std::runtime_error("CMB global variable amount is past the suspicion limit!"); // TODO: better error
 
+	result.header.assign(data.begin(), data.begin() + 0x2C);
+
 	// String pool
 	result.stringPool.assign(
 		data.begin() + offStrings,
@@ -188,7 +190,9 @@ CmbInfo decode_cmb(Span<const byte_type> data, GameKind game)
 
 	for (unsigned i = 0;; ++i)
 	{
-		if (offEvents + i*4 + 4 > data.size())
+		// offsets are 32-bit, so sums of them are computed in size_t so that they don't wrap around
+
+		if (std::size_t(offEvents) + i*4 + 4 > data.size())
 			throw std::runtime_error("Event offset array unterminated by then end of the file"); // TODO: better error
 
 		const auto offEvent = decode_int_le(data.subspan(offEvents + 4*i, 4));
@@ -196,14 +200,16 @@ CmbInfo decode_cmb(Span<const byte_type> data, GameKind game)
 		if (offEvent == 0)
 			break; // We reached the end!
 
-		if (offEvent + 0x14 > data.size())
+		if (std::size_t(offEvent) + 0x14 > data.size())
 			throw std::runtime_error("Scene information goes past the end of the file"); // TODO: better error
 
 		const auto offName   = decode_int_le(data.subspan(offEvent + 0x00, 4));
 		const auto offScript = decode_int_le(data.subspan(offEvent + 0x04, 4));
+		const auto unknown08 = decode_int_le(data.subspan(offEvent + 0x08, 4));
 		const auto kind      = decode_int_le(data.subspan(offEvent + 0x0C, 1));
 		const auto argAmt    = decode_int_le(data.subspan(offEvent + 0x0D, 1));
 		const auto paramAmt  = decode_int_le(data.subspan(offEvent + 0x0E, 1));
+		const auto unknown0F = decode_int_le(data.subspan(offEvent + 0x0F, 1));
 		const auto idx       = decode_int_le(data.subspan(offEvent + 0x10, 2));
 		const auto varAmt    = decode_int_le(data.subspan(offEvent + 0x12, 2));
 
@@ -216,9 +222,12 @@ CmbInfo decode_cmb(Span<const byte_type> data, GameKind game)
 		if (argAmt > varAmt)
 			throw std::runtime_error("Scene argument amount is past the variable amount!"); // TODO: better error
 
-		if (offEvent + 0x14 + 2*paramAmt > data.size())
+		if (std::size_t(offEvent) + 0x14 + 2*paramAmt > data.size())
 			throw std::runtime_error("Scene information parameters goes past the end of the file"); // TODO: better error
 
+		if (offScript >= data.size())
+			throw std::runtime_error("Scene script starts past the end of the file"); // TODO: better error
+
 		if (idx != i)
 			throw std::runtime_error("Scene information is invalid (index doesn't match)!"); // TODO: better error
 
@@ -230,6 +239,9 @@ CmbInfo decode_cmb(Span<const byte_type> data, GameKind game)
 		scene.argCnt   = argAmt;
 		scene.isGlobal = (offName != 0);
 
+		scene.unknown08 = unknown08;
+		scene.unknown0F = unknown0F;
+
 		// Read name
 		scene.name = [&] ()
 		{
@@ -240,7 +252,7 @@ CmbInfo decode_cmb(Span<const byte_type> data, GameKind game)
 
 			for (unsigned i = offName;; ++i)
 			{
-				if (i > data.size())
+				if (i >= data.size())
 					throw std::runtime_error("Scene name string reaches past the end of the file");
 
 				if (data[i] == 0)
@@ -278,7 +290,10 @@ CmbInfo decode_cmb(Span<const byte_type> data, GameKind game)
 		} ();
 
 		// Decode script
-		scene.rawScript = decode_script(data.subspan(offScript), game);
+		if (budget != nullptr)
+			budget->begin_scene();
+
+		scene.rawScript = decode_script(data.subspan(offScript), game, budget);
 	}
 
 	return result;
@@ -0,0 +1,68 @@
+
+#include "decode/layout.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace soren {
+
+CmbLayout read_cmb_layout(Span<const byte_type> data)
+{
+	CmbLayout result;
+
+	if (data.size() < 0x2C)
+		throw std::runtime_error("This is not a valid CMB file! (too small)"); // TODO: better error
+
+	result.strings = read_int_le(data, 0x24, 4);
+	result.events = read_int_le(data, 0x28, 4);
+
+	if (result.strings >= data.size() || result.events >= data.size())
+		throw std::runtime_error("String pool or event offset array past the end of the file!"); // TODO: better error
+
+	result.stringsEnd = result.strings > result.events ? data.size() : result.events;
+
+	std::vector<std::uint32_t> starts { 0u, result.strings, result.events };
+
+	for (unsigned i = 0;; ++i)
+	{
+		// offsets are 32-bit, so sums of them are computed in size_t so that they don't wrap around
+
+		if (std::size_t(result.events) + i*4 + 4 > data.size())
+			throw std::runtime_error("Event offset array unterminated by then end of the file"); // TODO: better error
+
+		const auto offEvent = read_int_le(data, result.events + 4*i, 4);
+
+		if (offEvent == 0)
+			break;
+
+		if (std::size_t(offEvent) + 0x14 > data.size())
+			throw std::runtime_error("Scene information goes past the end of the file"); // TODO: better error
+
+		const std::uint32_t infoSize = 0x14u + 2*data[offEvent + 0x0E];
+
+		if (std::size_t(offEvent) + infoSize > data.size())
+			throw std::runtime_error("Scene information parameters goes past the end of the file"); // TODO: better error
+
+		const auto offScript = read_int_le(data, offEvent + 0x04, 4);
+
+		if (offScript >= data.size())
+			throw std::runtime_error("Scene script starts past the end of the file"); // TODO: better error
+
+		result.scenes.push_back(CmbSceneLayout { offEvent, infoSize, offScript, 0u });
+
+		starts.push_back(offEvent);
+		starts.push_back(offScript);
+	}
+
+	std::sort(starts.begin(), starts.end());
+
+	for (auto& scene : result.scenes)
+	{
+		const auto next = std::upper_bound(starts.begin(), starts.end(), scene.script);
+		scene.scriptEnd = (next == starts.end()) ? data.size() : *next;
+	}
+
+	return result;
+}
+
+} // namespace soren
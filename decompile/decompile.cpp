@@ -0,0 +1,798 @@
+
+#include "decompile/decompile.h"
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+namespace soren {
+
+Span<BcIns> convert_bks_to_fake_logic(Span<BcIns> slice, WorkBudget* budget)
+{
+	// Converts bky/bkn chains to fake land/lorr instructions and reorder accordingly
+	// ex:
+	/*
+	 * 0 val 0
+	 * 2 bkn 7
+	 * 5 val 1
+	 * 7 bn ...
+	 */
+	// becomes
+	/*
+	 * 0 val 0
+	 * 5 val 1
+	 * 2 fake!land
+	 * 7 bn ...
+	 */
+
+	for (unsigned i = 0; i < slice.size();)
+	{
+		unsigned op = slice[i].opcode;
+
+		if (op != BC_OPCODE_BKN && op != BC_OPCODE_BKY)
+		{
+			i++;
+			continue;
+		}
+
+		// Move the bkn/bky to just before the jump target, and replace it with a fake and/or
+		// what followed it is now at i, and may be a bkn/bky too (a || b && c both going to the same place), so i stays
+
+		unsigned target = slice[i].operand;
+		unsigned j = i + 1;
+
+		while (j < slice.size() && slice[j].location != target)
+		{
+			// chains of these are quadratic
+			charge_instructions(budget);
+
+			std::swap(slice[j-1], slice[j]);
+			j++;
+		}
+
+		slice[j-1].opcode = (op == BC_OPCODE_BKN) ? BC_FAKEOP_LAND : BC_FAKEOP_LORR;
+		slice[j-1].operand = 0;
+	}
+
+	return slice;
+}
+
+std::vector<BcIns> get_bks_as_fake_logic(Span<const BcIns> slice, WorkBudget* budget)
+{
+	charge_bytes(budget, slice.size() * sizeof(BcIns));
+
+	std::vector<BcIns> result(slice.begin(), slice.end());
+	convert_bks_to_fake_logic(result, budget);
+
+	return result;
+}
+
+namespace {
+
+// how make_statements handles an opcode
+
+enum class StmtOpClass : std::uint8_t
+{
+	Unsupported,
+	Nothing,
+
+	Leaf,        // push <operand>
+	LeafAddr,    // push &<operand>
+	Indexed,     // push a => push [&<operand> + a]
+	IndexedAddr, // push a => push &<operand> + a
+
+	Unop,        // push a => push <kind> a
+	Binop,       // push a, b => push a <kind> b
+	BinopExpr,   // push a, b => a <kind> b
+	Deref,       // push a => push a, [a]
+	Dup,         // push a => push a, a
+	Disc,        // push a => a
+
+	Call,        // push ... => push func(...)
+	Printf,      // push ... => __printf(...)
+
+	Return,      // push a => return a
+	ReturnConst, // return <constant>
+	Goto,        // goto off
+	GotoIf,      // push a => goto off if a (or if <kind> a)
+	Yield,       // yield
+};
+
+// where the operand (or its meaning) comes from
+enum class StmtOperandSource : std::uint8_t
+{
+	None,
+	Local,    // scene local name
+	Global,   // global name
+	Literal,  // the operand itself
+	String,   // string pool at operand
+	Scene,    // scene name and argument count
+	External, // string pool at operand >> 8, operand & 0xFF arguments
+	ArgCount, // operand arguments
+};
+
+struct StmtOpDesc
+{
+	StmtOpClass opClass;
+	StmtOperandSource source;
+	Expr::Kind kind;
+	std::int32_t constant;
+};
+
+struct StmtOpTable
+{
+	StmtOpDesc ops[BC_OPCODE_COUNT];
+};
+
+} // namespace
+
+static constexpr
+StmtOpDesc stmt_op(StmtOpClass opClass, StmtOperandSource source = StmtOperandSource::None,
+	Expr::Kind kind = Expr::Kind::Invalid, std::int32_t constant = 0)
+{
+	return StmtOpDesc { opClass, source, kind, constant };
+}
+
+static constexpr
+StmtOpTable make_stmt_op_table()
+{
+	using C = StmtOpClass;
+	using S = StmtOperandSource;
+	using K = Expr::Kind;
+
+	StmtOpTable result {};
+
+	// anything not listed is unsupported (valy/refy and their global variants, inc, dec)
+
+	result.ops[BC_OPCODE_NOP]      = stmt_op(C::Nothing);
+	result.ops[BC_OPCODE_40]       = stmt_op(C::Nothing);
+
+	result.ops[BC_OPCODE_VAL8]     = stmt_op(C::Leaf, S::Local);
+	result.ops[BC_OPCODE_VAL16]    = stmt_op(C::Leaf, S::Local);
+	result.ops[BC_OPCODE_VALX8]    = stmt_op(C::Indexed, S::Local);
+	result.ops[BC_OPCODE_VALX16]   = stmt_op(C::Indexed, S::Local);
+	result.ops[BC_OPCODE_REF8]     = stmt_op(C::LeafAddr, S::Local);
+	result.ops[BC_OPCODE_REF16]    = stmt_op(C::LeafAddr, S::Local);
+	result.ops[BC_OPCODE_REFX8]    = stmt_op(C::IndexedAddr, S::Local);
+	result.ops[BC_OPCODE_REFX16]   = stmt_op(C::IndexedAddr, S::Local);
+
+	result.ops[BC_OPCODE_GVAL8]    = stmt_op(C::Leaf, S::Global);
+	result.ops[BC_OPCODE_GVAL16]   = stmt_op(C::Leaf, S::Global);
+	result.ops[BC_OPCODE_GVALX8]   = stmt_op(C::Indexed, S::Global);
+	result.ops[BC_OPCODE_GVALX16]  = stmt_op(C::Indexed, S::Global);
+	result.ops[BC_OPCODE_GREF8]    = stmt_op(C::LeafAddr, S::Global);
+	result.ops[BC_OPCODE_GREF16]   = stmt_op(C::LeafAddr, S::Global);
+	result.ops[BC_OPCODE_GREFX8]   = stmt_op(C::IndexedAddr, S::Global);
+	result.ops[BC_OPCODE_GREFX16]  = stmt_op(C::IndexedAddr, S::Global);
+
+	result.ops[BC_OPCODE_NUMBER8]  = stmt_op(C::Leaf, S::Literal);
+	result.ops[BC_OPCODE_NUMBER16] = stmt_op(C::Leaf, S::Literal);
+	result.ops[BC_OPCODE_NUMBER32] = stmt_op(C::Leaf, S::Literal);
+	result.ops[BC_OPCODE_STRING8]  = stmt_op(C::Leaf, S::String);
+	result.ops[BC_OPCODE_STRING16] = stmt_op(C::Leaf, S::String);
+	result.ops[BC_OPCODE_STRING32] = stmt_op(C::Leaf, S::String);
+
+	result.ops[BC_OPCODE_DEREF]    = stmt_op(C::Deref);
+	result.ops[BC_OPCODE_DISC]     = stmt_op(C::Disc);
+	result.ops[BC_OPCODE_DUP]      = stmt_op(C::Dup);
+
+	result.ops[BC_OPCODE_STORE]    = stmt_op(C::Binop, S::None, K::Assign);
+	result.ops[BC_OPCODE_ADD]      = stmt_op(C::Binop, S::None, K::Add);
+	result.ops[BC_OPCODE_SUB]      = stmt_op(C::Binop, S::None, K::Sub);
+	result.ops[BC_OPCODE_MUL]      = stmt_op(C::Binop, S::None, K::Mul);
+	result.ops[BC_OPCODE_DIV]      = stmt_op(C::Binop, S::None, K::Div);
+	result.ops[BC_OPCODE_MOD]      = stmt_op(C::Binop, S::None, K::Mod);
+	result.ops[BC_OPCODE_ORR]      = stmt_op(C::Binop, S::None, K::Or);
+	result.ops[BC_OPCODE_AND]      = stmt_op(C::Binop, S::None, K::And);
+	result.ops[BC_OPCODE_XOR]      = stmt_op(C::Binop, S::None, K::Xor);
+	result.ops[BC_OPCODE_LSL]      = stmt_op(C::Binop, S::None, K::Lsl);
+	result.ops[BC_OPCODE_LSR]      = stmt_op(C::Binop, S::None, K::Lsr);
+	result.ops[BC_OPCODE_EQ]       = stmt_op(C::Binop, S::None, K::Eq);
+	result.ops[BC_OPCODE_NE]       = stmt_op(C::Binop, S::None, K::Ne);
+	result.ops[BC_OPCODE_LT]       = stmt_op(C::Binop, S::None, K::Lt);
+	result.ops[BC_OPCODE_LE]       = stmt_op(C::Binop, S::None, K::Le);
+	result.ops[BC_OPCODE_GT]       = stmt_op(C::Binop, S::None, K::Gt);
+	result.ops[BC_OPCODE_GE]       = stmt_op(C::Binop, S::None, K::Ge);
+	result.ops[BC_OPCODE_EQSTR]    = stmt_op(C::Binop, S::None, K::EqStr);
+	result.ops[BC_OPCODE_NESTR]    = stmt_op(C::Binop, S::None, K::NeStr);
+	result.ops[BC_FAKEOP_LAND]     = stmt_op(C::Binop, S::None, K::LogicalAnd);
+	result.ops[BC_FAKEOP_LORR]     = stmt_op(C::Binop, S::None, K::LogicalOr);
+	result.ops[BC_OPCODE_ASSIGN]   = stmt_op(C::BinopExpr, S::None, K::Assign);
+
+	result.ops[BC_OPCODE_NEG]      = stmt_op(C::Unop, S::None, K::Neg);
+	result.ops[BC_OPCODE_NOT]      = stmt_op(C::Unop, S::None, K::Not);
+	result.ops[BC_OPCODE_MVN]      = stmt_op(C::Unop, S::None, K::BitwiseNot);
+
+	result.ops[BC_OPCODE_CALL]     = stmt_op(C::Call, S::Scene);
+	result.ops[BC_OPCODE_CALLEXT]  = stmt_op(C::Call, S::External);
+	result.ops[BC_OPCODE_PRINTF]   = stmt_op(C::Printf, S::ArgCount);
+
+	result.ops[BC_OPCODE_RETURN]   = stmt_op(C::Return);
+	result.ops[BC_OPCODE_RETN]     = stmt_op(C::ReturnConst, S::None, K::Invalid, 0);
+	result.ops[BC_OPCODE_RETY]     = stmt_op(C::ReturnConst, S::None, K::Invalid, 1);
+	result.ops[BC_OPCODE_B]        = stmt_op(C::Goto);
+	result.ops[BC_OPCODE_BY]       = stmt_op(C::GotoIf);
+	result.ops[BC_OPCODE_BN]       = stmt_op(C::GotoIf, S::None, K::Not);
+	result.ops[BC_OPCODE_YIELD]    = stmt_op(C::Yield);
+
+	return result;
+}
+
+static constexpr StmtOpTable gStmtOpTable = make_stmt_op_table();
+
+namespace {
+
+// values pushed and not popped yet
+// each remembers how many (non-push) statements there were when it was pushed: it can only be popped if there
+// were none since, and the ones left at the end become push statements at that position
+// entries only grows (call arguments alone can be 255 deep), popped entries past size are reused
+struct StmtExprStack
+{
+	enum { INITIAL_CAPACITY = 128 };
+
+	struct Entry
+	{
+		std::unique_ptr<Expr> expr;
+		std::size_t position;
+	};
+
+	std::vector<Entry> entries = std::vector<Entry>(INITIAL_CAPACITY);
+	unsigned size { 0u };
+};
+
+} // namespace
+
+std::vector<Stmt> make_statements(const CmbInfo& script, const SceneInfo& scene, Span<const BcIns> slice, WorkBudget* budget)
+{
+	std::vector<Stmt> result;
+	result.reserve(slice.size());
+
+	StmtExprStack stack;
+
+	const auto push = [&] (std::unique_ptr<Expr>&& expr)
+	{
+		if (stack.size == stack.entries.size())
+			stack.entries.resize(stack.entries.size() * 2);
+
+		stack.entries[stack.size++] = { std::move(expr), result.size() };
+	};
+
+	// the top count values, which must have been pushed since the last statement
+	const auto top = [&] (unsigned count) -> StmtExprStack::Entry*
+	{
+		if (stack.size < count || (count != 0 && stack.entries[stack.size - count].position != result.size()))
+			throw std::runtime_error("expected after push"); // TODO: better error ("name" only expected after push)
+
+		return stack.entries.data() + stack.size - count;
+	};
+
+	const auto name_of = [&] (StmtOperandSource source, std::int32_t operand) -> const std::string&
+	{
+		const auto& names = source == StmtOperandSource::Local ? scene.varnames : script.globalNames;
+
+		if (operand < 0 || static_cast<std::size_t>(operand) >= names.size())
+			throw std::runtime_error("Variable index out of range."); // TODO: better error
+
+		return names[operand];
+	};
+
+	const auto call = [&] (const char* funcname, unsigned argCnt)
+	{
+		auto args = top(argCnt);
+
+		auto callexpr = std::make_unique<Expr>();
+
+		callexpr->kind = Expr::Kind::Func;
+		callexpr->named = funcname;
+		callexpr->children.reserve(argCnt);
+
+		for (unsigned i = 0; i < argCnt; ++i)
+			callexpr->children.push_back(std::move(args[i].expr));
+
+		stack.size -= argCnt;
+
+		return callexpr;
+	};
+
+	for (auto& ins : slice)
+	{
+		const auto& desc = gStmtOpTable.ops[ins.opcode];
+
+		// each instruction builds a few nodes at most, copies (deref, dup) are charged per node
+		charge_nodes(budget);
+		charge_bytes(budget, DECOMPILE_BYTES_PER_NODE);
+
+		switch (desc.opClass)
+		{
+
+		case StmtOpClass::Unsupported:
+			throw std::runtime_error("Unsupported opcode."); // TODO: better error
+
+		case StmtOpClass::Nothing:
+			break;
+
+		case StmtOpClass::Leaf:
+			switch (desc.source)
+			{
+
+			case StmtOperandSource::Literal:
+				push(Expr::make_unique_intlit(ins.operand));
+				break;
+
+			case StmtOperandSource::String:
+				push(Expr::make_unique_strlit({ script.get_cstr(ins.operand) }));
+				break;
+
+			default:
+				push(Expr::make_unique_identifier(std::string(name_of(desc.source, ins.operand))));
+				break;
+
+			} // switch (desc.source)
+
+			break;
+
+		case StmtOpClass::LeafAddr:
+			push(Expr::make_unique_unop(Expr::Kind::Addrof,
+				Expr::make_unique_identifier(std::string(name_of(desc.source, ins.operand)))));
+
+			break;
+
+		case StmtOpClass::Indexed:
+		case StmtOpClass::IndexedAddr:
+		{
+			auto& back = top(1)->expr;
+
+			back = Expr::make_unique_binop(Expr::Kind::Add,
+				Expr::make_unique_unop(Expr::Kind::Addrof,
+					Expr::make_unique_identifier(std::string(name_of(desc.source, ins.operand)))),
+				std::move(back));
+
+			if (desc.opClass == StmtOpClass::Indexed)
+				back = Expr::make_unique_unop(Expr::Kind::Deref, std::move(back));
+
+			break;
+		}
+
+		case StmtOpClass::Unop:
+		{
+			auto& back = top(1)->expr;
+			back = Expr::make_unique_unop(desc.kind, std::move(back));
+
+			break;
+		}
+
+		case StmtOpClass::Binop:
+		case StmtOpClass::BinopExpr:
+		{
+			auto operands = top(2);
+
+			auto expr = Expr::make_unique_binop(desc.kind, std::move(operands[0].expr), std::move(operands[1].expr));
+			stack.size -= 2;
+
+			if (desc.opClass == StmtOpClass::Binop)
+			{
+				push(std::move(expr));
+			}
+			else
+			{
+				result.push_back(Stmt::make_push(std::move(expr)));
+				result.back().kind = Stmt::Kind::Expr;
+			}
+
+			break;
+		}
+
+		case StmtOpClass::Deref:
+			push(Expr::make_unique_unop(Expr::Kind::Deref, Expr::make_unique_copy(*top(1)->expr, budget)));
+			break;
+
+		case StmtOpClass::Dup:
+			push(Expr::make_unique_copy(*top(1)->expr, budget));
+			break;
+
+		case StmtOpClass::Disc:
+		case StmtOpClass::Return:
+		{
+			auto expr = std::move(top(1)->expr);
+			stack.size -= 1;
+
+			result.push_back(Stmt::make_push(std::move(expr)));
+			result.back().kind = desc.opClass == StmtOpClass::Disc ? Stmt::Kind::Expr : Stmt::Kind::Return;
+
+			break;
+		}
+
+		case StmtOpClass::Call:
+			if (desc.source == StmtOperandSource::Scene)
+			{
+				if (ins.operand < 0 || static_cast<std::size_t>(ins.operand) >= script.scenes.size())
+					throw std::runtime_error("Call to non-existent scene."); // TODO: better error
+
+				push(call(script.scenes[ins.operand].name.c_str(), script.scenes[ins.operand].argCnt));
+			}
+			else
+				push(call(script.get_cstr(ins.operand >> 8), ins.operand & 0xFF));
+
+			break;
+
+		case StmtOpClass::Printf:
+			result.push_back(Stmt::make_push(call("__printf", ins.operand)));
+			result.back().kind = Stmt::Kind::Expr;
+
+			break;
+
+		case StmtOpClass::ReturnConst:
+			result.push_back(Stmt::make_return(Expr::make_unique_intlit(desc.constant)));
+			break;
+
+		case StmtOpClass::Goto:
+			result.push_back(Stmt::make_goto(ins.operand));
+			break;
+
+		case StmtOpClass::GotoIf:
+		{
+			auto expr = std::move(top(1)->expr);
+			stack.size -= 1;
+
+			if (desc.kind != Expr::Kind::Invalid)
+				expr = Expr::make_unique_unop(desc.kind, std::move(expr));
+
+			result.push_back(Stmt::make_goto_if(ins.operand, std::move(expr)));
+
+			break;
+		}
+
+		case StmtOpClass::Yield:
+			result.push_back(Stmt::make_yield());
+			break;
+
+		} // switch (desc.opClass)
+	}
+
+	if (stack.size == 0)
+		return result;
+
+	// values left on the stack become push statements where they were pushed
+
+	std::vector<Stmt> merged;
+	merged.reserve(result.size() + stack.size);
+
+	std::size_t next = 0;
+
+	for (unsigned i = 0; i < stack.size; ++i)
+	{
+		auto& entry = stack.entries[i];
+
+		for (; next < entry.position; ++next)
+			merged.push_back(std::move(result[next]));
+
+		merged.push_back(Stmt::make_push(std::move(entry.expr)));
+	}
+
+	for (; next < result.size(); ++next)
+		merged.push_back(std::move(result[next]));
+
+	return merged;
+}
+
+namespace {
+
+// what is printed around and between the children of an expression
+struct ExprPunctuation
+{
+	const char* prefix;
+	const char* infix;
+	const char* suffix;
+};
+
+// same, with lengths (so that printing doesn't need to look for them)
+struct ExprPunctuationPart
+{
+	const char* str;
+	std::size_t size;
+};
+
+struct ExprPunctuationTable
+{
+	ExprPunctuationPart prefixes[static_cast<unsigned>(Expr::Kind::Func) + 1];
+	ExprPunctuationPart infixes[static_cast<unsigned>(Expr::Kind::Func) + 1];
+	ExprPunctuationPart suffixes[static_cast<unsigned>(Expr::Kind::Func) + 1];
+};
+
+} // namespace
+
+static constexpr
+ExprPunctuation make_expr_punctuation(Expr::Kind kind)
+{
+	switch (kind)
+	{
+
+	case Expr::Kind::Deref:      return { "[", "", "]" };
+	case Expr::Kind::Addrof:     return { "&", "", "" };
+	case Expr::Kind::Assign:     return { "[", "] = ", "" };
+	case Expr::Kind::Add:        return { "", " + ", "" };
+	case Expr::Kind::Sub:        return { "", " - ", "" };
+	case Expr::Kind::Mul:        return { "", " * ", "" };
+	case Expr::Kind::Div:        return { "", " / ", "" };
+	case Expr::Kind::Mod:        return { "", " % ", "" };
+	case Expr::Kind::And:        return { "", " & ", "" };
+	case Expr::Kind::Or:         return { "", " | ", "" };
+	case Expr::Kind::Xor:        return { "", " ^ ", "" };
+	case Expr::Kind::Lsl:        return { "", " << ", "" };
+	case Expr::Kind::Lsr:        return { "", " >> ", "" };
+	case Expr::Kind::Not:        return { "!", "", "" };
+	case Expr::Kind::Neg:        return { "-", "", "" };
+	case Expr::Kind::BitwiseNot: return { "~", "", "" };
+	case Expr::Kind::Eq:         return { "", " == ", "" };
+	case Expr::Kind::Ne:         return { "", " != ", "" };
+	case Expr::Kind::Lt:         return { "", " <? ", "" };
+	case Expr::Kind::Le:         return { "", " <= ", "" };
+	case Expr::Kind::Gt:         return { "", " >? ", "" };
+	case Expr::Kind::Ge:         return { "", " >=? ", "" };
+	case Expr::Kind::EqStr:      return { "", " <=> ", "" };
+	case Expr::Kind::NeStr:      return { "", " <!> ", "" };
+	case Expr::Kind::LogicalAnd: return { "", " && ", "" };
+	case Expr::Kind::LogicalOr:  return { "", " || ", "" };
+	case Expr::Kind::Func:       return { "(", ", ", ")" }; // after the name
+
+	// leaves are printed on their own
+	case Expr::Kind::IntLiteral:
+	case Expr::Kind::StrLiteral:
+	case Expr::Kind::Named:
+		return { "", "", "" };
+
+	default:
+		return { "<expr>", "", "" };
+
+	} // switch (kind)
+}
+
+static constexpr
+ExprPunctuationPart make_expr_punctuation_part(const char* str)
+{
+	std::size_t size = 0;
+
+	while (str[size] != '\0')
+		size++;
+
+	return { str, size };
+}
+
+static constexpr
+ExprPunctuationTable make_expr_punctuation_table()
+{
+	ExprPunctuationTable result {};
+
+	for (unsigned kind = 0; kind <= static_cast<unsigned>(Expr::Kind::Func); ++kind)
+	{
+		const auto punctuation = make_expr_punctuation(static_cast<Expr::Kind>(kind));
+
+		result.prefixes[kind] = make_expr_punctuation_part(punctuation.prefix);
+		result.infixes[kind] = make_expr_punctuation_part(punctuation.infix);
+		result.suffixes[kind] = make_expr_punctuation_part(punctuation.suffix);
+	}
+
+	return result;
+}
+
+static constexpr ExprPunctuationTable gExprPunctuationTable = make_expr_punctuation_table();
+
+std::ostream& operator << (std::ostream& os, const Expr& expr)
+{
+	struct Printer
+	{
+		void enter(const Expr& node)
+		{
+			switch (node.kind)
+			{
+
+			case Expr::Kind::IntLiteral:
+				os << std::dec << node.literal;
+				return;
+
+			case Expr::Kind::StrLiteral:
+				os.put('"');
+				os.write(node.named.data(), node.named.size());
+				os.put('"');
+				return;
+
+			case Expr::Kind::Named:
+			case Expr::Kind::Func:
+				os.write(node.named.data(), node.named.size());
+				break;
+
+			default:
+				break;
+
+			} // switch (node.kind)
+
+			write(gExprPunctuationTable.prefixes[static_cast<unsigned>(node.kind)]);
+		}
+
+		void between(const Expr& node, std::size_t)
+		{
+			write(gExprPunctuationTable.infixes[static_cast<unsigned>(node.kind)]);
+		}
+
+		void leave(const Expr& node)
+		{
+			write(gExprPunctuationTable.suffixes[static_cast<unsigned>(node.kind)]);
+		}
+
+		void write(const ExprPunctuationPart& part)
+		{
+			// most punctuation is empty, and writing nothing to a stream still isn't free
+			if (part.size != 0)
+				os.write(part.str, part.size);
+		}
+
+		std::ostream& os;
+	};
+
+	walk_expr(expr, Printer { os });
+
+	return os;
+}
+
+std::ostream& operator << (std::ostream& os, const Stmt& stmt)
+{
+	switch (stmt.kind)
+	{
+
+	case Stmt::Kind::Invalid:
+		return os << "<invalid statement>" << std::endl;
+
+	case Stmt::Kind::Push:
+		return os << "push " << *stmt.children[0] << ";";
+
+	case Stmt::Kind::Expr:
+		return os << *stmt.children[0] << ";";
+
+	case Stmt::Kind::Return:
+		return os << "return " << *stmt.children[0] << ";";
+
+	case Stmt::Kind::Goto:
+		return os << "goto " << *stmt.children[0] << ";";
+
+	case Stmt::Kind::GotoIf:
+		return os << "goto " << *stmt.children[0] << " if " << *stmt.children[1] << ";";
+
+	case Stmt::Kind::Yield:
+		return os << "yield;";
+
+	} // switch (stmt.kind)
+}
+
+SlicedScene slice_scene(const SceneInfo& scene)
+{
+	SlicedScene result;
+
+	result.slices = slice_script(scene.rawScript);
+
+	for (auto& slice : result.slices)
+	{
+		for (auto& ins : slice.second)
+		{
+			if (ins.is_jump() && !ins.is_jump_keep())
+				result.labels.set(ins.operand, [&] () { std::string r("label_"); r.append(std::to_string(ins.operand)); return r; } ());
+		}
+	}
+
+	return result;
+}
+
+void make_scene_statements(const CmbInfo& cmb, const SceneInfo& scene, const SlicedScene& sliced,
+	std::vector<std::vector<Stmt>>& statements, WorkBudget* budget)
+{
+	statements.reserve(sliced.slices.size());
+
+	for (auto& slice : sliced.slices)
+	{
+		if (slice.second.empty())
+		{
+			statements.emplace_back();
+			continue;
+		}
+
+		// TODO: check whether any bkn/bky jumps to another slice, because that would be bad
+		const auto fixedSlice = get_bks_as_fake_logic(slice.second, budget);
+
+		statements.push_back(make_statements(cmb, scene, fixedSlice, budget));
+	}
+}
+
+void print_scene_statements(std::ostream& os, const SceneInfo& scene, const SlicedScene& sliced,
+	const std::vector<std::vector<Stmt>>& statements)
+{
+	os << "EVENT " << scene.name << "(";
+
+	for (unsigned i = 0; i < scene.argCnt; ++i)
+	{
+		if (i != 0)
+			os << ", ";
+
+		os << scene.varnames[i];
+	}
+
+	os << ")";
+
+	if (scene.isGlobal)
+		os << " global";
+
+	os << std::endl;
+	os << "{" << std::endl;
+
+	for (unsigned i = 0; i < sliced.slices.size(); ++i)
+	{
+		auto& slice = sliced.slices[i];
+
+		if (slice.second.empty())
+			continue;
+
+		if (slice.first != 0)
+			os << std::endl;
+
+		sliced.labels.for_at(slice.first, [&] (auto& name)
+		{
+			os << name << ":" << std::endl;
+		});
+
+		// statements of the slice failed to build, the caller reports it
+		if (i >= statements.size())
+			return;
+
+		for (auto& stmt : statements[i])
+			os << "  " << stmt << std::endl;
+	}
+
+	os << "}" << std::endl << std::endl;
+}
+
+void print_scene(std::ostream& os, const CmbInfo& cmb, const SceneInfo& scene, WorkBudget* budget, DecompileStats* stats)
+{
+	const auto counters = stats != nullptr ? stats->counters : nullptr;
+
+	PerfSample unused;
+	const auto phase = [&] (unsigned which) -> PerfSample& { return stats != nullptr ? stats->phases[which] : unused; };
+
+	SlicedScene sliced;
+	std::vector<std::vector<Stmt>> statements;
+	std::exception_ptr error;
+
+	{
+		PerfScope scope(counters, phase(DecompileStats::PHASE_SLICE));
+		sliced = slice_scene(scene);
+	}
+
+	{
+		PerfScope scope(counters, phase(DecompileStats::PHASE_STATEMENTS));
+
+		try
+		{
+			make_scene_statements(cmb, scene, sliced, statements, budget);
+		}
+		catch (...)
+		{
+			// what was built still gets printed
+			error = std::current_exception();
+		}
+	}
+
+	{
+		PerfScope scope(counters, phase(DecompileStats::PHASE_PRINT));
+		print_scene_statements(os, scene, sliced, statements);
+	}
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void DecompileStats::write(std::ostream& os) const
+{
+	static const char* const names[PHASE_COUNT] = { "decode", "slice", "statements", "print" };
+
+	if (counters != nullptr)
+		write_perf_table(os, *counters, names, phases, PHASE_COUNT);
+}
+
+} // namespace soren
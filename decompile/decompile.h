@@ -0,0 +1,132 @@
+#ifndef SOREN_DECOMPILE_INCLUDED
+#define SOREN_DECOMPILE_INCLUDED
+
+#include <ostream>
+#include <set>
+#include <vector>
+
+#include "core/types.h"
+#include "core/offset-map.h"
+#include "core/budget.h"
+#include "core/perf-counters.h"
+#include "core/soren-cmb.h"
+
+#include "ast/expr.h"
+#include "ast/stmt.h"
+
+namespace soren {
+
+// Decompilation stages: scripts are sliced into straight-line pieces, bky/bkn chains in each slice are turned into
+// fake logical instructions, and statements are built from each slice.
+// Functions taking a budget charge their work to it if it isn't null (see core/budget.h).
+
+template<bool IgnoreBranchAndKeeps = true>
+OffsetMap<Span<const BcIns>> slice_script(Span<const BcIns> script)
+{
+	OffsetMap<Span<const BcIns>> result;
+	std::set<std::size_t> slicePoints;
+
+	// Step 1: Find slice points
+
+	for (auto& ins : script)
+	{
+		if (IgnoreBranchAndKeeps && ins.is_jump_keep())
+			continue;
+
+		if (ins.is_jump())
+		{
+			// jumps generate:
+			// a slice after themselves
+			// a slice before the jump target
+			// a label before the jump target
+
+			slicePoints.insert(ins.location + 1 + ins.info().operandSize);
+			slicePoints.insert(ins.operand);
+		}
+
+		if (ins.is_end())
+		{
+			// ends generate slices after themselves
+			slicePoints.insert(ins.location + 1);
+		}
+	}
+
+	// Step 2: Slice
+
+	auto scrIt   = script.begin();
+	auto sliceIt = slicePoints.begin();
+
+	while (scrIt != script.end())
+	{
+		auto itStart = scrIt;
+
+		if (sliceIt != slicePoints.end())
+		{
+			auto sliceOffset = *sliceIt++;
+
+			scrIt = std::find_if(itStart, script.end(), [sliceOffset] (auto& ins)
+			{
+				return ins.location >= sliceOffset;
+			});
+		}
+		else
+		{
+			scrIt = script.end();
+		}
+
+		result.set(itStart->location, { itStart, scrIt });
+	}
+
+	return result;
+}
+
+Span<BcIns> convert_bks_to_fake_logic(Span<BcIns> slice, WorkBudget* budget = nullptr);
+std::vector<BcIns> get_bks_as_fake_logic(Span<const BcIns> slice, WorkBudget* budget = nullptr);
+
+std::vector<Stmt> make_statements(const CmbInfo& script, const SceneInfo& scene, Span<const BcIns> slice, WorkBudget* budget = nullptr);
+
+std::ostream& operator << (std::ostream& os, const Expr& expr);
+std::ostream& operator << (std::ostream& os, const Stmt& stmt);
+
+// the stages of print_scene, for callers that look at each of them (see --stats)
+
+struct SlicedScene
+{
+	OffsetMap<Span<const BcIns>> slices;
+	NameMap labels; //< at jump targets
+};
+
+SlicedScene slice_scene(const SceneInfo& scene);
+
+// statements of each slice, in order
+// if building the statements of a slice throws, statements has those of the slices before it
+void make_scene_statements(const CmbInfo& cmb, const SceneInfo& scene, const SlicedScene& sliced,
+	std::vector<std::vector<Stmt>>& statements, WorkBudget* budget = nullptr);
+
+// prints the scene as far as there are statements (the closing brace only if there are statements for every slice)
+void print_scene_statements(std::ostream& os, const SceneInfo& scene, const SlicedScene& sliced,
+	const std::vector<std::vector<Stmt>>& statements);
+
+// counts for each stage of decompiling (see core/perf-counters.h), decoding being done (and counted) by the caller
+struct DecompileStats
+{
+	enum { PHASE_DECODE, PHASE_SLICE, PHASE_STATEMENTS, PHASE_PRINT, PHASE_COUNT };
+
+	explicit DecompileStats(const PerfCounters* counters)
+		: counters(counters) {}
+
+	void write(std::ostream& os) const;
+
+	const PerfCounters* counters;
+	PerfSample phases[PHASE_COUNT];
+};
+
+void print_scene(std::ostream& os, const CmbInfo& cmb, const SceneInfo& scene, WorkBudget* budget = nullptr, DecompileStats* stats = nullptr);
+
+// rough heap use per instruction turned into statements (the expression with its allocation, and a share of statements),
+// charged to the byte budget while decompiling
+constexpr std::uint64_t DECOMPILE_BYTES_PER_NODE = sizeof(Expr) + sizeof(Stmt) / 2 + 4 * sizeof(void*);
+
+} // namespace soren
+
+#endif // SOREN_DECOMPILE_INCLUDED
@@ -0,0 +1,87 @@
+
+// soren-delta: makes and applies deltas between original and modified files (see patch/delta.h)
+//
+//     soren-delta make <original> <modified> <out.delta>
+//     soren-delta apply <original> <file.delta> <out>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "core/types.h"
+
+#include "patch/delta.h"
+
+namespace soren {
+
+namespace {
+
+std::vector<byte_type> read_file(const std::string& path)
+{
+	std::ifstream in(path, std::ios::binary);
+
+	if (!in.is_open())
+		throw std::runtime_error("couldn't open file"); // TODO: better error
+
+	return std::vector<byte_type>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void write_file(const std::vector<byte_type>& data, const std::string& path)
+{
+	std::ofstream out(path, std::ios::binary);
+	out.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+	if (!out)
+		throw std::runtime_error("couldn't write file"); // TODO: better error
+}
+
+} // namespace
+
+} // namespace soren
+
+int main(int argc, char** argv)
+{
+	const std::string mode = argc > 1 ? argv[1] : "";
+
+	if (argc != 5 || (mode != "make" && mode != "apply"))
+	{
+		std::cerr << "usage: " << argv[0] << " make <original> <modified> <out.delta>" << std::endl;
+		std::cerr << "       " << argv[0] << " apply <original> <file.delta> <out>" << std::endl;
+		return 1;
+	}
+
+	// errors are reported for the file being worked on (the input while making or applying the delta)
+	const char* file = argv[2];
+
+	try
+	{
+		const auto source = soren::read_file(file);
+
+		file = argv[3];
+		const auto input = soren::read_file(file);
+
+		const auto start = std::chrono::steady_clock::now();
+
+		const auto result = (mode == "make")
+			? soren::make_delta(source, input)
+			: soren::apply_delta(source, input);
+
+		const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+		file = argv[4];
+		soren::write_file(result, file);
+
+		std::cerr << "wrote " << result.size() << " bytes to " << argv[4] << " (" << elapsed.count() << " ms)" << std::endl;
+
+		return 0;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << file << ": " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -0,0 +1,48 @@
+#ifndef SOREN_ENCODE_INCLUDED
+#define SOREN_ENCODE_INCLUDED
+
+#include <cstdint>
+#include <vector>
+
+#include "core/types.h"
+#include "core/soren-cmb.h"
+
+namespace soren {
+
+// little endian integers of cmb headers and scene informations (see read_int_le in decode/layout.h)
+
+static inline
+void encode_int_le(std::vector<byte_type>& out, std::uint32_t value, unsigned size)
+{
+	for (unsigned i = 0; i < size; ++i)
+		out.push_back((value >> (8*i)) & 0xFF);
+}
+
+static inline
+void store_int_le(std::vector<byte_type>& out, std::size_t offset, std::uint32_t value, unsigned size)
+{
+	for (unsigned i = 0; i < size; ++i)
+		out[offset + i] = (value >> (8*i)) & 0xFF;
+}
+
+// changes the opcode of instructions with different operand sizes (val8/val16, number8/16/32, ...)
+// to the smallest one that fits the operand
+void fit_operand_size(BcIns& ins);
+
+// size of the encoded instruction in bytes (including the opcode)
+unsigned encoded_size(const BcIns& ins, GameKind game);
+
+// recomputes instruction locations from encoded sizes
+// jump operands are expected to be instruction indices (see opt/optimize.h), and are kept as such
+void layout_script(Span<BcIns> script, GameKind game);
+
+// encodes a script as decoded by decode_cmb (jump operands being locations)
+std::vector<byte_type> encode_script(Span<const BcIns> script, GameKind game);
+
+// encodes a whole cmb file, that decode_cmb can read back
+// names of global scenes are expected to be in the string pool
+std::vector<byte_type> encode_cmb(const CmbInfo& cmb, GameKind game);
+
+} // namespace soren
+
+#endif // SOREN_ENCODE_INCLUDED
@@ -0,0 +1,368 @@
+
+#include "encode/synthetic.h"
+
+#include "core/soren-bytecode.h"
+
+#include "opt/optimize.h"
+
+#include <random>
+#include <string>
+
+namespace soren {
+
+namespace {
+
+struct SyntheticGenerator
+{
+	SyntheticGenerator(std::uint32_t seed, GameKind game, const SyntheticShape& shape)
+		: rng(seed), game(game), shape(shape) {}
+
+	unsigned pick(unsigned bound) { return rng() % bound; }
+	bool chance(unsigned percent) { return pick(100) < percent; }
+
+	CmbInfo make_cmb()
+	{
+		CmbInfo result;
+
+		result.globalNames.resize(pick(4));
+
+		for (unsigned i = 0; i < result.globalNames.size(); ++i)
+			result.globalNames[i] = "gvar_" + std::to_string(i);
+
+		// a few strings, for string pushes and external calls
+
+		const char* const strings[] = { "PID_IKE", "IID_IRONSWORD", "UnitGetByPID", "UnitAddItem", "MessageShow", "%d" };
+
+		for (auto string : strings)
+		{
+			stringOffsets.push_back(result.stringPool.size());
+			result.stringPool.insert(result.stringPool.end(), string, string + std::char_traits<char>::length(string) + 1);
+		}
+
+		const unsigned sceneAmt = 1 + pick(shape.maxScenes);
+
+		for (unsigned i = 0; i < sceneAmt; ++i)
+		{
+			result.scenes.emplace_back();
+			auto& scene = result.scenes.back();
+
+			scene.idx = i;
+			scene.argCnt = pick(3);
+			scene.varnames.resize(scene.argCnt + pick(4));
+
+			for (unsigned v = 0; v < scene.varnames.size(); ++v)
+				scene.varnames[v] = (v < scene.argCnt ? "arg_" : "var_") + std::to_string(v);
+
+			// named scenes refer to the pool, so these stay unnamed
+			scene.name = "Unknown_" + std::to_string(i);
+
+			const unsigned kinds[] = { CMB_SCENE_KIND_FUNCTION, CMB_SCENE_KIND_TURN3, CMB_SCENE_KIND_AREA_UNS, CMB_SCENE_KIND_TURN6 };
+			scene.kind = kinds[pick(4)];
+
+			for (unsigned p = pick(5); p > 0; --p)
+				scene.parameters.push_back(pick(0x20));
+		}
+
+		for (auto& scene : result.scenes)
+			scene.rawScript = make_script(result, scene);
+
+		return result;
+	}
+
+	std::vector<BcIns> make_script(const CmbInfo& cmb, const SceneInfo& scene)
+	{
+		this->cmb = &cmb;
+		this->scene = &scene;
+
+		code.clear();
+
+		for (unsigned i = 1 + pick(shape.maxStatements); i > 0; --i)
+			emit_stmt(shape.depth);
+
+		// always terminated, as jumps may go right after the last statement
+		if (game == GameKind::FE10)
+		{
+			emit(BC_OPCODE_RETN);
+		}
+		else
+		{
+			emit(BC_OPCODE_NUMBER8, 0);
+			emit(BC_OPCODE_RETURN);
+		}
+
+		return unindex_jumps(std::move(code), game);
+	}
+
+	// pushes one value
+	void emit_expr(unsigned depth)
+	{
+		if (depth == 0 || chance(30))
+		{
+			emit_leaf();
+			return;
+		}
+
+		switch (pick(5))
+		{
+
+		case 0:
+			// unops
+			emit_expr(depth - 1);
+			emit(BC_OPCODE_NEG + pick(3));
+
+			break;
+
+		case 1:
+		{
+			// logic: a bkn/bky over the right operand
+			emit_expr(depth - 1);
+
+			const auto bk = emit(chance(50) ? BC_OPCODE_BKN : BC_OPCODE_BKY);
+			emit_expr(depth - 1);
+
+			code[bk].operand = code.size();
+
+			break;
+		}
+
+		case 2:
+		{
+			// calls
+			if (!cmb->scenes.empty() && chance(50))
+			{
+				const unsigned callee = pick(cmb->scenes.size());
+
+				for (unsigned i = 0; i < cmb->scenes[callee].argCnt; ++i)
+					emit_expr(depth - 1);
+
+				emit(BC_OPCODE_CALL, callee);
+			}
+			else
+			{
+				const unsigned argCnt = pick(3);
+
+				for (unsigned i = 0; i < argCnt; ++i)
+					emit_expr(depth - 1);
+
+				emit(BC_OPCODE_CALLEXT, (stringOffsets[pick(stringOffsets.size())] << 8) | argCnt);
+			}
+
+			break;
+		}
+
+		default:
+		{
+			// binops (add to nestr, without neg/mvn/not)
+			static const std::uint8_t binops[] = {
+				BC_OPCODE_ADD, BC_OPCODE_SUB, BC_OPCODE_MUL, BC_OPCODE_DIV, BC_OPCODE_MOD,
+				BC_OPCODE_ORR, BC_OPCODE_AND, BC_OPCODE_XOR, BC_OPCODE_LSL, BC_OPCODE_LSR,
+				BC_OPCODE_EQ, BC_OPCODE_NE, BC_OPCODE_LT, BC_OPCODE_LE, BC_OPCODE_GT, BC_OPCODE_GE,
+				BC_OPCODE_EQSTR, BC_OPCODE_NESTR,
+			};
+
+			emit_expr(depth - 1);
+			emit_expr(depth - 1);
+			emit(binops[pick(sizeof(binops))]);
+
+			break;
+		}
+
+		} // switch
+	}
+
+	void emit_leaf()
+	{
+		const unsigned varAmt = scene->varnames.size();
+		const unsigned globalAmt = cmb->globalNames.size();
+
+		switch (pick(4))
+		{
+
+		case 0:
+			if (varAmt != 0)
+			{
+				emit(BC_OPCODE_VAL8, pick(varAmt));
+				break;
+			}
+
+			// fallthrough
+
+		case 1:
+			if (globalAmt != 0)
+			{
+				emit(BC_OPCODE_GVAL8, pick(globalAmt));
+				break;
+			}
+
+			// fallthrough
+
+		case 2:
+		{
+			const std::int32_t numbers[] = { 0, 1, -1, 0x7F, 0x100, -0x8000, 0x12345678 };
+			emit(BC_OPCODE_NUMBER8, numbers[pick(7)]);
+
+			break;
+		}
+
+		default:
+			emit(BC_OPCODE_STRING8, stringOffsets[pick(stringOffsets.size())]);
+			break;
+
+		} // switch
+	}
+
+	void emit_stmt(unsigned depth)
+	{
+		const unsigned varAmt = scene->varnames.size();
+		const bool fe10 = game == GameKind::FE10;
+
+		switch (depth == 0 ? pick(3) : pick(7))
+		{
+
+		case 0:
+			// expression statement
+			emit_expr(2);
+			emit(BC_OPCODE_DISC);
+
+			break;
+
+		case 1:
+			// assignment
+			if (varAmt != 0)
+			{
+				emit(BC_OPCODE_REF8, pick(varAmt));
+			}
+			else if (!cmb->globalNames.empty())
+			{
+				emit(BC_OPCODE_GREF8, 0);
+			}
+			else
+			{
+				emit(BC_OPCODE_YIELD);
+				break;
+			}
+
+			emit_expr(2);
+
+			if (fe10 && chance(50))
+			{
+				emit(BC_OPCODE_ASSIGN);
+			}
+			else
+			{
+				emit(BC_OPCODE_STORE);
+				emit(BC_OPCODE_DISC);
+			}
+
+			break;
+
+		case 2:
+			emit(BC_OPCODE_YIELD);
+			break;
+
+		case 3:
+		{
+			// printf
+			const unsigned argCnt = 1 + pick(3);
+
+			for (unsigned i = 0; i < argCnt; ++i)
+				emit_expr(1);
+
+			emit(BC_OPCODE_PRINTF, argCnt);
+
+			break;
+		}
+
+		case 4:
+		{
+			// if/else
+			emit_expr(2);
+			const auto toElse = emit(chance(50) ? BC_OPCODE_BN : BC_OPCODE_BY);
+
+			emit_block(depth - 1);
+
+			if (chance(50))
+			{
+				const auto toEnd = emit(BC_OPCODE_B);
+
+				code[toElse].operand = code.size();
+				emit_block(depth - 1);
+
+				code[toEnd].operand = code.size();
+			}
+			else
+			{
+				code[toElse].operand = code.size();
+			}
+
+			break;
+		}
+
+		case 5:
+		{
+			// while loop
+			const std::int32_t top = code.size();
+
+			emit_expr(2);
+			const auto toEnd = emit(BC_OPCODE_BN);
+
+			emit_block(depth - 1);
+			emit(BC_OPCODE_B, top);
+
+			code[toEnd].operand = code.size();
+
+			break;
+		}
+
+		default:
+			// return, only in blocks: the decoder takes a return that no jump goes past as the end of the script
+			if (nesting == 0)
+			{
+				emit(BC_OPCODE_YIELD);
+				break;
+			}
+
+			emit_expr(2);
+			emit(BC_OPCODE_RETURN);
+
+			break;
+
+		} // switch
+	}
+
+	void emit_block(unsigned depth)
+	{
+		nesting++;
+
+		for (unsigned i = 1 + pick(3); i > 0; --i)
+			emit_stmt(depth);
+
+		nesting--;
+	}
+
+	std::size_t emit(unsigned opcode, std::int32_t operand = 0)
+	{
+		code.push_back(make_ins(opcode, operand));
+		return code.size() - 1;
+	}
+
+	std::mt19937 rng;
+	GameKind game;
+	SyntheticShape shape;
+
+	std::vector<unsigned> stringOffsets;
+
+	const CmbInfo* cmb { nullptr };
+	const SceneInfo* scene { nullptr };
+	std::vector<BcIns> code;
+	unsigned nesting { 0u };
+};
+
+} // namespace
+
+CmbInfo make_synthetic_cmb(std::uint32_t seed, GameKind game, const SyntheticShape& shape)
+{
+	return SyntheticGenerator(seed, game, shape).make_cmb();
+}
+
+} // namespace soren
@@ -0,0 +1,24 @@
+#ifndef SOREN_SYNTHETIC_INCLUDED
+#define SOREN_SYNTHETIC_INCLUDED
+
+#include <cstdint>
+
+#include "core/soren-cmb.h"
+
+namespace soren {
+
+struct SyntheticShape
+{
+	unsigned maxScenes { 4u }; //< scenes are 1 to maxScenes
+	unsigned maxStatements { 6u }; //< top level statements of a scene are 1 to maxStatements
+	unsigned depth { 3u }; //< nesting of blocks (if/else, loops)
+};
+
+// generates a random but well formed cmb, deterministic for a given seed
+// scripts cover what the decompiler handles: expressions of every kind, logic chains, branches, loops, calls and strings
+// (used for fuzzing seeds and benchmark corpora)
+CmbInfo make_synthetic_cmb(std::uint32_t seed, GameKind game, const SyntheticShape& shape = SyntheticShape {});
+
+} // namespace soren
+
+#endif // SOREN_SYNTHETIC_INCLUDED
@@ -0,0 +1,234 @@
+
+#include "encode/encode.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace soren {
+
+static inline
+bool fits_signed(std::int32_t value, unsigned bytes)
+{
+	if (bytes >= 4)
+		return true;
+
+	const std::int32_t limit = 1 << (8*bytes - 1);
+	return value >= -limit && value < limit;
+}
+
+static inline
+void align(std::vector<byte_type>& out, unsigned alignment)
+{
+	while (out.size() % alignment != 0)
+		out.push_back(0);
+}
+
+void fit_operand_size(BcIns& ins)
+{
+	// families of opcodes that only differ by operand size, smallest first
+
+	switch (ins.opcode)
+	{
+
+	case BC_OPCODE_VAL8:   case BC_OPCODE_VAL16:
+	case BC_OPCODE_VALX8:  case BC_OPCODE_VALX16:
+	case BC_OPCODE_VALY8:  case BC_OPCODE_VALY16:
+	case BC_OPCODE_REF8:   case BC_OPCODE_REF16:
+	case BC_OPCODE_REFX8:  case BC_OPCODE_REFX16:
+	case BC_OPCODE_REFY8:  case BC_OPCODE_REFY16:
+	case BC_OPCODE_GVAL8:  case BC_OPCODE_GVAL16:
+	case BC_OPCODE_GVALX8: case BC_OPCODE_GVALX16:
+	case BC_OPCODE_GVALY8: case BC_OPCODE_GVALY16:
+	case BC_OPCODE_GREF8:  case BC_OPCODE_GREF16:
+	case BC_OPCODE_GREFX8: case BC_OPCODE_GREFX16:
+	case BC_OPCODE_GREFY8: case BC_OPCODE_GREFY16:
+	{
+		// 8-bit variants are odd, 16-bit ones are the following opcode
+		const std::uint8_t base = ins.opcode - ((ins.opcode - BC_OPCODE_VAL8) & 1);
+		ins.opcode = fits_signed(ins.operand, 1) ? base : base + 1;
+
+		break;
+	}
+
+	case BC_OPCODE_NUMBER8:
+	case BC_OPCODE_NUMBER16:
+	case BC_OPCODE_NUMBER32:
+		ins.opcode = fits_signed(ins.operand, 1) ? BC_OPCODE_NUMBER8
+			: fits_signed(ins.operand, 2) ? BC_OPCODE_NUMBER16
+			: BC_OPCODE_NUMBER32;
+
+		break;
+
+	case BC_OPCODE_STRING8:
+	case BC_OPCODE_STRING16:
+	case BC_OPCODE_STRING32:
+		ins.opcode = fits_signed(ins.operand, 1) ? BC_OPCODE_STRING8
+			: fits_signed(ins.operand, 2) ? BC_OPCODE_STRING16
+			: BC_OPCODE_STRING32;
+
+		break;
+
+	} // switch (ins.opcode)
+}
+
+unsigned encoded_size(const BcIns& ins, GameKind game)
+{
+	if ((game == GameKind::FE10) && (ins.opcode == BC_OPCODE_CALL) && (ins.operand >= 0x80))
+		return 3; // see decode_script
+
+	return 1 + ins.info().operandSize;
+}
+
+void layout_script(Span<BcIns> script, GameKind game)
+{
+	unsigned location = 0;
+
+	for (auto& ins : script)
+	{
+		ins.location = location;
+		location += encoded_size(ins, game);
+	}
+}
+
+std::vector<byte_type> encode_script(Span<const BcIns> script, GameKind game)
+{
+	std::vector<byte_type> result;
+
+	for (auto& ins : script)
+	{
+		if (!ins.valid(game))
+			throw std::runtime_error("Can't encode instruction not valid for this game."); // TODO: better error
+
+		if (ins.location != result.size())
+			throw std::runtime_error("Can't encode script with inconsistent instruction locations."); // TODO: better error
+
+		result.push_back(ins.opcode);
+
+		const unsigned operandSize = ins.info().operandSize;
+		std::int32_t operand = ins.operand;
+
+		if (ins.is_jump())
+		{
+			// jumps are relative to the end of the opcode (see decode_script)
+			operand = operand - ins.location - 1;
+
+			if (!fits_signed(operand, operandSize))
+				throw std::runtime_error("Jump is too far to be encoded."); // TODO: better error
+		}
+
+		if ((game == GameKind::FE10) && (ins.opcode == BC_OPCODE_CALL) && (operand >= 0x80))
+		{
+			if (operand > 0x7FFF)
+				throw std::runtime_error("Call operand is too large to be encoded."); // TODO: better error
+
+			result.push_back(0x80 | (operand >> 8));
+			result.push_back(operand & 0xFF);
+
+			continue;
+		}
+
+		if (operandSize > 0 && !fits_signed(operand, operandSize) && !(ins.opcode == BC_OPCODE_CALL || ins.opcode == BC_OPCODE_CALLEXT))
+			throw std::runtime_error("Operand doesn't fit in instruction."); // TODO: better error
+
+		// big endian
+		for (unsigned i = operandSize; i > 0; --i)
+			result.push_back((static_cast<std::uint32_t>(operand) >> (8*(i-1))) & 0xFF);
+	}
+
+	return result;
+}
+
+std::vector<byte_type> encode_cmb(const CmbInfo& cmb, GameKind game)
+{
+	// layout: header, then each scene information followed by its script, then the string pool, then the event offset array
+	// (see decode_cmb for what is where)
+
+	std::vector<byte_type> result(cmb.header.begin(), cmb.header.end());
+	result.resize(0x2C, 0);
+
+	if (cmb.globalNames.size() > GLOBAL_AMT_SUSPICION_LIMIT)
+		throw std::runtime_error("Too many global variables to be encoded."); // TODO: better error
+
+	std::vector<std::uint32_t> offEventList;
+	std::vector<std::size_t> offNameFields;
+
+	for (unsigned i = 0; i < cmb.scenes.size(); ++i)
+	{
+		auto& scene = cmb.scenes[i];
+
+		if (scene.idx != i)
+			throw std::runtime_error("Can't encode scene whose index doesn't match its position."); // TODO: better error
+
+		if (scene.parameters.size() > PARAMS_AMT_SUSPICION_LIMIT || scene.varnames.size() > LOCALS_AMT_SUSPICION_LIMIT)
+			throw std::runtime_error("Too many parameters or locals in scene to be encoded."); // TODO: better error
+
+		align(result, 4);
+
+		const std::size_t offEvent = result.size();
+		offEventList.push_back(offEvent);
+		offNameFields.push_back(offEvent);
+
+		encode_int_le(result, 0, 4); // name, set once we know where the string pool is
+		encode_int_le(result, 0, 4); // script, set below
+		encode_int_le(result, scene.unknown08, 4);
+		encode_int_le(result, scene.kind, 1);
+		encode_int_le(result, scene.argCnt, 1);
+		encode_int_le(result, scene.parameters.size(), 1);
+		encode_int_le(result, scene.unknown0F, 1);
+		encode_int_le(result, scene.idx, 2);
+		encode_int_le(result, std::max<unsigned>(scene.varnames.size(), scene.argCnt), 2);
+
+		for (auto param : scene.parameters)
+			encode_int_le(result, param, 2);
+
+		store_int_le(result, offEvent + 0x04, result.size(), 4);
+
+		const auto script = encode_script(scene.rawScript, game);
+		result.insert(result.end(), script.begin(), script.end());
+	}
+
+	// string pool
+
+	const std::size_t offStrings = result.size();
+	result.insert(result.end(), cmb.stringPool.begin(), cmb.stringPool.end());
+
+	for (unsigned i = 0; i < cmb.scenes.size(); ++i)
+	{
+		auto& scene = cmb.scenes[i];
+
+		if (!scene.isGlobal)
+			continue;
+
+		// first occurrence of the name (with its terminator) in the pool
+
+		const std::string name = scene.name;
+		const auto end = cmb.stringPool.end();
+
+		auto it = std::search(cmb.stringPool.begin(), end, name.c_str(), name.c_str() + name.size() + 1);
+
+		if (it == end)
+			throw std::runtime_error("Name of global scene isn't in the string pool."); // TODO: better error
+
+		store_int_le(result, offNameFields[i], offStrings + (it - cmb.stringPool.begin()), 4);
+	}
+
+	// event offset array, zero terminated
+
+	align(result, 4);
+
+	const std::size_t offEvents = result.size();
+
+	for (auto offEvent : offEventList)
+		encode_int_le(result, offEvent, 4);
+
+	encode_int_le(result, 0, 4);
+
+	store_int_le(result, 0x22, cmb.globalNames.size(), 2);
+	store_int_le(result, 0x24, offStrings, 4);
+	store_int_le(result, 0x28, offEvents, 4);
+
+	return result;
+}
+
+} // namespace soren
@@ -0,0 +1,306 @@
+
+// Standalone driver for the fuzz targets, for compilers without libFuzzer
+// Replays the given inputs, then (with -runs) runs random mutations of them. This isn't coverage guided,
+// but it catches the same crashes and slow units on what it does run, and keeps track of throughput
+
+#include "fuzz/fuzz.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct DriverOptions
+{
+	std::uint64_t runs { 0u };
+	std::uint32_t seed { 0u };
+	std::size_t maxLength { 4096u };
+
+	double timeout { 10.0 }; //< seconds before a unit is considered hung (0 for none)
+	double slow { 1.0 }; //< seconds after which a unit is reported as slow (0 for none)
+	double reportInterval { 5.0 }; //< seconds between throughput reports
+};
+
+// the unit being run, for the crash handler and the watchdog
+// the watchdog takes gCurrentUnitMutex to read it (the crash handler can't, and doesn't come back)
+std::vector<std::uint8_t> gCurrentUnit;
+std::mutex gCurrentUnitMutex;
+std::atomic<std::int64_t> gUnitStart { -1 }; //< in steady clock ticks, -1 when not running
+
+void write_unit(const char* path, const std::vector<std::uint8_t>& unit)
+{
+	if (auto file = std::fopen(path, "wb"))
+	{
+		std::fwrite(unit.data(), 1, unit.size(), file);
+		std::fclose(file);
+	}
+}
+
+extern "C" void on_crash(int sig)
+{
+	// not quite signal safe, but we're going down anyway
+	write_unit("crash-unit", gCurrentUnit);
+	std::fputs("==soren-fuzz== crash, unit written to crash-unit\n", stderr);
+
+	std::signal(sig, SIG_DFL);
+	std::raise(sig);
+}
+
+bool read_unit(const char* path, std::vector<std::uint8_t>& unit)
+{
+	std::ifstream in(path, std::ios::binary);
+
+	if (!in)
+		return false;
+
+	unit.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+	return true;
+}
+
+double seconds_since(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void mutate(std::vector<std::uint8_t>& unit, std::mt19937& rng, std::size_t maxLength)
+{
+	// values that offsets and counts in cmb files like to be
+	static const std::uint32_t INTERESTING[] = { 0u, 1u, 0x7Fu, 0x80u, 0xFFu, 0x7FFFu, 0xFFFFu, 0x7FFFFFFFu, 0xFFFFFFFFu };
+
+	const auto pick = [&] (std::size_t bound) { return static_cast<std::size_t>(rng() % bound); };
+
+	for (unsigned count = 1 + pick(4); count > 0; --count)
+	{
+		switch (unit.empty() ? 2 : pick(6))
+		{
+
+		case 0: // flip a bit
+			unit[pick(unit.size())] ^= 1u << pick(8);
+			break;
+
+		case 1: // random byte
+			unit[pick(unit.size())] = rng();
+			break;
+
+		case 2: // insert a byte
+			if (unit.size() < maxLength)
+				unit.insert(unit.begin() + pick(unit.size() + 1), static_cast<std::uint8_t>(rng()));
+
+			break;
+
+		case 3: // erase some bytes
+		{
+			const auto at = pick(unit.size());
+			const auto amount = std::min<std::size_t>(1 + pick(8), unit.size() - at);
+
+			unit.erase(unit.begin() + at, unit.begin() + at + amount);
+
+			break;
+		}
+
+		case 4: // copy a chunk over another place
+		{
+			const auto from = pick(unit.size()), to = pick(unit.size());
+			const auto amount = std::min<std::size_t>({ 1 + pick(16), unit.size() - from, unit.size() - to });
+
+			std::copy(unit.begin() + from, unit.begin() + from + amount, unit.begin() + to);
+
+			break;
+		}
+
+		case 5: // interesting value, little endian
+		{
+			auto value = INTERESTING[pick(sizeof(INTERESTING) / sizeof(INTERESTING[0]))];
+
+			// as a u8, u16 or u32, whichever it fits in at least (zero included)
+			const std::size_t needed = value > 0xFFFFu ? 4 : value > 0xFFu ? 2 : 1;
+			const std::size_t width = std::max<std::size_t>(needed, std::size_t(1) << pick(3));
+
+			for (std::size_t at = pick(unit.size()), i = 0; at < unit.size() && i < width; ++at, ++i, value >>= 8)
+				unit[at] = value & 0xFF;
+
+			break;
+		}
+
+		} // switch
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	DriverOptions options;
+	std::vector<std::string> paths;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string arg(argv[i]);
+
+		const auto value = [&] (const char* name, std::string& out)
+		{
+			const std::string prefix(name);
+
+			if (arg.compare(0, prefix.size(), prefix) != 0)
+				return false;
+
+			out = arg.substr(prefix.size());
+			return true;
+		};
+
+		std::string v;
+
+		if (value("-runs=", v))
+			options.runs = std::stoull(v);
+		else if (value("-seed=", v))
+			options.seed = std::stoul(v);
+		else if (value("-max_len=", v))
+			options.maxLength = std::stoul(v);
+		else if (value("-timeout=", v))
+			options.timeout = std::stod(v);
+		else if (value("-report_slow_units=", v))
+			options.slow = std::stod(v);
+		else if (!arg.empty() && arg[0] == '-')
+			std::cerr << "ignoring unknown option " << arg << std::endl;
+		else
+			paths.push_back(arg);
+	}
+
+	if (paths.empty())
+	{
+		std::cerr << "usage: " << argv[0] << " [-runs=<n>] [-seed=<n>] [-max_len=<n>] [-timeout=<s>] [-report_slow_units=<s>] <unit>..." << std::endl;
+		return 1;
+	}
+
+	std::vector<std::vector<std::uint8_t>> corpus;
+
+	for (auto& path : paths)
+	{
+		corpus.emplace_back();
+
+		if (!read_unit(path.c_str(), corpus.back()))
+		{
+			std::cerr << "couldn't read " << path << std::endl;
+			return 1;
+		}
+	}
+
+	for (int sig : { SIGSEGV, SIGABRT, SIGILL, SIGFPE })
+		std::signal(sig, on_crash);
+
+	// the watchdog: a unit that doesn't return in time is as bad as a crash
+
+	std::atomic<bool> done { false };
+
+	std::thread watchdog([&] ()
+	{
+		while (!done)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+			const auto start = gUnitStart.load();
+
+			if (options.timeout <= 0.0 || start < 0)
+				continue;
+
+			if (seconds_since(Clock::time_point(Clock::duration(start))) > options.timeout)
+			{
+				{
+					std::lock_guard<std::mutex> lock(gCurrentUnitMutex);
+					write_unit("timeout-unit", gCurrentUnit);
+				}
+
+				std::cerr << "==soren-fuzz== timeout after " << options.timeout << "s, unit written to timeout-unit" << std::endl;
+				std::_Exit(1);
+			}
+		}
+	});
+
+	const auto begin = Clock::now();
+	auto lastReport = begin;
+
+	std::uint64_t execs = 0, bytes = 0, slowUnits = 0;
+	double slowest = 0.0;
+
+	const auto report = [&] (const char* what)
+	{
+		const auto elapsed = std::max(seconds_since(begin), 1e-9);
+
+		std::cerr << "#" << execs << " " << what
+			<< " exec/s: " << static_cast<std::uint64_t>(execs / elapsed)
+			<< " MB/s: " << bytes / elapsed / 1e6
+			<< " slowest: " << slowest << "s"
+			<< " slow units: " << slowUnits << std::endl;
+	};
+
+	const auto run = [&] (const std::vector<std::uint8_t>& unit)
+	{
+		{
+			std::lock_guard<std::mutex> lock(gCurrentUnitMutex);
+			gCurrentUnit = unit;
+		}
+
+		gUnitStart = Clock::now().time_since_epoch().count();
+
+		const auto start = Clock::now();
+		LLVMFuzzerTestOneInput(gCurrentUnit.data(), gCurrentUnit.size());
+		const auto elapsed = seconds_since(start);
+
+		gUnitStart = -1;
+
+		execs++;
+		bytes += unit.size();
+		slowest = std::max(slowest, elapsed);
+
+		if (options.slow > 0.0 && elapsed > options.slow)
+		{
+			const auto path = "slow-unit-" + std::to_string(slowUnits++);
+			write_unit(path.c_str(), unit);
+
+			std::cerr << "==soren-fuzz== slow unit: " << elapsed << "s, written to " << path << std::endl;
+		}
+
+		if (seconds_since(lastReport) > options.reportInterval)
+		{
+			lastReport = Clock::now();
+			report("pulse");
+		}
+	};
+
+	for (auto& unit : corpus)
+		run(unit);
+
+	report("replayed");
+
+	std::mt19937 rng(options.seed);
+
+	for (std::uint64_t i = 0; i < options.runs; ++i)
+	{
+		auto unit = corpus[rng() % corpus.size()];
+		mutate(unit, rng, options.maxLength);
+
+		run(unit);
+	}
+
+	if (options.runs > 0)
+		report("done");
+
+	done = true;
+	watchdog.join();
+
+	return slowUnits > 0 ? 1 : 0;
+}
@@ -0,0 +1,35 @@
+
+#include "fuzz/fuzz.h"
+
+#include "decode/decode.h"
+#include "decompile/decompile.h"
+
+using namespace soren;
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size)
+{
+	FuzzInput input;
+
+	if (!split_fuzz_input(data, size, input))
+		return 0;
+
+	auto budget = make_fuzz_budget(size);
+
+	try
+	{
+		const auto script = decode_script(input.payload, input.game, &budget);
+
+		// on slices (as the decompiler does) and on the whole script, where jump targets can be anywhere
+
+		for (auto& slice : slice_script(script))
+			get_bks_as_fake_logic(slice.second, &budget);
+
+		get_bks_as_fake_logic(script, &budget);
+	}
+	catch (const std::exception&)
+	{
+		// rejected
+	}
+
+	return 0;
+}
@@ -0,0 +1,27 @@
+
+#include "fuzz/fuzz.h"
+
+#include "decode/decode.h"
+
+using namespace soren;
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size)
+{
+	FuzzInput input;
+
+	if (!split_fuzz_input(data, size, input))
+		return 0;
+
+	auto budget = make_fuzz_budget(size);
+
+	try
+	{
+		decode_cmb(input.payload, input.game, &budget);
+	}
+	catch (const std::exception&)
+	{
+		// rejected
+	}
+
+	return 0;
+}
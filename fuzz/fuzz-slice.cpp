@@ -0,0 +1,44 @@
+
+#include "fuzz/fuzz.h"
+
+#include "decode/decode.h"
+#include "decompile/decompile.h"
+
+using namespace soren;
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size)
+{
+	FuzzInput input;
+
+	if (!split_fuzz_input(data, size, input))
+		return 0;
+
+	auto budget = make_fuzz_budget(size);
+
+	try
+	{
+		const auto script = decode_script(input.payload, input.game, &budget);
+
+		// both ways the decompiler slices, each slice having to be a non-empty part of the script
+
+		const auto check = [&] (const OffsetMap<Span<const BcIns>>& slices)
+		{
+			std::size_t total = 0;
+
+			for (auto& slice : slices)
+				total += slice.second.size();
+
+			if (total != script.size())
+				__builtin_trap();
+		};
+
+		check(slice_script<true>(script));
+		check(slice_script<false>(script));
+	}
+	catch (const std::exception&)
+	{
+		// rejected
+	}
+
+	return 0;
+}
@@ -0,0 +1,53 @@
+
+#include "fuzz/fuzz.h"
+
+#include <sstream>
+
+#include "decode/decode.h"
+#include "decompile/decompile.h"
+
+using namespace soren;
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size)
+{
+	FuzzInput input;
+
+	if (!split_fuzz_input(data, size, input))
+		return 0;
+
+	auto budget = make_fuzz_budget(size);
+
+	try
+	{
+		const auto cmb = decode_cmb(input.payload, input.game, &budget);
+
+		// statements are built and printed per scene, as the CLI does
+
+		for (auto& scene : cmb.scenes)
+		{
+			budget.begin_scene();
+
+			std::ostringstream os;
+
+			try
+			{
+				print_scene(os, cmb, scene, &budget);
+			}
+			catch (const BudgetExceeded& e)
+			{
+				if (e.wholeFile)
+					throw;
+			}
+			catch (const std::exception&)
+			{
+				// rejected scene
+			}
+		}
+	}
+	catch (const std::exception&)
+	{
+		// rejected
+	}
+
+	return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef SOREN_FUZZ_INCLUDED
+#define SOREN_FUZZ_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+#include "core/types.h"
+#include "core/budget.h"
+#include "core/soren-bytecode.h"
+
+// Fuzz targets: each defines the libFuzzer entry point, and is linked either with libFuzzer (clang) or with the
+// standalone driver (fuzz/driver.cpp) that replays and mutates inputs and reports slow ones.
+
+// Inputs are a game byte (low bit: 0 for FE9, 1 for FE10) followed by what the target decodes (a cmb file or a script).
+// Rejecting an input with an exception is fine, crashing or taking long on it isn't.
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size);
+
+namespace soren {
+
+struct FuzzInput
+{
+	GameKind game;
+	Span<const std::uint8_t> payload;
+};
+
+static inline
+bool split_fuzz_input(const std::uint8_t* data, std::size_t size, FuzzInput& input)
+{
+	if (size < 1)
+		return false;
+
+	input.game = (data[0] & 1) ? GameKind::FE10 : GameKind::FE9;
+	input.payload = Span<const std::uint8_t>(data + 1, size - 1);
+
+	return true;
+}
+
+// work budget for an input: the decompiler is expected to be about linear, so anything that goes over a generous
+// multiple of the input size is cut short here (as the CLI would with budgets), and shows up as a slow unit if it
+// still takes long. Expressions duplicated over and over (dup, deref) are what the node budget is for
+
+static inline
+WorkBudget make_fuzz_budget(std::size_t size)
+{
+	WorkLimits limits;
+
+	limits.instructions = 64u * size + 4096u;
+	limits.nodes = 64u * size + 4096u;
+
+	WorkBudget result(limits, limits);
+	result.begin_file();
+
+	return result;
+}
+
+} // namespace soren
+
+#endif // SOREN_FUZZ_INCLUDED
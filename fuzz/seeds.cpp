@@ -0,0 +1,66 @@
+
+// Seed corpus generator for the fuzz targets
+// Writes synthetic but well formed inputs (see fuzz/fuzz.h for the format): cmb-* files for the cmb targets
+// (decode, statements) and script-* files for the script targets (slice, bks), from encode/synthetic.h
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "core/soren-cmb.h"
+
+#include "encode/encode.h"
+#include "encode/synthetic.h"
+
+using namespace soren;
+
+namespace {
+
+bool write_seed(const std::string& path, GameKind game, const std::vector<byte_type>& payload)
+{
+	auto file = std::fopen(path.c_str(), "wb");
+
+	if (file == nullptr)
+		return false;
+
+	const byte_type gameByte = game == GameKind::FE10 ? 1 : 0;
+
+	std::fwrite(&gameByte, 1, 1, file);
+	std::fwrite(payload.data(), 1, payload.size(), file);
+
+	return std::fclose(file) == 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "usage: " << argv[0] << " <out directory> [count]" << std::endl;
+		return 1;
+	}
+
+	const std::string directory(argv[1]);
+	const unsigned count = argc > 2 ? std::stoul(argv[2]) : 64u;
+
+	for (unsigned i = 0; i < count; ++i)
+	{
+		const auto game = (i & 1) ? GameKind::FE10 : GameKind::FE9;
+
+		const auto cmb = make_synthetic_cmb(i, game);
+
+		const auto prefix = directory + "/";
+		const auto suffix = "-" + std::to_string(i);
+
+		if (!write_seed(prefix + "cmb" + suffix, game, encode_cmb(cmb, game))
+			|| !write_seed(prefix + "script" + suffix, game, encode_script(cmb.scenes[0].rawScript, game)))
+		{
+			std::cerr << "couldn't write seeds to " << directory << std::endl;
+			return 1;
+		}
+	}
+
+	return 0;
+}
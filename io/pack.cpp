@@ -0,0 +1,183 @@
+
+#include "io/pack.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace soren {
+
+static const char PACK_MAGIC[8] = { 'S', 'R', 'N', 'P', 'A', 'C', 'K', '1' };
+static const char INDEX_MAGIC[8] = { 'S', 'R', 'N', 'I', 'N', 'D', 'E', 'X' };
+
+enum { TRAILER_SIZE = 8 + 8 + 8 };
+
+static
+void put_le(std::vector<char>& out, std::uint64_t value, unsigned bytes)
+{
+	for (unsigned i = 0; i < bytes; ++i)
+		out.push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+}
+
+static
+std::uint64_t get_le(const byte_type* data, unsigned bytes)
+{
+	std::uint64_t result = 0;
+
+	for (unsigned i = 0; i < bytes; ++i)
+		result |= std::uint64_t(data[i]) << (8 * i);
+
+	return result;
+}
+
+PackWriter::PackWriter(const std::string& path, std::size_t bufferSize)
+	: buffer(bufferSize != 0 ? bufferSize : 1)
+{
+	file = std::fopen(path.c_str(), "wb");
+
+	if (file == nullptr)
+		throw std::runtime_error("couldn't open " + path + " for writing"); // TODO: better error
+
+	setp(buffer.data(), buffer.data() + buffer.size());
+	write_raw(PACK_MAGIC, sizeof(PACK_MAGIC));
+}
+
+PackWriter::~PackWriter()
+{
+	if (file != nullptr)
+		std::fclose(file);
+}
+
+void PackWriter::begin_entry(const std::string& name)
+{
+	if (inEntry)
+		end_entry();
+
+	PackEntry entry;
+
+	entry.name = name;
+	entry.offset = position();
+
+	entries.push_back(std::move(entry));
+	inEntry = true;
+}
+
+void PackWriter::end_entry()
+{
+	if (!inEntry)
+		return;
+
+	entries.back().length = position() - entries.back().offset;
+	inEntry = false;
+}
+
+void PackWriter::finish()
+{
+	end_entry();
+
+	const auto indexOffset = position();
+
+	std::vector<char> index;
+
+	for (auto& entry : entries)
+	{
+		put_le(index, entry.offset, 8);
+		put_le(index, entry.length, 8);
+		put_le(index, entry.name.size(), 4);
+
+		index.insert(index.end(), entry.name.begin(), entry.name.end());
+	}
+
+	put_le(index, indexOffset, 8);
+	put_le(index, entries.size(), 8);
+
+	index.insert(index.end(), INDEX_MAGIC, INDEX_MAGIC + sizeof(INDEX_MAGIC));
+
+	write_raw(index.data(), index.size());
+	flush_buffer();
+
+	const bool closed = std::fclose(file) == 0;
+	file = nullptr;
+
+	if (failed || !closed)
+		throw std::runtime_error("couldn't write pack"); // TODO: better error
+}
+
+int PackWriter::overflow(int c)
+{
+	flush_buffer();
+
+	if (failed)
+		return traits_type::eof();
+
+	if (!traits_type::eq_int_type(c, traits_type::eof()))
+		sputc(traits_type::to_char_type(c));
+
+	return traits_type::not_eof(c);
+}
+
+void PackWriter::flush_buffer()
+{
+	const std::size_t size = pptr() - pbase();
+
+	if (size != 0 && !failed && std::fwrite(pbase(), 1, size, file) != size)
+		failed = true;
+
+	flushed += size;
+	setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+void PackWriter::write_raw(const void* data, std::size_t size)
+{
+	sputn(static_cast<const char*>(data), size);
+}
+
+std::vector<PackEntry> read_pack_index(Span<const byte_type> pack)
+{
+	if (pack.size() < sizeof(PACK_MAGIC) + TRAILER_SIZE || std::memcmp(pack.data(), PACK_MAGIC, sizeof(PACK_MAGIC)) != 0)
+		throw std::runtime_error("not a pack"); // TODO: better error
+
+	const auto trailer = pack.data() + pack.size() - TRAILER_SIZE;
+
+	if (std::memcmp(trailer + 16, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0)
+		throw std::runtime_error("pack has no index (unfinished?)"); // TODO: better error
+
+	const auto indexOffset = get_le(trailer, 8);
+	const auto count = get_le(trailer + 8, 8);
+
+	const std::uint64_t indexEnd = pack.size() - TRAILER_SIZE;
+
+	if (indexOffset < sizeof(PACK_MAGIC) || indexOffset > indexEnd)
+		throw std::runtime_error("pack index out of bounds"); // TODO: better error
+
+	std::vector<PackEntry> result;
+	std::uint64_t pos = indexOffset;
+
+	for (std::uint64_t i = 0; i < count; ++i)
+	{
+		if (indexEnd - pos < 20)
+			throw std::runtime_error("pack index out of bounds"); // TODO: better error
+
+		PackEntry entry;
+
+		entry.offset = get_le(pack.data() + pos, 8);
+		entry.length = get_le(pack.data() + pos + 8, 8);
+
+		const auto nameLength = get_le(pack.data() + pos + 16, 4);
+		pos += 20;
+
+		if (indexEnd - pos < nameLength)
+			throw std::runtime_error("pack index out of bounds"); // TODO: better error
+
+		if (entry.offset < sizeof(PACK_MAGIC) || entry.offset > indexOffset || indexOffset - entry.offset < entry.length)
+			throw std::runtime_error("pack entry out of bounds"); // TODO: better error
+
+		entry.name.assign(reinterpret_cast<const char*>(pack.data() + pos), nameLength);
+		pos += nameLength;
+
+		result.push_back(std::move(entry));
+	}
+
+	return result;
+}
+
+} // namespace soren
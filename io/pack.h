@@ -0,0 +1,73 @@
+#ifndef SOREN_PACK_INCLUDED
+#define SOREN_PACK_INCLUDED
+
+#include <cstdint>
+#include <cstdio>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "core/types.h"
+
+namespace soren {
+
+// pack: many named entries (dumps) in one file, written front to back, with the index at the end
+//
+//     "SRNPACK1"
+//     entry data, back to back
+//     index, per entry: offset (u64), length (u64), name length (u32), name
+//     index offset (u64), entry count (u64), "SRNINDEX"
+//
+// numbers are little endian, offsets are from the start of the file
+
+struct PackEntry
+{
+	std::string name;
+
+	std::uint64_t offset { 0u };
+	std::uint64_t length { 0u };
+};
+
+struct PackWriter : public std::streambuf
+{
+	// entries are written through this (as the buffer of an ostream), between begin_entry and end_entry
+	// writes go out in large blocks, and flushing the stream doesn't make them go out sooner
+
+	explicit PackWriter(const std::string& path, std::size_t bufferSize = 1u << 20);
+	~PackWriter();
+
+	PackWriter(const PackWriter&) = delete;
+	PackWriter& operator = (const PackWriter&) = delete;
+
+	void begin_entry(const std::string& name);
+	void end_entry();
+
+	// writes the index and closes the file
+	void finish();
+
+protected:
+	int overflow(int c) override;
+	int sync() override { return 0; }
+
+private:
+	std::uint64_t position() const { return flushed + (pptr() - pbase()); }
+
+	void flush_buffer();
+	void write_raw(const void* data, std::size_t size);
+
+	std::FILE* file { nullptr };
+	bool failed { false };
+
+	std::vector<char> buffer;
+	std::uint64_t flushed { 0u }; //< bytes written to the file so far
+
+	std::vector<PackEntry> entries;
+	bool inEntry { false };
+};
+
+// the index of a whole pack in memory (such as a mapped file), entries being at [offset, offset + length) of it
+std::vector<PackEntry> read_pack_index(Span<const byte_type> pack);
+
+} // namespace soren
+
+#endif // SOREN_PACK_INCLUDED
@@ -0,0 +1,277 @@
+
+#include "io/tar.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+
+namespace soren {
+
+static
+std::uint64_t round_to_block(std::uint64_t size)
+{
+	return (size + 511) / 512 * 512;
+}
+
+// numeric header fields are octal text, or base-256 with the high bit of the first byte set (GNU, for large values)
+static
+std::uint64_t parse_number(const byte_type* field, unsigned length)
+{
+	std::uint64_t result = 0;
+
+	if (field[0] & 0x80)
+	{
+		result = field[0] & 0x7F;
+
+		for (unsigned i = 1; i < length; ++i)
+			result = (result << 8) | field[i];
+
+		return result;
+	}
+
+	unsigned i = 0;
+
+	while (i < length && field[i] == ' ')
+		i++;
+
+	for (; i < length && field[i] != 0 && field[i] != ' '; ++i)
+	{
+		if (field[i] < '0' || field[i] > '7')
+			throw std::runtime_error("tar: bad number in header"); // TODO: better error
+
+		result = (result << 3) | (field[i] - '0');
+	}
+
+	return result;
+}
+
+static
+std::string parse_string(const byte_type* field, unsigned length)
+{
+	const auto end = std::find(field, field + length, 0);
+	return std::string(field, end);
+}
+
+void TarReader::read_exact(void* data, std::uint64_t size)
+{
+	in.read(static_cast<char*>(data), size);
+
+	if (static_cast<std::uint64_t>(in.gcount()) != size)
+		throw std::runtime_error("tar: unexpected end of archive"); // TODO: better error
+}
+
+void TarReader::skip(std::uint64_t size)
+{
+	// ignore rather than seek, as the archive may be a pipe
+
+	const std::uint64_t chunk = std::numeric_limits<std::streamsize>::max();
+
+	while (size != 0)
+	{
+		const auto amount = std::min(size, chunk);
+
+		in.ignore(amount);
+
+		if (static_cast<std::uint64_t>(in.gcount()) != amount)
+			throw std::runtime_error("tar: unexpected end of archive"); // TODO: better error
+
+		size -= amount;
+	}
+}
+
+std::int64_t TarReader::remaining()
+{
+	const auto here = in.tellg();
+
+	if (here == std::streampos(-1))
+	{
+		in.clear();
+		return -1;
+	}
+
+	in.seekg(0, std::ios::end);
+	const auto end = in.tellg();
+	in.seekg(here);
+
+	if (end == std::streampos(-1) || !in)
+	{
+		in.clear();
+		in.seekg(here);
+		return -1;
+	}
+
+	return static_cast<std::int64_t>(end - here);
+}
+
+bool TarReader::next()
+{
+	skip(unread);
+	unread = 0;
+
+	// set by extended headers, for the next member
+	std::string longPath;
+	std::uint64_t longSize = 0;
+	bool hasLongSize = false;
+
+	for (;;)
+	{
+		byte_type header[BLOCK_SIZE];
+
+		in.read(reinterpret_cast<char*>(header), BLOCK_SIZE);
+
+		// the archive ends with zero blocks, but some writers leave them out
+		if (in.gcount() == 0)
+			return false;
+
+		if (in.gcount() != BLOCK_SIZE)
+			throw std::runtime_error("tar: unexpected end of archive"); // TODO: better error
+
+		if (std::all_of(header, header + BLOCK_SIZE, [] (byte_type b) { return b == 0; }))
+			return false;
+
+		// checksum is the sum of header bytes, with its own field as spaces
+
+		unsigned checksum = 0;
+
+		for (unsigned i = 0; i < BLOCK_SIZE; ++i)
+			checksum += (i >= 148 && i < 156) ? ' ' : header[i];
+
+		if (checksum != parse_number(header + 148, 8))
+			throw std::runtime_error("tar: bad header checksum"); // TODO: better error
+
+		const auto size = parse_number(header + 124, 12);
+		const auto type = header[156];
+
+		switch (type)
+		{
+
+		case 'L':
+		{
+			// GNU long name: the data is the path of the next member
+			if (size > MAX_EXTENDED_SIZE)
+				throw std::runtime_error("tar: extended header too large"); // TODO: better error
+
+			std::string path(size, '\0');
+			read_exact(&path[0], size);
+			skip(round_to_block(size) - size);
+
+			longPath = parse_string(reinterpret_cast<const byte_type*>(path.data()), path.size());
+			continue;
+		}
+
+		case 'x':
+		{
+			// pax extended header: "<length> <key>=<value>\n" records, of which path and size matter here
+			if (size > MAX_EXTENDED_SIZE)
+				throw std::runtime_error("tar: extended header too large"); // TODO: better error
+
+			std::string records(size, '\0');
+			read_exact(&records[0], size);
+			skip(round_to_block(size) - size);
+
+			for (std::size_t pos = 0; pos < records.size();)
+			{
+				const auto space = records.find(' ', pos);
+				const auto length = std::strtoull(records.c_str() + pos, nullptr, 10);
+
+				// the space has to be in the record, with at least the newline after it
+				if (space == std::string::npos || length == 0 || pos + length > records.size() || space >= pos + length - 1)
+					throw std::runtime_error("tar: bad pax record"); // TODO: better error
+
+				const auto record = records.substr(space + 1, pos + length - space - 2); // without the newline
+				const auto equals = record.find('=');
+
+				if (equals != std::string::npos)
+				{
+					const auto key = record.substr(0, equals);
+
+					if (key == "path")
+					{
+						longPath = record.substr(equals + 1);
+					}
+					else if (key == "size")
+					{
+						longSize = std::strtoull(record.c_str() + equals + 1, nullptr, 10);
+						hasLongSize = true;
+					}
+				}
+
+				pos += length;
+			}
+
+			continue;
+		}
+
+		case '0':
+		case '\0':
+		case '7':
+		{
+			if (!longPath.empty())
+			{
+				memberPath = longPath;
+			}
+			else
+			{
+				memberPath = parse_string(header, 100);
+
+				// ustar splits long paths into a prefix and a name
+				if (std::equal(header + 257, header + 262, "ustar") && header[345] != 0)
+					memberPath = parse_string(header + 345, 155) + "/" + memberPath;
+			}
+
+			memberSize = hasLongSize ? longSize : size;
+			unread = round_to_block(memberSize);
+
+			return true;
+		}
+
+		default:
+			// directories, links, devices, pax global headers: nothing to read
+			skip(round_to_block(size));
+
+			longPath.clear();
+			hasLongSize = false;
+
+			continue;
+
+		} // switch (type)
+	}
+}
+
+void TarReader::read(std::vector<byte_type>& buffer)
+{
+	if (unread != round_to_block(memberSize))
+		throw std::runtime_error("tar: member data already read"); // TODO: better error
+
+	// the size comes from the archive: nothing is allocated for data that isn't there
+
+	const auto left = remaining();
+
+	if (left >= 0 && memberSize > static_cast<std::uint64_t>(left))
+		throw std::runtime_error("tar: unexpected end of archive"); // TODO: better error
+
+	if (left >= 0)
+	{
+		buffer.resize(memberSize);
+		read_exact(buffer.data(), memberSize);
+	}
+	else
+	{
+		buffer.clear();
+
+		while (buffer.size() < memberSize)
+		{
+			const auto done = buffer.size();
+			const auto amount = std::min<std::uint64_t>(memberSize - done, READ_CHUNK);
+
+			buffer.resize(done + amount);
+			read_exact(buffer.data() + done, amount);
+		}
+	}
+
+	skip(unread - memberSize);
+	unread = 0;
+}
+
+} // namespace soren
@@ -0,0 +1,56 @@
+#ifndef SOREN_TAR_INCLUDED
+#define SOREN_TAR_INCLUDED
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "core/types.h"
+
+namespace soren {
+
+struct TarReader
+{
+	// reads a tar archive (ustar, with GNU long names and pax paths/sizes) front to back, so that it can be a pipe
+	// member data is only ever read into the caller's buffer, and skipped over (without being kept) if not read
+
+	explicit TarReader(std::istream& in)
+		: in(in) {}
+
+	// moves to the next regular file member, false at the end of the archive
+	bool next();
+
+	// of the current member
+	const std::string& path() const { return memberPath; }
+	std::uint64_t size() const { return memberSize; }
+
+	// reads the data of the current member (at most once) into buffer
+	// buffer is resized to fit, so that it can be reused across members
+	void read(std::vector<byte_type>& buffer);
+
+private:
+	enum
+	{
+		BLOCK_SIZE = 512,
+		MAX_EXTENDED_SIZE = 1 << 20, //< of long names and pax headers, which are read whole
+		READ_CHUNK = 1 << 20, //< member data is read in chunks where the archive size isn't known
+	};
+
+	void read_exact(void* data, std::uint64_t size);
+	void skip(std::uint64_t size);
+
+	// bytes left in the archive, or -1 if it can't be told (pipes)
+	std::int64_t remaining();
+
+	std::istream& in;
+
+	std::string memberPath;
+	std::uint64_t memberSize { 0u };
+
+	std::uint64_t unread { 0u }; //< data and padding of the current member not read yet
+};
+
+} // namespace soren
+
+#endif // SOREN_TAR_INCLUDED
@@ -5,8 +5,17 @@
 #include <algorithm>
 #include <stdexcept>
 #include <memory>
+#include <sstream>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <limits>
 
 #include "core/offset-map.h"
+#include "core/work-stealing.h"
+#include "core/perf-counters.h"
+#include "core/slowest-scenes.h"
+#include "core/trace.h"
 
 #include "core/soren-bytecode.h"
 #include "core/soren-cmb.h"
@@ -15,11 +24,26 @@
 #include "ast/stmt.h"
 
 #include "decode/decode.h"
+#include "decompile/decompile.h"
+
+#include "vm/vm.h"
+#include "vm/profiler.h"
+#include "vm/batch.h"
+#include "vm/triggers.h"
+
+#include "opt/optimize.h"
+#include "encode/encode.h"
+
+#include "io/pack.h"
+#include "io/tar.h"
+
+#include "patch/patch.h"
 
 namespace soren {
 
+// files of maxSize bytes or more (if not 0) aren't read (for --max-memory)
 static
-std::vector<byte_type> read_entire_file(const char* filename)
+std::vector<byte_type> read_entire_file(const char* filename, std::uint64_t maxSize = 0)
 {
 	std::ifstream in(filename, std::ios::binary | std::ios::ate);
 
@@ -27,6 +51,10 @@ std::vector<byte_type> read_entire_file(const char* filename)
 		throw "couldn't open file for binary read"; // FIXME
 
 	const auto size = in.tellg();
+
+	if (maxSize != 0 && static_cast<std::uint64_t>(size) >= maxSize)
+		throw std::runtime_error("file doesn't fit in --max-memory"); // TODO: better error
+
 	std::vector<byte_type> result(size);
 
 	in.seekg(0, std::ios::beg);
@@ -35,837 +63,1102 @@ std::vector<byte_type> read_entire_file(const char* filename)
 	return result;
 }
 
-template<bool IgnoreBranchAndKeeps = true>
-OffsetMap<Span<const BcIns>> slice_script(Span<const BcIns> script)
+// passes everything on to another buffer, counting bytes on the way
+struct CountingBuffer : public std::streambuf
 {
-	OffsetMap<Span<const BcIns>> result;
-	std::set<std::size_t> slicePoints;
-
-	// Step 1: Find slice points
+	explicit CountingBuffer(std::streambuf* target)
+		: target(target) {}
 
-	for (auto& ins : script)
+	int overflow(int c) override
 	{
-		if (IgnoreBranchAndKeeps && ins.is_jump_keep())
-			continue;
-
-		if (ins.is_jump())
-		{
-			// jumps generate:
-			// a slice after themselves
-			// a slice before the jump target
-			// a label before the jump target
+		if (traits_type::eq_int_type(c, traits_type::eof()))
+			return traits_type::not_eof(c);
 
-			slicePoints.insert(ins.location + 1 + ins.info().operandSize);
-			slicePoints.insert(ins.operand);
-		}
-
-		if (ins.is_end())
-		{
-			// ends generate slices after themselves
-			slicePoints.insert(ins.location + 1);
-		}
+		count++;
+		return target->sputc(traits_type::to_char_type(c));
 	}
 
-	// Step 2: Slice
+	std::streamsize xsputn(const char* s, std::streamsize n) override
+	{
+		const auto written = target->sputn(s, n);
+		count += written;
 
-	auto scrIt   = script.begin();
-	auto sliceIt = slicePoints.begin();
+		return written;
+	}
 
-	while (scrIt != script.end())
-	{
-		auto itStart = scrIt;
+	int sync() override { return target->pubsync(); }
 
-		if (sliceIt != slicePoints.end())
-		{
-			auto sliceOffset = *sliceIt++;
+	std::streambuf* target;
+	std::uint64_t count { 0u };
+};
 
-			scrIt = std::find_if(itStart, script.end(), [sliceOffset] (auto& ins)
-			{
-				return ins.location >= sliceOffset;
-			});
-		}
-		else
-		{
-			scrIt = script.end();
-		}
+struct RunOptions
+{
+	std::string event;
 
-		result.set(itStart->location, { itStart, scrIt });
-	}
+	std::string profilePath; //< empty for no profiling
+	std::uint64_t profilePeriod { 997u };
 
-	return result;
-}
+	std::string batchStatesPath; //< empty for a single run
+	unsigned threadCount { 0u };
+	std::uint64_t stepLimit { 0u };
+	bool lanes { false };
+};
 
-Span<BcIns> convert_bks_to_fake_logic(Span<BcIns> slice)
+static
+std::vector<std::vector<std::int32_t>> read_batch_states(const char* filename)
 {
-	// Converts bky/bkn chains to fake land/lorr instructions and reorder accordingly
-	// ex:
-	/*
-	 * 0 val 0
-	 * 2 bkn 7
-	 * 5 val 1
-	 * 7 bn ...
-	 */
-	// becomes
-	/*
-	 * 0 val 0
-	 * 5 val 1
-	 * 2 fake!land
-	 * 7 bn ...
-	 */
-
-	for (unsigned i = 0; i < slice.size(); ++i)
-	{
-		unsigned op = slice[i].opcode;
+	// one state per line: initial global values separated by whitespace
 
-		switch (op)
-		{
+	std::ifstream in(filename);
 
-		case BC_OPCODE_BKN:
-		case BC_OPCODE_BKY:
-		{
-			// Move the bkn/bky to just before the jump target, and replace it with a fake and/or
+	if (!in.is_open())
+		throw std::runtime_error("couldn't open batch states file"); // TODO: better error
 
-			unsigned target = slice[i++].operand;
-			unsigned j = i;
+	std::vector<std::vector<std::int32_t>> result;
+	std::string line;
 
-			while (j < slice.size() && slice[j].location != target)
-			{
-				std::swap(slice[j-1], slice[j]);
-				j++;
-			}
+	while (std::getline(in, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
 
-			slice[j-1].opcode = (op == BC_OPCODE_BKN) ? BC_FAKEOP_LAND : BC_FAKEOP_LORR;
-			slice[j-1].operand = 0;
-		}
+		std::istringstream values(line);
+		std::vector<std::int32_t> globals;
+		std::int32_t value;
 
-		default:
-			continue;
+		while (values >> value)
+			globals.push_back(value);
 
-		} // switch (op)
+		result.push_back(std::move(globals));
 	}
 
-	return slice;
+	return result;
 }
 
-std::vector<BcIns> get_bks_as_fake_logic(Span<const BcIns> slice)
+static
+int run_event_batch(const CmbInfo& cmb, const SceneInfo& scene, const RunOptions& options)
 {
-	std::vector<BcIns> result(slice.begin(), slice.end());
-	convert_bks_to_fake_logic(result);
+	const auto initialGlobals = read_batch_states(options.batchStatesPath.c_str());
+	const auto program = make_vm_program(cmb);
 
-	return result;
-}
+	const std::vector<std::int32_t> args(scene.argCnt, 0);
 
-std::vector<Stmt> make_statements(const CmbInfo& script, const SceneInfo& scene, Span<const BcIns> slice)
-{
-	std::vector<Stmt> result;
-	result.reserve(slice.size());
+	VmBatchConfig config;
 
-	const auto expect_push = [&] (const char*, auto func)
-	{
-		if (result.size() < 1)
-			throw std::runtime_error("expected after push"); // TODO: better error ("name" only expected after push)
+	config.threadCount = options.threadCount;
+	config.stepLimit = options.stepLimit;
+	config.lanes = options.lanes;
 
-		if (result.back().kind != Stmt::Kind::Push)
-			throw std::runtime_error("expected after push"); // TODO: better error ("name" only expected after push)
+	const auto start = std::chrono::steady_clock::now();
+	const auto results = run_vm_batch(program, scene.idx, args, initialGlobals, config);
+	const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-		func(result.back());
-	};
+	std::uint64_t totalSteps = 0;
 
-	const auto expect_push_push = [&] (const char*, auto func)
+	for (unsigned i = 0; i < results.size(); ++i)
 	{
-		if (result.size() < 2)
-			throw false; // FIXME: error ("name" as first instruction)
+		auto& result = results[i];
 
-		if (result.back().kind != Stmt::Kind::Push)
-			throw false; // FIXME: error ("name" only expected after 2 pushes)
+		std::cout << i << ": ";
 
-		auto& rop = result.back();
+		if (!result.error.empty())
+			std::cout << "error: " << result.error;
+		else if (result.status == VmStatus::StepLimit)
+			std::cout << "step limit reached";
+		else
+			std::cout << "returned " << result.result;
 
-		if (result[result.size()-2].kind != Stmt::Kind::Push)
-			throw false; // FIXME: error ("name" only expected after 2 pushes)
+		std::cout << " (" << result.steps << " instructions, " << result.yields << " yields)" << std::endl;
 
-		auto& lop = result[result.size()-2];
+		totalSteps += result.steps;
+	}
 
-		func(lop, rop);
-	};
+	std::cerr << results.size() << " states in " << seconds << "s ("
+		<< (results.size() / seconds) << " states/s, " << (totalSteps / seconds / 1e6) << "M instructions/s, "
+		<< resolve_thread_count(options.threadCount) << " threads)" << std::endl;
 
-	const auto unop = [&] (const char* name, Expr::Kind kind)
+	return 0;
+}
+
+static
+int run_event(const CmbInfo& cmb, const RunOptions& options)
+{
+	const auto sceneIt = std::find_if(cmb.scenes.begin(), cmb.scenes.end(), [&] (auto& scene)
 	{
-		expect_push(name, [&] (auto& back)
-		{
-			back.children[0] = Expr::make_unique_unop(kind, std::move(back.children[0]));
-		});
-	};
+		return scene.name == options.event;
+	});
+
+	if (sceneIt == cmb.scenes.end())
+	{
+		std::cerr << "no event named " << options.event << std::endl;
+		return 1;
+	}
 
-	const auto binop = [&] (const char* name, Expr::Kind kind)
+	if (!options.batchStatesPath.empty())
 	{
-		expect_push_push(name, [&] (auto& l, auto& r)
+		if (!options.profilePath.empty())
 		{
-			auto lexpr = std::move(l.children[0]);
-			auto rexpr = std::move(r.children[0]);
+			std::cerr << "--profile can't be used with --batch-states" << std::endl;
+			return 1;
+		}
 
-			result.pop_back();
-			result.pop_back();
+		return run_event_batch(cmb, *sceneIt, options);
+	}
 
-			result.push_back(Stmt::make_push(
-				Expr::make_unique_binop(kind, std::move(lexpr), std::move(rexpr))));
-		});
-	};
+	const auto program = make_vm_program(cmb);
+	auto state = make_vm_state(program);
 
-	const auto call = [&] (const char* funcname, unsigned argCnt)
-	{
-		if (result.size() < argCnt)
-			throw false; // FIXME: error (call expected after x pushes)
+	VmProfiler profiler(options.profilePeriod);
 
-		for (unsigned i = result.size() - argCnt; i < result.size(); ++i)
-			if (result[i].kind != Stmt::Kind::Push)
-				throw false; // FIXME: error (call expexted after x pushes)
+	VmConfig config;
 
-		auto callexpr = std::make_unique<Expr>();
+	if (!options.profilePath.empty())
+		config.profiler = &profiler;
 
-		callexpr->kind = Expr::Kind::Func;
-		callexpr->named = funcname;
+	const std::vector<std::int32_t> args(sceneIt->argCnt, 0);
+	vm_start(state, program, sceneIt->idx, args);
 
-		for (unsigned i = result.size() - argCnt; i < result.size(); ++i)
-			callexpr->children.push_back(std::move(result[i].children[0]));
+	// the step limit is for the whole event, not for each vm_run
+	unsigned yields = 0;
+	const auto status = vm_run_to_end(state, program, config, options.stepLimit, 0, yields);
 
-		result.resize(result.size() - argCnt);
-		result.push_back(Stmt::make_push(std::move(callexpr)));
-	};
+	if (status == VmStatus::StepLimit)
+		std::cerr << "step limit reached" << std::endl;
 
-	for (auto& ins : slice)
-	{
-		switch (ins.opcode)
-		{
+	std::cout << options.event << " returned " << state.result
+		<< " (" << state.steps << " instructions, " << yields << " yields)" << std::endl;
 
-		case BC_OPCODE_NOP:
-			// nothing
+	if (!options.profilePath.empty())
+	{
+		std::ofstream out(options.profilePath);
 
-			break;
+		if (!out.is_open())
+		{
+			std::cerr << "couldn't open " << options.profilePath << " for writing" << std::endl;
+			return 1;
+		}
 
-		case BC_OPCODE_VAL8:
-		case BC_OPCODE_VAL16:
-			// push varname
+		profiler.write_folded(out, cmb);
 
-			result.push_back(Stmt::make_push(
-				Expr::make_unique_identifier(std::string(scene.varnames[ins.operand]))));
+		std::cerr << profiler.totalSamples << " samples, by opcode:" << std::endl;
+		profiler.write_opcode_summary(std::cerr);
+	}
 
-			break;
+	return 0;
+}
 
-		case BC_OPCODE_VALX8:
-		case BC_OPCODE_VALX16:
-			// push a => push [&varname + a]
+struct SpecializeOptions
+{
+	std::string event;
+	ConstantBindings constants;
+};
 
-			expect_push("valx", [&] (auto& back)
-			{
-				back.children[0] = Expr::make_unique_unop(Expr::Kind::Deref,
-					Expr::make_unique_binop(Expr::Kind::Add,
-						Expr::make_unique_unop(Expr::Kind::Addrof,
-							Expr::make_unique_identifier(std::string(scene.varnames[ins.operand]))),
-						std::move(back.children[0])));
-			});
+static
+int specialize_event(const CmbInfo& cmb, const SpecializeOptions& options)
+{
+	const auto sceneIt = std::find_if(cmb.scenes.begin(), cmb.scenes.end(), [&] (auto& scene)
+	{
+		return scene.name == options.event;
+	});
 
-			break;
+	if (sceneIt == cmb.scenes.end())
+	{
+		std::cerr << "no event named " << options.event << std::endl;
+		return 1;
+	}
 
-		case BC_OPCODE_REF8:
-		case BC_OPCODE_REF16:
-			// push &varname
+	const auto specialized = specialize_scene(cmb, *sceneIt, options.constants, GameKind::FE10);
 
-			result.push_back(Stmt::make_push(
-				Expr::make_unique_unop(Expr::Kind::Addrof,
-					Expr::make_unique_identifier(std::string(scene.varnames[ins.operand])))));
+	print_scene(std::cout, cmb, specialized);
 
-			break;
+	std::cerr << options.event << ": "
+		<< sceneIt->rawScript.size() << " -> " << specialized.rawScript.size() << " instructions, "
+		<< encode_script(sceneIt->rawScript, GameKind::FE10).size() << " -> " << encode_script(specialized.rawScript, GameKind::FE10).size() << " bytes"
+		<< std::endl;
 
-		case BC_OPCODE_REFX8:
-		case BC_OPCODE_REFX16:
-			// push a => push &varname + a
+	return 0;
+}
 
-			expect_push("refx", [&] (auto& back)
-			{
-				back.children[0] = Expr::make_unique_binop(Expr::Kind::Add,
-					Expr::make_unique_unop(Expr::Kind::Addrof,
-						Expr::make_unique_identifier(std::string(scene.varnames[ins.operand]))),
-					std::move(back.children[0]));
-			});
+static
+std::uint64_t scene_heap_size(const SceneInfo& scene)
+{
+	std::uint64_t result = sizeof(SceneInfo) + scene.name.capacity() + scene.rawScript.capacity() * sizeof(BcIns);
 
-			break;
+	for (auto& name : scene.varnames)
+		result += sizeof(name) + name.capacity();
 
-		case BC_OPCODE_GVAL8:
-		case BC_OPCODE_GVAL16:
-			// push varname
+	return result;
+}
 
-			result.push_back(Stmt::make_push(
-				Expr::make_unique_identifier(std::string(script.globalNames[ins.operand]))));
+// what a decoded cmb takes on the heap, roughly
+static
+std::uint64_t cmb_heap_size(const CmbInfo& cmb)
+{
+	std::uint64_t result = cmb.stringPool.capacity();
 
-			break;
+	for (auto& name : cmb.globalNames)
+		result += sizeof(name) + name.capacity();
 
-		case BC_OPCODE_GVALX8:
-		case BC_OPCODE_GVALX16:
-			// push a => push [&varname + a]
+	for (auto& scene : cmb.scenes)
+		result += scene_heap_size(scene);
 
-			expect_push("valx", [&] (auto& back)
-			{
-				back.children[0] = Expr::make_unique_unop(Expr::Kind::Deref,
-					Expr::make_unique_binop(Expr::Kind::Add,
-						Expr::make_unique_unop(Expr::Kind::Addrof,
-							Expr::make_unique_identifier(std::string(script.globalNames[ins.operand]))),
-						std::move(back.children[0])));
-			});
+	return result;
+}
 
-			break;
+static
+std::size_t encoded_cmb_script_size(const CmbInfo& cmb)
+{
+	std::size_t result = 0;
 
-		case BC_OPCODE_GREF8:
-		case BC_OPCODE_GREF16:
-			// push &varname
+	for (auto& scene : cmb.scenes)
+		result += encode_script(scene.rawScript, GameKind::FE10).size();
 
-			result.push_back(Stmt::make_push(
-				Expr::make_unique_unop(Expr::Kind::Addrof,
-					Expr::make_unique_identifier(std::string(script.globalNames[ins.operand])))));
+	return result;
+}
 
-			break;
+static
+void inline_scene_calls(CmbInfo& cmb)
+{
+	const auto sizeBefore = encoded_cmb_script_size(cmb);
+	const auto inlined = inline_calls(cmb, InlineConfig {}, GameKind::FE10);
 
-		case BC_OPCODE_GREFX8:
-		case BC_OPCODE_GREFX16:
-			// push a => push &varname + a
+	std::cerr << "inlined " << inlined << " call sites, scripts "
+		<< sizeBefore << " -> " << encoded_cmb_script_size(cmb) << " bytes" << std::endl;
+}
 
-			expect_push("refx", [&] (auto& back)
-			{
-				back.children[0] = Expr::make_unique_binop(Expr::Kind::Add,
-					Expr::make_unique_unop(Expr::Kind::Addrof,
-						Expr::make_unique_identifier(std::string(script.globalNames[ins.operand]))),
-					std::move(back.children[0]));
-			});
+static
+void compact_scene_locals(CmbInfo& cmb)
+{
+	unsigned before = 0, after = 0;
 
-			break;
+	for (auto& scene : cmb.scenes)
+	{
+		before += scene.varnames.size();
+		compact_locals(cmb, scene, GameKind::FE10);
+		after += scene.varnames.size();
+	}
 
-		case BC_OPCODE_NUMBER8:
-		case BC_OPCODE_NUMBER16:
-		case BC_OPCODE_NUMBER32:
-			// push imm
+	std::cerr << "compacted locals, " << before << " -> " << after << " slots in total" << std::endl;
+}
 
-			result.push_back(Stmt::make_push(
-				Expr::make_unique_intlit(ins.operand)));
+static
+void layout_scenes(CmbInfo& cmb, const std::string& trainEvent, std::uint64_t stepLimit)
+{
+	std::vector<std::vector<std::uint64_t>> weights(cmb.scenes.size());
 
-			break;
+	if (!trainEvent.empty())
+	{
+		const auto sceneIt = std::find_if(cmb.scenes.begin(), cmb.scenes.end(), [&] (auto& scene)
+		{
+			return scene.name == trainEvent;
+		});
 
-		case BC_OPCODE_STRING8:
-		case BC_OPCODE_STRING16:
-		case BC_OPCODE_STRING32:
-			// push <string at imm>
+		if (sceneIt == cmb.scenes.end())
+		{
+			std::cerr << "no event named " << trainEvent << ", laying out without execution counts" << std::endl;
+		}
+		else
+		{
+			// sampling every instruction gives exact execution counts
 
-			result.push_back(Stmt::make_push(
-				Expr::make_unique_strlit({ script.get_cstr(ins.operand) })));
+			const auto program = make_vm_program(cmb);
+			auto state = make_vm_state(program);
 
-			break;
+			VmProfiler profiler(1);
 
-		case BC_OPCODE_DEREF:
-			// push a => push a, [a]
+			VmConfig config;
+			config.profiler = &profiler;
 
-			expect_push("deref", [&] (auto& back)
-			{
-				result.push_back(Stmt::make_push(
-					Expr::make_unique_unop(Expr::Kind::Deref,
-						Expr::make_unique_copy(*back.children[0]))));
-			});
+			const std::vector<std::int32_t> args(sceneIt->argCnt, 0);
+			vm_start(state, program, sceneIt->idx, args);
 
-			break;
+			// the step limit is for the whole event, as in run_event
+			unsigned yields = 0;
+			const auto status = vm_run_to_end(state, program, config, stepLimit, 0, yields);
 
-		case BC_OPCODE_DISC:
-			// push a => a
+			if (status == VmStatus::StepLimit)
+				std::cerr << "step limit reached while running " << trainEvent << ", using partial execution counts" << std::endl;
 
-			expect_push("disc", [&] (auto& back)
-			{
-				back.kind = Stmt::Kind::Expr;
-			});
+			for (unsigned i = 0; i < cmb.scenes.size(); ++i)
+				weights[i] = profiler.instruction_samples(cmb, i);
+		}
+	}
 
-			break;
+	const auto sizeBefore = encoded_cmb_script_size(cmb);
+	unsigned changed = 0;
 
-		case BC_OPCODE_STORE:
-			// push a, b => push [a] = b
+	for (unsigned i = 0; i < cmb.scenes.size(); ++i)
+		changed += optimize_layout(cmb.scenes[i], weights[i], GameKind::FE10);
 
-			binop("store", Expr::Kind::Assign);
-			break;
+	std::cerr << "laid out " << changed << " scenes, scripts "
+		<< sizeBefore << " -> " << encoded_cmb_script_size(cmb) << " bytes" << std::endl;
+}
 
-		case BC_OPCODE_ADD:
-			// push a, b => push a + b
+static
+void strip_cmb(CmbInfo& cmb)
+{
+	const auto scenesBefore = cmb.scenes.size();
+	const auto stripped = strip_dead_scenes(cmb, GameKind::FE10);
+	const auto saved = strip_unused_strings(cmb, GameKind::FE10);
 
-			binop("add", Expr::Kind::Add);
-			break;
+	std::cerr << "stripped " << stripped << " of " << scenesBefore << " scenes, "
+		<< saved << " bytes of strings" << std::endl;
+}
 
-		case BC_OPCODE_SUB:
-			// push a, b => push a - b
+static
+bool write_file(const std::vector<byte_type>& data, const std::string& path)
+{
+	std::ofstream out(path, std::ios::binary);
+	out.write(reinterpret_cast<const char*>(data.data()), data.size());
 
-			binop("sub", Expr::Kind::Sub);
-			break;
+	return static_cast<bool>(out);
+}
 
-		case BC_OPCODE_MUL:
-			// push a, b => push a * b
+static
+int write_cmb(const CmbInfo& cmb, const std::string& path)
+{
+	const auto data = encode_cmb(cmb, GameKind::FE10);
 
-			binop("mul", Expr::Kind::Mul);
-			break;
+	if (!write_file(data, path))
+	{
+		std::cerr << "couldn't write " << path << std::endl;
+		return 1;
+	}
 
-		case BC_OPCODE_DIV:
-			// push a, b => push a / b
+	std::cerr << "wrote " << data.size() << " bytes to " << path << std::endl;
 
-			binop("div", Expr::Kind::Div);
-			break;
+	return 0;
+}
 
-		case BC_OPCODE_MOD:
-			// push a, b => push a % b
+// patches are <scene>@<location>=<value> (the value being a string for string pushes, a target location for jumps)
+// or [<scene>:]number:<old>=<new> and [<scene>:]string:<old>=<new> for every match (in every scene without <scene>)
+static
+int patch_cmb(std::vector<byte_type> data, const std::vector<std::string>& specs, const std::string& path)
+{
+	CmbPatcher patcher(std::move(data), GameKind::FE10);
 
-			binop("mod", Expr::Kind::Mod);
-			break;
+	// everything is found before anything is patched, so that locations are those of the original file
 
-		case BC_OPCODE_ORR:
-			// push a, b => push a | b
+	struct Edit
+	{
+		PatchRef ref;
+		unsigned location; //< in the original file, for reporting
+		std::string value;
+	};
 
-			binop("orr", Expr::Kind::Or);
-			break;
+	std::vector<Edit> edits;
 
-		case BC_OPCODE_AND:
-			// push a, b => push a & b
+	for (auto& spec : specs)
+	{
+		const auto eq = spec.find('=');
 
-			binop("and", Expr::Kind::And);
-			break;
+		if (eq == std::string::npos)
+			throw std::runtime_error("Bad patch: " + spec); // TODO: better error
 
-		case BC_OPCODE_XOR:
-			// push a, b => push a ^ b
+		const auto where = spec.substr(0, eq);
+		const auto value = spec.substr(eq + 1);
 
-			binop("xor", Expr::Kind::Xor);
-			break;
+		const auto at = where.find('@');
 
-		case BC_OPCODE_LSL:
-			// push a, b => push a << b
+		if (at != std::string::npos)
+		{
+			const auto scene = patcher.find_scene(where.substr(0, at));
+			const auto location = std::stoul(where.substr(at + 1), nullptr, 0);
 
-			binop("lsl", Expr::Kind::Lsl);
-			break;
+			edits.push_back({ patcher.at(scene, location), static_cast<unsigned>(location), value });
 
-		case BC_OPCODE_LSR:
-			// push a, b => push a >> b
+			continue;
+		}
 
-			binop("lsr", Expr::Kind::Lsr);
-			break;
+		int scene = -1;
+		auto pattern = where;
 
-		case BC_OPCODE_EQ:
-			// push a, b => push a == b
+		if (pattern.compare(0, 7, "number:") != 0 && pattern.compare(0, 7, "string:") != 0)
+		{
+			const auto colon = pattern.find(':');
 
-			binop("eq", Expr::Kind::Eq);
-			break;
+			if (colon == std::string::npos)
+				throw std::runtime_error("Bad patch: " + spec); // TODO: better error
 
-		case BC_OPCODE_NE:
-			// push a, b => push a != b
+			scene = patcher.find_scene(pattern.substr(0, colon));
+			pattern = pattern.substr(colon + 1);
+		}
 
-			binop("ne", Expr::Kind::Ne);
-			break;
+		std::vector<PatchRef> found;
 
-		case BC_OPCODE_LT:
-			// push a, b => push a < b
+		if (pattern.compare(0, 7, "number:") == 0)
+			found = patcher.find_numbers(std::stol(pattern.substr(7), nullptr, 0), scene);
+		else if (pattern.compare(0, 7, "string:") == 0)
+			found = patcher.find_strings(pattern.substr(7), scene);
+		else
+			throw std::runtime_error("Bad patch: " + spec); // TODO: better error
 
-			binop("lt", Expr::Kind::Lt);
-			break;
+		if (found.empty())
+			std::cerr << spec << ": nothing matches" << std::endl;
 
-		case BC_OPCODE_LE:
-			// push a, b => push a <= b
+		for (auto ref : found)
+			edits.push_back({ ref, patcher.instruction(ref).location, value });
+	}
 
-			binop("le", Expr::Kind::Le);
-			break;
+	for (auto& edit : edits)
+	{
+		const auto ins = patcher.instruction(edit.ref);
+		const bool isString = ins.opcode == BC_OPCODE_STRING8 || ins.opcode == BC_OPCODE_STRING16 || ins.opcode == BC_OPCODE_STRING32;
 
-		case BC_OPCODE_GT:
-			// push a, b => push a > b
+		std::cerr << patcher.scene_name(edit.ref.scene) << "@" << edit.location << ": ";
 
-			binop("gt", Expr::Kind::Gt);
-			break;
+		if (isString)
+			std::cerr << "\"" << patcher.string_at(edit.ref) << "\" -> \"" << edit.value << "\"";
+		else
+			std::cerr << ins.operand << " -> " << edit.value;
 
-		case BC_OPCODE_GE:
-			// push a, b => push a >= b
+		const bool inPlace = isString
+			? patcher.set_string(edit.ref, edit.value)
+			: patcher.set_operand(edit.ref, std::stol(edit.value, nullptr, 0));
 
-			binop("ge", Expr::Kind::Ge);
-			break;
+		std::cerr << (inPlace ? " (in place)" : " (relocated)") << std::endl;
+	}
 
-		case BC_OPCODE_EQSTR:
-			// push a, b => push a <=> b
+	const auto result = patcher.result();
 
-			binop("eqstr", Expr::Kind::EqStr);
-			break;
+	if (!write_file(result, path))
+	{
+		std::cerr << "couldn't write " << path << std::endl;
+		return 1;
+	}
 
-		case BC_OPCODE_NESTR:
-			// push a, b => push a <!> b
+	std::cerr << "wrote " << result.size() << " bytes to " << path << std::endl;
 
-			binop("nestr", Expr::Kind::NeStr);
-			break;
+	return 0;
+}
 
-		case BC_OPCODE_NEG:
-			// push a => push -a
+struct TriggerOptions
+{
+	bool byTurn { false };
+	unsigned turn { 0u }, phase { 0u };
 
-			unop("neg", Expr::Kind::Neg);
-			break;
+	bool byPosition { false };
+	int x { 0 }, y { 0 };
+};
 
-		case BC_OPCODE_NOT:
-			// push a => push !a
+static
+int list_triggers(const CmbInfo& cmb, const TriggerOptions& options)
+{
+	const auto index = make_trigger_index(cmb);
 
-			unop("not", Expr::Kind::Not);
-			break;
+	std::vector<unsigned> scenes;
 
-		case BC_OPCODE_MVN:
-			// push a => push ~a
+	const auto print = [&] (const char* what)
+	{
+		std::cout << what << ":";
 
-			unop("mvn", Expr::Kind::BitwiseNot);
-			break;
+		for (auto scene : scenes)
+			std::cout << " " << cmb.scenes[scene].name;
 
-		case BC_OPCODE_CALL:
-			// push ... => push func(...)
+		std::cout << std::endl;
+	};
 
-			call(script.scenes[ins.operand].name.c_str(), script.scenes[ins.operand].argCnt);
-			break;
+	if (options.byTurn)
+	{
+		index.turn_events(options.turn, options.phase, scenes);
+		print("turn");
+	}
 
-		case BC_OPCODE_CALLEXT:
-			// push ... => push func(...)
+	if (options.byPosition)
+	{
+		index.area_events(options.x, options.y, scenes);
+		print("area");
+	}
 
-			call(script.get_cstr(ins.operand >> 8), ins.operand & 0xFF);
-			break;
+	return 0;
+}
 
-		case BC_OPCODE_RETURN:
-			// push a => return a
+} // namespace soren
 
-			expect_push("ret", [&] (auto& back)
-			{
-				back.kind = Stmt::Kind::Return;
-			});
+#include <iomanip>
 
-			break;
+static
+bool parse_binding(const char* text, std::pair<unsigned, std::int32_t>& binding)
+{
+	// <index>=<value>
 
-		case BC_OPCODE_B:
-			// goto off
+	const std::string str(text);
+	const auto eq = str.find('=');
 
-			result.push_back(Stmt::make_goto(ins.operand));
-			break;
+	if (eq == std::string::npos)
+		return false;
 
-		case BC_OPCODE_BN:
-			// push a => goto off if !a
+	binding.first = std::stoul(str.substr(0, eq));
+	binding.second = std::stol(str.substr(eq + 1), nullptr, 0);
 
-			expect_push("bn", [&] (auto& back)
-			{
-				auto expr = std::move(back.children[0]);
-				result.pop_back();
+	return true;
+}
 
-				result.push_back(Stmt::make_goto_if(ins.operand,
-					Expr::make_unique_unop(Expr::Kind::Not, std::move(expr))));
-			});
+// <a><sep><b>
+template<typename T>
+static
+bool parse_pair(const char* text, char sep, T& a, T& b)
+{
+	const std::string str(text);
+	const auto pos = str.find(sep);
 
-			break;
+	if (pos == std::string::npos)
+		return false;
 
-		case BC_OPCODE_BY:
-			// push a => goto off if a
+	a = std::stol(str.substr(0, pos));
+	b = std::stol(str.substr(pos + 1));
 
-			expect_push("by", [&] (auto& back)
-			{
-				auto expr = std::move(back.children[0]);
-				result.pop_back();
+	return true;
+}
 
-				result.push_back(Stmt::make_goto_if(ins.operand, std::move(expr)));
-			});
+// bytes, with an optional K, M or G suffix (powers of 1024)
+static
+bool parse_size(const char* text, std::uint64_t& size)
+{
+	if (*text < '0' || *text > '9')
+		return false;
 
-			break;
+	char* end;
+	errno = 0;
+	size = std::strtoull(text, &end, 10);
 
-		case BC_OPCODE_YIELD:
-			// yield
+	if (errno == ERANGE)
+		return false;
 
-			result.push_back(Stmt::make_yield());
-			break;
+	unsigned shift = 0;
 
-		case BC_OPCODE_40:
-			// nothing
+	switch (*end)
+	{
 
-			break;
+	case 0: return true;
+	case 'K': case 'k': shift = 10; break;
+	case 'M': case 'm': shift = 20; break;
+	case 'G': case 'g': shift = 30; break;
+	default: return false;
 
-		case BC_OPCODE_PRINTF:
-			// push ... => __printf(...)
+	} // switch (*end)
 
-			call("__printf", ins.operand);
-			result.back().kind = Stmt::Kind::Expr;
+	if (size > (std::numeric_limits<std::uint64_t>::max() >> shift))
+		return false;
 
-			break;
+	size <<= shift;
 
-		case BC_OPCODE_DUP:
-			// push a => push a, a
+	return end[1] == 0;
+}
 
-			expect_push("dup", [&] (auto& back)
-			{
-				result.push_back(Stmt::make_push(
-					Expr::make_unique_copy(*back.children[0])));
-			});
+// a positive amount of threads, clamped to a few per hardware thread (more only wastes memory on states)
+static
+bool parse_jobs(const char* text, unsigned& jobs)
+{
+	if (*text < '0' || *text > '9')
+		return false;
 
-			break;
+	char* end;
+	errno = 0;
+	const auto value = std::strtoull(text, &end, 10);
 
-		case BC_OPCODE_RETN:
-			// return 0
+	if (errno == ERANGE || *end != 0 || value == 0)
+		return false;
 
-			result.push_back(Stmt::make_return(
-				Expr::make_unique_intlit(0)));
+	const unsigned maxJobs = 4 * soren::resolve_thread_count(0);
+	jobs = static_cast<unsigned>(std::min<unsigned long long>(value, maxJobs));
 
-			break;
+	return true;
+}
 
-		case BC_OPCODE_RETY:
-			// return 1
+// <key>=<value>[,<key>=<value>...] with keys instructions, nodes and time (seconds)
+static
+bool parse_limits(const char* text, soren::WorkLimits& limits)
+{
+	std::istringstream in(text);
+	std::string item;
 
-			result.push_back(Stmt::make_return(
-				Expr::make_unique_intlit(1)));
+	while (std::getline(in, item, ','))
+	{
+		const auto eq = item.find('=');
 
-			break;
+		if (eq == std::string::npos)
+			return false;
 
-		case BC_OPCODE_ASSIGN:
-			// push a, b => [a] = b
+		const auto key = item.substr(0, eq);
+		const auto value = item.substr(eq + 1);
 
-			binop("assign", Expr::Kind::Assign);
-			result.back().kind = Stmt::Kind::Expr;
+		if (key == "instructions")
+			limits.instructions = std::stoull(value);
+		else if (key == "nodes")
+			limits.nodes = std::stoull(value);
+		else if (key == "time")
+			limits.seconds = std::stod(value);
+		else
+			return false;
+	}
 
-			break;
+	return true;
+}
 
-		case BC_FAKEOP_LAND:
-			// push a, b => push a && b
+static
+void print_usage(const char* name)
+{
+	std::cerr << "usage: " << name << " [options] <path/to/script.cmb>..." << std::endl
+		<< "options:" << std::endl
+		<< "  --run <event>          run event in the VM instead of dumping the script" << std::endl
+		<< "  --profile <out>        with --run, write sampled call stacks (folded, for flame graphs) to <out>" << std::endl
+		<< "  --profile-period <n>   with --profile, sample every <n> instructions (default 997)" << std::endl
+		<< "  --batch-states <file>  with --run, run once per line of <file> (initial global values)" << std::endl
+		<< "  --jobs <n>             worker threads for batch modes (default: one per hardware thread, at most four per)" << std::endl
+		<< "  --step-limit <n>       with --run, stop the event after <n> instructions in total, across yields (for each state" << std::endl
+		<< "                         with --batch-states), and with --layout-train, stop the training run after <n> instructions" << std::endl
+		<< "  --lanes                with --batch-states, run several states at once in the multi-lane VM" << std::endl
+		<< "  --specialize <event>   print the event specialized for the constants given by the following" << std::endl
+		<< "  --const-arg <i>=<v>    with --specialize, argument <i> is always <v>" << std::endl
+		<< "  --const-global <i>=<v> with --specialize, global variable <i> is always <v>" << std::endl
+		<< "  --inline               inline calls to small scenes before doing anything else" << std::endl
+		<< "  --compact-locals       share local slots between locals that are never needed at the same time (after --inline)" << std::endl
+		<< "  --layout               thread jumps, and remove jumps over jumps (after --compact-locals)" << std::endl
+		<< "  --layout-train <event> with --layout, also reorder code so that what runs most when running <event> falls through" << std::endl
+		<< "  --strip                remove scenes that can't be reached and strings that aren't used (after --layout)" << std::endl
+		<< "  --write <out>          write the (transformed) script to <out> instead of dumping it (one input file only)" << std::endl
+		<< "  --patch <patch>        with --write, patch the file as it is, <patch> being <scene>@<location>=<value>," << std::endl
+		<< "                         [<scene>:]number:<old>=<new> or [<scene>:]string:<old>=<new> (can be repeated)" << std::endl
+		<< "  --triggers <t>:<p>     list turn events that fire on turn <t>, phase <p>" << std::endl
+		<< "  --triggers-at <x>,<y>  list area events that fire at position <x>,<y>" << std::endl
+		<< "  --scene-budget <spec>  give up on scenes past limits, <spec> being instructions=<n>,nodes=<n>,time=<seconds> (any of them)" << std::endl
+		<< "  --file-budget <spec>   same for whole files (then moving on to the next file)" << std::endl
+		<< "  --stats                print time and performance counters for each stage of dumping to stderr" << std::endl
+		<< "  --tar                  paths are tar archives (- for stdin), of which .cmb members are processed" << std::endl
+		<< "  --pack <out>           write dumps to one pack file (entries named by path, see soren-unpack) instead of stdout" << std::endl
+		<< "  --max-memory <size>    keep the estimated memory of dumping a file under <size> (with K, M or G), giving up on what doesn't fit" << std::endl
+		<< "  --slowest <n>          print the <n> slowest scenes to dump (with their work and output size) to stderr" << std::endl;
+}
 
-			binop("fake!land", Expr::Kind::LogicalAnd);
-			break;
+int main(int argc, char** argv)
+{
+	std::vector<std::string> filenames;
+	soren::RunOptions runOptions;
+	soren::SpecializeOptions specializeOptions;
+	bool inlineCalls = false;
+	bool compactLocals = false;
+	bool layout = false;
+	std::string layoutTrainEvent;
+	bool strip = false;
+	std::string writePath;
+	soren::TriggerOptions triggerOptions;
+	soren::WorkLimits sceneLimits, fileLimits;
+	bool stats = false;
+	unsigned slowestCount = 0;
+	bool tarInput = false;
+	std::string packPath;
+	std::uint64_t maxMemory = 0;
+	std::vector<std::string> patches;
+
+	// values are parsed with std::stoul and the like, which throw on what isn't a number
+	int i = 1;
+
+	try
+	{
+		for (; i < argc; ++i)
+		{
+			const std::string arg = argv[i];
+			const bool hasValue = i + 1 < argc;
+
+			if (arg == "--run" && hasValue)
+				runOptions.event = argv[++i];
+			else if (arg == "--profile" && hasValue)
+				runOptions.profilePath = argv[++i];
+			else if (arg == "--profile-period" && hasValue)
+				runOptions.profilePeriod = std::max(1ull, std::stoull(argv[++i]));
+			else if (arg == "--batch-states" && hasValue)
+				runOptions.batchStatesPath = argv[++i];
+			else if (arg == "--jobs" && hasValue)
+			{
+				if (!parse_jobs(argv[++i], runOptions.threadCount))
+					return print_usage(argv[0]), 1;
+			}
+			else if (arg == "--step-limit" && hasValue)
+				runOptions.stepLimit = std::stoull(argv[++i]);
+			else if (arg == "--lanes")
+				runOptions.lanes = true;
+			else if (arg == "--inline")
+				inlineCalls = true;
+			else if (arg == "--compact-locals")
+				compactLocals = true;
+			else if (arg == "--layout")
+				layout = true;
+			else if (arg == "--layout-train" && hasValue)
+				layoutTrainEvent = argv[++i];
+			else if (arg == "--strip")
+				strip = true;
+			else if (arg == "--write" && hasValue)
+				writePath = argv[++i];
+			else if (arg == "--triggers" && hasValue)
+			{
+				triggerOptions.byTurn = true;
 
-		case BC_FAKEOP_LORR:
-			// push a, b => push a || b
+				if (!parse_pair(argv[++i], ':', triggerOptions.turn, triggerOptions.phase))
+					return print_usage(argv[0]), 1;
+			}
+			else if (arg == "--triggers-at" && hasValue)
+			{
+				triggerOptions.byPosition = true;
 
-			binop("fake!lorr", Expr::Kind::LogicalOr);
-			break;
+				if (!parse_pair(argv[++i], ',', triggerOptions.x, triggerOptions.y))
+					return print_usage(argv[0]), 1;
+			}
+			else if (arg == "--scene-budget" && hasValue)
+			{
+				if (!parse_limits(argv[++i], sceneLimits))
+					return print_usage(argv[0]), 1;
+			}
+			else if (arg == "--file-budget" && hasValue)
+			{
+				if (!parse_limits(argv[++i], fileLimits))
+					return print_usage(argv[0]), 1;
+			}
+			else if (arg == "--stats")
+				stats = true;
+			else if (arg == "--slowest" && hasValue)
+				slowestCount = std::stoul(argv[++i]);
+			else if (arg == "--tar")
+				tarInput = true;
+			else if (arg == "--patch" && hasValue)
+				patches.push_back(argv[++i]);
+			else if (arg == "--pack" && hasValue)
+				packPath = argv[++i];
+			else if (arg == "--max-memory" && hasValue)
+			{
+				if (!parse_size(argv[++i], maxMemory))
+					return print_usage(argv[0]), 1;
+			}
+			else if (arg == "--specialize" && hasValue)
+				specializeOptions.event = argv[++i];
+			else if (arg == "--const-arg" && hasValue)
+			{
+				specializeOptions.constants.args.emplace_back();
 
-		default:
-			throw false; // FIXME: unsupported opcode
+				if (!parse_binding(argv[++i], specializeOptions.constants.args.back()))
+					return print_usage(argv[0]), 1;
+			}
+			else if (arg == "--const-global" && hasValue)
+			{
+				specializeOptions.constants.globals.emplace_back();
 
-		} // switch (ins.opcode)
+				if (!parse_binding(argv[++i], specializeOptions.constants.globals.back()))
+					return print_usage(argv[0]), 1;
+			}
+			else if (arg.size() > 1 && arg[0] == '-')
+				return print_usage(argv[0]), 1;
+			else
+				filenames.push_back(arg);
+		}
+	}
+	catch (const std::logic_error&)
+	{
+		std::cerr << "bad value for " << argv[i - 1] << ": " << argv[i] << std::endl;
+		return print_usage(argv[0]), 1;
 	}
 
-	return result;
-}
+	if (filenames.empty() || (!patches.empty() && writePath.empty()))
+		return print_usage(argv[0]), 1;
 
-std::ostream& operator << (std::ostream& os, const Expr& expr)
-{
-	switch (expr.kind)
+	// every input would be written to the same place, each one overwriting the last
+	if (!writePath.empty() && (filenames.size() > 1 || tarInput))
 	{
+		std::cerr << "--write can only be used with a single input file" << std::endl;
+		return 1;
+	}
 
-	case Expr::Kind::IntLiteral:
-		return os << std::dec << expr.literal;
-
-	case Expr::Kind::StrLiteral:
-		return os << "\"" << expr.named << "\"";
+	soren::WorkBudget budget(sceneLimits, fileLimits);
 
-	case Expr::Kind::Named:
-		return os << expr.named;
+	std::unique_ptr<soren::PerfCounters> counters;
 
-	case Expr::Kind::Deref:
-		return os << "[" << *expr.children[0] << "]";
+	if (stats)
+		counters = std::make_unique<soren::PerfCounters>();
 
-	case Expr::Kind::Addrof:
-		return os << "&" << *expr.children[0];
+	soren::DecompileStats decompileStats(counters.get());
 
-	case Expr::Kind::Assign:
-		return os << "[" << *expr.children[0] << "] = " << *expr.children[1];
+	std::unique_ptr<soren::PackWriter> pack;
 
-	case Expr::Kind::Add:
-		return os << *expr.children[0] << " + " << *expr.children[1];
+	if (!packPath.empty())
+	{
+		try
+		{
+			pack = std::make_unique<soren::PackWriter>(packPath);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+	}
 
-	case Expr::Kind::Sub:
-		return os << *expr.children[0] << " - " << *expr.children[1];
+	std::ostream packOut(pack.get());
 
-	case Expr::Kind::Mul:
-		return os << *expr.children[0] << " * " << *expr.children[1];
+	// scenes are printed through a counting buffer only when counting, as it costs a call per character
 
-	case Expr::Kind::Div:
-		return os << *expr.children[0] << " / " << *expr.children[1];
+	soren::SlowestScenes slowest(slowestCount);
+	soren::CountingBuffer countingBuffer(pack ? pack.get() : std::cout.rdbuf());
+	std::ostream countingOut(&countingBuffer);
 
-	case Expr::Kind::Mod:
-		return os << *expr.children[0] << " % " << *expr.children[1];
+	std::ostream& dumpOut = slowestCount != 0 ? countingOut : (pack ? packOut : std::cout);
 
-	case Expr::Kind::And:
-		return os << *expr.children[0] << " & " << *expr.children[1];
+	// with --max-memory, the byte budget is what is left beside what is already in memory
+	const auto memory_left = [&] (std::uint64_t used) -> std::uint64_t
+	{
+		return used < maxMemory ? maxMemory - used : 1u;
+	};
 
-	case Expr::Kind::Or:
-		return os << *expr.children[0] << " | " << *expr.children[1];
+	const auto process_file = [&] (const std::string& filename, std::vector<soren::byte_type>& data)
+	{
+		if (!patches.empty())
+			return soren::patch_cmb(data, patches, writePath);
 
-	case Expr::Kind::Xor:
-		return os << *expr.children[0] << " ^ " << *expr.children[1];
+		budget.begin_file();
 
-	case Expr::Kind::Lsl:
-		return os << *expr.children[0] << " << " << *expr.children[1];
+		if (maxMemory != 0)
+		{
+			// decoding charges the instructions it makes, which have to fit beside the input
+			// inputs that don't fit at all were turned down before being read
 
-	case Expr::Kind::Lsr:
-		return os << *expr.children[0] << " >> " << *expr.children[1];
+			budget.fileLimits.bytes = memory_left(data.capacity());
+			budget.sceneLimits.bytes = 0;
+		}
 
-	case Expr::Kind::Not:
-		return os << "!" << *expr.children[0];
+		auto cmb = [&] ()
+		{
+			soren::PerfScope scope(counters.get(), decompileStats.phases[soren::DecompileStats::PHASE_DECODE]);
 
-	case Expr::Kind::Neg:
-		return os << "-" << *expr.children[0];
+			try
+			{
+				return soren::decode_cmb(data, soren::GameKind::FE10, &budget);
+			}
+			catch (const std::exception& e)
+			{
+				SOREN_TRACE2(decode__error, filename.c_str(), e.what());
+				throw;
+			}
+		} ();
 
-	case Expr::Kind::BitwiseNot:
-		return os << "~" << *expr.children[0];
+		// the input isn't needed past decoding, and from then on each scene is limited to what is left beside the cmb
+		if (maxMemory != 0)
+		{
+			std::vector<soren::byte_type>().swap(data);
+			budget.fileLimits.bytes = 0;
+		}
 
-	case Expr::Kind::Eq:
-		return os << *expr.children[0] << " == " << *expr.children[1];
+		if (inlineCalls)
+			soren::inline_scene_calls(cmb);
 
-	case Expr::Kind::Ne:
-		return os << *expr.children[0] << " != " << *expr.children[1];
+		if (compactLocals)
+			soren::compact_scene_locals(cmb);
 
-	case Expr::Kind::Lt:
-		return os << *expr.children[0] << " <? " << *expr.children[1];
+		if (layout)
+			soren::layout_scenes(cmb, layoutTrainEvent, runOptions.stepLimit);
 
-	case Expr::Kind::Le:
-		return os << *expr.children[0] << " <= " << *expr.children[1];
+		if (strip)
+			soren::strip_cmb(cmb);
 
-	case Expr::Kind::Gt:
-		return os << *expr.children[0] << " >? " << *expr.children[1];
+		if (!writePath.empty())
+			return soren::write_cmb(cmb, writePath);
 
-	case Expr::Kind::Ge:
-		return os << *expr.children[0] << " >=? " << *expr.children[1];
+		if (triggerOptions.byTurn || triggerOptions.byPosition)
+			return soren::list_triggers(cmb, triggerOptions);
 
-	case Expr::Kind::EqStr:
-		return os << *expr.children[0] << " <=> " << *expr.children[1];
+		if (!runOptions.event.empty())
+			return soren::run_event(cmb, runOptions);
 
-	case Expr::Kind::NeStr:
-		return os << *expr.children[0] << " <!> " << *expr.children[1];
+		if (!specializeOptions.event.empty())
+			return soren::specialize_event(cmb, specializeOptions);
 
-	case Expr::Kind::LogicalAnd:
-		return os << *expr.children[0] << " && " << *expr.children[1];
+		for (auto& gvar : cmb.globalNames)
+			dumpOut << "VARIABLE " << gvar << ";" << std::endl;
 
-	case Expr::Kind::LogicalOr:
-		return os << *expr.children[0] << " || " << *expr.children[1];
+		if (cmb.globalNames.size() > 0)
+			dumpOut << std::endl;
 
-	case Expr::Kind::Func:
-		os << expr.named << "(";
+		std::uint64_t cmbBytes = maxMemory != 0 ? cmb_heap_size(cmb) : 0;
 
-		for (unsigned i = 0; i < expr.children.size(); ++i)
+		for (auto& scene : cmb.scenes)
 		{
-			if (i != 0)
-				os << ", ";
+			budget.begin_scene();
 
-			os << *expr.children[i];
-		}
+			SOREN_TRACE3(scene__start, filename.c_str(), scene.name.c_str(), scene.idx);
 
-		return os << ")";
+			const auto sceneStart = std::chrono::steady_clock::now();
+			const auto bytesBefore = countingBuffer.count;
 
-	default:
-		return os << "<expr>";
+			if (maxMemory != 0)
+				budget.sceneLimits.bytes = memory_left(cmbBytes);
 
-	} // switch (expr.kind)
-}
+			const auto finish_scene = [&] (bool failed)
+			{
+				SOREN_TRACE3(scene__end, filename.c_str(), scene.name.c_str(), failed);
 
-std::ostream& operator << (std::ostream& os, const Stmt& stmt)
-{
-	switch (stmt.kind)
-	{
+				const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - sceneStart).count();
 
-	case Stmt::Kind::Invalid:
-		return os << "<invalid statement>" << std::endl;
+				if (slowestCount != 0 && slowest.wants(seconds))
+				{
+					soren::SceneCost cost;
 
-	case Stmt::Kind::Push:
-		return os << "push " << *stmt.children[0] << ";";
+					cost.file = filename;
+					cost.scene = scene.name;
+					cost.seconds = seconds;
+					cost.instructions = scene.rawScript.size() + budget.scene_instructions();
+					cost.nodes = budget.scene_nodes();
+					cost.outputBytes = countingBuffer.count - bytesBefore;
+					cost.failed = failed;
 
-	case Stmt::Kind::Expr:
-		return os << *stmt.children[0] << ";";
+					slowest.add(std::move(cost));
+				}
 
-	case Stmt::Kind::Return:
-		return os << "return " << *stmt.children[0] << ";";
+				// with --max-memory, what only printing the scene needed goes right away (calls to it only need its name)
 
-	case Stmt::Kind::Goto:
-		return os << "goto " << *stmt.children[0] << ";";
+				if (maxMemory != 0)
+				{
+					cmbBytes -= scene_heap_size(scene);
 
-	case Stmt::Kind::GotoIf:
-		return os << "goto " << *stmt.children[0] << " if " << *stmt.children[1] << ";";
+					std::vector<soren::BcIns>().swap(scene.rawScript);
+					std::vector<std::string>().swap(scene.varnames);
 
-	case Stmt::Kind::Yield:
-		return os << "yield;";
+					cmbBytes += scene_heap_size(scene);
+				}
+			};
 
-	} // switch (stmt.kind)
-}
+			try {
+			soren::print_scene(dumpOut, cmb, scene, &budget, &decompileStats);
+			} catch(const soren::BudgetExceeded& e) {
+				dumpOut << "FAILED " << scene.name << std::endl << "}" << std::endl << std::endl;
+				std::cerr << filename << ": " << scene.name << ": " << e.what() << std::endl;
 
-} // namespace soren
+				finish_scene(true);
 
-#include <iomanip>
+				if (e.wholeFile)
+					throw;
 
-int main(int argc, char** argv)
-{
-	if (argc < 2)
-		return 1;
+				continue;
+			} catch(...) {
+				dumpOut << "FAILED " << scene.name << std::endl << "}" << std::endl << std::endl;
 
-	std::string filename = argv[1];
+				finish_scene(true);
+				continue;
+			}
 
-	const auto data = soren::read_entire_file(filename.c_str());
-	const auto span = soren::Span<const soren::byte_type>(data);
-	const auto cmb = soren::decode_cmb(span, soren::GameKind::FE10);
+			finish_scene(false);
+		}
 
-	for (auto& gvar : cmb.globalNames)
-		std::cout << "VARIABLE " << gvar << ";" << std::endl;
+		return 0;
+	};
 
-	if (cmb.globalNames.size() > 0)
-		std::cout << std::endl;
+	int result = 0;
 
-	for (auto& scene : cmb.scenes)
+	// file contents, reused from one file (or archive member) to the next
+	std::vector<soren::byte_type> data;
+
+	// read_data fills data
+	const auto process_input = [&] (const std::string& filename, const auto& read_data)
 	{
-		try {
-		std::cout << "EVENT " << scene.name << "(";
+		if (pack)
+			pack->begin_entry(filename);
+		else if (filenames.size() > 1 || tarInput)
+			std::cout << "// " << filename << std::endl << std::endl;
 
-		for (unsigned i = 0; i < scene.argCnt; ++i)
-		{
-			if (i != 0)
-				std::cout << ", ";
+		// one bad file shouldn't stop the others
 
-			std::cout << scene.varnames[i];
-		}
+		SOREN_TRACE1(file__start, filename.c_str());
+
+		int status = 1;
 
-		std::cout << ")";
+		try
+		{
+			read_data();
+			status = process_file(filename, data);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << filename << ": " << e.what() << std::endl;
+		}
+		catch (const char* e)
+		{
+			std::cerr << filename << ": " << e << std::endl;
+		}
 
-		if (scene.isGlobal)
-			std::cout << " global";
+		SOREN_TRACE2(file__end, filename.c_str(), status);
 
-		std::cout << std::endl;
-		std::cout << "{" << std::endl;
+		if (pack)
+			pack->end_entry();
 
-		const auto slices = soren::slice_script(scene.rawScript);
+		result = std::max(result, status);
+	};
 
-		const auto labels = [&] ()
+	for (auto& filename : filenames)
+	{
+		if (!tarInput)
 		{
-			soren::NameMap result;
+			process_input(filename, [&] () { data = soren::read_entire_file(filename.c_str(), maxMemory); });
+			continue;
+		}
 
-			for (auto& slice : slices)
-			{
-				for (auto& ins : slice.second)
-				{
-					if (ins.is_jump() && !ins.is_jump_keep())
-						result.set(ins.operand, [&] () { std::string r("label_"); r.append(std::to_string(ins.operand)); return r; } ());
-				}
-			}
+		// .cmb members of the archive are decoded straight from the stream, named by their path in it
 
-			return result;
-		} ();
+		std::ifstream file;
 
-		for (auto& slice : slices)
+		if (filename != "-")
 		{
-			if (slice.second.empty())
+			file.open(filename, std::ios::binary);
+
+			if (!file.is_open())
+			{
+				std::cerr << filename << ": couldn't open archive" << std::endl;
+				result = 1;
 				continue;
+			}
+		}
 
-			if (slice.first != 0)
-				std::cout << std::endl;
+		try
+		{
+			soren::TarReader tar(filename != "-" ? file : std::cin);
 
-			labels.for_at(slice.first, [&] (auto& name)
+			while (tar.next())
 			{
-				std::cout << name << ":" << std::endl;
-			});
+				const auto& path = tar.path();
+
+				if (path.size() < 4 || path.compare(path.size() - 4, 4, ".cmb") != 0)
+					continue;
 
-			// TODO: check whether any bkn/bky jumps to another slice, because that would be bad
-			const auto fixedSlice = soren::get_bks_as_fake_logic(slice.second);
+				process_input(path, [&] ()
+				{
+					if (maxMemory != 0 && tar.size() >= maxMemory)
+						throw std::runtime_error("file doesn't fit in --max-memory"); // TODO: better error
 
-			for (auto& stmt : soren::make_statements(cmb, scene, fixedSlice))
-				std::cout << "  " << stmt << std::endl;
+					tar.read(data);
+				});
+			}
 		}
+		catch (const std::exception& e)
+		{
+			std::cerr << filename << ": " << e.what() << std::endl;
+			result = 1;
+		}
+	}
 
-		std::cout << "}" << std::endl << std::endl;
-		} catch(...) {std::cout << "FAILED " << scene.name << std::endl << "}" << std::endl << std::endl;}
+	if (pack)
+	{
+		try
+		{
+			pack->finish();
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << packPath << ": " << e.what() << std::endl;
+			result = 1;
+		}
 	}
 
-	return 0;
+	if (stats)
+		decompileStats.write(std::cerr);
+
+	if (slowestCount != 0)
+		slowest.write(std::cerr);
+
+	return result;
 }
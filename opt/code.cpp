@@ -0,0 +1,318 @@
+
+#include "opt/optimize.h"
+#include "encode/encode.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace soren {
+
+std::vector<BcIns> index_jumps(Span<const BcIns> script)
+{
+	std::vector<BcIns> result(script.begin(), script.end());
+
+	for (auto& ins : result)
+	{
+		if (!ins.is_jump())
+			continue;
+
+		const auto target = static_cast<unsigned>(ins.operand);
+
+		auto it = std::lower_bound(script.begin(), script.end(), target,
+			[] (const BcIns& a, unsigned b) { return a.location < b; });
+
+		if (it == script.end() || it->location != target)
+			throw std::runtime_error("Jump target is not an instruction."); // TODO: better error
+
+		ins.operand = it - script.begin();
+	}
+
+	return result;
+}
+
+std::vector<BcIns> unindex_jumps(std::vector<BcIns> code, GameKind game)
+{
+	for (auto& ins : code)
+		fit_operand_size(ins);
+
+	layout_script(code, game);
+
+	for (auto& ins : code)
+	{
+		if (!ins.is_jump())
+			continue;
+
+		if (ins.operand < 0 || static_cast<unsigned>(ins.operand) >= code.size())
+			throw std::runtime_error("Jump target is out of the code."); // TODO: better error
+
+		ins.operand = code[ins.operand].location;
+	}
+
+	return code;
+}
+
+void erase_instructions(std::vector<BcIns>& code, const std::vector<bool>& erase)
+{
+	// newIndex[i] is the new index of the first kept instruction at or after i
+
+	std::vector<std::int32_t> newIndex(code.size() + 1);
+	std::int32_t kept = 0;
+
+	for (unsigned i = 0; i < code.size(); ++i)
+	{
+		newIndex[i] = kept;
+
+		if (!erase[i])
+			kept++;
+	}
+
+	newIndex[code.size()] = kept;
+
+	unsigned j = 0;
+
+	for (unsigned i = 0; i < code.size(); ++i)
+	{
+		if (erase[i])
+			continue;
+
+		auto ins = code[i];
+
+		if (ins.is_jump())
+			ins.operand = newIndex[ins.operand];
+
+		code[j++] = ins;
+	}
+
+	code.resize(j);
+}
+
+void insert_instructions(std::vector<BcIns>& code, unsigned index, Span<const BcIns> instructions, bool jumpToInserted)
+{
+	const std::int32_t count = instructions.size();
+
+	for (auto& ins : code)
+	{
+		if (!ins.is_jump())
+			continue;
+
+		if (ins.operand > static_cast<std::int32_t>(index) || (ins.operand == static_cast<std::int32_t>(index) && !jumpToInserted))
+			ins.operand += count;
+	}
+
+	code.insert(code.begin() + index, instructions.begin(), instructions.end());
+
+	// inserted jumps are expected to already be relative to the final code
+}
+
+std::vector<bool> find_reachable(Span<const BcIns> code)
+{
+	std::vector<bool> result(code.size(), false);
+	std::vector<unsigned> work;
+
+	if (!code.empty())
+		work.push_back(0);
+
+	while (!work.empty())
+	{
+		unsigned i = work.back();
+		work.pop_back();
+
+		// follow fall-through as far as it goes, and queue jump targets
+
+		while (i < code.size() && !result[i])
+		{
+			result[i] = true;
+
+			auto& ins = code[i];
+
+			if (ins.is_jump())
+				work.push_back(ins.operand);
+
+			if (ins.is_end() || ins.opcode == BC_OPCODE_B)
+				break;
+
+			i++;
+		}
+	}
+
+	return result;
+}
+
+bool erase_unreachable(std::vector<BcIns>& code)
+{
+	const auto reachable = find_reachable(code);
+
+	if (std::find(reachable.begin(), reachable.end(), false) == reachable.end())
+		return false;
+
+	std::vector<bool> unreachable(reachable.size());
+	std::transform(reachable.begin(), reachable.end(), unreachable.begin(), [] (bool b) { return !b; });
+
+	erase_instructions(code, unreachable);
+
+	return true;
+}
+
+std::vector<bool> find_jump_targets(Span<const BcIns> code)
+{
+	std::vector<bool> result(code.size(), false);
+
+	for (auto& ins : code)
+		if (ins.is_jump() && static_cast<unsigned>(ins.operand) < code.size())
+			result[ins.operand] = true;
+
+	return result;
+}
+
+void terminate_code(std::vector<BcIns>& code, GameKind game)
+{
+	if (!code.empty() && code.back().is_end())
+		return;
+
+	if (game == GameKind::FE10)
+	{
+		code.push_back(make_ins(BC_OPCODE_RETN));
+	}
+	else
+	{
+		code.push_back(make_ins(BC_OPCODE_NUMBER8, 0));
+		code.push_back(make_ins(BC_OPCODE_RETURN));
+	}
+}
+
+StackEffect stack_effect(const CmbInfo& cmb, const BcIns& ins)
+{
+	switch (ins.opcode)
+	{
+
+	case BC_OPCODE_VALX8:  case BC_OPCODE_VALX16:
+	case BC_OPCODE_VALY8:  case BC_OPCODE_VALY16:
+	case BC_OPCODE_REFX8:  case BC_OPCODE_REFX16:
+	case BC_OPCODE_REFY8:  case BC_OPCODE_REFY16:
+	case BC_OPCODE_GVALX8: case BC_OPCODE_GVALX16:
+	case BC_OPCODE_GVALY8: case BC_OPCODE_GVALY16:
+	case BC_OPCODE_GREFX8: case BC_OPCODE_GREFX16:
+	case BC_OPCODE_GREFY8: case BC_OPCODE_GREFY16:
+	case BC_OPCODE_NEG:
+	case BC_OPCODE_MVN:
+	case BC_OPCODE_NOT:
+		return { 1, 1 };
+
+	case BC_OPCODE_DEREF:
+	case BC_OPCODE_DUP:
+		return { 1, 2 };
+
+	case BC_OPCODE_STORE:
+	case BC_OPCODE_ADD:
+	case BC_OPCODE_SUB:
+	case BC_OPCODE_MUL:
+	case BC_OPCODE_DIV:
+	case BC_OPCODE_MOD:
+	case BC_OPCODE_ORR:
+	case BC_OPCODE_AND:
+	case BC_OPCODE_XOR:
+	case BC_OPCODE_LSL:
+	case BC_OPCODE_LSR:
+	case BC_OPCODE_EQ:
+	case BC_OPCODE_NE:
+	case BC_OPCODE_LT:
+	case BC_OPCODE_LE:
+	case BC_OPCODE_GT:
+	case BC_OPCODE_GE:
+	case BC_OPCODE_EQSTR:
+	case BC_OPCODE_NESTR:
+	case BC_FAKEOP_LAND:
+	case BC_FAKEOP_LORR:
+		return { 2, 1 };
+
+	case BC_OPCODE_CALL:
+		if (ins.operand < 0 || static_cast<unsigned>(ins.operand) >= cmb.scenes.size())
+			throw std::runtime_error("Call to non-existent scene."); // TODO: better error
+
+		return { cmb.scenes[ins.operand].argCnt, 1 };
+
+	case BC_OPCODE_CALLEXT:
+		return { static_cast<unsigned>(ins.operand & 0xFF), 1 };
+
+	case BC_OPCODE_PRINTF:
+		return { static_cast<unsigned>(ins.operand), 0 };
+
+	case BC_OPCODE_RETURN:
+	case BC_OPCODE_BY:
+	case BC_OPCODE_BN:
+	case BC_OPCODE_BKY:
+	case BC_OPCODE_BKN:
+		return { 1, 0 };
+
+	} // switch (ins.opcode)
+
+	// everything else only pops or only pushes (or neither)
+
+	const int diff = ins.info().stackDiff;
+
+	if (diff > 0)
+		return { 0, static_cast<unsigned>(diff) };
+
+	return { static_cast<unsigned>(-diff), 0 };
+}
+
+bool compute_stack_depths(const CmbInfo& cmb, Span<const BcIns> code, std::vector<int>& depths)
+{
+	depths.assign(code.size(), -1);
+
+	std::vector<unsigned> work;
+
+	const auto reach = [&] (std::int32_t index, int depth)
+	{
+		if (index < 0 || static_cast<unsigned>(index) >= code.size())
+			return false;
+
+		if (depths[index] == -1)
+		{
+			depths[index] = depth;
+			work.push_back(index);
+		}
+
+		return depths[index] == depth;
+	};
+
+	if (!code.empty() && !reach(0, 0))
+		return false;
+
+	while (!work.empty())
+	{
+		const unsigned i = work.back();
+		work.pop_back();
+
+		auto& ins = code[i];
+		const auto effect = stack_effect(cmb, ins);
+
+		const int depth = depths[i];
+
+		if (depth < static_cast<int>(effect.pops))
+			return false;
+
+		const int after = depth - effect.pops + effect.pushes;
+
+		if (ins.is_end())
+			continue;
+
+		if (ins.opcode == BC_OPCODE_B)
+		{
+			if (!reach(ins.operand, depth))
+				return false;
+
+			continue;
+		}
+
+		if (ins.is_jump() && !reach(ins.operand, ins.is_jump_keep() ? depth : after))
+			return false;
+
+		if (!reach(i + 1, after))
+			return false;
+	}
+
+	return true;
+}
+
+} // namespace soren
@@ -0,0 +1,624 @@
+
+#include "opt/optimize.h"
+
+#include "decompile/decompile.h"
+
+#include <algorithm>
+
+namespace soren {
+
+namespace {
+
+struct InlineCallee
+{
+	bool inlinable = false;
+
+	// whether the body has jumps other than keeping ones
+	// the decompiler (and the game's compiler) never keeps values on the stack across labels,
+	// so those are only inlined where the stack is otherwise empty
+	bool branching = false;
+
+	// the rewritten body: returns removed (straight-line callees) or replaced by an assignment
+	// to an extra local and a jump to a final read of it (branching ones)
+	// jump operands are indices in the body, body.size() being the instruction after it
+	std::vector<BcIns> body;
+
+	// number of locals used by the body, including the extra one
+	unsigned varAmt = 0;
+
+	// locals that may be read before being written, and so need to be zeroed like a call would
+	std::vector<unsigned> zeroedLocals;
+
+	// arguments only ever read with plain val, for which constants can be substituted
+	std::vector<bool> plainArgs;
+
+	unsigned sites = 0;
+};
+
+} // namespace
+
+static inline
+bool is_local_access(std::uint8_t opcode)
+{
+	// val, valx, valy, ref, refx, refy: operand is a local slot
+	return opcode >= BC_OPCODE_VAL8 && opcode <= BC_OPCODE_REFY16;
+}
+
+static inline
+bool is_constant(const BcIns& ins)
+{
+	switch (ins.opcode)
+	{
+
+	case BC_OPCODE_NUMBER8:
+	case BC_OPCODE_NUMBER16:
+	case BC_OPCODE_NUMBER32:
+	case BC_OPCODE_STRING8:
+	case BC_OPCODE_STRING16:
+	case BC_OPCODE_STRING32:
+		return true;
+
+	default:
+		return false;
+
+	} // switch (ins.opcode)
+}
+
+static
+void append_assign(std::vector<BcIns>& out, GameKind game)
+{
+	// pops address and value, like a statement-level assignment does
+
+	if (game == GameKind::FE10)
+	{
+		out.push_back(make_ins(BC_OPCODE_ASSIGN));
+	}
+	else
+	{
+		out.push_back(make_ins(BC_OPCODE_STORE));
+		out.push_back(make_ins(BC_OPCODE_DISC));
+	}
+}
+
+// finds the instructions pushing each argument of the call at code[call]
+// on success, the arguments start at code[start] and argument k ends with code[ends[k]]
+static
+bool find_argument_ranges(const CmbInfo& cmb, Span<const BcIns> code, const std::vector<int>& depths,
+	unsigned call, unsigned argCnt, unsigned& start, std::vector<unsigned>& ends)
+{
+	ends.assign(argCnt, 0);
+	start = call;
+
+	if (argCnt == 0)
+		return true;
+
+	const int base = depths[call] - static_cast<int>(argCnt);
+
+	if (base < 0)
+		return false;
+
+	// walk back to where the stack was last at the depth it has below the arguments
+
+	for (;;)
+	{
+		if (start == 0)
+			return false;
+
+		start--;
+
+		auto& ins = code[start];
+
+		if (depths[start] < 0 || ins.is_end() || (ins.is_jump() && !ins.is_jump_keep()) || ins.opcode == BC_OPCODE_YIELD)
+			return false;
+
+		if (depths[start] < base)
+			return false;
+
+		if (depths[start] == base)
+			break;
+	}
+
+	// argument k ends with the last instruction that touches stack slot base+k or below
+
+	for (unsigned k = 0; k < argCnt; ++k)
+	{
+		const int slot = base + static_cast<int>(k);
+		bool found = false;
+
+		for (unsigned j = call; j-- > start;)
+		{
+			const auto effect = stack_effect(cmb, code[j]);
+
+			if (depths[j] - static_cast<int>(effect.pops) <= slot)
+			{
+				// the instruction must push exactly up to this argument (dup could push two arguments at once)
+				if (depths[j] - static_cast<int>(effect.pops) + static_cast<int>(effect.pushes) != slot + 1)
+					return false;
+
+				ends[k] = j;
+				found = true;
+				break;
+			}
+		}
+
+		if (!found || (k > 0 && ends[k] <= ends[k-1]))
+			return false;
+	}
+
+	if (ends[argCnt-1] + 1 != call)
+		return false;
+
+	// no jumping into the arguments from elsewhere, and keeping jumps in an argument stay in it
+
+	for (unsigned i = 0; i < code.size(); ++i)
+	{
+		auto& ins = code[i];
+
+		if (!ins.is_jump())
+			continue;
+
+		const auto target = static_cast<unsigned>(ins.operand);
+
+		if (i < start || i >= call)
+		{
+			if (target > start && target <= call)
+				return false;
+
+			continue;
+		}
+
+		const auto k = std::lower_bound(ends.begin(), ends.end(), i) - ends.begin();
+
+		if (target <= i || target > ends[k] + 1)
+			return false;
+	}
+
+	return true;
+}
+
+// finds which locals of the callee need zeroing and which arguments are only read directly
+static
+void analyze_callee_locals(const CmbInfo& cmb, const SceneInfo& scene, Span<const BcIns> code, const std::vector<int>& depths, InlineCallee& callee)
+{
+	const unsigned varAmt = std::max<unsigned>(scene.varnames.size(), scene.argCnt);
+
+	callee.plainArgs.assign(scene.argCnt, false);
+	callee.zeroedLocals.clear();
+
+	for (unsigned i = scene.argCnt; i < varAmt; ++i)
+		callee.zeroedLocals.push_back(i);
+
+	// indexed accesses could reach any slot, don't bother then
+
+	const auto is_indexed = [] (std::uint8_t opcode)
+	{
+		return opcode >= BC_OPCODE_VALX8 && opcode <= BC_OPCODE_REFY16
+			&& opcode != BC_OPCODE_REF8 && opcode != BC_OPCODE_REF16;
+	};
+
+	for (auto& ins : code)
+		if (is_indexed(ins.opcode))
+			return;
+
+	const auto is_ref = [] (const BcIns& ins) { return ins.opcode == BC_OPCODE_REF8 || ins.opcode == BC_OPCODE_REF16; };
+
+	callee.plainArgs.assign(scene.argCnt, true);
+
+	for (auto& ins : code)
+		if (is_ref(ins) && static_cast<unsigned>(ins.operand) < scene.argCnt)
+			callee.plainArgs[ins.operand] = false;
+
+	// a local doesn't need zeroing if, before any jump, its first use is taking its address for an assignment
+	// whose value doesn't read it
+
+	const auto targets = find_jump_targets(code);
+
+	std::vector<bool> used(varAmt, false);
+	std::vector<bool> assignedFirst(varAmt, false);
+
+	const auto breaks_flow = [&] (unsigned i)
+	{
+		return (i > 0 && targets[i]) || code[i].is_jump() || code[i].is_end();
+	};
+
+	for (unsigned i = 0; i < code.size() && !breaks_flow(i); ++i)
+	{
+		auto& ins = code[i];
+
+		if (!is_local_access(ins.opcode))
+			continue;
+
+		const auto slot = static_cast<unsigned>(ins.operand);
+
+		if (slot >= varAmt || used[slot])
+			continue;
+
+		used[slot] = true;
+
+		if (!is_ref(ins))
+			continue;
+
+		for (unsigned j = i + 1; j < code.size() && !breaks_flow(j); ++j)
+		{
+			if (is_local_access(code[j].opcode) && static_cast<unsigned>(code[j].operand) == slot)
+				break;
+
+			const int lowWater = depths[j] - static_cast<int>(stack_effect(cmb, code[j]).pops);
+
+			if (lowWater > depths[i])
+				continue;
+
+			const bool assigns = code[j].opcode == BC_OPCODE_ASSIGN || code[j].opcode == BC_OPCODE_STORE;
+			assignedFirst[slot] = assigns && lowWater == depths[i];
+
+			break;
+		}
+	}
+
+	callee.zeroedLocals.erase(std::remove_if(callee.zeroedLocals.begin(), callee.zeroedLocals.end(),
+		[&] (unsigned slot) { return assignedFirst[slot]; }), callee.zeroedLocals.end());
+}
+
+static
+InlineCallee prepare_callee(const CmbInfo& cmb, const SceneInfo& scene, unsigned sceneIdx, GameKind game)
+{
+	InlineCallee result;
+
+	auto code = index_jumps(scene.rawScript);
+
+	erase_unreachable(code);
+
+	std::vector<int> depths;
+
+	if (code.empty() || !compute_stack_depths(cmb, code, depths))
+		return result;
+
+	for (unsigned i = 0; i < code.size(); ++i)
+	{
+		auto& ins = code[i];
+
+		// yielding from inside a caller would suspend the caller too, which is fine for the game
+		// but not something we want to change behind the script author's back
+		if (ins.opcode == BC_OPCODE_YIELD)
+			return result;
+
+		// no recursion
+		if (ins.opcode == BC_OPCODE_CALL && static_cast<unsigned>(ins.operand) == sceneIdx)
+			return result;
+
+		// returns must leave exactly the return value on the stack, as we don't discard anything
+		if (ins.opcode == BC_OPCODE_RETURN && depths[i] != 1)
+			return result;
+
+		if ((ins.opcode == BC_OPCODE_RETN || ins.opcode == BC_OPCODE_RETY) && depths[i] != 0)
+			return result;
+
+		if (ins.is_jump() && !ins.is_jump_keep())
+			result.branching = true;
+	}
+
+	result.varAmt = std::max<unsigned>(scene.varnames.size(), scene.argCnt);
+
+	analyze_callee_locals(cmb, scene, code, depths, result);
+
+	if (!result.branching)
+	{
+		// without jumps, the only return is the last instruction
+
+		const auto ret = code.back().opcode;
+		code.pop_back();
+
+		if (ret == BC_OPCODE_RETN || ret == BC_OPCODE_RETY)
+			code.push_back(make_ins(BC_OPCODE_NUMBER8, ret == BC_OPCODE_RETY ? 1 : 0));
+
+		result.body = std::move(code);
+		result.inlinable = true;
+
+		return result;
+	}
+
+	const std::int32_t resultSlot = result.varAmt++;
+
+	// find where returned values start being pushed before changing anything
+
+	std::vector<std::pair<unsigned, unsigned>> returns; // (return, start of its value)
+
+	for (unsigned i = 0; i < code.size(); ++i)
+	{
+		if (!code[i].is_end())
+			continue;
+
+		unsigned start = i;
+		std::vector<unsigned> ends;
+
+		if (code[i].opcode == BC_OPCODE_RETURN && !find_argument_ranges(cmb, code, depths, i, 1, start, ends))
+			return result;
+
+		returns.emplace_back(i, start);
+	}
+
+	// the final read of the result, which every return jumps to
+
+	code.push_back(make_ins(BC_OPCODE_VAL16, resultSlot));
+
+	for (auto it = returns.rbegin(); it != returns.rend(); ++it)
+	{
+		const unsigned ret = it->first;
+		const std::uint8_t opcode = code[ret].opcode;
+
+		// ret => assign; b end
+
+		std::vector<BcIns> assign;
+		append_assign(assign, game);
+
+		const std::vector<BcIns> jump = { make_ins(BC_OPCODE_B, code.size()) };
+		insert_instructions(code, ret + 1, jump, false);
+
+		code[ret] = assign[0];
+
+		if (assign.size() > 1)
+			insert_instructions(code, ret + 1, Span<const BcIns>(assign).subspan(1), false);
+
+		// the value being returned goes to the result slot
+
+		std::vector<BcIns> ref = { make_ins(BC_OPCODE_REF16, resultSlot) };
+
+		if (opcode != BC_OPCODE_RETURN)
+		{
+			ref.push_back(make_ins(BC_OPCODE_NUMBER8, opcode == BC_OPCODE_RETY ? 1 : 0));
+			insert_instructions(code, ret, ref, true);
+		}
+		else
+		{
+			insert_instructions(code, it->second, ref, true);
+		}
+	}
+
+	result.body = std::move(code);
+	result.inlinable = true;
+
+	return result;
+}
+
+static
+bool decompiles(const CmbInfo& cmb, const SceneInfo& scene)
+{
+	try
+	{
+		std::vector<std::vector<Stmt>> statements;
+		make_scene_statements(cmb, scene, slice_scene(scene), statements);
+	}
+	catch (const std::exception&)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+// replaces the call at code[call] with the callee's body
+// returns false (leaving code untouched) if the call site isn't simple enough
+// insertedBefore is set to how many instructions were added before the call's arguments ended
+static
+bool inline_call(const CmbInfo& cmb, SceneInfo& caller, std::vector<BcIns>& code, unsigned call,
+	const SceneInfo& calleeScene, const InlineCallee& callee, bool keepDecompilable, GameKind game, unsigned& insertedBefore)
+{
+	std::vector<int> depths;
+
+	if (!compute_stack_depths(cmb, code, depths) || depths[call] < 0)
+		return false;
+
+	const unsigned argCnt = calleeScene.argCnt;
+
+	// branching callees have labels, and arguments become assignments: with anything else on the stack,
+	// the decompiler could no longer read the caller (nor could the game's compiler have written it)
+	if ((callee.branching || (keepDecompilable && argCnt > 0)) && depths[call] != static_cast<int>(argCnt))
+		return false;
+
+	// nor inside the range of a keeping jump (a && or || chain): the depth there is the same whether it is taken or not
+	for (unsigned i = 0; i < call; ++i)
+		if (code[i].is_jump_keep() && code[i].operand > static_cast<std::int32_t>(call))
+			return false;
+
+	if (caller.varnames.size() + callee.varAmt > LOCALS_AMT_SUSPICION_LIMIT)
+		return false;
+
+	unsigned start;
+	std::vector<unsigned> ends;
+
+	if (!find_argument_ranges(cmb, code, depths, call, argCnt, start, ends))
+		return false;
+
+	// constant arguments the callee only reads are substituted in the body instead of being assigned
+	// (the instruction pushing them is turned into a nop, removed once done with the caller)
+
+	std::vector<BcIns> constants(argCnt);
+	std::vector<bool> isConstant(argCnt, false);
+
+	for (unsigned k = 0; k < argCnt; ++k)
+	{
+		const unsigned first = k > 0 ? ends[k-1] + 1 : start;
+		auto& ins = code[ends[k]];
+
+		if (!callee.plainArgs[k] || first != ends[k] || !is_constant(ins))
+			continue;
+
+		constants[k] = ins;
+		isConstant[k] = true;
+
+		ins = make_ins(BC_OPCODE_NOP);
+	}
+
+	// the callee's locals get new slots at the end of the caller's
+
+	const std::int32_t localBase = caller.varnames.size();
+
+	for (unsigned i = 0; i < callee.varAmt; ++i)
+		caller.varnames.push_back([&] () { std::string r("var_"); r.append(std::to_string(localBase + i)); return r; } ()); // TODO: better string formatting
+
+	// build the block replacing the call: assignment of the last argument, zeroing of the other locals, then the body
+	// the block is inserted after the call before the call is erased, so the block starts at call+1
+
+	std::vector<BcIns> block;
+
+	if (argCnt > 0 && !isConstant[argCnt-1])
+		append_assign(block, game);
+
+	for (auto slot : callee.zeroedLocals)
+	{
+		block.push_back(make_ins(BC_OPCODE_REF16, localBase + slot));
+		block.push_back(make_ins(BC_OPCODE_NUMBER8, 0));
+		append_assign(block, game);
+	}
+
+	const std::int32_t bodyStart = call + 1 + block.size();
+
+	for (auto ins : callee.body)
+	{
+		const bool readsArg = (ins.opcode == BC_OPCODE_VAL8 || ins.opcode == BC_OPCODE_VAL16)
+			&& static_cast<unsigned>(ins.operand) < argCnt;
+
+		if (readsArg && isConstant[ins.operand])
+			ins = constants[ins.operand];
+		else if (ins.is_jump())
+			ins.operand += bodyStart;
+		else if (is_local_access(ins.opcode))
+			ins.operand += localBase;
+
+		block.push_back(ins);
+	}
+
+	insert_instructions(code, call + 1, block, false);
+
+	std::vector<bool> erase(code.size(), false);
+	erase[call] = true;
+
+	erase_instructions(code, erase);
+
+	// assign the other arguments as soon as they are pushed
+	// (from last to first, so that earlier indices stay valid)
+
+	insertedBefore = 0;
+
+	for (unsigned k = argCnt; k-- > 1;)
+	{
+		std::vector<BcIns> assign;
+
+		if (!isConstant[k-1])
+			append_assign(assign, game);
+
+		if (!isConstant[k])
+			assign.push_back(make_ins(BC_OPCODE_REF16, localBase + k));
+
+		insert_instructions(code, ends[k-1] + 1, assign, true);
+		insertedBefore += assign.size();
+	}
+
+	if (argCnt > 0 && !isConstant[0])
+	{
+		const BcIns ref = make_ins(BC_OPCODE_REF16, localBase);
+		insert_instructions(code, start, Span<const BcIns>(&ref, 1), true);
+		insertedBefore += 1;
+	}
+
+	return true;
+}
+
+unsigned inline_calls(CmbInfo& cmb, const InlineConfig& config, GameKind game)
+{
+	// callees are prepared from the scenes as they are before anything is inlined,
+	// so that inlining doesn't compound (and recursion through several scenes ends)
+
+	std::vector<InlineCallee> callees;
+	callees.reserve(cmb.scenes.size());
+
+	for (unsigned i = 0; i < cmb.scenes.size(); ++i)
+		callees.push_back(prepare_callee(cmb, cmb.scenes[i], i, game));
+
+	for (auto& scene : cmb.scenes)
+		for (auto& ins : scene.rawScript)
+			if (ins.opcode == BC_OPCODE_CALL && static_cast<unsigned>(ins.operand) < callees.size())
+				callees[ins.operand].sites++;
+
+	const auto worth_inlining = [&] (const InlineCallee& callee)
+	{
+		if (!callee.inlinable)
+			return false;
+
+		const unsigned size = callee.body.size();
+
+		if (size <= config.alwaysSize)
+			return true;
+
+		// each site grows by about the callee's size, minus the call
+		const unsigned growth = (size - 1) * callee.sites;
+		return growth <= config.maxGrowth;
+	};
+
+	unsigned inlined = 0;
+
+	for (unsigned sceneIdx = 0; sceneIdx < cmb.scenes.size(); ++sceneIdx)
+	{
+		auto& caller = cmb.scenes[sceneIdx];
+		auto code = index_jumps(caller.rawScript);
+
+		const SceneInfo original = caller;
+		unsigned sceneInlined = 0;
+
+		// from last to first: inlining only moves the instructions from the start of the call's arguments on
+
+		for (unsigned i = code.size(); i-- > 0;)
+		{
+			if (code[i].opcode != BC_OPCODE_CALL)
+				continue;
+
+			const auto calleeIdx = static_cast<unsigned>(code[i].operand);
+
+			if (calleeIdx == sceneIdx || calleeIdx >= callees.size() || !worth_inlining(callees[calleeIdx]))
+				continue;
+
+			unsigned insertedBefore;
+
+			if (!inline_call(cmb, caller, code, i, cmb.scenes[calleeIdx], callees[calleeIdx], config.keepDecompilable, game, insertedBefore))
+				continue;
+
+			// the arguments may have calls in them too, continue from the new position of the last one
+			i += insertedBefore;
+
+			sceneInlined++;
+		}
+
+		if (sceneInlined == 0)
+			continue;
+
+		// returns at the very end of an inlined body became jumps to the next instruction,
+		// and constant arguments left nops behind
+
+		std::vector<bool> erase(code.size(), false);
+
+		for (unsigned i = 0; i < code.size(); ++i)
+		{
+			erase[i] = (code[i].opcode == BC_OPCODE_B && code[i].operand == static_cast<std::int32_t>(i + 1))
+				|| code[i].opcode == BC_OPCODE_NOP;
+		}
+
+		erase_instructions(code, erase);
+		terminate_code(code, game);
+
+		caller.rawScript = unindex_jumps(std::move(code), game);
+
+		// the checks above are about what the decompiler reads, make sure it still does
+
+		if (config.keepDecompilable && !decompiles(cmb, caller))
+		{
+			caller = original;
+			continue;
+		}
+
+		inlined += sceneInlined;
+	}
+
+	return inlined;
+}
+
+} // namespace soren
@@ -0,0 +1,294 @@
+
+#include "opt/optimize.h"
+
+namespace soren {
+
+namespace {
+
+struct LayoutUnit
+{
+	// [begin, end) in the code
+	unsigned begin, end;
+
+	// units following this one: by falling through (or jumping if laid out elsewhere) and by jumping
+	// -1 for none
+	int fall, jump;
+};
+
+} // namespace
+
+static inline
+std::uint8_t inverted_branch(std::uint8_t opcode)
+{
+	return opcode == BC_OPCODE_BN ? BC_OPCODE_BY : BC_OPCODE_BN;
+}
+
+bool thread_jumps(std::vector<BcIns>& code)
+{
+	bool changed = false;
+
+	for (bool progress = true; progress;)
+	{
+		progress = false;
+
+		// where a jump ends up going, following unconditional jumps (stopping on loops)
+
+		const auto resolve = [&] (std::int32_t target)
+		{
+			for (unsigned hops = 0; hops < code.size() && code[target].opcode == BC_OPCODE_B; ++hops)
+				target = code[target].operand;
+
+			return target;
+		};
+
+		for (auto& ins : code)
+		{
+			if (!ins.is_jump())
+				continue;
+
+			auto target = resolve(ins.operand);
+
+			// keeping jumps to the same keeping jump: the value is kept, so that one is taken too
+
+			if (ins.is_jump_keep())
+			{
+				for (unsigned hops = 0; hops < code.size() && code[target].opcode == ins.opcode; ++hops)
+					target = resolve(code[target].operand);
+			}
+
+			if (target != ins.operand)
+			{
+				ins.operand = target;
+				progress = true;
+			}
+
+			// b to a return => return
+
+			if (ins.opcode == BC_OPCODE_B && code[target].is_end())
+			{
+				ins = code[target];
+				progress = true;
+			}
+		}
+
+		const auto targets = find_jump_targets(code);
+		std::vector<bool> erase(code.size(), false);
+
+		for (unsigned i = 0; i < code.size(); ++i)
+		{
+			auto& ins = code[i];
+
+			// bn/by over a b => by/bn
+
+			const bool branch = ins.opcode == BC_OPCODE_BN || ins.opcode == BC_OPCODE_BY;
+
+			if (branch && i + 2 < code.size() && ins.operand == static_cast<std::int32_t>(i + 2)
+				&& code[i+1].opcode == BC_OPCODE_B && !targets[i+1])
+			{
+				ins = make_ins(inverted_branch(ins.opcode), code[i+1].operand);
+				erase[++i] = true;
+				progress = true;
+
+				continue;
+			}
+
+			// jumps to the next instruction
+
+			if (ins.opcode == BC_OPCODE_B && ins.operand == static_cast<std::int32_t>(i + 1))
+			{
+				erase[i] = true;
+				progress = true;
+			}
+		}
+
+		erase_instructions(code, erase);
+
+		// jumps threaded past may have left unconditional jumps no one goes to
+
+		if (erase_unreachable(code))
+			progress = true;
+
+		changed = changed || progress;
+	}
+
+	return changed;
+}
+
+static
+std::vector<LayoutUnit> split_units(Span<const BcIns> code)
+{
+	// units are what the decompiler slices code in (see slice_script): they start at targets of (non-keeping) jumps,
+	// and after jumps and ends. Logic (keeping jumps) stays inside units, as do values on the stack
+
+	std::vector<bool> starts(code.size() + 1, false);
+	starts[0] = true;
+
+	for (unsigned i = 0; i < code.size(); ++i)
+	{
+		auto& ins = code[i];
+
+		if (ins.is_jump() && !ins.is_jump_keep())
+		{
+			starts[ins.operand] = true;
+			starts[i + 1] = true;
+		}
+
+		if (ins.is_end())
+			starts[i + 1] = true;
+	}
+
+	std::vector<LayoutUnit> result;
+	std::vector<int> unitOf(code.size(), -1);
+
+	for (unsigned i = 0; i < code.size(); ++i)
+	{
+		if (starts[i])
+			result.push_back({ i, i, -1, -1 });
+
+		result.back().end = i + 1;
+		unitOf[i] = result.size() - 1;
+	}
+
+	for (unsigned u = 0; u < result.size(); ++u)
+	{
+		auto& unit = result[u];
+		auto& last = code[unit.end - 1];
+
+		if (!last.is_end() && last.opcode != BC_OPCODE_B && u + 1 < result.size())
+			unit.fall = u + 1;
+
+		if (last.is_jump() && !last.is_jump_keep())
+			unit.jump = unitOf[last.operand];
+	}
+
+	return result;
+}
+
+bool layout_blocks(std::vector<BcIns>& code, Span<const std::uint64_t> weights)
+{
+	if (weights.size() != code.size())
+		return false;
+
+	const auto units = split_units(code);
+
+	// how often a unit is entered
+
+	const auto weight = [&] (int unit) { return weights[units[unit].begin]; };
+
+	// greedy chaining: after each unit goes its most executed successor that isn't laid out yet,
+	// or else the next unit not laid out in the original order
+
+	std::vector<int> order;
+	std::vector<bool> placed(units.size(), false);
+
+	unsigned nextInOrder = 0;
+
+	for (int u = 0; u >= 0;)
+	{
+		order.push_back(u);
+		placed[u] = true;
+
+		auto& unit = units[u];
+
+		int first = unit.fall, second = unit.jump;
+
+		if (first >= 0 && second >= 0 && weight(second) > weight(first))
+			std::swap(first, second);
+
+		if (first >= 0 && !placed[first])
+		{
+			u = first;
+		}
+		else if (second >= 0 && !placed[second])
+		{
+			u = second;
+		}
+		else
+		{
+			while (nextInOrder < units.size() && placed[nextInOrder])
+				nextInOrder++;
+
+			u = nextInOrder < units.size() ? static_cast<int>(nextInOrder) : -1;
+		}
+	}
+
+	bool reordered = false;
+
+	for (unsigned k = 0; k < order.size(); ++k)
+		reordered = reordered || order[k] != static_cast<int>(k);
+
+	if (!reordered)
+		return false;
+
+	// emit units in the new order, with jump operands still being old indices, and fix fall-throughs
+
+	std::vector<BcIns> result;
+	std::vector<std::int32_t> newIndex(code.size(), 0);
+
+	result.reserve(code.size() + units.size());
+
+	for (unsigned k = 0; k < order.size(); ++k)
+	{
+		auto& unit = units[order[k]];
+		const int next = k + 1 < order.size() ? order[k+1] : -1;
+
+		for (unsigned i = unit.begin; i + 1 < unit.end; ++i)
+		{
+			newIndex[i] = result.size();
+			result.push_back(code[i]);
+		}
+
+		const unsigned lastIndex = unit.end - 1;
+		auto last = code[lastIndex];
+
+		newIndex[lastIndex] = result.size();
+
+		if (last.opcode == BC_OPCODE_B)
+		{
+			// jumping to what comes next anyway
+			if (unit.jump != next)
+				result.push_back(last);
+
+			continue;
+		}
+
+		if ((last.opcode == BC_OPCODE_BN || last.opcode == BC_OPCODE_BY) && unit.jump == next && unit.fall >= 0)
+		{
+			// the target comes next: branch on the opposite condition to what used to follow
+			result.push_back(make_ins(inverted_branch(last.opcode), units[unit.fall].begin));
+			continue;
+		}
+
+		result.push_back(last);
+
+		if (unit.fall >= 0 && unit.fall != next)
+			result.push_back(make_ins(BC_OPCODE_B, units[unit.fall].begin));
+	}
+
+	for (auto& ins : result)
+		if (ins.is_jump())
+			ins.operand = newIndex[ins.operand];
+
+	code = std::move(result);
+
+	return true;
+}
+
+bool optimize_layout(SceneInfo& scene, Span<const std::uint64_t> weights, GameKind game)
+{
+	auto code = index_jumps(scene.rawScript);
+
+	// layout first, as weights are for the code as it is
+	const bool laidOut = !weights.empty() && layout_blocks(code, weights);
+	const bool threaded = thread_jumps(code);
+
+	if (!laidOut && !threaded)
+		return false;
+
+	terminate_code(code, game);
+	scene.rawScript = unindex_jumps(std::move(code), game);
+
+	return true;
+}
+
+} // namespace soren
@@ -0,0 +1,376 @@
+
+#include "opt/optimize.h"
+
+#include <algorithm>
+
+namespace soren {
+
+namespace {
+
+// a set of local slots
+using SlotSet = std::vector<bool>;
+
+struct LocalAccesses
+{
+	// per instruction: slots read and slots written
+	std::vector<std::vector<unsigned>> uses;
+	std::vector<std::vector<unsigned>> defs;
+
+	// slots that may be reached through an indexed access: they can't move, and nothing else can share them
+	SlotSet pinned;
+
+	// slots whose address escapes: nothing else can share them
+	SlotSet escaping;
+};
+
+} // namespace
+
+static inline
+bool is_plain_access(std::uint8_t opcode)
+{
+	return opcode == BC_OPCODE_VAL8 || opcode == BC_OPCODE_VAL16
+		|| opcode == BC_OPCODE_REF8 || opcode == BC_OPCODE_REF16;
+}
+
+static inline
+bool is_local_access(std::uint8_t opcode)
+{
+	return opcode >= BC_OPCODE_VAL8 && opcode <= BC_OPCODE_REFY16;
+}
+
+static inline
+bool is_indexed_access(std::uint8_t opcode)
+{
+	// valx/refx: slot + @0
+	return opcode == BC_OPCODE_VALX8 || opcode == BC_OPCODE_VALX16 || opcode == BC_OPCODE_REFX8 || opcode == BC_OPCODE_REFX16;
+}
+
+// follows the address pushed by code[ref] to what uses it
+// returns false if the address escapes (is anything else than assigned to, incremented, decremented or dereferenced)
+static
+bool follow_address(const CmbInfo& cmb, Span<const BcIns> code, const std::vector<int>& depths,
+	unsigned ref, unsigned slot, LocalAccesses& accesses)
+{
+	const int position = depths[ref];
+
+	for (unsigned j = ref + 1; j < code.size(); ++j)
+	{
+		auto& ins = code[j];
+
+		// only logic (keeping jumps) may happen above the address
+
+		if (depths[j] < 0 || ins.is_end() || (ins.is_jump() && !ins.is_jump_keep()))
+			return false;
+
+		const auto effect = stack_effect(cmb, ins);
+		const int lowWater = depths[j] - static_cast<int>(effect.pops);
+
+		if (lowWater > position)
+			continue;
+
+		// code[j] pops the address
+
+		if (lowWater != position)
+			return false;
+
+		// the path from the ref to here must be self-contained: jumps in it stay in it, and nothing else jumps in
+
+		for (unsigned k = 0; k < code.size(); ++k)
+		{
+			if (!code[k].is_jump())
+				continue;
+
+			const auto target = static_cast<unsigned>(code[k].operand);
+			const bool inside = k > ref && k < j;
+
+			if (inside ? target > j : (target > ref && target <= j))
+				return false;
+		}
+
+		switch (ins.opcode)
+		{
+
+		case BC_OPCODE_ASSIGN:
+		case BC_OPCODE_STORE:
+			accesses.defs[j].push_back(slot);
+			return true;
+
+		case BC_OPCODE_INC:
+		case BC_OPCODE_DEC:
+			accesses.uses[j].push_back(slot);
+			accesses.defs[j].push_back(slot);
+			return true;
+
+		case BC_OPCODE_DEREF:
+			// the address stays, keep following it
+			accesses.uses[j].push_back(slot);
+			continue;
+
+		default:
+			return false;
+
+		} // switch (ins.opcode)
+	}
+
+	return false;
+}
+
+static
+LocalAccesses find_local_accesses(const CmbInfo& cmb, Span<const BcIns> code, const std::vector<int>& depths, unsigned varAmt)
+{
+	LocalAccesses result;
+
+	result.uses.resize(code.size());
+	result.defs.resize(code.size());
+	result.pinned.assign(varAmt, false);
+	result.escaping.assign(varAmt, false);
+
+	for (unsigned i = 0; i < code.size(); ++i)
+	{
+		auto& ins = code[i];
+
+		if (!is_local_access(ins.opcode))
+			continue;
+
+		const auto slot = static_cast<unsigned>(ins.operand);
+
+		if (slot >= varAmt)
+			continue;
+
+		if (is_indexed_access(ins.opcode))
+		{
+			// could reach any slot from there (even before, but negative indices hopefully aren't a thing)
+			std::fill(result.pinned.begin() + slot, result.pinned.end(), true);
+			continue;
+		}
+
+		if (!is_plain_access(ins.opcode) || ins.opcode == BC_OPCODE_VAL8 || ins.opcode == BC_OPCODE_VAL16)
+		{
+			// val, valy and refy read the slot (valy and refy use its value as an address)
+			result.uses[i].push_back(slot);
+			continue;
+		}
+
+		// ref: unreachable ones don't matter
+
+		if (depths[i] < 0)
+			continue;
+
+		if (!follow_address(cmb, code, depths, i, slot, result))
+			result.escaping[slot] = true;
+	}
+
+	return result;
+}
+
+static
+std::vector<unsigned> successors(Span<const BcIns> code, unsigned i)
+{
+	auto& ins = code[i];
+
+	if (ins.is_end())
+		return {};
+
+	if (ins.opcode == BC_OPCODE_B)
+		return { static_cast<unsigned>(ins.operand) };
+
+	if (ins.is_jump())
+		return { static_cast<unsigned>(ins.operand), i + 1 };
+
+	return { i + 1 };
+}
+
+bool compact_locals(const CmbInfo& cmb, SceneInfo& scene, GameKind game)
+{
+	const unsigned argCnt = scene.argCnt;
+	const unsigned varAmt = std::max<unsigned>(scene.varnames.size(), argCnt);
+
+	if (varAmt == 0)
+		return false;
+
+	auto code = index_jumps(scene.rawScript);
+
+	std::vector<int> depths;
+
+	if (!compute_stack_depths(cmb, code, depths))
+		return false;
+
+	const auto accesses = find_local_accesses(cmb, code, depths, varAmt);
+
+	// liveness
+
+	std::vector<SlotSet> liveIn(code.size(), SlotSet(varAmt, false));
+
+	const auto live_out = [&] (unsigned i)
+	{
+		SlotSet result(varAmt, false);
+
+		for (auto succ : successors(code, i))
+			if (succ < code.size())
+				for (unsigned s = 0; s < varAmt; ++s)
+					result[s] = result[s] || liveIn[succ][s];
+
+		return result;
+	};
+
+	for (bool changed = true; changed;)
+	{
+		changed = false;
+
+		for (unsigned i = code.size(); i-- > 0;)
+		{
+			auto live = live_out(i);
+
+			for (auto slot : accesses.defs[i])
+				live[slot] = false;
+
+			for (auto slot : accesses.uses[i])
+				live[slot] = true;
+
+			if (live != liveIn[i])
+			{
+				liveIn[i] = std::move(live);
+				changed = true;
+			}
+		}
+	}
+
+	// arguments (placed there by the caller) and pinned slots keep their index
+	// slots read before being written, and escaping ones (which could be), rely on the frame being zeroed:
+	// they can move, but not to an argument's slot
+
+	const SlotSet entry = code.empty() ? SlotSet(varAmt, false) : liveIn[0];
+
+	SlotSet fixed(varAmt, false), needsZero(varAmt, false);
+
+	for (unsigned s = 0; s < varAmt; ++s)
+	{
+		fixed[s] = s < argCnt || accesses.pinned[s];
+		needsZero[s] = !fixed[s] && (entry[s] || accesses.escaping[s]);
+	}
+
+	// interference
+
+	std::vector<SlotSet> interferes(varAmt, SlotSet(varAmt, false));
+
+	const auto interfere = [&] (unsigned a, unsigned b)
+	{
+		if (a != b)
+			interferes[a][b] = interferes[b][a] = true;
+	};
+
+	for (unsigned i = 0; i < code.size(); ++i)
+	{
+		if (accesses.defs[i].empty())
+			continue;
+
+		const auto live = live_out(i);
+
+		for (auto def : accesses.defs[i])
+			for (unsigned s = 0; s < varAmt; ++s)
+				if (live[s])
+					interfere(def, s);
+	}
+
+	// everything is written when entering the scene (by the caller or by zeroing)
+
+	for (unsigned a = 0; a < varAmt; ++a)
+		for (unsigned b = 0; b < varAmt; ++b)
+			if (entry[a] && entry[b])
+				interfere(a, b);
+
+	for (unsigned s = 0; s < varAmt; ++s)
+		if (accesses.pinned[s] || accesses.escaping[s])
+			for (unsigned other = 0; other < varAmt; ++other)
+				interfere(s, other);
+
+	// which slots are used at all
+
+	SlotSet used(varAmt, false);
+
+	for (auto& ins : code)
+		if (is_local_access(ins.opcode) && static_cast<unsigned>(ins.operand) < varAmt)
+			used[ins.operand] = true;
+
+	// greedy coloring: fixed slots are their own color, the others get the lowest color nothing they interfere with has
+
+	std::vector<int> color(varAmt, -1);
+
+	for (unsigned s = 0; s < varAmt; ++s)
+		if (fixed[s])
+			color[s] = s;
+
+	for (unsigned s = 0; s < varAmt; ++s)
+	{
+		if (color[s] >= 0 || !used[s])
+			continue;
+
+		for (int c = needsZero[s] ? argCnt : 0; color[s] < 0; ++c)
+		{
+			bool taken = false;
+
+			for (unsigned other = 0; other < varAmt && !taken; ++other)
+				taken = color[other] == c && interferes[s][other];
+
+			if (!taken)
+				color[s] = c;
+		}
+	}
+
+	unsigned newVarAmt = argCnt;
+
+	for (unsigned s = 0; s < varAmt; ++s)
+		if (color[s] >= 0)
+			newVarAmt = std::max<unsigned>(newVarAmt, color[s] + 1);
+
+	bool moved = false;
+
+	for (unsigned s = 0; s < varAmt; ++s)
+		moved = moved || (color[s] >= 0 && color[s] != static_cast<int>(s));
+
+	if (!moved && newVarAmt == scene.varnames.size())
+		return false;
+
+	for (auto& ins : code)
+		if (is_local_access(ins.opcode) && static_cast<unsigned>(ins.operand) < varAmt)
+			ins.operand = color[ins.operand];
+
+	// locals copied into one another may now be the same: ref k; val k; assign => nothing
+
+	const auto targets = find_jump_targets(code);
+	std::vector<bool> erase(code.size(), false);
+
+	for (unsigned i = 0; i + 2 < code.size(); ++i)
+	{
+		auto& ref = code[i];
+		auto& val = code[i+1];
+
+		const bool isRef = ref.opcode == BC_OPCODE_REF8 || ref.opcode == BC_OPCODE_REF16;
+		const bool isVal = val.opcode == BC_OPCODE_VAL8 || val.opcode == BC_OPCODE_VAL16;
+
+		if (isRef && isVal && ref.operand == val.operand && code[i+2].opcode == BC_OPCODE_ASSIGN && !targets[i+1] && !targets[i+2])
+		{
+			erase[i] = erase[i+1] = erase[i+2] = true;
+			i += 2;
+		}
+	}
+
+	erase_instructions(code, erase);
+
+	std::vector<std::string> varnames(newVarAmt);
+
+	for (unsigned i = 0; i < newVarAmt; ++i)
+	{
+		if (i < argCnt && i < scene.varnames.size())
+			varnames[i] = scene.varnames[i];
+		else
+			varnames[i] = [&] () { std::string r("var_"); r.append(std::to_string(i)); return r; } (); // TODO: better string formatting
+	}
+
+	scene.varnames = std::move(varnames);
+	scene.rawScript = unindex_jumps(std::move(code), game);
+
+	return true;
+}
+
+} // namespace soren
@@ -0,0 +1,139 @@
+#ifndef SOREN_OPTIMIZE_INCLUDED
+#define SOREN_OPTIMIZE_INCLUDED
+
+#include <cstdint>
+#include <vector>
+
+#include "core/types.h"
+#include "core/soren-cmb.h"
+
+namespace soren {
+
+// Bytecode passes work on "indexed" code: the same instructions as SceneInfo::rawScript, except that
+// jump operands are instruction indices rather than locations, so that instructions can be added and removed
+// freely. Locations of indexed code are meaningless until it is converted back with unindex_jumps.
+
+std::vector<BcIns> index_jumps(Span<const BcIns> script);
+
+// also picks the smallest operand sizes and recomputes locations
+std::vector<BcIns> unindex_jumps(std::vector<BcIns> code, GameKind game);
+
+// removes instructions for which erase[i] is true
+// jumps to a removed instruction go to the next kept one instead
+void erase_instructions(std::vector<BcIns>& code, const std::vector<bool>& erase);
+
+// inserts instructions before code[index]
+// jumps to code[index] go to the first inserted instruction if jumpToInserted, else still to code[index]
+void insert_instructions(std::vector<BcIns>& code, unsigned index, Span<const BcIns> instructions, bool jumpToInserted);
+
+// instructions reachable from the first one
+std::vector<bool> find_reachable(Span<const BcIns> code);
+
+// removes instructions not reachable from the first one, returns whether there were any
+bool erase_unreachable(std::vector<BcIns>& code);
+
+// which instructions are jump targets
+std::vector<bool> find_jump_targets(Span<const BcIns> code);
+
+// makes sure the last instruction is an end (as the decoder expects), by adding an unreachable return if needed
+void terminate_code(std::vector<BcIns>& code, GameKind game);
+
+struct StackEffect
+{
+	unsigned pops;
+	unsigned pushes;
+};
+
+// how many values an instruction takes from and puts on the stack
+// jumps that keep are considered as not taken (pops their value)
+StackEffect stack_effect(const CmbInfo& cmb, const BcIns& ins);
+
+// stack depth before each instruction (relative to the frame), -1 for unreachable instructions
+// returns false if the code pops values it doesn't have, or if paths meet with different depths
+bool compute_stack_depths(const CmbInfo& cmb, Span<const BcIns> code, std::vector<int>& depths);
+
+// a small instruction constructor, for passes
+static inline
+BcIns make_ins(std::uint8_t opcode, std::int32_t operand = 0)
+{
+	return BcIns { 0u, operand, opcode };
+}
+
+// Specialization (partial evaluation)
+
+struct ConstantBindings
+{
+	// (index, value) pairs
+	// arguments are only considered constant if the scene never writes to them
+	// globals are assumed not to be changed by anything else while the scene runs (not even by calls)
+
+	std::vector<std::pair<unsigned, std::int32_t>> args;
+	std::vector<std::pair<unsigned, std::int32_t>> globals;
+};
+
+// returns a copy of the scene where reads of constant arguments/globals are replaced by their values,
+// constant expressions are folded, branches on constants are resolved and unreachable code is removed
+SceneInfo specialize_scene(const CmbInfo& cmb, const SceneInfo& scene, const ConstantBindings& constants, GameKind game);
+
+// folds constant expressions and branches, and removes unreachable code
+// returns whether anything changed
+bool fold_constants(std::vector<BcIns>& code);
+
+// Inlining
+
+struct InlineConfig
+{
+	// callees of at most this many instructions are always inlined
+	unsigned alwaysSize = 12;
+
+	// other callees are inlined if it grows the code (over all its call sites) by at most this many instructions
+	unsigned maxGrowth = 48;
+
+	// only inline where the result can still be decompiled (see inline_calls)
+	bool keepDecompilable = true;
+};
+
+// replaces calls to small scenes with the body of the scene, moving its locals to new locals of the caller
+// callees that yield or call themselves aren't inlined, and neither are call sites whose arguments aren't simple
+// callees with branches are only inlined where nothing else is on the stack (statement-level calls, conditions, returns),
+// and so are callees with arguments if keepDecompilable is set, which also leaves scenes that no longer decompile as they were
+// returns the number of call sites inlined
+unsigned inline_calls(CmbInfo& cmb, const InlineConfig& config, GameKind game);
+
+// Local slot compaction
+
+// gives locals whose values are never needed at the same time the same slot, and shrinks the frame accordingly
+// arguments, locals read before being written, and locals whose address escapes or that are indexed (valx/refx) keep their slot
+// returns whether anything changed
+bool compact_locals(const CmbInfo& cmb, SceneInfo& scene, GameKind game);
+
+// Jump threading and block layout
+
+// jumps to unconditional jumps go directly where those go (or return directly), conditional jumps over
+// an unconditional jump are inverted, jumps to the next instruction and code that becomes unreachable are removed
+// returns whether anything changed
+bool thread_jumps(std::vector<BcIns>& code);
+
+// reorders the code (by units the decompiler would slice it in) so that the most executed successor of each unit
+// follows it, adding or inverting jumps as needed. weights are execution counts of each instruction
+// returns whether anything changed
+bool layout_blocks(std::vector<BcIns>& code, Span<const std::uint64_t> weights);
+
+// both of the above on a scene; weights are for the scene's rawScript, and may be empty to only thread jumps
+bool optimize_layout(SceneInfo& scene, Span<const std::uint64_t> weights, GameKind game);
+
+// Stripping
+
+// removes scenes that can't be reached: roots are named scenes and scenes that aren't functions (events),
+// from which calls are followed. Scenes are renumbered and calls rewritten accordingly
+// returns the number of scenes removed
+unsigned strip_dead_scenes(CmbInfo& cmb, GameKind game);
+
+// rebuilds the string pool with only the strings referenced by string pushes, external calls and names of global scenes
+// (each once), and rewrites references accordingly. Offsets computed at run time can't be accounted for
+// returns the number of bytes saved (0 if the pool wouldn't shrink, in which case nothing changes)
+unsigned strip_unused_strings(CmbInfo& cmb, GameKind game);
+
+} // namespace soren
+
+#endif // SOREN_OPTIMIZE_INCLUDED
@@ -0,0 +1,370 @@
+
+#include "opt/optimize.h"
+#include "vm/ops.h"
+
+#include <stdexcept>
+
+namespace soren {
+
+static inline
+bool is_number(const BcIns& ins)
+{
+	return ins.opcode == BC_OPCODE_NUMBER8 || ins.opcode == BC_OPCODE_NUMBER16 || ins.opcode == BC_OPCODE_NUMBER32;
+}
+
+static
+bool fold_binop(std::uint8_t opcode, std::int32_t a, std::int32_t b, std::int32_t& result)
+{
+	// same semantics as the VM, except that we don't fold anything we are unsure the game agrees with:
+	// division by zero, right shifts of negative values and the comparisons marked as unsure
+
+	switch (opcode)
+	{
+
+	case BC_OPCODE_ADD: result = vm_wrap(static_cast<std::uint32_t>(a) + static_cast<std::uint32_t>(b)); return true;
+	case BC_OPCODE_SUB: result = vm_wrap(static_cast<std::uint32_t>(a) - static_cast<std::uint32_t>(b)); return true;
+	case BC_OPCODE_MUL: result = vm_wrap(static_cast<std::uint32_t>(a) * static_cast<std::uint32_t>(b)); return true;
+	case BC_OPCODE_DIV: result = vm_div(a, b); return b != 0;
+	case BC_OPCODE_MOD: result = vm_mod(a, b); return b != 0;
+	case BC_OPCODE_ORR: result = a | b; return true;
+	case BC_OPCODE_AND: result = a & b; return true;
+	case BC_OPCODE_XOR: result = a ^ b; return true;
+	case BC_OPCODE_LSL: result = vm_lsl(a, b); return true;
+	case BC_OPCODE_LSR: result = vm_lsr(a, b); return a >= 0;
+	case BC_OPCODE_EQ:  result = a == b; return true;
+	case BC_OPCODE_NE:  result = a != b; return true;
+	case BC_OPCODE_LE:  result = a <= b; return true;
+
+	default:
+		return false;
+
+	} // switch (opcode)
+}
+
+static
+bool fold_unop(std::uint8_t opcode, std::int32_t a, std::int32_t& result)
+{
+	switch (opcode)
+	{
+
+	case BC_OPCODE_NEG: result = vm_wrap(0u - static_cast<std::uint32_t>(a)); return true;
+	case BC_OPCODE_MVN: result = ~a; return true;
+	case BC_OPCODE_NOT: result = !a; return true;
+
+	default:
+		return false;
+
+	} // switch (opcode)
+}
+
+bool fold_constants(std::vector<BcIns>& code)
+{
+	bool changed = false;
+
+	for (bool progress = true; progress;)
+	{
+		progress = false;
+
+		// instructions that are jumped to can't be folded into the instructions before them,
+		// as the stack may hold something else when coming from the jump
+
+		const auto targets = find_jump_targets(code);
+		std::vector<bool> erase(code.size(), false);
+
+		for (unsigned i = 0; i + 1 < code.size(); ++i)
+		{
+			if (!is_number(code[i]) || targets[i+1])
+				continue;
+
+			auto& next = code[i+1];
+			const auto value = code[i].operand;
+
+			std::int32_t result;
+
+			if (fold_unop(next.opcode, value, result))
+			{
+				// number a; unop => number (unop a)
+
+				code[i].operand = result;
+				erase[++i] = true;
+			}
+			else if (i + 2 < code.size() && is_number(next) && !targets[i+2] && fold_binop(code[i+2].opcode, value, next.operand, result))
+			{
+				// number a; number b; binop => number (a binop b)
+
+				code[i].operand = result;
+				erase[++i] = true;
+				erase[++i] = true;
+			}
+			else if (next.opcode == BC_OPCODE_BN || next.opcode == BC_OPCODE_BY)
+			{
+				// number a; bn/by => b or nothing
+
+				const bool taken = (value != 0) == (next.opcode == BC_OPCODE_BY);
+
+				if (taken)
+					code[i] = make_ins(BC_OPCODE_B, next.operand);
+				else
+					erase[i] = true;
+
+				erase[++i] = true;
+			}
+			else if (next.opcode == BC_OPCODE_BKN || next.opcode == BC_OPCODE_BKY)
+			{
+				// number a; bkn/bky => number a; b or nothing
+
+				const bool taken = (value != 0) == (next.opcode == BC_OPCODE_BKY);
+
+				if (taken)
+				{
+					next = make_ins(BC_OPCODE_B, next.operand);
+				}
+				else
+				{
+					erase[i] = true;
+					erase[i+1] = true;
+				}
+
+				i++;
+			}
+			else if (next.opcode == BC_OPCODE_DISC)
+			{
+				// number a; disc => nothing
+
+				erase[i] = true;
+				erase[++i] = true;
+			}
+			else if (next.opcode == BC_OPCODE_DUP)
+			{
+				// number a; dup => number a; number a
+
+				next = code[i];
+				i++;
+			}
+			else
+			{
+				continue;
+			}
+
+			progress = true;
+		}
+
+		// jumps to the next instruction
+
+		for (unsigned i = 0; i < code.size(); ++i)
+		{
+			if (code[i].opcode == BC_OPCODE_B && code[i].operand == static_cast<std::int32_t>(i + 1) && !erase[i])
+			{
+				erase[i] = true;
+				progress = true;
+			}
+		}
+
+		erase_instructions(code, erase);
+
+		// unreachable code
+
+		if (erase_unreachable(code))
+			progress = true;
+
+		changed = changed || progress;
+	}
+
+	return changed;
+}
+
+// follows the address pushed by code[ref] to what takes it
+// returns false if the address may end up anywhere else than in the slot it was taken of
+// (it being anything else than assigned to, incremented, decremented or dereferenced, such as added to)
+static
+bool address_stays_put(const CmbInfo& cmb, Span<const BcIns> code, const std::vector<int>& depths, unsigned ref)
+{
+	const int position = depths[ref];
+
+	for (unsigned j = ref + 1; j < code.size(); ++j)
+	{
+		auto& ins = code[j];
+
+		if (depths[j] < 0 || ins.is_end() || (ins.is_jump() && !ins.is_jump_keep()))
+			return false;
+
+		const auto effect = stack_effect(cmb, ins);
+		const int lowWater = depths[j] - static_cast<int>(effect.pops);
+
+		if (lowWater > position)
+			continue;
+
+		if (lowWater != position)
+			return false;
+
+		// keeping jumps in the path could take the address elsewhere, and other jumps into it could bring it from elsewhere
+
+		for (unsigned k = 0; k < code.size(); ++k)
+		{
+			if (!code[k].is_jump())
+				continue;
+
+			const auto target = static_cast<unsigned>(code[k].operand);
+			const bool inside = k > ref && k < j;
+
+			if (inside ? target > j : (target > ref && target <= j))
+				return false;
+		}
+
+		switch (ins.opcode)
+		{
+
+		case BC_OPCODE_ASSIGN:
+		case BC_OPCODE_STORE:
+		case BC_OPCODE_INC:
+		case BC_OPCODE_DEC:
+			return true;
+
+		case BC_OPCODE_DEREF:
+			// the address stays, keep following it
+			continue;
+
+		default:
+			return false;
+
+		} // switch (ins.opcode)
+	}
+
+	return false;
+}
+
+// whether each slot written to is named by the operand of a ref (or is after the one of a refx)
+// refy takes its address from a value, and addresses that go through arithmetic can land on any slot
+static
+bool writes_are_known(const CmbInfo& cmb, Span<const BcIns> code)
+{
+	std::vector<int> depths;
+
+	try
+	{
+		// calls to scenes that don't exist are left for the VM to fail on
+		if (!compute_stack_depths(cmb, code, depths))
+			return false;
+	}
+	catch (const std::runtime_error&)
+	{
+		return false;
+	}
+
+	for (unsigned i = 0; i < code.size(); ++i)
+	{
+		switch (code[i].opcode)
+		{
+
+		case BC_OPCODE_REFY8:
+		case BC_OPCODE_REFY16:
+		case BC_OPCODE_GREFY8:
+		case BC_OPCODE_GREFY16:
+			return false;
+
+		case BC_OPCODE_REF8:
+		case BC_OPCODE_REF16:
+		case BC_OPCODE_REFX8:
+		case BC_OPCODE_REFX16:
+		case BC_OPCODE_GREF8:
+		case BC_OPCODE_GREF16:
+		case BC_OPCODE_GREFX8:
+		case BC_OPCODE_GREFX16:
+			if (depths[i] >= 0 && !address_stays_put(cmb, code, depths, i))
+				return false;
+
+			break;
+
+		} // switch (code[i].opcode)
+	}
+
+	return true;
+}
+
+SceneInfo specialize_scene(const CmbInfo& cmb, const SceneInfo& scene, const ConstantBindings& constants, GameKind game)
+{
+	auto code = index_jumps(scene.rawScript);
+
+	// a slot may be written to if its address is taken
+	// refx can index anything after its base, so consider everything after it taken too
+	// when that isn't enough to know (see writes_are_known), every slot may be written to
+
+	const bool writesKnown = writes_are_known(cmb, code);
+
+	const auto is_written = [&] (unsigned slot, bool global)
+	{
+		if (!writesKnown)
+			return true;
+
+		for (auto& ins : code)
+		{
+			switch (ins.opcode)
+			{
+
+			case BC_OPCODE_REF8:
+			case BC_OPCODE_REF16:
+				if (!global && static_cast<unsigned>(ins.operand) == slot)
+					return true;
+
+				break;
+
+			case BC_OPCODE_REFX8:
+			case BC_OPCODE_REFX16:
+				if (!global && static_cast<unsigned>(ins.operand) <= slot)
+					return true;
+
+				break;
+
+			case BC_OPCODE_GREF8:
+			case BC_OPCODE_GREF16:
+				if (global && static_cast<unsigned>(ins.operand) == slot)
+					return true;
+
+				break;
+
+			case BC_OPCODE_GREFX8:
+			case BC_OPCODE_GREFX16:
+				if (global && static_cast<unsigned>(ins.operand) <= slot)
+					return true;
+
+				break;
+
+			} // switch (ins.opcode)
+		}
+
+		return false;
+	};
+
+	const auto substitute = [&] (unsigned slot, std::int32_t value, bool global)
+	{
+		if (is_written(slot, global))
+			return;
+
+		const std::uint8_t op8 = global ? BC_OPCODE_GVAL8 : BC_OPCODE_VAL8;
+		const std::uint8_t op16 = global ? BC_OPCODE_GVAL16 : BC_OPCODE_VAL16;
+
+		for (auto& ins : code)
+		{
+			if ((ins.opcode == op8 || ins.opcode == op16) && static_cast<unsigned>(ins.operand) == slot)
+				ins = make_ins(BC_OPCODE_NUMBER32, value);
+		}
+	};
+
+	for (auto& arg : constants.args)
+		if (arg.first < scene.argCnt)
+			substitute(arg.first, arg.second, false);
+
+	for (auto& global : constants.globals)
+		if (global.first < cmb.globalNames.size())
+			substitute(global.first, global.second, true);
+
+	fold_constants(code);
+	terminate_code(code, game);
+
+	SceneInfo result = scene;
+	result.rawScript = unindex_jumps(std::move(code), game);
+
+	return result;
+}
+
+} // namespace soren
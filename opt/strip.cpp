@@ -0,0 +1,196 @@
+
+#include "opt/optimize.h"
+
+#include <map>
+#include <stdexcept>
+#include <string>
+
+namespace soren {
+
+static inline
+bool is_string_push(std::uint8_t opcode)
+{
+	return opcode == BC_OPCODE_STRING8 || opcode == BC_OPCODE_STRING16 || opcode == BC_OPCODE_STRING32;
+}
+
+unsigned strip_dead_scenes(CmbInfo& cmb, GameKind game)
+{
+	// roots: what the game can start by itself (named scenes, and scenes that aren't plain functions)
+
+	std::vector<bool> reachable(cmb.scenes.size(), false);
+	std::vector<unsigned> work;
+
+	for (unsigned i = 0; i < cmb.scenes.size(); ++i)
+	{
+		auto& scene = cmb.scenes[i];
+
+		if (scene.isGlobal || scene.kind != CMB_SCENE_KIND_FUNCTION)
+		{
+			reachable[i] = true;
+			work.push_back(i);
+		}
+	}
+
+	// calls in unreachable code of a kept scene still keep their callee, as the call needs to be encodable
+
+	while (!work.empty())
+	{
+		const unsigned i = work.back();
+		work.pop_back();
+
+		for (auto& ins : cmb.scenes[i].rawScript)
+		{
+			if (ins.opcode != BC_OPCODE_CALL)
+				continue;
+
+			if (ins.operand < 0 || static_cast<unsigned>(ins.operand) >= cmb.scenes.size())
+				throw std::runtime_error("Call to non-existent scene."); // TODO: better error
+
+			if (!reachable[ins.operand])
+			{
+				reachable[ins.operand] = true;
+				work.push_back(ins.operand);
+			}
+		}
+	}
+
+	// new indices
+
+	std::vector<std::int32_t> newIdx(cmb.scenes.size(), -1);
+	std::vector<SceneInfo> scenes;
+
+	for (unsigned i = 0; i < cmb.scenes.size(); ++i)
+	{
+		if (!reachable[i])
+			continue;
+
+		newIdx[i] = scenes.size();
+		scenes.push_back(std::move(cmb.scenes[i]));
+	}
+
+	const unsigned stripped = cmb.scenes.size() - scenes.size();
+
+	if (stripped == 0)
+	{
+		cmb.scenes = std::move(scenes);
+		return 0;
+	}
+
+	for (unsigned i = 0; i < scenes.size(); ++i)
+	{
+		auto& scene = scenes[i];
+
+		scene.idx = i;
+
+		bool calls = false;
+
+		for (auto& ins : scene.rawScript)
+			calls = calls || ins.opcode == BC_OPCODE_CALL;
+
+		if (!calls)
+			continue;
+
+		// call operand sizes vary (fe10), so this may move things around
+
+		auto code = index_jumps(scene.rawScript);
+
+		for (auto& ins : code)
+			if (ins.opcode == BC_OPCODE_CALL)
+				ins.operand = newIdx[ins.operand];
+
+		scene.rawScript = unindex_jumps(std::move(code), game);
+	}
+
+	cmb.scenes = std::move(scenes);
+
+	return stripped;
+}
+
+unsigned strip_unused_strings(CmbInfo& cmb, GameKind game)
+{
+	// new pool, with each referenced string once (in order of first reference)
+	// strings referenced from within another string (suffixes) get a copy of their own
+
+	std::vector<char> pool;
+	std::map<std::string, std::int32_t> offsets;
+
+	const auto add_string = [&] (std::int32_t offset)
+	{
+		if (offset < 0)
+			throw std::runtime_error("Reading string out of bounds."); // TODO: better error
+
+		const std::string str = cmb.get_cstr(offset);
+
+		auto it = offsets.find(str);
+
+		if (it != offsets.end())
+			return it->second;
+
+		const std::int32_t result = pool.size();
+
+		pool.insert(pool.end(), str.begin(), str.end());
+		pool.push_back('\0');
+
+		offsets.emplace(str, result);
+
+		return result;
+	};
+
+	// names of global scenes are referenced by offset from the scene info (see encode_cmb)
+
+	for (auto& scene : cmb.scenes)
+	{
+		if (!scene.isGlobal)
+			continue;
+
+		const std::string name = scene.name;
+
+		if (offsets.find(name) != offsets.end())
+			continue;
+
+		const std::int32_t offset = pool.size();
+
+		pool.insert(pool.end(), name.begin(), name.end());
+		pool.push_back('\0');
+
+		offsets.emplace(name, offset);
+	}
+
+	// new operands for each scene, applied once we know the new pool is smaller
+
+	std::vector<std::vector<BcIns>> codes(cmb.scenes.size());
+
+	for (unsigned i = 0; i < cmb.scenes.size(); ++i)
+	{
+		auto& code = codes[i];
+
+		code = index_jumps(cmb.scenes[i].rawScript);
+
+		for (auto& ins : code)
+		{
+			if (is_string_push(ins.opcode))
+				ins.operand = add_string(ins.operand);
+
+			if (ins.opcode == BC_OPCODE_CALLEXT)
+				ins.operand = (add_string(ins.operand >> 8) << 8) | (ins.operand & 0xFF);
+		}
+	}
+
+	if (pool.size() >= cmb.stringPool.size())
+		return 0;
+
+	const unsigned saved = cmb.stringPool.size() - pool.size();
+
+	for (unsigned i = 0; i < cmb.scenes.size(); ++i)
+	{
+		// string operand sizes may shrink
+
+		cmb.scenes[i].rawScript = unindex_jumps(std::move(codes[i]), game);
+	}
+
+	cmb.stringPool = std::move(pool);
+
+	return saved;
+}
+
+} // namespace soren
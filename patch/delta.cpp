@@ -0,0 +1,550 @@
+
+#include "patch/delta.h"
+
+#include "decode/layout.h"
+#include "encode/encode.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+namespace soren {
+
+static const char DELTA_MAGIC[8] = { 'S', 'R', 'N', 'D', 'E', 'L', 'T', 'A' };
+
+enum : unsigned
+{
+	DELTA_SOURCE_READ = 0,
+	DELTA_TARGET_READ = 1,
+	DELTA_SOURCE_COPY = 2,
+	DELTA_RELOCATED_COPY = 3,
+};
+
+constexpr std::size_t DELTA_HASH_WINDOW = 8; //< shortest match looked up in the source (and shortest copy)
+constexpr unsigned DELTA_MAX_CANDIDATES = 32; //< positions of the source tried per position of the target
+
+// as bps does it: 7 bits at a time, the last byte having its top bit set
+// each byte after the first also adds one, so that there is only one way to encode a number
+static
+void encode_varint(std::vector<byte_type>& out, std::uint64_t value)
+{
+	for (;;)
+	{
+		const byte_type bits = value & 0x7F;
+		value >>= 7;
+
+		if (value == 0)
+		{
+			out.push_back(0x80 | bits);
+			return;
+		}
+
+		out.push_back(bits);
+		value--;
+	}
+}
+
+static
+std::uint64_t decode_varint(Span<const byte_type> data, std::size_t& pos)
+{
+	std::uint64_t result = 0, shift = 1;
+
+	for (;;)
+	{
+		if (pos >= data.size())
+			throw std::runtime_error("Delta ends in the middle of a number."); // TODO: better error
+
+		const auto byte = data[pos++];
+		result += (byte & 0x7F) * shift;
+
+		if (byte & 0x80)
+			return result;
+
+		if (shift >= (std::uint64_t(1) << 56))
+			throw std::runtime_error("Delta has a number that is too large."); // TODO: better error
+
+		shift <<= 7;
+		result += shift;
+	}
+}
+
+// false if data doesn't look like a cmb (see read_cmb_layout), which is then diffed like any other file
+static
+bool read_layout(Span<const byte_type> data, CmbLayout& layout)
+{
+	try
+	{
+		layout = read_cmb_layout(data);
+		return true;
+	}
+	catch (const std::runtime_error&)
+	{
+		return false;
+	}
+}
+
+// source offsets in [begin, begin + length) are at offset + shift in the target
+
+struct Relocation
+{
+	std::uint32_t begin, length;
+	std::int64_t shift;
+};
+
+// the source with the offsets that point into relocations shifted (see delta.h)
+// relocations are sorted by begin
+static
+std::vector<byte_type> relocate_source(Span<const byte_type> source, const std::vector<Relocation>& relocations)
+{
+	std::vector<byte_type> result(source.begin(), source.end());
+
+	CmbLayout layout;
+
+	if (!read_layout(source, layout))
+		return result;
+
+	const auto relocate = [&] (std::size_t pos)
+	{
+		const auto value = read_int_le(source, pos, 4);
+
+		if (value == 0)
+			return;
+
+		auto it = std::upper_bound(relocations.begin(), relocations.end(), value,
+			[] (std::uint32_t a, const Relocation& b) { return a < b.begin; });
+
+		if (it == relocations.begin() || value - (--it)->begin >= it->length)
+			return;
+
+		store_int_le(result, pos, static_cast<std::uint32_t>(value + it->shift), 4);
+	};
+
+	relocate(0x24);
+	relocate(0x28);
+
+	for (unsigned i = 0; i < layout.scenes.size(); ++i)
+	{
+		relocate(layout.scenes[i].info + 0x00);
+		relocate(layout.scenes[i].info + 0x04);
+
+		relocate(layout.events + 4*i);
+	}
+
+	return result;
+}
+
+std::uint32_t crc32(Span<const byte_type> data)
+{
+	static const auto table = [] ()
+	{
+		std::array<std::uint32_t, 256> result;
+
+		for (std::uint32_t i = 0; i < 256; ++i)
+		{
+			std::uint32_t crc = i;
+
+			for (unsigned k = 0; k < 8; ++k)
+				crc = (crc & 1) ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+
+			result[i] = crc;
+		}
+
+		return result;
+	} ();
+
+	std::uint32_t crc = 0xFFFFFFFFu;
+
+	for (auto byte : data)
+		crc = table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+
+	return crc ^ 0xFFFFFFFFu;
+}
+
+std::vector<byte_type> make_delta(Span<const byte_type> source, Span<const byte_type> target)
+{
+	std::vector<byte_type> result(DELTA_MAGIC, DELTA_MAGIC + sizeof(DELTA_MAGIC));
+
+	encode_varint(result, source.size());
+	encode_varint(result, target.size());
+
+	// 1. scenes of the target paired with scenes of the source: those with the same script (padding aside) first,
+	// then those at the same index. Unchanged scripts are where matching starts from when the target gets to them,
+	// which the hash lookup alone may miss (scripts often start the same way).
+
+	std::unordered_map<std::uint32_t, std::uint32_t> anchors; //< target offset, source offset
+	std::vector<Relocation> relocations;
+
+	CmbLayout from, to;
+
+	if (read_layout(source, from) && read_layout(target, to))
+	{
+		const auto trimmed = [] (Span<const byte_type> data, const CmbSceneLayout& scene)
+		{
+			auto end = scene.scriptEnd;
+
+			while (end > scene.script + 1 && data[end - 1] == 0)
+				end--;
+
+			return data.subspan(scene.script, end - scene.script);
+		};
+
+		std::unordered_multimap<std::uint32_t, unsigned> sourceScripts; //< crc, scene
+		std::vector<int> pairs(to.scenes.size(), -1);
+		std::vector<bool> paired(from.scenes.size(), false);
+
+		for (unsigned i = 0; i < from.scenes.size(); ++i)
+			sourceScripts.emplace(crc32(trimmed(source, from.scenes[i])), i);
+
+		for (unsigned i = 0; i < to.scenes.size(); ++i)
+		{
+			const auto script = trimmed(target, to.scenes[i]);
+			const auto range = sourceScripts.equal_range(crc32(script));
+
+			for (auto it = range.first; it != range.second; ++it)
+			{
+				const auto& scene = from.scenes[it->second];
+
+				if (paired[it->second] || std::size_t(scene.script) + script.size() > source.size()
+					|| !std::equal(script.begin(), script.end(), source.begin() + scene.script))
+					continue;
+
+				pairs[i] = it->second;
+				paired[it->second] = true;
+
+				anchors.emplace(to.scenes[i].script, scene.script);
+				break;
+			}
+		}
+
+		for (unsigned i = 0; i < to.scenes.size() && i < from.scenes.size(); ++i)
+		{
+			if (pairs[i] < 0 && !paired[i])
+			{
+				pairs[i] = i;
+				paired[i] = true;
+			}
+		}
+
+		// where things moved: scene informations and scripts of paired scenes, the string pool and event offset array
+		// consecutive relocations with the same shift are merged (gaps are padding, that nothing points to)
+
+		const auto relocate = [&] (std::uint32_t begin, std::uint32_t end, std::uint32_t moved)
+		{
+			relocations.push_back(Relocation { begin, end - begin, std::int64_t(moved) - std::int64_t(begin) });
+		};
+
+		for (unsigned i = 0; i < to.scenes.size(); ++i)
+		{
+			if (pairs[i] < 0)
+				continue;
+
+			const auto& scene = from.scenes[pairs[i]];
+
+			relocate(scene.info, scene.info + scene.infoSize, to.scenes[i].info);
+			relocate(scene.script, scene.scriptEnd, to.scenes[i].script);
+		}
+
+		relocate(from.strings, from.stringsEnd, to.strings);
+		relocate(from.events, from.events + 4*(from.scenes.size() + 1), to.events);
+
+		std::sort(relocations.begin(), relocations.end(),
+			[] (const Relocation& a, const Relocation& b) { return a.begin < b.begin; });
+
+		std::vector<Relocation> merged;
+
+		for (auto& relocation : relocations)
+		{
+			if (!merged.empty() && merged.back().shift == relocation.shift && merged.back().begin + merged.back().length <= relocation.begin)
+				merged.back().length = relocation.begin + relocation.length - merged.back().begin;
+			else
+				merged.push_back(relocation);
+		}
+
+		relocations = std::move(merged);
+	}
+
+	encode_varint(result, relocations.size());
+
+	for (unsigned i = 0; i < relocations.size(); ++i)
+	{
+		auto& relocation = relocations[i];
+		const auto shift = relocation.shift;
+
+		encode_varint(result, relocation.begin - (i > 0 ? relocations[i - 1].begin : 0));
+		encode_varint(result, relocation.length);
+		encode_varint(result, (std::uint64_t(shift < 0 ? -shift : shift) << 1) | (shift < 0 ? 1 : 0));
+	}
+
+	const auto moved = relocate_source(source, relocations);
+
+	// target ranges of relocations, to find where in the source what is at a position of the target was
+
+	std::vector<Relocation> movedTo(relocations);
+
+	std::sort(movedTo.begin(), movedTo.end(),
+		[] (const Relocation& a, const Relocation& b) { return a.begin + a.shift < b.begin + b.shift; });
+
+	// 2. every position of the source, by hash of the bytes there (latest first in each chain)
+
+	unsigned bits = 10;
+
+	while ((std::size_t(1) << bits) < source.size() && bits < 24)
+		bits++;
+
+	const auto hash_at = [&] (const byte_type* at)
+	{
+		std::uint64_t window;
+		std::memcpy(&window, at, sizeof(window));
+
+		return static_cast<std::size_t>((window * 0x9E3779B97F4A7C15ull) >> (64 - bits));
+	};
+
+	static_assert(DELTA_HASH_WINDOW == sizeof(std::uint64_t), "the hashed window is read as one integer");
+
+	std::vector<std::int32_t> heads(std::size_t(1) << bits, -1);
+	std::vector<std::int32_t> chain(source.size() >= DELTA_HASH_WINDOW ? source.size() - DELTA_HASH_WINDOW + 1 : 0, -1);
+
+	for (std::size_t i = 0; i < chain.size(); ++i)
+	{
+		auto& head = heads[hash_at(source.data() + i)];
+
+		chain[i] = head;
+		head = i;
+	}
+
+	// 3. commands, taking the longest match at each position of the target (greedily)
+
+	const auto command = [&] (unsigned action, std::size_t length)
+	{
+		encode_varint(result, (std::uint64_t(length - 1) << 2) | action);
+	};
+
+	std::size_t pos = 0, literals = 0; //< literals: where the target bytes not written yet start
+	std::size_t sourceEnd = 0; //< of the previous source copy
+
+	const auto flush_literals = [&] ()
+	{
+		if (pos == literals)
+			return;
+
+		command(DELTA_TARGET_READ, pos - literals);
+		result.insert(result.end(), target.begin() + literals, target.begin() + pos);
+	};
+
+	while (pos < target.size())
+	{
+		std::size_t bestLength = 0, bestFrom = 0;
+		bool bestMoved = false;
+
+		const auto consider = [&] (std::size_t from, bool relocated)
+		{
+			const auto& bytes = relocated ? Span<const byte_type>(moved) : source;
+			std::size_t length = 0;
+
+			while (from + length < bytes.size() && pos + length < target.size() && bytes[from + length] == target[pos + length])
+				length++;
+
+			if (length > bestLength)
+			{
+				bestLength = length;
+				bestFrom = from;
+				bestMoved = relocated;
+			}
+		};
+
+		// cheapest to encode first, as ties keep the first: a source read has no offset, nor does continuing the previous copy
+
+		consider(pos, false);
+		consider(sourceEnd, false);
+		consider(sourceEnd, true);
+
+		if (!movedTo.empty())
+		{
+			auto it = std::upper_bound(movedTo.begin(), movedTo.end(), std::int64_t(pos),
+				[] (std::int64_t a, const Relocation& b) { return a < b.begin + b.shift; });
+
+			if (it != movedTo.begin() && std::int64_t(pos) - (--it)->shift - it->begin < it->length)
+				consider(pos - it->shift, true);
+		}
+
+		const auto anchor = anchors.find(pos);
+
+		if (anchor != anchors.end())
+			consider(anchor->second, false);
+
+		if (pos + DELTA_HASH_WINDOW <= target.size() && !chain.empty())
+		{
+			unsigned tried = 0;
+
+			for (auto from = heads[hash_at(target.data() + pos)]; from >= 0 && tried < DELTA_MAX_CANDIDATES; from = chain[from], ++tried)
+			{
+				consider(from, false);
+
+				if (!relocations.empty())
+					consider(from, true);
+			}
+		}
+
+		const std::size_t minLength = ((bestFrom == pos && !bestMoved) || bestFrom == sourceEnd) ? 4 : DELTA_HASH_WINDOW;
+
+		if (bestLength < minLength)
+		{
+			pos++;
+			continue;
+		}
+
+		// the match may also cover the end of the literals before it
+
+		const auto& bytes = bestMoved ? Span<const byte_type>(moved) : source;
+
+		while (pos > literals && bestFrom > 0 && bytes[bestFrom - 1] == target[pos - 1])
+		{
+			pos--;
+			bestFrom--;
+			bestLength++;
+		}
+
+		flush_literals();
+
+		if (bestFrom == pos && !bestMoved)
+		{
+			command(DELTA_SOURCE_READ, bestLength);
+		}
+		else
+		{
+			const std::int64_t offset = std::int64_t(bestFrom) - std::int64_t(sourceEnd);
+
+			command(bestMoved ? DELTA_RELOCATED_COPY : DELTA_SOURCE_COPY, bestLength);
+			encode_varint(result, (std::uint64_t(offset < 0 ? -offset : offset) << 1) | (offset < 0 ? 1 : 0));
+
+			sourceEnd = bestFrom + bestLength;
+		}
+
+		pos += bestLength;
+		literals = pos;
+	}
+
+	flush_literals();
+
+	// checksums
+
+	for (auto crc : { crc32(source), crc32(target), crc32(result) })
+		for (unsigned i = 0; i < 4; ++i)
+			result.push_back((crc >> (8*i)) & 0xFF);
+
+	return result;
+}
+
+std::vector<byte_type> apply_delta(Span<const byte_type> source, Span<const byte_type> delta)
+{
+	if (delta.size() < sizeof(DELTA_MAGIC) + 12 || !std::equal(DELTA_MAGIC, DELTA_MAGIC + sizeof(DELTA_MAGIC), delta.begin()))
+		throw std::runtime_error("This is not a soren delta."); // TODO: better error
+
+	const auto body = delta.first(delta.size() - 12);
+	const auto trailer = delta.size() - 12;
+
+	if (crc32(body) != read_int_le(delta, trailer + 8, 4))
+		throw std::runtime_error("Delta is corrupted (checksum mismatch)."); // TODO: better error
+
+	std::size_t pos = sizeof(DELTA_MAGIC);
+
+	const auto sourceSize = decode_varint(body, pos);
+	const auto targetSize = decode_varint(body, pos);
+
+	if (sourceSize != source.size() || crc32(source) != read_int_le(delta, trailer, 4))
+		throw std::runtime_error("Delta was made from another file."); // TODO: better error
+
+	if (targetSize > (std::uint64_t(1) << 32))
+		throw std::runtime_error("Delta target is too large."); // TODO: better error
+
+	const auto signed_varint = [&] ()
+	{
+		const auto value = decode_varint(body, pos);
+		return (value & 1) ? -std::int64_t(value >> 1) : std::int64_t(value >> 1);
+	};
+
+	const auto relocationCount = decode_varint(body, pos);
+
+	if (relocationCount > body.size())
+		throw std::runtime_error("Delta has more relocations than bytes."); // TODO: better error
+
+	std::vector<Relocation> relocations(relocationCount);
+
+	for (unsigned i = 0; i < relocations.size(); ++i)
+	{
+		const std::uint64_t begin = decode_varint(body, pos) + (i > 0 ? relocations[i - 1].begin : 0);
+		const auto length = decode_varint(body, pos);
+
+		if (begin + length > (std::uint64_t(1) << 32))
+			throw std::runtime_error("Delta relocates past 32-bit offsets."); // TODO: better error
+
+		relocations[i] = Relocation { static_cast<std::uint32_t>(begin), static_cast<std::uint32_t>(length), signed_varint() };
+	}
+
+	const auto moved = relocations.empty() ? std::vector<byte_type>() : relocate_source(source, relocations);
+
+	std::vector<byte_type> result;
+	result.reserve(targetSize);
+
+	std::uint64_t sourceEnd = 0; //< of the previous source copy
+
+	while (pos < body.size())
+	{
+		const auto cmd = decode_varint(body, pos);
+		const auto length = (cmd >> 2) + 1;
+
+		if (length > targetSize - result.size())
+			throw std::runtime_error("Delta writes past the end of the target."); // TODO: better error
+
+		switch (cmd & 3)
+		{
+
+		case DELTA_SOURCE_READ:
+			if (result.size() + length > source.size())
+				throw std::runtime_error("Delta reads past the end of the source."); // TODO: better error
+
+			result.insert(result.end(), source.begin() + result.size(), source.begin() + result.size() + length);
+			break;
+
+		case DELTA_TARGET_READ:
+			if (length > body.size() - pos)
+				throw std::runtime_error("Delta ends in the middle of a command."); // TODO: better error
+
+			result.insert(result.end(), body.begin() + pos, body.begin() + pos + length);
+			pos += length;
+
+			break;
+
+		case DELTA_SOURCE_COPY:
+		case DELTA_RELOCATED_COPY:
+		{
+			const auto& bytes = ((cmd & 3) == DELTA_RELOCATED_COPY) ? Span<const byte_type>(moved) : source;
+			const auto offset = signed_varint();
+
+			if (offset < -std::int64_t(sourceEnd) || std::uint64_t(std::int64_t(sourceEnd) + offset) > bytes.size())
+				throw std::runtime_error("Delta copies from outside of the source."); // TODO: better error
+
+			const auto from = std::uint64_t(std::int64_t(sourceEnd) + offset);
+
+			if (length > bytes.size() - from)
+				throw std::runtime_error("Delta copies from outside of the source."); // TODO: better error
+
+			result.insert(result.end(), bytes.begin() + from, bytes.begin() + from + length);
+			sourceEnd = from + length;
+
+			break;
+		}
+
+		} // switch (cmd & 3)
+	}
+
+	if (result.size() != targetSize || crc32(result) != read_int_le(delta, trailer + 4, 4))
+		throw std::runtime_error("Delta didn't make the expected file."); // TODO: better error
+
+	return result;
+}
+
+} // namespace soren
@@ -0,0 +1,40 @@
+#ifndef SOREN_PATCH_DELTA_INCLUDED
+#define SOREN_PATCH_DELTA_INCLUDED
+
+#include <cstdint>
+#include <vector>
+
+#include "core/types.h"
+
+namespace soren {
+
+// delta: how to make a modified file out of the original one (to distribute mods without the original files)
+// close to BPS, with every number a variable length integer (see encode_varint in delta.cpp)
+//
+//     "SRNDELTA"
+//     source size, target size
+//     relocation count, then per relocation: begin (from the previous one's), length, signed shift
+//     commands, each ((length - 1) << 2 | action), until the target is complete:
+//         0: source read, the next length bytes of the source at the same offset as in the target
+//         1: target read, followed by length bytes to write as they are
+//         2: source copy, followed by a signed offset from the end of the previous (relocated) source copy
+//         3: relocated source copy, the same from the relocated source
+//     crc32 of the source, the target, and the delta up to here (u32, little endian)
+//
+// the relocated source is the source where the offsets of its header, scene informations and event offset array
+// (if it is a cmb) that are in a relocation [begin, begin + length) are shifted, to be where they point to in the target
+//
+// any files can be diffed, cmb files get scripts matched to scripts first (the scene-aware part):
+// those that didn't change only move (scripts don't have absolute offsets), and are copied whole,
+// and where things moved gives the relocations, so that the offsets to them don't have to be in the delta
+
+std::vector<byte_type> make_delta(Span<const byte_type> source, Span<const byte_type> target);
+
+// throws if the delta is corrupted, or was made from another source
+std::vector<byte_type> apply_delta(Span<const byte_type> source, Span<const byte_type> delta);
+
+std::uint32_t crc32(Span<const byte_type> data);
+
+} // namespace soren
+
+#endif // SOREN_PATCH_DELTA_INCLUDED
@@ -0,0 +1,538 @@
+
+#include "patch/edit.h"
+
+#include "decode/decode.h"
+#include "decode/layout.h"
+#include "encode/encode.h"
+#include "opt/optimize.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace soren {
+
+static inline
+void check_script(Span<const BcIns> script)
+{
+	if (script.size() == 0 || !script[script.size() - 1].is_end())
+		throw std::runtime_error("Script doesn't end with an end instruction."); // TODO: better error
+}
+
+CmbEditor::CmbEditor(std::vector<byte_type> bytes, GameKind game)
+	: game(game), data(std::move(bytes))
+{
+	// only where things are, scripts are decoded when needed
+
+	const auto layout = read_cmb_layout(data);
+
+	offStrings = layout.strings;
+	endStrings = layout.stringsEnd;
+	offEvents = layout.events;
+
+	for (auto& scene : layout.scenes)
+	{
+		infoOffsets.push_back(scene.info);
+		scriptOffsets.push_back(scene.script);
+	}
+
+	entries.resize(infoOffsets.size());
+
+	for (unsigned i = 0; i < entries.size(); ++i)
+		entries[i].original = i;
+
+	if (!find_regions())
+		regions.clear();
+}
+
+bool CmbEditor::find_regions()
+{
+	regions.push_back(Region { 0u, 0u, RegionKind::Header, 0u });
+
+	for (unsigned i = 0; i < infoOffsets.size(); ++i)
+	{
+		regions.push_back(Region { infoOffsets[i], 0u, RegionKind::Info, i });
+		regions.push_back(Region { scriptOffsets[i], 0u, RegionKind::Script, i });
+	}
+
+	regions.push_back(Region { offStrings, 0u, RegionKind::Strings, 0u });
+	regions.push_back(Region { offEvents, 0u, RegionKind::Events, 0u });
+
+	std::sort(regions.begin(), regions.end(), [] (const Region& a, const Region& b) { return a.begin < b.begin; });
+
+	// each region goes until the next one (so it keeps any padding after it)
+
+	for (unsigned i = 0; i < regions.size(); ++i)
+	{
+		auto& region = regions[i];
+
+		region.end = (i + 1 < regions.size()) ? regions[i + 1].begin : data.size();
+
+		if (region.end <= region.begin)
+			return false; // two things at the same place
+
+		const auto size = region.end - region.begin;
+
+		switch (region.kind)
+		{
+
+		case RegionKind::Header:
+			if (size < 0x2C)
+				return false;
+
+			break;
+
+		case RegionKind::Info:
+			if (size < 0x14 + 2u*data[region.begin + 0x0E])
+				return false;
+
+			break;
+
+		case RegionKind::Script:
+			break;
+
+		case RegionKind::Strings:
+			// strings added at the end of the region have to be at the end of the pool
+			if (region.end != endStrings)
+				return false;
+
+			break;
+
+		case RegionKind::Events:
+			if (size < 4*(infoOffsets.size() + 1))
+				return false;
+
+			break;
+
+		} // switch (region.kind)
+	}
+
+	return true;
+}
+
+std::string CmbEditor::scene_name(unsigned scene) const
+{
+	auto& entry = entries.at(scene);
+
+	if (entry.original < 0)
+		return entry.added.name;
+
+	const auto offName = read_int_le(data, infoOffsets[entry.original], 4);
+
+	if (offName == 0)
+		return "Unknown_" + std::to_string(scene);
+
+	const auto begin = data.begin() + std::min<std::size_t>(offName, data.size());
+	return std::string(begin, std::find(begin, data.end(), 0));
+}
+
+const std::vector<BcIns>& CmbEditor::script(unsigned scene)
+{
+	if (scene >= entries.size())
+		throw std::runtime_error("Scene index out of range."); // TODO: better error
+
+	auto& entry = entries[scene];
+
+	if (entry.script.empty())
+		entry.script = decode_script(Span<const byte_type>(data).subspan(scriptOffsets[entry.original]), game);
+
+	return entry.script;
+}
+
+std::string CmbEditor::string_at(std::int32_t offset) const
+{
+	const std::size_t poolSize = endStrings - offStrings;
+
+	if (offset < 0 || static_cast<std::size_t>(offset) >= poolSize + addedStrings.size())
+		throw std::runtime_error("Bad string pool offset"); // TODO: better error
+
+	const auto from = [&] (const char* begin, const char* end)
+	{
+		const auto stop = std::find(begin, end, '\0');
+
+		if (stop == end)
+			throw std::runtime_error("Unterminated string in string pool"); // TODO: better error
+
+		return std::string(begin, stop);
+	};
+
+	const auto pool = reinterpret_cast<const char*>(data.data()) + offStrings;
+
+	if (static_cast<std::size_t>(offset) < poolSize)
+		return from(pool + offset, pool + poolSize);
+
+	return from(addedStrings.data() + (offset - poolSize), addedStrings.data() + addedStrings.size());
+}
+
+std::int32_t CmbEditor::add_string(const std::string& text)
+{
+	// with its terminator
+
+	const std::size_t poolSize = endStrings - offStrings;
+
+	const auto pool = reinterpret_cast<const char*>(data.data()) + offStrings;
+	const auto it = std::search(pool, pool + poolSize, text.c_str(), text.c_str() + text.size() + 1);
+
+	if (it != pool + poolSize)
+		return it - pool;
+
+	const auto added = std::search(addedStrings.begin(), addedStrings.end(), text.c_str(), text.c_str() + text.size() + 1);
+
+	if (added != addedStrings.end())
+		return poolSize + (added - addedStrings.begin());
+
+	const std::int32_t result = poolSize + addedStrings.size();
+	addedStrings.insert(addedStrings.end(), text.c_str(), text.c_str() + text.size() + 1);
+
+	return result;
+}
+
+void CmbEditor::set_script(unsigned scene, std::vector<BcIns> script)
+{
+	if (scene >= entries.size())
+		throw std::runtime_error("Scene index out of range."); // TODO: better error
+
+	check_script(script);
+
+	entries[scene].script = std::move(script);
+	entries[scene].dirty = true;
+}
+
+unsigned CmbEditor::add_scene(SceneInfo scene)
+{
+	check_script(scene.rawScript);
+
+	if (scene.parameters.size() > PARAMS_AMT_SUSPICION_LIMIT || scene.varnames.size() > LOCALS_AMT_SUSPICION_LIMIT)
+		throw std::runtime_error("Too many parameters or locals in scene to be encoded."); // TODO: better error
+
+	entries.emplace_back();
+	auto& entry = entries.back();
+
+	entry.script = std::move(scene.rawScript);
+	entry.dirty = true;
+
+	entry.added = std::move(scene);
+	entry.added.rawScript.clear();
+
+	if (entry.added.isGlobal)
+		entry.addedName = add_string(entry.added.name);
+
+	return entries.size() - 1;
+}
+
+void CmbEditor::remove_scene(unsigned scene)
+{
+	if (scene >= entries.size())
+		throw std::runtime_error("Scene index out of range."); // TODO: better error
+
+	// scenes are called by index, so calls to the scenes after this one are renumbered
+	// (which, with fe10 call operand sizes varying, may move things around in the scripts that have them)
+
+	std::vector<unsigned> renumber;
+
+	for (unsigned i = 0; i < entries.size(); ++i)
+	{
+		if (i == scene)
+			continue;
+
+		bool calls = false;
+
+		for (auto& ins : script(i))
+		{
+			if (ins.opcode != BC_OPCODE_CALL)
+				continue;
+
+			if (static_cast<unsigned>(ins.operand) == scene)
+				throw std::runtime_error("Can't remove a scene that is still called."); // TODO: better error
+
+			calls = calls || static_cast<unsigned>(ins.operand) > scene;
+		}
+
+		if (calls)
+			renumber.push_back(i);
+	}
+
+	for (auto i : renumber)
+	{
+		auto code = index_jumps(script(i));
+
+		for (auto& ins : code)
+			if (ins.opcode == BC_OPCODE_CALL && static_cast<unsigned>(ins.operand) > scene)
+				ins.operand--;
+
+		set_script(i, unindex_jumps(std::move(code), game));
+	}
+
+	entries.erase(entries.begin() + scene);
+	removed = true;
+}
+
+bool CmbEditor::edited() const
+{
+	if (removed || !addedStrings.empty())
+		return true;
+
+	return std::any_of(entries.begin(), entries.end(), [] (const Entry& entry) { return entry.dirty; });
+}
+
+std::vector<byte_type> CmbEditor::result() const
+{
+	encodedBytes = 0;
+
+	if (!edited())
+		return data;
+
+	if (regions.empty())
+		return result_whole();
+
+	return result_incremental();
+}
+
+std::vector<byte_type> CmbEditor::result_incremental() const
+{
+	std::vector<byte_type> result;
+	result.reserve(data.size() + addedStrings.size() + 0x100);
+
+	std::vector<int> entryOf(infoOffsets.size(), -1);
+
+	for (unsigned i = 0; i < entries.size(); ++i)
+		if (entries[i].original >= 0)
+			entryOf[entries[i].original] = i;
+
+	std::vector<std::uint32_t> newInfo(entries.size(), 0u), newScript(entries.size(), 0u);
+	std::uint32_t newStrings = 0, newEvents = 0;
+
+	// copied regions (in file order), to find where what offsets point to went
+
+	struct Moved
+	{
+		std::uint32_t begin, end, to;
+	};
+
+	std::vector<Moved> moved;
+
+	const auto copy = [&] (std::uint32_t begin, std::uint32_t end)
+	{
+		moved.push_back(Moved { begin, end, static_cast<std::uint32_t>(result.size()) });
+		result.insert(result.end(), data.begin() + begin, data.begin() + end);
+	};
+
+	// regions that need alignment keep the one they had, so that nothing is padded unless sizes changed
+
+	const auto pad_like = [&] (std::uint32_t original)
+	{
+		while (result.size() % 4 != original % 4)
+			result.push_back(0);
+	};
+
+	const auto add_script = [&] (unsigned e)
+	{
+		newScript[e] = result.size();
+
+		const auto script = encode_script(entries[e].script, game);
+		result.insert(result.end(), script.begin(), script.end());
+
+		encodedBytes += script.size();
+	};
+
+	// added scenes go after the scenes of the original file (before the string pool if there were none)
+
+	std::size_t insertAt = regions.size();
+
+	for (unsigned i = 0; i < regions.size(); ++i)
+	{
+		if (infoOffsets.empty() && insertAt == regions.size() && regions[i].kind != RegionKind::Header)
+			insertAt = i;
+
+		if (regions[i].kind == RegionKind::Info || regions[i].kind == RegionKind::Script)
+			insertAt = i + 1;
+	}
+
+	for (unsigned i = 0; i <= regions.size(); ++i)
+	{
+		if (i == insertAt)
+		{
+			for (unsigned e = 0; e < entries.size(); ++e)
+			{
+				auto& entry = entries[e];
+
+				if (entry.original >= 0)
+					continue;
+
+				pad_like(0);
+
+				const auto begin = result.size();
+				newInfo[e] = begin;
+
+				// as encode_cmb does, name and script being set below
+
+				encode_int_le(result, 0, 4);
+				encode_int_le(result, 0, 4);
+				encode_int_le(result, entry.added.unknown08, 4);
+				encode_int_le(result, entry.added.kind, 1);
+				encode_int_le(result, entry.added.argCnt, 1);
+				encode_int_le(result, entry.added.parameters.size(), 1);
+				encode_int_le(result, entry.added.unknown0F, 1);
+				encode_int_le(result, e, 2);
+				encode_int_le(result, std::max<unsigned>(entry.added.varnames.size(), entry.added.argCnt), 2);
+
+				for (auto param : entry.added.parameters)
+					encode_int_le(result, param, 2);
+
+				encodedBytes += result.size() - begin;
+
+				add_script(e);
+			}
+		}
+
+		if (i == regions.size())
+			break;
+
+		auto& region = regions[i];
+
+		switch (region.kind)
+		{
+
+		case RegionKind::Header:
+			copy(region.begin, region.end);
+			break;
+
+		case RegionKind::Info:
+		{
+			const auto e = entryOf[region.scene];
+
+			if (e < 0)
+				break; // removed
+
+			pad_like(region.begin);
+
+			newInfo[e] = result.size();
+			copy(region.begin, region.end);
+
+			break;
+		}
+
+		case RegionKind::Script:
+		{
+			const auto e = entryOf[region.scene];
+
+			if (e < 0)
+				break; // removed
+
+			if (entries[e].dirty)
+			{
+				add_script(e);
+				break;
+			}
+
+			newScript[e] = result.size();
+			copy(region.begin, region.end);
+
+			break;
+		}
+
+		case RegionKind::Strings:
+			newStrings = result.size();
+			copy(region.begin, region.end);
+
+			result.insert(result.end(), addedStrings.begin(), addedStrings.end());
+			encodedBytes += addedStrings.size();
+
+			break;
+
+		case RegionKind::Events:
+		{
+			// zero terminated, filled below (scene informations may come after it)
+
+			pad_like(region.begin);
+
+			newEvents = result.size();
+			result.resize(result.size() + 4*(entries.size() + 1), 0);
+
+			encodedBytes += 4*(entries.size() + 1);
+
+			// whatever was after the original array
+
+			const auto rest = region.begin + 4*(infoOffsets.size() + 1);
+
+			if (rest < region.end)
+				copy(rest, region.end);
+
+			break;
+		}
+
+		} // switch (region.kind)
+	}
+
+	// offsets
+
+	const auto moved_to = [&] (std::uint32_t offset)
+	{
+		auto it = std::upper_bound(moved.begin(), moved.end(), offset,
+			[] (std::uint32_t a, const Moved& b) { return a < b.begin; });
+
+		if (it == moved.begin() || offset >= (--it)->end)
+			throw std::runtime_error("Scene name isn't in a part of the file that is kept."); // TODO: better error
+
+		return it->to + (offset - it->begin);
+	};
+
+	for (unsigned e = 0; e < entries.size(); ++e)
+	{
+		auto& entry = entries[e];
+
+		std::uint32_t offName = 0;
+
+		if (entry.original >= 0)
+		{
+			offName = read_int_le(data, infoOffsets[entry.original], 4);
+
+			if (offName != 0)
+				offName = moved_to(offName);
+		}
+		else if (entry.addedName >= 0)
+		{
+			offName = newStrings + entry.addedName;
+		}
+
+		store_int_le(result, newInfo[e] + 0x00, offName, 4);
+		store_int_le(result, newInfo[e] + 0x04, newScript[e], 4);
+		store_int_le(result, newInfo[e] + 0x10, e, 2);
+
+		store_int_le(result, newEvents + 4*e, newInfo[e], 4);
+	}
+
+	store_int_le(result, 0x24, newStrings, 4);
+	store_int_le(result, 0x28, newEvents, 4);
+
+	return result;
+}
+
+std::vector<byte_type> CmbEditor::result_whole() const
+{
+	auto cmb = decode_cmb(data, game);
+
+	std::vector<SceneInfo> scenes;
+	scenes.reserve(entries.size());
+
+	for (unsigned e = 0; e < entries.size(); ++e)
+	{
+		auto& entry = entries[e];
+
+		scenes.push_back(entry.original >= 0 ? std::move(cmb.scenes[entry.original]) : entry.added);
+
+		if (entry.dirty)
+			scenes.back().rawScript = entry.script;
+
+		scenes.back().idx = e;
+	}
+
+	cmb.scenes = std::move(scenes);
+	cmb.stringPool.insert(cmb.stringPool.end(), addedStrings.begin(), addedStrings.end());
+
+	auto result = encode_cmb(cmb, game);
+	encodedBytes = result.size();
+
+	return result;
+}
+
+} // namespace soren
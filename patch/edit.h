@@ -0,0 +1,107 @@
+#ifndef SOREN_PATCH_EDIT_INCLUDED
+#define SOREN_PATCH_EDIT_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "core/types.h"
+#include "core/soren-bytecode.h"
+#include "core/soren-cmb.h"
+
+namespace soren {
+
+// Editing an encoded cmb (scripts, scenes, strings) without encoding all of it back.
+// The file is cut into the regions it is made of (header, scene informations and scripts, string pool, event offset array),
+// in the order they are in. The result copies the regions that weren't edited as they are, encodes the ones that were,
+// and fixes the offsets (in the header, scene informations and event offset array) that point past where sizes changed.
+// Files with regions that overlap or are out of the usual order are decoded and encoded back as a whole instead.
+
+struct CmbEditor
+{
+	CmbEditor(std::vector<byte_type> data, GameKind game);
+
+	unsigned scene_count() const { return entries.size(); }
+
+	std::string scene_name(unsigned scene) const;
+
+	// as decode_cmb gives it (jump operands being locations), decoded when first needed
+	const std::vector<BcIns>& script(unsigned scene);
+
+	// the string at offset in the string pool (added strings included)
+	std::string string_at(std::int32_t offset) const;
+
+	// the offset of text in the string pool, text being added at the end of the pool if it isn't in it
+	std::int32_t add_string(const std::string& text);
+
+	// replaces the script of a scene, with locations laid out (as unindex_jumps gives them)
+	void set_script(unsigned scene, std::vector<BcIns> script);
+
+	// adds a scene after the others, returns its index
+	// the name of a global scene is added to the string pool
+	unsigned add_scene(SceneInfo scene);
+
+	// removes a scene, renumbering calls to the scenes after it (throws if it is still called)
+	void remove_scene(unsigned scene);
+
+	bool edited() const;
+
+	// the edited cmb
+	std::vector<byte_type> result() const;
+
+	// how many bytes of the last result were encoded (rather than copied from the original)
+	std::size_t encoded_bytes() const { return encodedBytes; }
+
+private:
+	enum class RegionKind
+	{
+		Header,
+		Info,
+		Script,
+		Strings,
+		Events,
+	};
+
+	struct Region
+	{
+		std::uint32_t begin, end;
+		RegionKind kind;
+		unsigned scene; //< for informations and scripts
+	};
+
+	struct Entry
+	{
+		int original { -1 }; //< scene in the original file, -1 for added scenes
+		bool dirty { false }; //< whether the script was replaced
+
+		std::vector<BcIns> script; //< empty until decoded (or replaced)
+
+		SceneInfo added; //< for added scenes, without the script
+		std::int32_t addedName { -1 }; //< for added global scenes, offset of the name in the string pool
+	};
+
+	bool find_regions();
+
+	std::vector<byte_type> result_incremental() const;
+	std::vector<byte_type> result_whole() const;
+
+	GameKind game;
+
+	std::vector<byte_type> data;
+
+	std::vector<std::uint32_t> infoOffsets, scriptOffsets; //< of scenes in the original file
+	std::uint32_t offStrings { 0u }, endStrings { 0u }, offEvents { 0u };
+
+	std::vector<Region> regions; //< in file order, empty if the file has to be encoded as a whole
+
+	std::vector<Entry> entries;
+	std::vector<char> addedStrings; //< after the original string pool
+
+	bool removed { false };
+
+	mutable std::size_t encodedBytes { 0u };
+};
+
+} // namespace soren
+
+#endif // SOREN_PATCH_EDIT_INCLUDED
@@ -0,0 +1,324 @@
+
+#include "patch/patch.h"
+
+#include "decode/decode.h"
+#include "decode/layout.h"
+#include "encode/encode.h"
+#include "opt/optimize.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace soren {
+
+static inline
+bool is_number(const BcIns& ins)
+{
+	return ins.opcode == BC_OPCODE_NUMBER8 || ins.opcode == BC_OPCODE_NUMBER16 || ins.opcode == BC_OPCODE_NUMBER32;
+}
+
+static inline
+bool is_string(const BcIns& ins)
+{
+	return ins.opcode == BC_OPCODE_STRING8 || ins.opcode == BC_OPCODE_STRING16 || ins.opcode == BC_OPCODE_STRING32;
+}
+
+// the width of the operand of ins as encoded at operand (the bytes after its opcode)
+// an FE10 call is 2 bytes if the first one has its high bit set, whatever the value (see decode_script)
+static
+unsigned encoded_operand_size(const BcIns& ins, const byte_type* operand, GameKind game)
+{
+	if ((game == GameKind::FE10) && (ins.opcode == BC_OPCODE_CALL))
+		return (operand[0] & 0x80) ? 2 : 1;
+
+	return ins.info().operandSize;
+}
+
+// whether value can be encoded in the operand of ins with size bytes
+static
+bool fits_encoded(const BcIns& ins, unsigned size, std::int32_t value, GameKind game)
+{
+	if ((game == GameKind::FE10) && (ins.opcode == BC_OPCODE_CALL))
+	{
+		// 1 or 2 bytes, with the high bit of the first one telling which
+		return value >= 0 && (size == 2 ? value <= 0x7FFF : value < 0x80);
+	}
+
+	if (size >= 4)
+		return true;
+
+	if (ins.opcode == BC_OPCODE_CALL || ins.opcode == BC_OPCODE_CALLEXT)
+		return value >= 0 && value < (std::int32_t(1) << (8*size));
+
+	const std::int32_t limit = std::int32_t(1) << (8*size - 1);
+	return value >= -limit && value < limit;
+}
+
+CmbPatcher::CmbPatcher(std::vector<byte_type> bytes, GameKind game)
+	: game(game), data(std::move(bytes))
+{
+	// only where things are, scripts are decoded when needed
+
+	const auto layout = read_cmb_layout(data);
+
+	offStrings = layout.strings;
+	endStrings = layout.stringsEnd;
+
+	for (auto& scene : layout.scenes)
+	{
+		infoOffsets.push_back(scene.info);
+		scriptOffsets.push_back(scene.script);
+	}
+
+	scripts.resize(scriptOffsets.size());
+}
+
+std::string CmbPatcher::scene_name(unsigned scene) const
+{
+	if (editor)
+		return editor->scene_name(scene);
+
+	const auto offName = read_int_le(data, infoOffsets[scene], 4);
+
+	if (offName == 0)
+		return "Unknown_" + std::to_string(scene);
+
+	const auto begin = data.begin() + std::min<std::size_t>(offName, data.size());
+	return std::string(begin, std::find(begin, data.end(), 0));
+}
+
+unsigned CmbPatcher::find_scene(const std::string& nameOrIndex) const
+{
+	for (unsigned i = 0; i < scene_count(); ++i)
+		if (scene_name(i) == nameOrIndex)
+			return i;
+
+	if (!nameOrIndex.empty() && std::all_of(nameOrIndex.begin(), nameOrIndex.end(), [] (char c) { return c >= '0' && c <= '9'; }))
+	{
+		const auto index = std::stoul(nameOrIndex);
+
+		if (index < scene_count())
+			return index;
+	}
+
+	throw std::runtime_error("No scene " + nameOrIndex); // TODO: better error
+}
+
+const std::vector<BcIns>& CmbPatcher::script(unsigned scene)
+{
+	if (editor)
+		return editor->script(scene);
+
+	if (scene >= scene_count())
+		throw std::runtime_error("Scene index out of range."); // TODO: better error
+
+	auto& result = scripts[scene];
+
+	if (result.empty())
+		result = decode_script(Span<const byte_type>(data).subspan(scriptOffsets[scene]), game);
+
+	return result;
+}
+
+Span<const char> CmbPatcher::string_pool() const
+{
+	return Span<const char>(reinterpret_cast<const char*>(data.data()) + offStrings, endStrings - offStrings);
+}
+
+PatchRef CmbPatcher::at(unsigned scene, unsigned location)
+{
+	auto& code = script(scene);
+
+	const auto it = std::lower_bound(code.begin(), code.end(), location,
+		[] (const BcIns& a, unsigned b) { return a.location < b; });
+
+	if (it == code.end() || it->location != location)
+		throw std::runtime_error("No instruction starts at " + std::to_string(location)); // TODO: better error
+
+	return PatchRef { scene, static_cast<unsigned>(it - code.begin()) };
+}
+
+const BcIns& CmbPatcher::instruction(PatchRef ref)
+{
+	return script(ref.scene).at(ref.index);
+}
+
+std::vector<PatchRef> CmbPatcher::find_numbers(std::int32_t value, int scene)
+{
+	std::vector<PatchRef> result;
+
+	for (unsigned s = 0; s < scene_count(); ++s)
+	{
+		if (scene >= 0 && s != static_cast<unsigned>(scene))
+			continue;
+
+		auto& code = script(s);
+
+		for (unsigned i = 0; i < code.size(); ++i)
+			if (is_number(code[i]) && code[i].operand == value)
+				result.push_back(PatchRef { s, i });
+	}
+
+	return result;
+}
+
+std::string CmbPatcher::string_at(PatchRef ref)
+{
+	auto& ins = instruction(ref);
+
+	if (!is_string(ins))
+		throw std::runtime_error("Instruction isn't a string push."); // TODO: better error
+
+	if (editor)
+		return editor->string_at(ins.operand);
+
+	const auto pool = string_pool();
+
+	if (ins.operand < 0 || static_cast<std::size_t>(ins.operand) >= pool.size())
+		throw std::runtime_error("Bad string pool offset"); // TODO: better error
+
+	const auto begin = pool.begin() + ins.operand;
+	const auto end = std::find(begin, pool.end(), '\0');
+
+	if (end == pool.end())
+		throw std::runtime_error("Unterminated string in string pool"); // TODO: better error
+
+	return std::string(begin, end);
+}
+
+std::vector<PatchRef> CmbPatcher::find_strings(const std::string& text, int scene)
+{
+	std::vector<PatchRef> result;
+
+	for (unsigned s = 0; s < scene_count(); ++s)
+	{
+		if (scene >= 0 && s != static_cast<unsigned>(scene))
+			continue;
+
+		auto& code = script(s);
+
+		for (unsigned i = 0; i < code.size(); ++i)
+			if (is_string(code[i]) && string_at(PatchRef { s, i }) == text)
+				result.push_back(PatchRef { s, i });
+	}
+
+	return result;
+}
+
+bool CmbPatcher::set_operand(PatchRef ref, std::int32_t value)
+{
+	const auto ins = instruction(ref);
+
+	// where the operand is and how wide it is encoded, until relocated
+	const auto offset = scriptOffsets[ref.scene] + ins.location + 1;
+	const unsigned size = editor ? 0u : encoded_operand_size(ins, data.data() + offset, game);
+
+	if (ins.is_jump())
+	{
+		at(ref.scene, value); // the target has to be an instruction
+
+		if (!editor)
+		{
+			// jumps are relative to the end of the opcode (see decode_script)
+			const std::int32_t relative = value - static_cast<std::int32_t>(ins.location) - 1;
+
+			if (!fits_encoded(ins, size, relative, game))
+				throw std::runtime_error("Jump is too far to be encoded."); // TODO: better error
+
+			for (unsigned i = 0; i < size; ++i)
+				data[offset + i] = (static_cast<std::uint32_t>(relative) >> (8*(size - 1 - i))) & 0xFF;
+
+			scripts[ref.scene][ref.index].operand = value;
+			return true;
+		}
+	}
+	else if (!editor && fits_encoded(ins, size, value, game))
+	{
+		// an FE10 call keeps the width it was encoded with (2 bytes even for a value under 0x80)
+		if ((game == GameKind::FE10) && (ins.opcode == BC_OPCODE_CALL) && (size == 2))
+		{
+			data[offset] = 0x80 | (value >> 8);
+			data[offset + 1] = value & 0xFF;
+		}
+		else
+		{
+			// big endian
+			for (unsigned i = 0; i < size; ++i)
+				data[offset + i] = (static_cast<std::uint32_t>(value) >> (8*(size - 1 - i))) & 0xFF;
+		}
+
+		scripts[ref.scene][ref.index].operand = value;
+		return true;
+	}
+	else
+	{
+		// only instructions with wider variants can take values that don't fit
+		auto wider = ins;
+
+		wider.operand = value;
+		fit_operand_size(wider);
+
+		const bool wideCall = (game == GameKind::FE10) && (wider.opcode == BC_OPCODE_CALL);
+
+		if (!fits_encoded(wider, wideCall ? 2 : wider.info().operandSize, value, game))
+			throw std::runtime_error("Operand doesn't fit in instruction."); // TODO: better error
+	}
+
+	// relocation: the script is laid out again (with what comes after it moving along)
+
+	relocate();
+
+	auto indexed = index_jumps(editor->script(ref.scene));
+
+	if (indexed[ref.index].is_jump())
+		indexed[ref.index].operand = at(ref.scene, value).index;
+	else
+		indexed[ref.index].operand = value;
+
+	editor->set_script(ref.scene, unindex_jumps(std::move(indexed), game));
+
+	return false;
+}
+
+bool CmbPatcher::set_string(PatchRef ref, const std::string& text)
+{
+	if (!is_string(instruction(ref)))
+		throw std::runtime_error("Instruction isn't a string push."); // TODO: better error
+
+	// a string already in the pool (with its terminator) can be pointed to as it is
+
+	if (!editor)
+	{
+		const auto pool = string_pool();
+		const auto it = std::search(pool.begin(), pool.end(), text.c_str(), text.c_str() + text.size() + 1);
+
+		if (it != pool.end())
+			return set_operand(ref, it - pool.begin());
+
+		relocate();
+	}
+
+	return set_operand(ref, editor->add_string(text));
+}
+
+void CmbPatcher::relocate()
+{
+	if (editor)
+		return;
+
+	// with what was patched in place so far
+	editor.reset(new CmbEditor(std::move(data), game));
+
+	scripts.clear();
+}
+
+std::vector<byte_type> CmbPatcher::result() const
+{
+	if (editor)
+		return editor->result();
+
+	return data;
+}
+
+} // namespace soren
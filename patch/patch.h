@@ -0,0 +1,83 @@
+#ifndef SOREN_PATCH_INCLUDED
+#define SOREN_PATCH_INCLUDED
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "core/types.h"
+#include "core/soren-bytecode.h"
+#include "core/soren-cmb.h"
+#include "patch/edit.h"
+
+namespace soren {
+
+// Patching instructions of an encoded cmb without decoding (and encoding back) all of it.
+// An operand is rewritten in place when the new value fits the width it is encoded with, touching only its bytes.
+// Otherwise (an operand that needs a wider instruction, a string that isn't in the pool yet) the script is encoded again,
+// moving what comes after it (see CmbEditor): "relocation".
+
+struct PatchRef
+{
+	unsigned scene;
+	unsigned index; //< in the scene's script (which, unlike locations, relocation doesn't change)
+};
+
+struct CmbPatcher
+{
+	CmbPatcher(std::vector<byte_type> data, GameKind game);
+
+	unsigned scene_count() const { return scriptOffsets.size(); }
+
+	// the scene with this name, or this index (as text), throws if there is none
+	unsigned find_scene(const std::string& nameOrIndex) const;
+
+	std::string scene_name(unsigned scene) const;
+
+	// the instruction at location in the script of scene, throws if none starts there
+	PatchRef at(unsigned scene, unsigned location);
+
+	// as it is now (jump operands being locations in the script)
+	const BcIns& instruction(PatchRef ref);
+
+	// number pushes of value and string pushes of text, in scene (or in all of them if scene is -1)
+	std::vector<PatchRef> find_numbers(std::int32_t value, int scene = -1);
+	std::vector<PatchRef> find_strings(const std::string& text, int scene = -1);
+
+	// the string a string push pushes
+	std::string string_at(PatchRef ref);
+
+	// sets the operand of an instruction, the target location for jumps (which can't be made wider)
+	// returns whether it was done in place
+	bool set_operand(PatchRef ref, std::int32_t value);
+
+	// makes a string push push text, adding text to the string pool if it isn't there
+	// returns whether it was done in place
+	bool set_string(PatchRef ref, const std::string& text);
+
+	bool relocated() const { return editor != nullptr; }
+
+	// the patched cmb
+	std::vector<byte_type> result() const;
+
+private:
+	const std::vector<BcIns>& script(unsigned scene);
+	Span<const char> string_pool() const;
+
+	void relocate();
+
+	GameKind game;
+
+	std::vector<byte_type> data; //< patched in place until relocated (then moved to the editor)
+	std::vector<std::uint32_t> infoOffsets, scriptOffsets;
+	std::uint32_t offStrings { 0u }, endStrings { 0u };
+
+	std::vector<std::vector<BcIns>> scripts; //< decoded when first needed (empty until then)
+
+	std::unique_ptr<CmbEditor> editor; //< once relocated
+};
+
+} // namespace soren
+
+#endif // SOREN_PATCH_INCLUDED
@@ -0,0 +1,152 @@
+
+// soren-unpack: lists or extracts entries of a pack written by soren --pack (see io/pack.h)
+//
+//     soren-unpack <file.pack>             lists entries (offset, length, name)
+//     soren-unpack <file.pack> <name>...   writes the named entries to stdout, one after the other
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SOREN_HAS_MMAP 1
+#endif
+
+#include "core/types.h"
+
+#include "io/pack.h"
+
+namespace soren {
+
+namespace {
+
+// the whole file in memory: mapped where possible, so that extracting an entry only touches its pages
+struct MappedFile
+{
+	explicit MappedFile(const char* path)
+	{
+#if SOREN_HAS_MMAP
+		const int fd = ::open(path, O_RDONLY);
+
+		if (fd >= 0)
+		{
+			struct stat st;
+
+			if (::fstat(fd, &st) == 0 && st.st_size > 0)
+			{
+				auto map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+				if (map != MAP_FAILED)
+				{
+					mapped = map;
+					size = st.st_size;
+				}
+			}
+
+			::close(fd);
+
+			if (mapped != nullptr)
+				return;
+		}
+#endif
+
+		std::ifstream in(path, std::ios::binary);
+
+		if (!in.is_open())
+			throw std::runtime_error(std::string("couldn't open ") + path); // TODO: better error
+
+		copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	~MappedFile()
+	{
+#if SOREN_HAS_MMAP
+		if (mapped != nullptr)
+			::munmap(mapped, size);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator = (const MappedFile&) = delete;
+
+	Span<const byte_type> data() const
+	{
+		if (mapped != nullptr)
+			return Span<const byte_type>(static_cast<const byte_type*>(mapped), size);
+
+		return Span<const byte_type>(reinterpret_cast<const byte_type*>(copy.data()), copy.size());
+	}
+
+	void* mapped { nullptr };
+	std::size_t size { 0u };
+
+	std::vector<char> copy; //< where mapping isn't possible
+};
+
+} // namespace
+
+} // namespace soren
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		std::cerr << "usage: " << argv[0] << " <file.pack> [name...]" << std::endl;
+		return 1;
+	}
+
+	try
+	{
+		const soren::MappedFile file(argv[1]);
+
+		const auto pack = file.data();
+		const auto entries = soren::read_pack_index(pack);
+
+		if (argc == 2)
+		{
+			for (auto& entry : entries)
+				std::cout << entry.offset << "\t" << entry.length << "\t" << entry.name << std::endl;
+
+			return 0;
+		}
+
+		int result = 0;
+
+		for (int i = 2; i < argc; ++i)
+		{
+			bool found = false;
+
+			for (auto& entry : entries)
+			{
+				if (entry.name != argv[i])
+					continue;
+
+				std::cout.write(reinterpret_cast<const char*>(pack.data() + entry.offset), entry.length);
+
+				found = true;
+				break;
+			}
+
+			if (!found)
+			{
+				std::cerr << argv[i] << ": no such entry" << std::endl;
+				result = 1;
+			}
+		}
+
+		return result;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << argv[1] << ": " << e.what() << std::endl;
+		return 1;
+	}
+}
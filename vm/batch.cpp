@@ -0,0 +1,87 @@
+
+#include "vm/batch.h"
+#include "vm/lanes.h"
+
+#include "core/work-stealing.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace soren {
+
+void resume_vm_batch_state(VmState& state, const VmProgram& program, VmConfig& vmConfig, const VmBatchConfig& config, VmBatchResult& result)
+{
+	try
+	{
+		result.status = vm_run_to_end(state, program, vmConfig, config.stepLimit, config.yieldLimit, result.yields);
+		result.result = state.result;
+	}
+	catch (const std::exception& e)
+	{
+		result.error = e.what();
+	}
+
+	result.steps = state.steps;
+	result.globals.assign(state.memory.begin(), state.memory.begin() + std::min<std::size_t>(state.memory.size(), program.globalAmt));
+}
+
+std::vector<VmBatchResult> run_vm_batch(const VmProgram& program, unsigned scene, Span<const std::int32_t> args,
+	Span<const std::vector<std::int32_t>> initialGlobals, const VmBatchConfig& config)
+{
+	std::vector<VmBatchResult> results(initialGlobals.size());
+
+	const unsigned threadCount = resolve_thread_count(config.threadCount);
+
+	// one state per worker, reused from one initial state to the next so that its buffers stay allocated
+	std::vector<VmState> states(threadCount, make_vm_state(program));
+	std::vector<VmConfig> vmConfigs(threadCount);
+
+	for (auto& vmConfig : vmConfigs)
+		vmConfig.externFunc = config.externFunc;
+
+	if (config.lanes)
+	{
+		// work items are groups of vm_lane_count states
+
+		const std::size_t groupCount = (initialGlobals.size() + vm_lane_count - 1) / vm_lane_count;
+
+		parallel_for(groupCount, threadCount, [&] (unsigned worker, std::size_t index)
+		{
+			const std::size_t first = index * vm_lane_count;
+			const std::size_t count = std::min<std::size_t>(vm_lane_count, initialGlobals.size() - first);
+
+			run_vm_lanes(program, scene, args, initialGlobals.subspan(first, count), config,
+				Span<VmBatchResult>(results.data() + first, count), states[worker], vmConfigs[worker]);
+		});
+
+		return results;
+	}
+
+	parallel_for(initialGlobals.size(), threadCount, [&] (unsigned worker, std::size_t index)
+	{
+		auto& state = states[worker];
+		auto& result = results[index];
+		auto& globals = initialGlobals[index];
+
+		state.memory.assign(program.globalAmt, 0);
+		state.steps = 0;
+
+		std::copy_n(globals.begin(), std::min<std::size_t>(globals.size(), program.globalAmt), state.memory.begin());
+
+		try
+		{
+			vm_start(state, program, scene, args);
+		}
+		catch (const std::exception& e)
+		{
+			result.error = e.what();
+			return;
+		}
+
+		resume_vm_batch_state(state, program, vmConfigs[worker], config, result);
+	});
+
+	return results;
+}
+
+} // namespace soren
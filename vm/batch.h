@@ -0,0 +1,50 @@
+#ifndef SOREN_VM_BATCH_INCLUDED
+#define SOREN_VM_BATCH_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "vm/vm.h"
+
+namespace soren {
+
+struct VmBatchConfig
+{
+	unsigned threadCount { 0u }; //< 0 for one per hardware thread
+
+	// must be safe to call concurrently from all workers
+	VmExternFunc externFunc;
+
+	std::uint64_t stepLimit { 0u }; //< total instructions per state, 0 for no limit
+	unsigned yieldLimit { 0u }; //< resumes after yields per state, 0 for no limit
+
+	// run vm_lane_count states at once with the multi-lane interpreter (see vm/lanes.h)
+	bool lanes { false };
+	unsigned maxLaneGroups { 4u }; //< lanes fall back to the scalar VM when they diverge into more groups than this
+};
+
+struct VmBatchResult
+{
+	VmStatus status { VmStatus::Finished };
+	std::int32_t result { 0 };
+
+	std::uint64_t steps { 0u };
+	unsigned yields { 0u };
+
+	std::vector<std::int32_t> globals; //< final global values
+
+	std::string error; //< non-empty if the VM threw
+};
+
+// continues running an already started state with the batch limits (state.steps counts towards the step limit)
+void resume_vm_batch_state(VmState& state, const VmProgram& program, VmConfig& vmConfig, const VmBatchConfig& config, VmBatchResult& result);
+
+// runs `scene` once per initial state (initial global values, missing ones are 0)
+// the program (and the CmbInfo behind it) is shared read-only by all workers, each worker owns one VmState
+std::vector<VmBatchResult> run_vm_batch(const VmProgram& program, unsigned scene, Span<const std::int32_t> args,
+	Span<const std::vector<std::int32_t>> initialGlobals, const VmBatchConfig& config);
+
+} // namespace soren
+
+#endif // SOREN_VM_BATCH_INCLUDED
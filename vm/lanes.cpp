@@ -0,0 +1,984 @@
+
+#include "vm/lanes.h"
+#include "vm/ops.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace soren {
+
+using VmLaneMask = std::uint32_t;
+
+struct VmLaneVec
+{
+	std::int32_t v[vm_lane_count];
+};
+
+struct VmLaneGroup
+{
+	VmLaneMask mask;
+
+	std::vector<VmFrame> frames; // stackBase is relative to this group's stack
+	std::vector<VmLaneVec> stack; // lanes not in mask hold garbage
+};
+
+struct VmLaneMachine
+{
+	const VmProgram& program;
+	const VmBatchConfig& config;
+
+	Span<VmBatchResult> results;
+
+	// memory is shared by all groups, since groups never have lanes in common
+	// it only grows, so that a group returning from a call doesn't throw away the locals of another group
+	std::vector<VmLaneVec> memory;
+	std::vector<VmLaneGroup> groups;
+
+	std::uint64_t steps[vm_lane_count] {};
+	unsigned yields[vm_lane_count] {};
+};
+
+static inline
+VmLaneVec lane_broadcast(std::int32_t value)
+{
+	VmLaneVec result;
+
+	for (unsigned l = 0; l < vm_lane_count; ++l)
+		result.v[l] = value;
+
+	return result;
+}
+
+static inline
+void lane_blend(VmLaneVec& dst, const VmLaneVec& src, VmLaneMask mask)
+{
+	for (unsigned l = 0; l < vm_lane_count; ++l)
+		if (mask & (1u << l))
+			dst.v[l] = src.v[l];
+}
+
+static inline
+unsigned lane_popcount(VmLaneMask mask)
+{
+	unsigned result = 0;
+
+	for (; mask != 0; mask &= mask - 1)
+		result++;
+
+	return result;
+}
+
+#define SOREN_LANES_FOR(mask, l) \
+	for (unsigned l = 0; l < vm_lane_count; ++l) \
+		if ((mask) & (1u << l))
+
+static inline
+void lane_binop(std::uint8_t opcode, VmLaneVec& a, const VmLaneVec& b)
+{
+	// lanes outside of the group mask are computed too (without being able to trap), it's cheaper than masking
+
+#if defined(__AVX2__)
+	{
+		const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a.v));
+		const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b.v));
+
+		const __m256i one = _mm256_set1_epi32(1);
+		const __m256i shiftMask = _mm256_set1_epi32(31);
+
+		__m256i r;
+
+		switch (opcode)
+		{
+
+		case BC_OPCODE_ADD: r = _mm256_add_epi32(x, y); break;
+		case BC_OPCODE_SUB: r = _mm256_sub_epi32(x, y); break;
+		case BC_OPCODE_MUL: r = _mm256_mullo_epi32(x, y); break;
+		case BC_OPCODE_ORR: r = _mm256_or_si256(x, y); break;
+		case BC_OPCODE_AND: r = _mm256_and_si256(x, y); break;
+		case BC_OPCODE_XOR: r = _mm256_xor_si256(x, y); break;
+		case BC_OPCODE_LSL: r = _mm256_sllv_epi32(x, _mm256_and_si256(y, shiftMask)); break;
+		case BC_OPCODE_LSR: r = _mm256_srav_epi32(x, _mm256_and_si256(y, shiftMask)); break;
+		case BC_OPCODE_EQ: r = _mm256_and_si256(_mm256_cmpeq_epi32(x, y), one); break;
+		case BC_OPCODE_NE: r = _mm256_andnot_si256(_mm256_cmpeq_epi32(x, y), one); break;
+		case BC_OPCODE_LT: r = _mm256_and_si256(_mm256_cmpgt_epi32(y, x), one); break;
+		case BC_OPCODE_LE: r = _mm256_andnot_si256(_mm256_cmpgt_epi32(x, y), one); break;
+		case BC_OPCODE_GT: r = _mm256_and_si256(_mm256_cmpgt_epi32(x, y), one); break;
+		case BC_OPCODE_GE: r = _mm256_andnot_si256(_mm256_cmpgt_epi32(y, x), one); break;
+
+		default:
+			goto portable; // div and mod, there is no vector integer division
+
+		} // switch (opcode)
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(a.v), r);
+		return;
+	}
+
+portable:
+#endif
+
+	// plain loops, which the compiler vectorizes when it can
+
+#define SOREN_LANES_BINOP(opcode, expr) \
+	case opcode: \
+		for (unsigned l = 0; l < vm_lane_count; ++l) \
+		{ \
+			const std::int32_t x = a.v[l]; \
+			const std::int32_t y = b.v[l]; \
+			a.v[l] = (expr); \
+		} \
+		break;
+
+	switch (opcode)
+	{
+
+	SOREN_LANES_BINOP(BC_OPCODE_ADD, vm_wrap(static_cast<std::uint32_t>(x) + static_cast<std::uint32_t>(y)))
+	SOREN_LANES_BINOP(BC_OPCODE_SUB, vm_wrap(static_cast<std::uint32_t>(x) - static_cast<std::uint32_t>(y)))
+	SOREN_LANES_BINOP(BC_OPCODE_MUL, vm_wrap(static_cast<std::uint32_t>(x) * static_cast<std::uint32_t>(y)))
+	SOREN_LANES_BINOP(BC_OPCODE_DIV, vm_div(x, y))
+	SOREN_LANES_BINOP(BC_OPCODE_MOD, vm_mod(x, y))
+	SOREN_LANES_BINOP(BC_OPCODE_ORR, x | y)
+	SOREN_LANES_BINOP(BC_OPCODE_AND, x & y)
+	SOREN_LANES_BINOP(BC_OPCODE_XOR, x ^ y)
+	SOREN_LANES_BINOP(BC_OPCODE_LSL, vm_lsl(x, y))
+	SOREN_LANES_BINOP(BC_OPCODE_LSR, vm_lsr(x, y))
+	SOREN_LANES_BINOP(BC_OPCODE_EQ, x == y)
+	SOREN_LANES_BINOP(BC_OPCODE_NE, x != y)
+	SOREN_LANES_BINOP(BC_OPCODE_LT, x < y)
+	SOREN_LANES_BINOP(BC_OPCODE_LE, x <= y)
+	SOREN_LANES_BINOP(BC_OPCODE_GT, x > y)
+	SOREN_LANES_BINOP(BC_OPCODE_GE, x >= y)
+
+	} // switch (opcode)
+
+#undef SOREN_LANES_BINOP
+}
+
+static inline
+unsigned lane_frame_size(const VmProgram& program, unsigned scene)
+{
+	auto& vmScene = program.scenes[scene];
+	return std::max(vmScene.varAmt, vmScene.argCnt);
+}
+
+static
+void lane_finish(VmLaneMachine& m, unsigned lane, VmStatus status, std::int32_t value, std::uint64_t extraSteps, const char* error = nullptr)
+{
+	auto& result = m.results[lane];
+
+	result.status = status;
+	result.result = value;
+	result.steps = m.steps[lane] + extraSteps;
+	result.yields = m.yields[lane];
+
+	if (error)
+		result.error = error;
+
+	result.globals.resize(m.program.globalAmt);
+
+	for (unsigned i = 0; i < m.program.globalAmt; ++i)
+		result.globals[i] = m.memory[i].v[lane];
+}
+
+static
+void lane_push_frame(VmLaneMachine& m, VmLaneGroup& group, unsigned scene)
+{
+	if (scene >= m.program.scenes.size())
+		throw std::runtime_error("VM: call to non-existent scene"); // TODO: better error
+
+	auto& vmScene = m.program.scenes[scene];
+
+	const unsigned stackBase = group.frames.empty() ? 0 : group.frames.back().stackBase;
+
+	if (group.stack.size() < stackBase + vmScene.argCnt)
+		throw std::runtime_error("VM: stack underflow when passing arguments"); // TODO: better error
+
+	VmFrame frame;
+
+	frame.scene = scene;
+	frame.pc = 0;
+	frame.base = group.frames.empty()
+		? m.program.globalAmt
+		: group.frames.back().base + lane_frame_size(m.program, group.frames.back().scene);
+
+	const unsigned end = frame.base + lane_frame_size(m.program, scene);
+
+	if (m.memory.size() < end)
+		m.memory.resize(end, lane_broadcast(0));
+
+	const auto zero = lane_broadcast(0);
+
+	for (unsigned i = frame.base; i < end; ++i)
+		lane_blend(m.memory[i], zero, group.mask);
+
+	for (unsigned i = 0; i < vmScene.argCnt; ++i)
+		lane_blend(m.memory[frame.base + i], group.stack[group.stack.size() - vmScene.argCnt + i], group.mask);
+
+	group.stack.resize(group.stack.size() - vmScene.argCnt);
+	frame.stackBase = group.stack.size();
+
+	group.frames.push_back(frame);
+}
+
+static
+void lane_fallback(VmLaneMachine& m, VmLaneGroup& group, VmState& state, VmConfig& vmConfig)
+{
+	// continue each lane of the group in the scalar VM, from exactly where the group is
+
+	auto& frame = group.frames.back();
+	const unsigned end = frame.base + lane_frame_size(m.program, frame.scene);
+
+	SOREN_LANES_FOR(group.mask, l)
+	{
+		state.memory.resize(end);
+
+		for (unsigned i = 0; i < end; ++i)
+			state.memory[i] = m.memory[i].v[l];
+
+		state.stack.resize(group.stack.size());
+
+		for (unsigned i = 0; i < group.stack.size(); ++i)
+			state.stack[i] = group.stack[i].v[l];
+
+		state.frames = group.frames;
+		state.steps = m.steps[l];
+		state.result = 0;
+
+		m.results[l].yields = m.yields[l];
+
+		resume_vm_batch_state(state, m.program, vmConfig, m.config, m.results[l]);
+	}
+
+	group.mask = 0;
+}
+
+static
+bool lane_same_position(const VmLaneGroup& a, const VmLaneGroup& b)
+{
+	if (a.frames.size() != b.frames.size() || a.stack.size() != b.stack.size())
+		return false;
+
+	for (unsigned i = 0; i < a.frames.size(); ++i)
+	{
+		auto& fa = a.frames[i];
+		auto& fb = b.frames[i];
+
+		if (fa.scene != fb.scene || fa.pc != fb.pc || fa.base != fb.base || fa.stackBase != fb.stackBase)
+			return false;
+	}
+
+	return true;
+}
+
+static
+bool lane_same_frame(const VmLaneGroup& a, const VmLaneGroup& b)
+{
+	// same as lane_same_position, ignoring the pc of the innermost frame and the stack
+
+	if (a.frames.size() != b.frames.size())
+		return false;
+
+	for (unsigned i = 0; i < a.frames.size(); ++i)
+	{
+		auto& fa = a.frames[i];
+		auto& fb = b.frames[i];
+
+		if (fa.scene != fb.scene || fa.base != fb.base || fa.stackBase != fb.stackBase)
+			return false;
+
+		if (i + 1 != a.frames.size() && fa.pc != fb.pc)
+			return false;
+	}
+
+	return true;
+}
+
+static
+void lane_run_group(VmLaneMachine& m, VmLaneGroup& group, std::vector<VmLaneGroup>& spawned,
+	unsigned stopPc, std::uint64_t budget, bool alone, VmState& state, std::uint64_t& executed)
+{
+	// runs until something happens that the scheduler needs to know about
+	// counts executed instructions (for all lanes in the group when it started) in executed,
+	// which is up to date when this throws, the instruction that threw being counted (as in vm_run)
+
+	auto& memory = m.memory;
+	auto& stack = group.stack;
+
+	const auto frame_end = [&] ()
+	{
+		auto& frame = group.frames.back();
+		return frame.base + lane_frame_size(m.program, frame.scene);
+	};
+
+	unsigned memoryEnd = frame_end();
+
+	const auto top = [&] () -> VmLaneVec&
+	{
+		if (stack.size() <= group.frames.back().stackBase)
+			throw std::runtime_error("VM: stack underflow"); // TODO: better error
+
+		return stack.back();
+	};
+
+	const auto pop = [&] ()
+	{
+		auto value = top();
+		stack.pop_back();
+
+		return value;
+	};
+
+	const auto row = [&] (std::int64_t address) -> VmLaneVec&
+	{
+		// same address for all lanes
+		if (address < 0 || address >= memoryEnd)
+			throw std::runtime_error("VM: memory access out of bounds"); // TODO: better error
+
+		return memory[address];
+	};
+
+	// lanes that failed on the current instruction, with what each one failed on
+	VmLaneMask bad = 0;
+	std::string errors[vm_lane_count];
+
+	const auto fail_lane = [&] (unsigned lane, const char* error)
+	{
+		bad |= 1u << lane;
+		errors[lane] = error;
+	};
+
+	const auto gather = [&] (const VmLaneVec& offsets, std::int64_t base, VmLaneVec& out)
+	{
+		SOREN_LANES_FOR(group.mask, l)
+		{
+			const std::int64_t address = base + offsets.v[l];
+
+			if (address < 0 || address >= memoryEnd)
+			{
+				fail_lane(l, "VM: memory access out of bounds"); // TODO: better error
+				continue;
+			}
+
+			out.v[l] = memory[address].v[l];
+		}
+	};
+
+	const auto scatter = [&] (const VmLaneVec& addresses, const VmLaneVec* values, int delta)
+	{
+		SOREN_LANES_FOR(group.mask, l)
+		{
+			const std::int64_t address = addresses.v[l];
+
+			if (address < 0 || address >= memoryEnd)
+			{
+				fail_lane(l, "VM: memory access out of bounds"); // TODO: better error
+				continue;
+			}
+
+			auto& cell = memory[address].v[l];
+			cell = values ? values->v[l] : vm_wrap(static_cast<std::uint32_t>(cell) + delta);
+		}
+	};
+
+	const auto fail_bad_lanes = [&] ()
+	{
+		SOREN_LANES_FOR(bad, l)
+			lane_finish(m, l, VmStatus::Finished, 0, executed, errors[l].c_str());
+
+		group.mask &= ~bad;
+		bad = 0;
+	};
+
+	const auto split = [&] (VmLaneMask taken, unsigned target)
+	{
+		// taken lanes go to a new group at the jump target
+
+		spawned.push_back(group);
+		spawned.back().mask = taken;
+		spawned.back().frames.back().pc = target;
+
+		group.mask &= ~taken;
+	};
+
+	while (group.mask != 0)
+	{
+		if (executed == budget)
+			break;
+
+		auto& frame = group.frames.back();
+		auto& code = m.program.scenes[frame.scene].code;
+
+		if (frame.pc == stopPc && executed != 0)
+			break;
+
+		// this also catches jumps to vm_bad_target
+		if (frame.pc >= code.size())
+			throw std::runtime_error("VM: reached end of scene code"); // TODO: better error
+
+		const auto& ins = code[frame.pc++];
+		executed++;
+
+		const std::int64_t base = frame.base;
+
+		switch (ins.opcode)
+		{
+
+		case BC_OPCODE_NOP:
+		case BC_OPCODE_40:
+			break;
+
+		case BC_OPCODE_VAL8:
+		case BC_OPCODE_VAL16:
+			stack.push_back(row(base + ins.operand));
+			break;
+
+		case BC_OPCODE_GVAL8:
+		case BC_OPCODE_GVAL16:
+			stack.push_back(row(ins.operand));
+			break;
+
+		case BC_OPCODE_VALX8:
+		case BC_OPCODE_VALX16:
+			gather(top(), base + ins.operand, top());
+			break;
+
+		case BC_OPCODE_GVALX8:
+		case BC_OPCODE_GVALX16:
+			gather(top(), ins.operand, top());
+			break;
+
+		case BC_OPCODE_VALY8:
+		case BC_OPCODE_VALY16:
+		case BC_OPCODE_GVALY8:
+		case BC_OPCODE_GVALY16:
+		{
+			const bool global = ins.opcode == BC_OPCODE_GVALY8 || ins.opcode == BC_OPCODE_GVALY16;
+
+			// the address doesn't wrap around (as in vm_run), so this isn't an add and a gather
+			const auto& index = row((global ? 0 : base) + ins.operand);
+			auto& value = top();
+
+			SOREN_LANES_FOR(group.mask, l)
+			{
+				const std::int64_t address = static_cast<std::int64_t>(index.v[l]) + value.v[l];
+
+				if (address < 0 || address >= memoryEnd)
+				{
+					fail_lane(l, "VM: memory access out of bounds"); // TODO: better error
+					continue;
+				}
+
+				value.v[l] = memory[address].v[l];
+			}
+
+			break;
+		}
+
+		case BC_OPCODE_REF8:
+		case BC_OPCODE_REF16:
+			stack.push_back(lane_broadcast(base + ins.operand));
+			break;
+
+		case BC_OPCODE_GREF8:
+		case BC_OPCODE_GREF16:
+			stack.push_back(lane_broadcast(ins.operand));
+			break;
+
+		case BC_OPCODE_REFX8:
+		case BC_OPCODE_REFX16:
+			lane_binop(BC_OPCODE_ADD, top(), lane_broadcast(base + ins.operand));
+			break;
+
+		case BC_OPCODE_GREFX8:
+		case BC_OPCODE_GREFX16:
+			lane_binop(BC_OPCODE_ADD, top(), lane_broadcast(ins.operand));
+			break;
+
+		case BC_OPCODE_REFY8:
+		case BC_OPCODE_REFY16:
+			lane_binop(BC_OPCODE_ADD, top(), row(base + ins.operand));
+			break;
+
+		case BC_OPCODE_GREFY8:
+		case BC_OPCODE_GREFY16:
+			lane_binop(BC_OPCODE_ADD, top(), row(ins.operand));
+			break;
+
+		case BC_OPCODE_NUMBER8:
+		case BC_OPCODE_NUMBER16:
+		case BC_OPCODE_NUMBER32:
+		case BC_OPCODE_STRING8:
+		case BC_OPCODE_STRING16:
+		case BC_OPCODE_STRING32:
+			stack.push_back(lane_broadcast(ins.operand));
+			break;
+
+		case BC_OPCODE_DEREF:
+		{
+			auto value = lane_broadcast(0);
+			gather(top(), 0, value);
+
+			stack.push_back(value);
+			break;
+		}
+
+		case BC_OPCODE_DISC:
+			pop();
+			break;
+
+		case BC_OPCODE_STORE:
+		{
+			auto value = pop();
+			scatter(top(), &value, 0);
+			top() = value;
+
+			break;
+		}
+
+		case BC_OPCODE_ASSIGN:
+		{
+			auto value = pop();
+			scatter(pop(), &value, 0);
+
+			break;
+		}
+
+		case BC_OPCODE_INC:
+			scatter(pop(), nullptr, +1);
+			break;
+
+		case BC_OPCODE_DEC:
+			scatter(pop(), nullptr, -1);
+			break;
+
+		case BC_OPCODE_DUP:
+		{
+			auto value = top();
+			stack.push_back(value);
+
+			break;
+		}
+
+		case BC_OPCODE_ADD:
+		case BC_OPCODE_SUB:
+		case BC_OPCODE_MUL:
+		case BC_OPCODE_DIV:
+		case BC_OPCODE_MOD:
+		case BC_OPCODE_ORR:
+		case BC_OPCODE_AND:
+		case BC_OPCODE_XOR:
+		case BC_OPCODE_LSL:
+		case BC_OPCODE_LSR:
+		case BC_OPCODE_EQ:
+		case BC_OPCODE_NE:
+		case BC_OPCODE_LT:
+		case BC_OPCODE_LE:
+		case BC_OPCODE_GT:
+		case BC_OPCODE_GE:
+		{
+			auto b = pop();
+			lane_binop(ins.opcode, top(), b);
+
+			break;
+		}
+
+		case BC_OPCODE_EQSTR:
+		case BC_OPCODE_NESTR:
+		{
+			auto b = pop();
+			auto& a = top();
+
+			SOREN_LANES_FOR(group.mask, l)
+			{
+				try
+				{
+					const bool equal = std::strcmp(m.program.cmb->get_cstr(a.v[l]), m.program.cmb->get_cstr(b.v[l])) == 0;
+					a.v[l] = (ins.opcode == BC_OPCODE_EQSTR) == equal;
+				}
+				catch (const std::exception& e)
+				{
+					fail_lane(l, e.what());
+				}
+			}
+
+			break;
+		}
+
+		case BC_OPCODE_NEG:
+			for (auto& value : top().v)
+				value = vm_wrap(0u - static_cast<std::uint32_t>(value));
+
+			break;
+
+		case BC_OPCODE_MVN:
+			for (auto& value : top().v)
+				value = ~value;
+
+			break;
+
+		case BC_OPCODE_NOT:
+			for (auto& value : top().v)
+				value = !value;
+
+			break;
+
+		case BC_OPCODE_CALL:
+			lane_push_frame(m, group, ins.operand);
+			memoryEnd = frame_end();
+
+			if (!alone)
+				return;
+
+			break;
+
+		case BC_OPCODE_CALLEXT:
+		{
+			const unsigned argCnt = ins.operand & 0xFF;
+
+			if (stack.size() < frame.stackBase + argCnt)
+				throw std::runtime_error("VM: stack underflow when passing arguments"); // TODO: better error
+
+			auto value = lane_broadcast(0);
+
+			if (m.config.externFunc)
+			{
+				const auto name = m.program.cmb->get_cstr(ins.operand >> 8);
+
+				// the extern function gets a scalar view of the lane, and may modify it
+
+				SOREN_LANES_FOR(group.mask, l)
+				{
+					state.memory.resize(memoryEnd);
+
+					for (unsigned i = 0; i < memoryEnd; ++i)
+						state.memory[i] = memory[i].v[l];
+
+					state.stack.resize(stack.size());
+
+					for (unsigned i = 0; i < stack.size(); ++i)
+						state.stack[i] = stack[i].v[l];
+
+					state.frames = group.frames;
+
+					try
+					{
+						value.v[l] = m.config.externFunc(state, name,
+							Span<const std::int32_t>(state.stack.data() + state.stack.size() - argCnt, argCnt));
+					}
+					catch (const std::exception& e)
+					{
+						// anything the scalar VM would let through to resume_vm_batch_state
+						fail_lane(l, e.what());
+						continue;
+					}
+
+					for (unsigned i = 0; i < memoryEnd; ++i)
+						memory[i].v[l] = state.memory[i];
+				}
+			}
+
+			stack.resize(stack.size() - argCnt);
+			stack.push_back(value);
+
+			break;
+		}
+
+		case BC_OPCODE_PRINTF:
+		{
+			const unsigned argCnt = ins.operand;
+
+			if (stack.size() < frame.stackBase + argCnt)
+				throw std::runtime_error("VM: stack underflow when passing arguments"); // TODO: better error
+
+			stack.resize(stack.size() - argCnt);
+			break;
+		}
+
+		case BC_OPCODE_RETURN:
+		case BC_OPCODE_RETN:
+		case BC_OPCODE_RETY:
+		{
+			const auto value = ins.opcode == BC_OPCODE_RETURN
+				? pop()
+				: lane_broadcast(ins.opcode == BC_OPCODE_RETY ? 1 : 0);
+
+			stack.resize(frame.stackBase);
+			group.frames.pop_back();
+
+			if (group.frames.empty())
+			{
+				SOREN_LANES_FOR(group.mask, l)
+					lane_finish(m, l, VmStatus::Finished, value.v[l], executed);
+
+				group.mask = 0;
+				return;
+			}
+
+			stack.push_back(value);
+			memoryEnd = frame_end();
+
+			if (!alone)
+				return;
+
+			break;
+		}
+
+		case BC_OPCODE_B:
+			frame.pc = ins.operand;
+
+			if (!alone)
+				return;
+
+			break;
+
+		case BC_OPCODE_BY:
+		case BC_OPCODE_BN:
+		case BC_OPCODE_BKY:
+		case BC_OPCODE_BKN:
+		{
+			const bool keep = ins.is_jump_keep();
+			const bool ifYes = ins.opcode == BC_OPCODE_BY || ins.opcode == BC_OPCODE_BKY;
+
+			const auto cond = top();
+
+			VmLaneMask taken = 0;
+
+			SOREN_LANES_FOR(group.mask, l)
+				if ((cond.v[l] != 0) == ifYes)
+					taken |= 1u << l;
+
+			if (taken == group.mask)
+			{
+				if (!keep)
+					pop();
+
+				frame.pc = ins.operand;
+
+				if (!alone)
+					return;
+			}
+			else if (taken == 0)
+			{
+				pop();
+			}
+			else
+			{
+				if (!keep)
+					pop();
+
+				split(taken, ins.operand);
+
+				if (keep)
+					pop();
+
+				return;
+			}
+
+			break;
+		}
+
+		case BC_OPCODE_YIELD:
+			SOREN_LANES_FOR(group.mask, l)
+			{
+				if (m.config.yieldLimit != 0 && m.yields[l] == m.config.yieldLimit)
+				{
+					lane_finish(m, l, VmStatus::Yielded, 0, executed);
+					group.mask &= ~(1u << l);
+				}
+				else
+				{
+					m.yields[l]++;
+				}
+			}
+
+			break;
+
+		default:
+			throw std::runtime_error("VM: unsupported opcode"); // TODO: better error
+
+		} // switch (ins.opcode)
+
+		if (bad != 0)
+			fail_bad_lanes();
+	}
+}
+
+void run_vm_lanes(const VmProgram& program, unsigned scene, Span<const std::int32_t> args,
+	Span<const std::vector<std::int32_t>> initialGlobals, const VmBatchConfig& config,
+	Span<VmBatchResult> results, VmState& state, VmConfig& vmConfig)
+{
+	const unsigned laneCount = std::min<std::size_t>(initialGlobals.size(), vm_lane_count);
+
+	VmLaneMachine m { program, config, results, {}, {}, };
+
+	m.memory.assign(program.globalAmt, lane_broadcast(0));
+
+	for (unsigned l = 0; l < laneCount; ++l)
+	{
+		auto& globals = initialGlobals[l];
+
+		for (unsigned i = 0; i < std::min<std::size_t>(globals.size(), program.globalAmt); ++i)
+			m.memory[i].v[l] = globals[i];
+	}
+
+	{
+		VmLaneGroup group;
+
+		group.mask = (1u << laneCount) - 1;
+
+		for (auto arg : args)
+			group.stack.push_back(lane_broadcast(arg));
+
+		try
+		{
+			if (scene < program.scenes.size() && args.size() != program.scenes[scene].argCnt)
+				throw std::runtime_error("VM: bad argument count for entry scene"); // TODO: better error
+
+			lane_push_frame(m, group, scene);
+		}
+		catch (const std::exception& e)
+		{
+			for (unsigned l = 0; l < laneCount; ++l)
+				lane_finish(m, l, VmStatus::Finished, 0, 0, e.what());
+
+			return;
+		}
+
+		m.groups.push_back(std::move(group));
+	}
+
+	std::vector<VmLaneGroup> spawned;
+
+	while (!m.groups.empty())
+	{
+		if (m.groups.size() > config.maxLaneGroups)
+		{
+			// lanes diverged too far for running them together to be worth it
+
+			for (auto& group : m.groups)
+				lane_fallback(m, group, state, vmConfig);
+
+			m.groups.clear();
+			break;
+		}
+
+		// pick the deepest group, then the one that's the least far in its scene
+		// this makes groups that took different paths wait for each other where the paths meet
+
+		unsigned g = 0;
+
+		for (unsigned i = 1; i < m.groups.size(); ++i)
+		{
+			auto& a = m.groups[i];
+			auto& b = m.groups[g];
+
+			if (a.frames.size() > b.frames.size() || (a.frames.size() == b.frames.size() && a.frames.back().pc < b.frames.back().pc))
+				g = i;
+		}
+
+		std::swap(m.groups[0], m.groups[g]);
+
+		auto& group = m.groups[0];
+
+		// merge groups that are at the same position
+
+		for (unsigned i = m.groups.size() - 1; i > 0; --i)
+		{
+			auto& other = m.groups[i];
+
+			if (!lane_same_position(group, other))
+				continue;
+
+			for (unsigned j = 0; j < group.stack.size(); ++j)
+				lane_blend(group.stack[j], other.stack[j], other.mask);
+
+			group.mask |= other.mask;
+			m.groups.erase(m.groups.begin() + i);
+		}
+
+		// lanes that ran out of steps
+
+		std::uint64_t budget = std::numeric_limits<std::uint64_t>::max();
+
+		if (config.stepLimit != 0)
+		{
+			SOREN_LANES_FOR(group.mask, l)
+			{
+				if (m.steps[l] >= config.stepLimit)
+				{
+					lane_finish(m, l, VmStatus::StepLimit, 0, 0);
+					group.mask &= ~(1u << l);
+				}
+				else
+				{
+					budget = std::min(budget, config.stepLimit - m.steps[l]);
+				}
+			}
+		}
+
+		if (lane_popcount(group.mask) == 1)
+			lane_fallback(m, group, state, vmConfig); // not worth it for a single lane
+
+		if (group.mask == 0)
+		{
+			m.groups.erase(m.groups.begin());
+			continue;
+		}
+
+		// stop where another group in the same frame waits, so that we can merge with it
+
+		unsigned stopPc = std::numeric_limits<unsigned>::max();
+
+		for (unsigned i = 1; i < m.groups.size(); ++i)
+		{
+			auto& other = m.groups[i];
+
+			if (lane_same_frame(group, other) && other.frames.back().pc > group.frames.back().pc)
+				stopPc = std::min(stopPc, other.frames.back().pc);
+		}
+
+		const VmLaneMask mask = group.mask;
+		std::uint64_t executed = 0;
+
+		try
+		{
+			lane_run_group(m, group, spawned, stopPc, budget, m.groups.size() == 1, state, executed);
+		}
+		catch (const std::exception& e)
+		{
+			SOREN_LANES_FOR(group.mask, l)
+				lane_finish(m, l, VmStatus::Finished, 0, executed, e.what());
+
+			group.mask = 0;
+		}
+
+		// finished lanes are out of the masks, and already have their steps
+
+		VmLaneMask running = group.mask;
+
+		for (auto& other : spawned)
+			running |= other.mask;
+
+		SOREN_LANES_FOR(mask & running, l)
+			m.steps[l] += executed;
+
+		if (group.mask == 0)
+			m.groups.erase(m.groups.begin());
+
+		for (auto& other : spawned)
+			m.groups.push_back(std::move(other));
+
+		spawned.clear();
+	}
+}
+
+#undef SOREN_LANES_FOR
+
+} // namespace soren
@@ -0,0 +1,22 @@
+#ifndef SOREN_VM_LANES_INCLUDED
+#define SOREN_VM_LANES_INCLUDED
+
+#include "vm/vm.h"
+#include "vm/batch.h"
+
+namespace soren {
+
+// amount of states run at once by the multi-lane interpreter (one AVX2 register of 32-bit values)
+static constexpr unsigned vm_lane_count = 8;
+
+// runs `scene` for up to vm_lane_count initial states at once
+// all lanes share the instruction stream; a conditional branch that goes both ways splits the lanes into
+// groups that are run one after the other and merged back when they meet again at the same position
+// lanes fall back to the scalar VM (using `state` and `vmConfig` as scratch) when they diverge too much
+void run_vm_lanes(const VmProgram& program, unsigned scene, Span<const std::int32_t> args,
+	Span<const std::vector<std::int32_t>> initialGlobals, const VmBatchConfig& config,
+	Span<VmBatchResult> results, VmState& state, VmConfig& vmConfig);
+
+} // namespace soren
+
+#endif // SOREN_VM_LANES_INCLUDED
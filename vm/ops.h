@@ -0,0 +1,51 @@
+#ifndef SOREN_VM_OPS_INCLUDED
+#define SOREN_VM_OPS_INCLUDED
+
+#include <cstdint>
+#include <limits>
+
+namespace soren {
+
+// shared by the scalar and multi-lane interpreters, so that both agree on the edge cases
+
+static inline
+std::int32_t vm_div(std::int32_t a, std::int32_t b)
+{
+	// TODO: investigate what the game does on division by zero
+	if (b == 0 || (a == std::numeric_limits<std::int32_t>::min() && b == -1))
+		return 0;
+
+	return a / b;
+}
+
+static inline
+std::int32_t vm_mod(std::int32_t a, std::int32_t b)
+{
+	if (b == 0 || (a == std::numeric_limits<std::int32_t>::min() && b == -1))
+		return 0;
+
+	return a % b;
+}
+
+static inline
+std::int32_t vm_wrap(std::uint32_t value)
+{
+	return static_cast<std::int32_t>(value);
+}
+
+static inline
+std::int32_t vm_lsl(std::int32_t a, std::int32_t b)
+{
+	return vm_wrap(static_cast<std::uint32_t>(a) << (b & 31));
+}
+
+static inline
+std::int32_t vm_lsr(std::int32_t a, std::int32_t b)
+{
+	// TODO: investigate whether this is logical or arithmetic
+	return a >> (b & 31);
+}
+
+} // namespace soren
+
+#endif // SOREN_VM_OPS_INCLUDED
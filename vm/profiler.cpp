@@ -0,0 +1,122 @@
+
+#include "vm/profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace soren {
+
+void VmProfiler::sample(const VmState& state, const VmProgram& program)
+{
+	key.clear();
+
+	for (unsigned i = 0; i < state.frames.size(); ++i)
+	{
+		auto& frame = state.frames[i];
+		auto& code = program.scenes[frame.scene].code;
+
+		// innermost frame: the instruction about to be executed
+		// outer frames: the call instruction (pc was already moved past it)
+
+		const bool innermost = (i + 1 == state.frames.size());
+		const unsigned pc = innermost ? frame.pc : frame.pc - 1;
+
+		key.push_back(frame.scene);
+		key.push_back(pc < code.size() ? code[pc].location : 0);
+
+		if (innermost && pc < code.size())
+			opcodeSamples[code[pc].opcode]++;
+	}
+
+	totalSamples++;
+
+	auto it = stacks.find(key);
+
+	if (it != stacks.end())
+		it->second++;
+	else
+		stacks.emplace(key, 1);
+}
+
+void VmProfiler::write_folded(std::ostream& os, const CmbInfo& cmb, bool withOffsets) const
+{
+	// different keys may fold to the same line (when offsets are omitted), so merge them first
+
+	std::map<std::string, std::uint64_t> lines;
+
+	for (auto& pair : stacks)
+	{
+		auto& frames = pair.first;
+
+		std::ostringstream line;
+
+		for (unsigned i = 0; i < frames.size(); i += 2)
+		{
+			if (i != 0)
+				line << ";";
+
+			const auto scene = frames[i];
+			const auto& name = scene < cmb.scenes.size() ? cmb.scenes[scene].name : std::string("?");
+
+			line << name;
+
+			if (withOffsets && i + 2 == frames.size())
+				line << ";" << name << "+0x" << std::hex << std::setw(4) << std::setfill('0') << frames[i+1] << std::dec;
+		}
+
+		lines[line.str()] += pair.second;
+	}
+
+	for (auto& pair : lines)
+		os << pair.first << " " << pair.second << std::endl;
+}
+
+void VmProfiler::write_opcode_summary(std::ostream& os) const
+{
+	std::vector<unsigned> opcodes;
+
+	for (unsigned i = 0; i < BC_OPCODE_COUNT; ++i)
+		if (opcodeSamples[i] != 0)
+			opcodes.push_back(i);
+
+	std::sort(opcodes.begin(), opcodes.end(), [&] (unsigned a, unsigned b)
+	{
+		return opcodeSamples[a] > opcodeSamples[b];
+	});
+
+	for (auto opcode : opcodes)
+	{
+		os << std::setw(8) << gBcOpcodeInfo[opcode].mnemonic
+			<< std::setw(12) << opcodeSamples[opcode]
+			<< std::setw(8) << std::fixed << std::setprecision(2) << (100.0 * opcodeSamples[opcode] / totalSamples) << "%"
+			<< std::endl;
+	}
+}
+
+std::vector<std::uint64_t> VmProfiler::instruction_samples(const CmbInfo& cmb, unsigned scene) const
+{
+	auto& script = cmb.scenes[scene].rawScript;
+	std::vector<std::uint64_t> result(script.size(), 0);
+
+	for (auto& entry : stacks)
+	{
+		auto& stack = entry.first;
+
+		if (stack.size() < 2 || stack[stack.size()-2] != scene)
+			continue;
+
+		const auto location = stack.back();
+
+		auto it = std::lower_bound(script.begin(), script.end(), location,
+			[] (const BcIns& a, std::uint32_t b) { return a.location < b; });
+
+		if (it != script.end() && it->location == location)
+			result[it - script.begin()] += entry.second;
+	}
+
+	return result;
+}
+
+} // namespace soren
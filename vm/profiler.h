@@ -0,0 +1,72 @@
+#ifndef SOREN_VM_PROFILER_INCLUDED
+#define SOREN_VM_PROFILER_INCLUDED
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <vector>
+
+#include "vm/vm.h"
+
+namespace soren {
+
+struct VmProfiler
+{
+	// counter based sampling profiler
+	// every `period` executed instructions (on average), the current call stack is recorded
+	// this is deterministic and doesn't need signal handlers, which is nice for comparing runs
+
+	explicit VmProfiler(std::uint64_t period = 997)
+		: period(period), countdown(period) {}
+
+	inline void tick(const VmState& state, const VmProgram& program)
+	{
+		if (--countdown == 0)
+		{
+			countdown = next_countdown();
+			sample(state, program);
+		}
+	}
+
+	void sample(const VmState& state, const VmProgram& program);
+
+	// writes samples in the "folded stacks" format understood by flamegraph.pl (and others)
+	// one line per unique stack: frames from outermost to innermost separated by ';', then the sample count
+	void write_folded(std::ostream& os, const CmbInfo& cmb, bool withOffsets = true) const;
+
+	// writes the sample count of each opcode, sorted by count
+	void write_opcode_summary(std::ostream& os) const;
+
+	// sample count of each instruction of a scene (as the innermost frame), indexed like SceneInfo::rawScript
+	// with a period of 1, these are exact execution counts
+	std::vector<std::uint64_t> instruction_samples(const CmbInfo& cmb, unsigned scene) const;
+
+	std::uint64_t period;
+	std::uint64_t countdown;
+
+	std::uint64_t totalSamples { 0u };
+	std::uint64_t opcodeSamples[BC_OPCODE_COUNT] {};
+
+	// key is (scene, bytecode offset) for each frame, outermost first
+	// for outer frames the offset is the one of the call instruction
+	std::map<std::vector<std::uint32_t>, std::uint64_t> stacks;
+
+private:
+	std::uint64_t next_countdown()
+	{
+		// jitter the period a bit (xorshift), so that we don't alias with loops whose length divides it
+
+		rng ^= rng << 13;
+		rng ^= rng >> 7;
+		rng ^= rng << 17;
+
+		return period/2 + 1 + rng % period;
+	}
+
+	std::uint64_t rng { 0x9E3779B97F4A7C15ull };
+	std::vector<std::uint32_t> key;
+};
+
+} // namespace soren
+
+#endif // SOREN_VM_PROFILER_INCLUDED
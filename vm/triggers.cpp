@@ -0,0 +1,222 @@
+
+#include "vm/triggers.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace soren {
+
+namespace {
+
+struct TurnTrigger
+{
+	unsigned scene;
+	unsigned first, last; //< inclusive, last is ~0u for no end
+	int phase; //< -1 for any phase
+};
+
+struct AreaTrigger
+{
+	unsigned scene;
+	bool anywhere;
+	int x1, y1, x2, y2; //< inclusive, sorted
+};
+
+} // namespace
+
+static inline
+bool is_turn_kind(unsigned kind)
+{
+	return kind == CMB_SCENE_KIND_TURN3 || kind == CMB_SCENE_KIND_TURN6;
+}
+
+static inline
+int clamp_coord(int value)
+{
+	return std::min<int>(std::max(value, 0), TriggerIndex::MAX_COORD);
+}
+
+// builds bucket lists from (bucket, scene) pairs given in scene order, so that each list is sorted
+template<typename EnumerateFunc>
+static
+void fill_buckets(unsigned bucketCount, EnumerateFunc enumerate, std::vector<std::uint32_t>& offsets, std::vector<std::uint32_t>& items)
+{
+	offsets.assign(bucketCount + 1, 0);
+
+	enumerate([&] (unsigned bucket, unsigned) { offsets[bucket + 1]++; });
+
+	for (unsigned i = 0; i < bucketCount; ++i)
+		offsets[i + 1] += offsets[i];
+
+	items.resize(offsets[bucketCount]);
+
+	std::vector<std::uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+
+	enumerate([&] (unsigned bucket, unsigned scene) { items[cursor[bucket]++] = scene; });
+}
+
+TriggerIndex make_trigger_index(const CmbInfo& cmb)
+{
+	TriggerIndex result;
+
+	std::vector<TurnTrigger> turns;
+	std::vector<AreaTrigger> areas;
+
+	for (auto& scene : cmb.scenes)
+	{
+		auto& params = scene.parameters;
+
+		if (is_turn_kind(scene.kind))
+		{
+			TurnTrigger trigger { scene.idx, 0u, ~0u, -1 };
+
+			if (params.size() >= 2)
+			{
+				trigger.first = std::min<unsigned>(std::max(params[0], 0), TriggerIndex::MAX_TURN);
+
+				if (params[1] > 0)
+					trigger.last = std::min<unsigned>(params[1], TriggerIndex::MAX_TURN);
+			}
+
+			if (params.size() >= 3)
+				trigger.phase = std::max(params[2], 0);
+
+			turns.push_back(trigger);
+		}
+		else if (scene.kind == CMB_SCENE_KIND_AREA_UNS)
+		{
+			AreaTrigger trigger { scene.idx, true, 0, 0, 0, 0 };
+
+			if (params.size() >= 4)
+			{
+				trigger.anywhere = false;
+				trigger.x1 = clamp_coord(std::min(params[0], params[2]));
+				trigger.y1 = clamp_coord(std::min(params[1], params[3]));
+				trigger.x2 = clamp_coord(std::max(params[0], params[2]));
+				trigger.y2 = clamp_coord(std::max(params[1], params[3]));
+			}
+
+			areas.push_back(trigger);
+		}
+	}
+
+	// turns: enough turn buckets that the last one only has triggers without an end (the same for every later turn),
+	// and enough phase buckets that the last one only has triggers for any phase (the same for every other phase)
+
+	unsigned maxTurn = 0, maxPhase = 0;
+
+	for (auto& trigger : turns)
+	{
+		maxTurn = std::max(maxTurn, trigger.first);
+
+		if (trigger.last != ~0u)
+			maxTurn = std::max(maxTurn, trigger.last);
+
+		if (trigger.phase >= 0)
+			maxPhase = std::max<unsigned>(maxPhase, trigger.phase + 1);
+	}
+
+	result.turnCount = maxTurn + 2;
+	result.phaseCount = maxPhase + 1;
+
+	fill_buckets(result.turnCount * result.phaseCount, [&] (auto add)
+	{
+		for (auto& trigger : turns)
+		{
+			const unsigned last = std::min(trigger.last, result.turnCount - 1);
+
+			for (unsigned turn = trigger.first; turn <= last; ++turn)
+			{
+				if (trigger.phase >= 0)
+				{
+					add(turn * result.phaseCount + trigger.phase, trigger.scene);
+					continue;
+				}
+
+				for (unsigned phase = 0; phase < result.phaseCount; ++phase)
+					add(turn * result.phaseCount + phase, trigger.scene);
+			}
+		}
+	}, result.turnOffsets, result.turnItems);
+
+	// areas: a grid over the bounding box of all areas, one bucket per position
+
+	int x2 = -1, y2 = -1;
+
+	result.gridX = result.gridY = TriggerIndex::MAX_COORD;
+
+	for (auto& trigger : areas)
+	{
+		if (trigger.anywhere)
+			continue;
+
+		result.gridX = std::min(result.gridX, trigger.x1);
+		result.gridY = std::min(result.gridY, trigger.y1);
+		x2 = std::max(x2, trigger.x2);
+		y2 = std::max(y2, trigger.y2);
+	}
+
+	result.gridWidth = x2 >= result.gridX ? x2 - result.gridX + 1 : 0;
+	result.gridHeight = y2 >= result.gridY ? y2 - result.gridY + 1 : 0;
+
+	const unsigned anywhereBucket = result.gridWidth * result.gridHeight;
+
+	fill_buckets(anywhereBucket + 1, [&] (auto add)
+	{
+		for (auto& trigger : areas)
+		{
+			if (trigger.anywhere)
+			{
+				add(anywhereBucket, trigger.scene);
+				continue;
+			}
+
+			for (int y = trigger.y1; y <= trigger.y2; ++y)
+				for (int x = trigger.x1; x <= trigger.x2; ++x)
+					add((y - result.gridY) * result.gridWidth + (x - result.gridX), trigger.scene);
+		}
+	}, result.areaOffsets, result.areaItems);
+
+	return result;
+}
+
+void TriggerIndex::turn_events(unsigned turn, unsigned phase, std::vector<unsigned>& out) const
+{
+	out.clear();
+
+	if (turnOffsets.empty())
+		return;
+
+	const unsigned bucket = std::min(turn, turnCount - 1) * phaseCount + std::min(phase, phaseCount - 1);
+
+	out.assign(turnItems.begin() + turnOffsets[bucket], turnItems.begin() + turnOffsets[bucket + 1]);
+}
+
+void TriggerIndex::area_events(int x, int y, std::vector<unsigned>& out) const
+{
+	out.clear();
+
+	if (areaOffsets.empty())
+		return;
+
+	const unsigned anywhereBucket = gridWidth * gridHeight;
+
+	const auto anywhereBegin = areaItems.begin() + areaOffsets[anywhereBucket];
+	const auto anywhereEnd = areaItems.begin() + areaOffsets[anywhereBucket + 1];
+
+	const bool inGrid = x >= gridX && y >= gridY
+		&& static_cast<unsigned>(x - gridX) < gridWidth && static_cast<unsigned>(y - gridY) < gridHeight;
+
+	if (!inGrid)
+	{
+		out.assign(anywhereBegin, anywhereEnd);
+		return;
+	}
+
+	const unsigned bucket = (y - gridY) * gridWidth + (x - gridX);
+
+	std::merge(areaItems.begin() + areaOffsets[bucket], areaItems.begin() + areaOffsets[bucket + 1],
+		anywhereBegin, anywhereEnd, std::back_inserter(out));
+}
+
+} // namespace soren
@@ -0,0 +1,51 @@
+#ifndef SOREN_VM_TRIGGERS_INCLUDED
+#define SOREN_VM_TRIGGERS_INCLUDED
+
+#include <cstdint>
+#include <vector>
+
+#include "core/soren-cmb.h"
+
+namespace soren {
+
+// What the parameters of triggered scenes mean is guessed: TODO: check against the game
+// - turn scenes (CMB_SCENE_KIND_TURN3, CMB_SCENE_KIND_TURN6): first turn, last turn (0 for no end), phase (absent for any phase)
+// - area scenes (CMB_SCENE_KIND_AREA_UNS): x1, y1, x2, y2 (inclusive corners, in any order)
+// scenes with less parameters than that fire on any turn (phase) or anywhere
+
+struct TriggerIndex
+{
+	enum
+	{
+		// coordinates and turns past these are clamped (maps and chapters are much smaller anyway)
+		MAX_COORD = 255,
+		MAX_TURN = 255,
+	};
+
+	// scene indices (sorted) of turn scenes that fire at the start of the given turn and phase
+	void turn_events(unsigned turn, unsigned phase, std::vector<unsigned>& out) const;
+
+	// scene indices (sorted) of area scenes whose area contains the given position
+	void area_events(int x, int y, std::vector<unsigned>& out) const;
+
+	// scene lists are stored contiguously: bucket i is items[offsets[i]..offsets[i+1])
+
+	// turns: bucket (turn * phaseCount + phase) for turn in [0, turnCount), the last turn bucket being for every later turn
+	unsigned turnCount { 0u };
+	unsigned phaseCount { 0u };
+	std::vector<std::uint32_t> turnOffsets;
+	std::vector<std::uint32_t> turnItems;
+
+	// areas: bucket (y * gridWidth + x) for positions in the bounding box of all areas, plus a last bucket for scenes
+	// that fire anywhere (that is checked for every position, and alone for positions outside of the box)
+	int gridX { 0 }, gridY { 0 };
+	unsigned gridWidth { 0u }, gridHeight { 0u };
+	std::vector<std::uint32_t> areaOffsets;
+	std::vector<std::uint32_t> areaItems;
+};
+
+TriggerIndex make_trigger_index(const CmbInfo& cmb);
+
+} // namespace soren
+
+#endif // SOREN_VM_TRIGGERS_INCLUDED
@@ -0,0 +1,473 @@
+
+#include "vm/vm.h"
+#include "vm/profiler.h"
+#include "vm/ops.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace soren {
+
+VmProgram make_vm_program(const CmbInfo& cmb)
+{
+	VmProgram result;
+
+	result.cmb = &cmb;
+	result.globalAmt = cmb.globalNames.size();
+	result.scenes.resize(cmb.scenes.size());
+
+	for (unsigned i = 0; i < cmb.scenes.size(); ++i)
+	{
+		auto& scene = cmb.scenes[i];
+		auto& vmScene = result.scenes[i];
+
+		vmScene.argCnt = scene.argCnt;
+		vmScene.varAmt = scene.varnames.size();
+		vmScene.code = scene.rawScript;
+
+		// resolve jump targets to instruction indices once, so that jumps are O(1) at run time
+
+		for (auto& ins : vmScene.code)
+		{
+			if (!ins.is_jump())
+				continue;
+
+			auto target = static_cast<unsigned>(ins.operand);
+
+			auto it = std::lower_bound(scene.rawScript.begin(), scene.rawScript.end(), target,
+				[] (const BcIns& a, unsigned b) { return a.location < b; });
+
+			ins.operand = (it != scene.rawScript.end() && it->location == target)
+				? static_cast<std::int32_t>(it - scene.rawScript.begin())
+				: vm_bad_target;
+		}
+	}
+
+	return result;
+}
+
+VmState make_vm_state(const VmProgram& program)
+{
+	VmState result;
+	result.memory.resize(program.globalAmt, 0);
+
+	return result;
+}
+
+static inline
+void vm_push_frame(VmState& state, const VmProgram& program, unsigned scene)
+{
+	if (scene >= program.scenes.size())
+		throw std::runtime_error("VM: call to non-existent scene"); // TODO: better error
+
+	auto& vmScene = program.scenes[scene];
+
+	VmFrame frame;
+
+	frame.scene = scene;
+	frame.pc = 0;
+	frame.base = state.memory.size();
+
+	// arguments come from the caller's part of the stack (as for callext and printf)
+	const unsigned stackBase = state.frames.empty() ? 0 : state.frames.back().stackBase;
+
+	if (state.stack.size() < stackBase + vmScene.argCnt)
+		throw std::runtime_error("VM: stack underflow when passing arguments"); // TODO: better error
+
+	// TODO: investigate whether the game clears locals on call, we do
+	state.memory.resize(frame.base + std::max(vmScene.varAmt, vmScene.argCnt), 0);
+
+	std::copy(state.stack.end() - vmScene.argCnt, state.stack.end(), state.memory.begin() + frame.base);
+	state.stack.resize(state.stack.size() - vmScene.argCnt);
+
+	frame.stackBase = state.stack.size();
+
+	state.frames.push_back(frame);
+}
+
+void vm_start(VmState& state, const VmProgram& program, unsigned scene, Span<const std::int32_t> args)
+{
+	state.memory.resize(program.globalAmt);
+	state.stack.assign(args.begin(), args.end());
+	state.frames.clear();
+	state.result = 0;
+
+	if (scene < program.scenes.size() && args.size() != program.scenes[scene].argCnt)
+		throw std::runtime_error("VM: bad argument count for entry scene"); // TODO: better error
+
+	vm_push_frame(state, program, scene);
+}
+
+template<bool Profiled>
+static VmStatus vm_run_impl(VmState& state, const VmProgram& program, const VmConfig& config)
+{
+	auto& memory = state.memory;
+	auto& stack = state.stack;
+
+	const auto pop = [&] ()
+	{
+		if (stack.size() <= state.frames.back().stackBase)
+			throw std::runtime_error("VM: stack underflow"); // TODO: better error
+
+		auto value = stack.back();
+		stack.pop_back();
+
+		return value;
+	};
+
+	const auto top = [&] () -> std::int32_t&
+	{
+		if (stack.size() <= state.frames.back().stackBase)
+			throw std::runtime_error("VM: stack underflow"); // TODO: better error
+
+		return stack.back();
+	};
+
+	const auto at = [&] (std::int64_t address) -> std::int32_t&
+	{
+		if (address < 0 || static_cast<std::uint64_t>(address) >= memory.size())
+			throw std::runtime_error("VM: memory access out of bounds"); // TODO: better error
+
+		return memory[address];
+	};
+
+	const auto cstr = [&] (std::int32_t offset)
+	{
+		return program.cmb->get_cstr(offset);
+	};
+
+	const std::uint64_t stepEnd = config.stepLimit != 0
+		? state.steps + config.stepLimit
+		: std::numeric_limits<std::uint64_t>::max();
+
+	while (!state.frames.empty())
+	{
+		if (state.steps == stepEnd)
+			return VmStatus::StepLimit;
+
+		auto& frame = state.frames.back();
+		auto& code = program.scenes[frame.scene].code;
+
+		// this also catches jumps to vm_bad_target
+		if (frame.pc >= code.size())
+			throw std::runtime_error("VM: reached end of scene code"); // TODO: better error
+
+		if (Profiled)
+			config.profiler->tick(state, program);
+
+		const auto& ins = code[frame.pc++];
+		state.steps++;
+
+		const std::int64_t base = frame.base;
+
+		switch (ins.opcode)
+		{
+
+		case BC_OPCODE_NOP:
+		case BC_OPCODE_40:
+			break;
+
+		case BC_OPCODE_VAL8:
+		case BC_OPCODE_VAL16:
+			stack.push_back(at(base + ins.operand));
+			break;
+
+		case BC_OPCODE_VALX8:
+		case BC_OPCODE_VALX16:
+			top() = at(base + ins.operand + top());
+			break;
+
+		case BC_OPCODE_VALY8:
+		case BC_OPCODE_VALY16:
+			top() = at(static_cast<std::int64_t>(at(base + ins.operand)) + top());
+			break;
+
+		case BC_OPCODE_REF8:
+		case BC_OPCODE_REF16:
+			stack.push_back(base + ins.operand);
+			break;
+
+		case BC_OPCODE_REFX8:
+		case BC_OPCODE_REFX16:
+			top() = base + ins.operand + top();
+			break;
+
+		case BC_OPCODE_REFY8:
+		case BC_OPCODE_REFY16:
+			top() = at(base + ins.operand) + top();
+			break;
+
+		case BC_OPCODE_GVAL8:
+		case BC_OPCODE_GVAL16:
+			stack.push_back(at(ins.operand));
+			break;
+
+		case BC_OPCODE_GVALX8:
+		case BC_OPCODE_GVALX16:
+			top() = at(static_cast<std::int64_t>(ins.operand) + top());
+			break;
+
+		case BC_OPCODE_GVALY8:
+		case BC_OPCODE_GVALY16:
+			top() = at(static_cast<std::int64_t>(at(ins.operand)) + top());
+			break;
+
+		case BC_OPCODE_GREF8:
+		case BC_OPCODE_GREF16:
+			stack.push_back(ins.operand);
+			break;
+
+		case BC_OPCODE_GREFX8:
+		case BC_OPCODE_GREFX16:
+			top() = ins.operand + top();
+			break;
+
+		case BC_OPCODE_GREFY8:
+		case BC_OPCODE_GREFY16:
+			top() = at(ins.operand) + top();
+			break;
+
+		case BC_OPCODE_NUMBER8:
+		case BC_OPCODE_NUMBER16:
+		case BC_OPCODE_NUMBER32:
+		case BC_OPCODE_STRING8:
+		case BC_OPCODE_STRING16:
+		case BC_OPCODE_STRING32:
+			// strings are represented by their offset in the string pool
+			stack.push_back(ins.operand);
+			break;
+
+		case BC_OPCODE_DEREF:
+		{
+			auto value = at(top());
+			stack.push_back(value);
+
+			break;
+		}
+
+		case BC_OPCODE_DISC:
+			pop();
+			break;
+
+		case BC_OPCODE_STORE:
+		{
+			auto value = pop();
+			at(top()) = value;
+			top() = value;
+
+			break;
+		}
+
+		case BC_OPCODE_ASSIGN:
+		{
+			auto value = pop();
+			at(pop()) = value;
+
+			break;
+		}
+
+		case BC_OPCODE_INC:
+		{
+			auto& cell = at(pop());
+			cell = vm_wrap(static_cast<std::uint32_t>(cell) + 1u);
+
+			break;
+		}
+
+		case BC_OPCODE_DEC:
+		{
+			auto& cell = at(pop());
+			cell = vm_wrap(static_cast<std::uint32_t>(cell) - 1u);
+
+			break;
+		}
+
+		case BC_OPCODE_DUP:
+		{
+			auto value = top();
+			stack.push_back(value);
+
+			break;
+		}
+
+#define SOREN_VM_BINOP(opcode, expr) \
+		case opcode: \
+		{ \
+			const std::int32_t b = pop(); \
+			const std::int32_t a = top(); \
+			top() = (expr); \
+			break; \
+		}
+
+		SOREN_VM_BINOP(BC_OPCODE_ADD, vm_wrap(static_cast<std::uint32_t>(a) + static_cast<std::uint32_t>(b)))
+		SOREN_VM_BINOP(BC_OPCODE_SUB, vm_wrap(static_cast<std::uint32_t>(a) - static_cast<std::uint32_t>(b)))
+		SOREN_VM_BINOP(BC_OPCODE_MUL, vm_wrap(static_cast<std::uint32_t>(a) * static_cast<std::uint32_t>(b)))
+		SOREN_VM_BINOP(BC_OPCODE_DIV, vm_div(a, b))
+		SOREN_VM_BINOP(BC_OPCODE_MOD, vm_mod(a, b))
+		SOREN_VM_BINOP(BC_OPCODE_ORR, a | b)
+		SOREN_VM_BINOP(BC_OPCODE_AND, a & b)
+		SOREN_VM_BINOP(BC_OPCODE_XOR, a ^ b)
+		SOREN_VM_BINOP(BC_OPCODE_LSL, vm_lsl(a, b))
+		SOREN_VM_BINOP(BC_OPCODE_LSR, vm_lsr(a, b))
+		SOREN_VM_BINOP(BC_OPCODE_EQ, a == b)
+		SOREN_VM_BINOP(BC_OPCODE_NE, a != b)
+		SOREN_VM_BINOP(BC_OPCODE_LT, a < b)
+		SOREN_VM_BINOP(BC_OPCODE_LE, a <= b)
+		SOREN_VM_BINOP(BC_OPCODE_GT, a > b)
+		SOREN_VM_BINOP(BC_OPCODE_GE, a >= b)
+		SOREN_VM_BINOP(BC_OPCODE_EQSTR, std::strcmp(cstr(a), cstr(b)) == 0)
+		SOREN_VM_BINOP(BC_OPCODE_NESTR, std::strcmp(cstr(a), cstr(b)) != 0)
+
+#undef SOREN_VM_BINOP
+
+		case BC_OPCODE_NEG:
+			top() = vm_wrap(0u - static_cast<std::uint32_t>(top()));
+			break;
+
+		case BC_OPCODE_MVN:
+			top() = ~top();
+			break;
+
+		case BC_OPCODE_NOT:
+			top() = !top();
+			break;
+
+		case BC_OPCODE_CALL:
+			// frame is invalidated after this
+			vm_push_frame(state, program, ins.operand);
+			break;
+
+		case BC_OPCODE_CALLEXT:
+		{
+			const unsigned argCnt = ins.operand & 0xFF;
+
+			if (stack.size() < frame.stackBase + argCnt)
+				throw std::runtime_error("VM: stack underflow when passing arguments"); // TODO: better error
+
+			// args stay on the stack during the call, so that they can be passed as a span
+			std::int32_t value = 0;
+
+			if (config.externFunc)
+			{
+				const auto name = cstr(ins.operand >> 8);
+				value = config.externFunc(state, name, Span<const std::int32_t>(stack.data() + stack.size() - argCnt, argCnt));
+			}
+
+			stack.resize(stack.size() - argCnt);
+			stack.push_back(value);
+
+			break;
+		}
+
+		case BC_OPCODE_PRINTF:
+		{
+			const unsigned argCnt = ins.operand;
+
+			if (stack.size() < frame.stackBase + argCnt)
+				throw std::runtime_error("VM: stack underflow when passing arguments"); // TODO: better error
+
+			stack.resize(stack.size() - argCnt);
+			break;
+		}
+
+		case BC_OPCODE_RETURN:
+		case BC_OPCODE_RETN:
+		case BC_OPCODE_RETY:
+		{
+			const std::int32_t value = ins.opcode == BC_OPCODE_RETURN
+				? pop()
+				: (ins.opcode == BC_OPCODE_RETY ? 1 : 0);
+
+			stack.resize(frame.stackBase);
+			memory.resize(frame.base);
+
+			state.frames.pop_back();
+
+			if (state.frames.empty())
+				state.result = value;
+			else
+				stack.push_back(value);
+
+			break;
+		}
+
+		case BC_OPCODE_B:
+			frame.pc = ins.operand;
+			break;
+
+		case BC_OPCODE_BY:
+			if (pop())
+				frame.pc = ins.operand;
+
+			break;
+
+		case BC_OPCODE_BN:
+			if (!pop())
+				frame.pc = ins.operand;
+
+			break;
+
+		case BC_OPCODE_BKY:
+			if (top())
+				frame.pc = ins.operand;
+			else
+				pop();
+
+			break;
+
+		case BC_OPCODE_BKN:
+			if (!top())
+				frame.pc = ins.operand;
+			else
+				pop();
+
+			break;
+
+		case BC_OPCODE_YIELD:
+			return VmStatus::Yielded;
+
+		default:
+			throw std::runtime_error("VM: unsupported opcode"); // TODO: better error
+
+		} // switch (ins.opcode)
+	}
+
+	return VmStatus::Finished;
+}
+
+VmStatus vm_run(VmState& state, const VmProgram& program, const VmConfig& config)
+{
+	if (config.profiler)
+		return vm_run_impl<true>(state, program, config);
+
+	return vm_run_impl<false>(state, program, config);
+}
+
+VmStatus vm_run_to_end(VmState& state, const VmProgram& program, VmConfig& config,
+	std::uint64_t stepLimit, unsigned yieldLimit, unsigned& yields)
+{
+	for (;;)
+	{
+		if (stepLimit != 0)
+		{
+			if (state.steps >= stepLimit)
+				return VmStatus::StepLimit;
+
+			config.stepLimit = stepLimit - state.steps;
+		}
+
+		const auto status = vm_run(state, program, config);
+
+		if (status != VmStatus::Yielded)
+			return status;
+
+		if (yieldLimit != 0 && yields == yieldLimit)
+			return status;
+
+		yields++;
+	}
+}
+
+} // namespace soren
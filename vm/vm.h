@@ -0,0 +1,93 @@
+#ifndef SOREN_VM_INCLUDED
+#define SOREN_VM_INCLUDED
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "core/types.h"
+#include "core/soren-cmb.h"
+
+namespace soren {
+
+struct VmProfiler;
+
+struct VmScene
+{
+	// same instructions as the scene's rawScript, except that jump operands are instruction indices
+	// (or vm_bad_target when the jump doesn't land on an instruction)
+
+	std::vector<BcIns> code;
+
+	unsigned argCnt { 0u };
+	unsigned varAmt { 0u };
+};
+
+struct VmProgram
+{
+	// immutable once built, so it can be shared by any amount of VmStates (and threads)
+
+	const CmbInfo* cmb { nullptr };
+
+	std::vector<VmScene> scenes;
+	unsigned globalAmt { 0u };
+};
+
+struct VmFrame
+{
+	unsigned scene;
+	unsigned pc;
+
+	unsigned base; // where the frame locals start in memory
+	unsigned stackBase; // stack size when the frame was entered (arguments already popped)
+};
+
+struct VmState
+{
+	// memory is globals followed by the locals of each frame
+	// addresses (as produced by ref/gref) are indices into memory
+
+	std::vector<std::int32_t> memory;
+	std::vector<std::int32_t> stack;
+	std::vector<VmFrame> frames;
+
+	std::int32_t result { 0 };
+	std::uint64_t steps { 0u };
+};
+
+enum class VmStatus
+{
+	Finished, // the entry scene returned (result holds the return value)
+	Yielded, // a yield was executed, call vm_run again to resume
+	StepLimit, // ran out of steps, call vm_run again to resume
+};
+
+using VmExternFunc = std::function<std::int32_t(VmState& state, const char* name, Span<const std::int32_t> args)>;
+
+struct VmConfig
+{
+	VmExternFunc externFunc; //< called for callext, returns 0 when empty
+	std::uint64_t stepLimit { 0u }; //< instructions per vm_run call, 0 for no limit
+
+	VmProfiler* profiler { nullptr };
+};
+
+static constexpr std::int32_t vm_bad_target = -1;
+
+VmProgram make_vm_program(const CmbInfo& cmb);
+
+VmState make_vm_state(const VmProgram& program);
+
+void vm_start(VmState& state, const VmProgram& program, unsigned scene, Span<const std::int32_t> args);
+
+VmStatus vm_run(VmState& state, const VmProgram& program, const VmConfig& config);
+
+// calls vm_run until the entry scene returns, resuming after yields
+// stepLimit is for all of it (state.steps counting towards it, config.stepLimit being set for each vm_run), 0 for no limit
+// yields counts the resumes, stopping (with Yielded) once it reaches yieldLimit, 0 for no limit
+VmStatus vm_run_to_end(VmState& state, const VmProgram& program, VmConfig& config,
+	std::uint64_t stepLimit, unsigned yieldLimit, unsigned& yields);
+
+} // namespace soren
+
+#endif // SOREN_VM_INCLUDED